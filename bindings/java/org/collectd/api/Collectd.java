@@ -170,6 +170,20 @@ public class Collectd
   native public static int registerWrite (String name,
       CollectdWriteInterface object);
 
+  /**
+   * Registers a write callback which receives value lists in batches.
+   *
+   * Value lists are queued until "BatchSize" of them have been collected,
+   * the oldest one has been waiting for one interval or the callback is
+   * flushed. This reduces the number of calls from the daemon into the JVM
+   * considerably.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see CollectdBatchWriteInterface
+   */
+  native public static int registerWrite (String name,
+      CollectdBatchWriteInterface object);
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_register_flush
    *
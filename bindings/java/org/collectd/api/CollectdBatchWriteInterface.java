@@ -0,0 +1,38 @@
+/*
+ * collectd/java - org/collectd/api/CollectdBatchWriteInterface.java
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+package org.collectd.api;
+
+import java.util.List;
+
+/**
+ * Interface for objects implementing a batched write method.
+ *
+ * Value lists are queued by the daemon and passed to the write method in
+ * batches of up to "BatchSize" elements. The {@link DataSet} objects
+ * referenced by the value lists are shared and must not be modified.
+ *
+ * @see Collectd#registerWrite(String, CollectdBatchWriteInterface)
+ */
+public interface CollectdBatchWriteInterface
+{
+	public int write (List<ValueList> vl);
+}
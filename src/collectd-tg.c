@@ -43,6 +43,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
@@ -64,6 +65,10 @@ static int conf_num_values = DEF_NUM_VALUES;
 static double conf_interval = DEF_INTERVAL;
 static const char *conf_destination = NET_DEFAULT_V6_ADDR;
 static const char *conf_service = NET_DEFAULT_PORT;
+static lcc_security_level_t conf_security_level = NONE;
+static const char *conf_username = NULL;
+static const char *conf_password = NULL;
+static int conf_benchmark = 0;
 
 static lcc_network_t *net;
 
@@ -91,6 +96,13 @@ static void exit_usage (int exit_status) /* {{{ */
       "                   (Default: %s)\n"
       "    -D <port>      Destination port of the network packets.\n"
       "                   (Default: %s)\n"
+      "    -l <level>     Security level: \"none\", \"sign\" or \"encrypt\".\n"
+      "                   (Default: none)\n"
+      "    -u <user>      Username for signing / encryption.\n"
+      "    -P <password>  Password for signing / encryption.\n"
+      "    -b <seconds>   Benchmark mode: Send values as fast as possible for\n"
+      "                   the given number of seconds, ignoring the interval,\n"
+      "                   and report the achieved throughput.\n"
       "    -h             Print usage information (this output).\n"
       "\n"
       "Copyright (C) 2010-2012  Florian Forster\n"
@@ -217,6 +229,57 @@ static int send_value (lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int send_value */
 
+static double get_time (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1e9));
+} /* }}} double get_time */
+
+/* Sends values as fast as possible for `conf_benchmark' seconds. This is
+ * useful to measure the throughput of a server, for example with signed or
+ * encrypted traffic. */
+static void run_benchmark (void) /* {{{ */
+{
+  double start;
+  double now;
+  double end;
+  long values_sent = 0;
+
+  fprintf (stdout, "Sending values for %i seconds (security level: %s) ...\n",
+      conf_benchmark,
+      (conf_security_level == ENCRYPT) ? "encrypt"
+      : (conf_security_level == SIGN) ? "sign" : "none");
+  fflush (stdout);
+
+  start = get_time ();
+  end = start + (double) conf_benchmark;
+  now = start;
+  while (loop && (now < end))
+  {
+    int i;
+
+    /* Reading the clock for every value would distort the result. */
+    for (i = 0; i < 1000; i++)
+    {
+      lcc_value_list_t *vl = c_heap_get_root (values_heap);
+      if (vl == NULL)
+        return;
+
+      send_value (vl);
+      values_sent++;
+
+      c_heap_insert (values_heap, vl);
+    }
+
+    now = get_time ();
+  }
+
+  fprintf (stdout, "%li values sent in %.3f seconds: %.0f values/s\n",
+      values_sent, now - start, ((double) values_sent) / (now - start));
+} /* }}} void run_benchmark */
+
 static int get_integer_opt (const char *str, int *ret_value) /* {{{ */
 {
   char *endptr;
@@ -279,7 +342,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 {
   int opt;
 
-  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:h")) != -1)
+  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:l:u:P:b:h")) != -1)
   {
     switch (opt)
     {
@@ -307,6 +370,32 @@ static int read_options (int argc, char **argv) /* {{{ */
         conf_service = optarg;
         break;
 
+      case 'l':
+        if (strcasecmp ("none", optarg) == 0)
+          conf_security_level = NONE;
+        else if (strcasecmp ("sign", optarg) == 0)
+          conf_security_level = SIGN;
+        else if (strcasecmp ("encrypt", optarg) == 0)
+          conf_security_level = ENCRYPT;
+        else
+        {
+          fprintf (stderr, "Invalid security level: \"%s\"\n", optarg);
+          exit (EXIT_FAILURE);
+        }
+        break;
+
+      case 'u':
+        conf_username = optarg;
+        break;
+
+      case 'P':
+        conf_password = optarg;
+        break;
+
+      case 'b':
+        get_integer_opt (optarg, &conf_benchmark);
+        break;
+
       case 'h':
         exit_usage (EXIT_SUCCESS);
 
@@ -315,6 +404,14 @@ static int read_options (int argc, char **argv) /* {{{ */
     } /* switch (opt) */
   } /* while (getopt) */
 
+  if ((conf_security_level != NONE)
+      && ((conf_username == NULL) || (conf_password == NULL)))
+  {
+    fprintf (stderr, "The security level \"sign\" and \"encrypt\" require "
+        "a username (-u) and a password (-P).\n");
+    exit (EXIT_FAILURE);
+  }
+
   return (0);
 } /* }}} int read_options */
 
@@ -358,10 +455,20 @@ int main (int argc, char **argv) /* {{{ */
     }
 
     lcc_server_set_ttl (srv, 42);
-#if 0
-    lcc_server_set_security_level (srv, ENCRYPT,
-        "admin", "password1");
-#endif
+
+    if (conf_security_level != NONE)
+    {
+      int status;
+
+      status = lcc_server_set_security_level (srv, conf_security_level,
+          conf_username, conf_password);
+      if (status != 0)
+      {
+        fprintf (stderr, "lcc_server_set_security_level failed with "
+            "status %i.\n", status);
+        exit (EXIT_FAILURE);
+      }
+    }
   }
 
   fprintf (stdout, "Creating %i values ... ", conf_num_values);
@@ -381,6 +488,12 @@ int main (int argc, char **argv) /* {{{ */
   }
   fprintf (stdout, "done\n");
 
+  if (conf_benchmark > 0)
+  {
+    run_benchmark ();
+    loop = 0;
+  }
+
   last_time = 0;
   while (loop)
   {
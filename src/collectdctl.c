@@ -84,9 +84,9 @@ static void exit_usage (const char *name, int status) {
 
       "\nAvailable commands:\n\n"
 
-      " * getval <identifier>\n"
+      " * getval <identifier> [<identifier> ...]\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
-      " * listval\n"
+      " * listval [glob=<pattern>] [regex=<regex>]\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
 
       "\nIdentifiers:\n\n"
@@ -177,51 +177,85 @@ static int parse_identifier (lcc_connection_t *c,
 
 static int getval (lcc_connection_t *c, int argc, char **argv)
 {
-  lcc_identifier_t ident;
+  lcc_identifier_t *idents;
+  char **idents_args;
+  size_t idents_num = 0;
+  int *found;
 
-  size_t   ret_values_num   = 0;
-  gauge_t *ret_values       = NULL;
-  char   **ret_values_names = NULL;
+  size_t   ret_values_num    = 0;
+  size_t  *ret_values_idents = NULL;
+  gauge_t *ret_values        = NULL;
+  char   **ret_values_names  = NULL;
 
   int status;
+  int errors = 0;
+  int j;
   size_t i;
 
   assert (strcasecmp (argv[0], "getval") == 0);
 
-  if (argc != 2) {
+  if (argc < 2) {
     fprintf (stderr, "ERROR: getval: Missing identifier.\n");
     return (-1);
   }
 
-  memset (&ident, 0, sizeof (ident));
-  status = parse_identifier (c, argv[1], &ident);
-  if (status != 0)
-    return (status);
+  idents = calloc ((size_t) argc - 1, sizeof (*idents));
+  idents_args = calloc ((size_t) argc - 1, sizeof (*idents_args));
+  found = calloc ((size_t) argc - 1, sizeof (*found));
+  if ((idents == NULL) || (idents_args == NULL) || (found == NULL)) {
+    fprintf (stderr, "ERROR: Failed to allocate memory.\n");
+    free (idents);
+    free (idents_args);
+    free (found);
+    return (-1);
+  }
 
-#define BAIL_OUT(s) \
-  do { \
-    if (ret_values != NULL) \
-      free (ret_values); \
-    if (ret_values_names != NULL) { \
-      for (i = 0; i < ret_values_num; ++i) \
-        free (ret_values_names[i]); \
-      free (ret_values_names); \
-    } \
-    ret_values_num = 0; \
-    return (s); \
-  } while (0)
+  for (j = 1; j < argc; j++) {
+    status = parse_identifier (c, argv[j], idents + idents_num);
+    if (status != 0) {
+      errors++;
+      continue;
+    }
+    idents_args[idents_num] = argv[j];
+    idents_num++;
+  }
 
-  status = lcc_getval (c, &ident,
-      &ret_values_num, &ret_values, &ret_values_names);
-  if (status != 0) {
-    fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
-    BAIL_OUT (-1);
+  if (idents_num > 0) {
+    status = lcc_getval_multi (c, idents, idents_num, &ret_values_num,
+        &ret_values_idents, &ret_values, &ret_values_names);
+    if (status != 0) {
+      fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+      errors++;
+    }
   }
 
-  for (i = 0; i < ret_values_num; ++i)
+  /* With more than one identifier, each value is prefixed with the
+   * identifier it belongs to. */
+  for (i = 0; i < ret_values_num; ++i) {
+    found[ret_values_idents[i]] = 1;
+    if (argc > 2)
+      printf ("%s ", idents_args[ret_values_idents[i]]);
     printf ("%s=%e\n", ret_values_names[i], ret_values[i]);
-  BAIL_OUT (0);
-#undef BAIL_OUT
+    free (ret_values_names[i]);
+  }
+
+  if (status == 0) {
+    for (i = 0; i < idents_num; ++i) {
+      if (found[i])
+        continue;
+      fprintf (stderr, "ERROR: %s: No such value.\n", idents_args[i]);
+      errors++;
+    }
+  }
+
+  free (ret_values_idents);
+  free (ret_values);
+  free (ret_values_names);
+  free (idents);
+  free (idents_args);
+  free (found);
+
+  return ((errors == 0) ? 0 : -1);
 } /* getval */
 
 static int flush (lcc_connection_t *c, int argc, char **argv)
@@ -348,14 +382,37 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
   lcc_identifier_t *ret_ident     = NULL;
   size_t            ret_ident_num = 0;
 
+  char *glob  = NULL;
+  char *regex = NULL;
+
   int status;
+  int j;
   size_t i;
 
   assert (strcasecmp (argv[0], "listval") == 0);
 
-  if (argc != 1) {
-    fprintf (stderr, "ERROR: listval: Does not accept any arguments.\n");
-    return (-1);
+  for (j = 1; j < argc; ++j) {
+    char *key, *value;
+
+    key   = argv[j];
+    value = strchr (argv[j], (int)'=');
+
+    if (! value) {
+      fprintf (stderr, "ERROR: listval: Invalid option ``%s''.\n", argv[j]);
+      return (-1);
+    }
+
+    *value = '\0';
+    ++value;
+
+    if (strcasecmp (key, "glob") == 0)
+      glob = value;
+    else if (strcasecmp (key, "regex") == 0)
+      regex = value;
+    else {
+      fprintf (stderr, "ERROR: listval: Unknown option `%s'.\n", key);
+      return (-1);
+    }
   }
 
 #define BAIL_OUT(s) \
@@ -366,7 +423,8 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
     return (s); \
   } while (0)
 
-  status = lcc_listval (c, &ret_ident, &ret_ident_num);
+  status = lcc_listval_with_filter (c, glob, regex,
+      &ret_ident, &ret_ident_num);
   if (status != 0) {
     fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
     BAIL_OUT (status);
@@ -810,7 +810,8 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
         size_t offset = 0;
         int status;
         int i;
-        gauge_t *rates = NULL;
+        gauge_t rates[ds->ds_num];
+        _Bool have_rates = 0;
 
         assert (0 == strcmp (ds->type, vl->type));
 
@@ -820,15 +821,9 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
         status = ssnprintf (ret + offset, ret_len - offset, \
                         __VA_ARGS__); \
         if (status < 1) \
-        { \
-                sfree (rates); \
                 return (-1); \
-        } \
         else if (((size_t) status) >= (ret_len - offset)) \
-        { \
-                sfree (rates); \
                 return (-1); \
-        } \
         else \
                 offset += ((size_t) status); \
 } while (0)
@@ -841,13 +836,16 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
                         BUFFER_ADD (":%f", vl->values[i].gauge);
                 else if (store_rates)
                 {
-                        if (rates == NULL)
-                                rates = uc_get_rate (ds, vl);
-                        if (rates == NULL)
+                        if (!have_rates)
                         {
-                                WARNING ("format_values: "
-						"uc_get_rate failed.");
-                                return (-1);
+                                if (uc_get_rate_into (ds, vl, rates,
+                                                STATIC_ARRAY_SIZE (rates)) != 0)
+                                {
+                                        WARNING ("format_values: "
+                                                        "uc_get_rate_into failed.");
+                                        return (-1);
+                                }
+                                have_rates = 1;
                         }
                         BUFFER_ADD (":%g", rates[i]);
                 }
@@ -861,14 +859,12 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
                 {
                         ERROR ("format_values plugin: Unknown data source type: %i",
                                         ds->ds[i].type);
-                        sfree (rates);
                         return (-1);
                 }
         } /* for ds->ds_num */
 
 #undef BUFFER_ADD
 
-        sfree (rates);
         return (0);
 } /* }}} int format_values */
 
@@ -952,25 +948,12 @@ int parse_identifier_vl (const char *str, value_list_t *vl) /* {{{ */
 	return (0);
 } /* }}} int parse_identifier_vl */
 
-int parse_value (const char *value_orig, value_t *ret_value, int ds_type)
+int parse_value (const char *value, value_t *ret_value, int ds_type)
 {
-  char *value;
   char *endptr = NULL;
-  size_t value_len;
 
-  if (value_orig == NULL)
-    return (EINVAL);
-
-  value = strdup (value_orig);
   if (value == NULL)
-    return (ENOMEM);
-  value_len = strlen (value);
-
-  while ((value_len > 0) && isspace ((int) value[value_len - 1]))
-  {
-    value[value_len - 1] = 0;
-    value_len--;
-  }
+    return (EINVAL);
 
   switch (ds_type)
   {
@@ -991,23 +974,25 @@ int parse_value (const char *value_orig, value_t *ret_value, int ds_type)
       break;
 
     default:
-      sfree (value);
       ERROR ("parse_value: Invalid data source type: %i.", ds_type);
       return -1;
   }
 
   if (value == endptr) {
-    sfree (value);
     ERROR ("parse_value: Failed to parse string as %s: %s.",
         DS_TYPE_TO_STRING (ds_type), value);
     return -1;
   }
-  else if ((NULL != endptr) && ('\0' != *endptr))
+
+  /* Trailing whitespace is fine, e.g. in fixed width database columns. */
+  while ((NULL != endptr) && isspace ((int) *endptr))
+    endptr++;
+
+  if ((NULL != endptr) && ('\0' != *endptr))
     INFO ("parse_value: Ignoring trailing garbage \"%s\" after %s value. "
         "Input string was \"%s\".",
-        endptr, DS_TYPE_TO_STRING (ds_type), value_orig);
+        endptr, DS_TYPE_TO_STRING (ds_type), value);
 
-  sfree (value);
   return 0;
 } /* int parse_value */
 
@@ -113,7 +113,8 @@ static int cpu_temp_retry_max     = 1;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+# include "utils_procfile.h"
+static cu_procfile_t *proc_stat = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -354,21 +355,27 @@ static int cpu_read (void)
 	int cpu;
 	derive_t user, nice, syst, idle;
 	derive_t wait, intr, sitr; /* sitr == soft interrupt */
-	FILE *fh;
-	char buf[1024];
+	char *buf;
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	if (proc_stat == NULL)
+	{
+		proc_stat = cu_procfile_create ("/proc/stat");
+		if (proc_stat == NULL)
+			return (-1);
+	}
+
+	if (cu_procfile_read (proc_stat) != 0)
 	{
 		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
+		ERROR ("cpu plugin: Reading /proc/stat failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	while ((buf = cu_procfile_readline (proc_stat)) != NULL)
 	{
 		if (strncmp (buf, "cpu", 3))
 			continue;
@@ -404,8 +411,6 @@ static int cpu_read (void)
 				submit (cpu, "steal", atoll (fields[8]));
 		}
 	}
-
-	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -601,8 +606,20 @@ static int cpu_read (void)
 	return (0);
 }
 
+#ifdef KERNEL_LINUX
+static int cpu_shutdown (void)
+{
+	cu_procfile_destroy (proc_stat);
+	proc_stat = NULL;
+	return (0);
+}
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
 	plugin_register_init ("cpu", init);
 	plugin_register_read ("cpu", cpu_read);
+#ifdef KERNEL_LINUX
+	plugin_register_shutdown ("cpu", cpu_shutdown);
+#endif
 } /* void module_register */
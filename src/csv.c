@@ -25,6 +25,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 #include "utils_parse_option.h"
 
 /*
@@ -47,12 +48,11 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	int offset;
 	int status;
 	int i;
-	gauge_t *rates = NULL;
+	gauge_t rates[ds->ds_num];
+	_Bool have_rates = 0;
 
 	assert (0 == strcmp (ds->type, vl->type));
 
-	memset (buffer, '\0', buffer_len);
-
 	status = ssnprintf (buffer, buffer_len, "%.3f",
 			CDTIME_T_TO_DOUBLE (vl->time));
 	if ((status < 1) || (status >= buffer_len))
@@ -67,57 +67,40 @@ static int value_list_to_string (char *buffer, int buffer_len,
 				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
 			return (-1);
 
-		if (ds->ds[i].type == DS_TYPE_GAUGE) 
-		{
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					",%lf", vl->values[i].gauge);
-		} 
-		else if (store_rates != 0)
+		if ((offset + 1) >= buffer_len)
+			return (-1);
+		buffer[offset] = ',';
+		offset++;
+
+		if ((ds->ds[i].type != DS_TYPE_GAUGE) && (store_rates != 0))
 		{
-			if (rates == NULL)
-				rates = uc_get_rate (ds, vl);
-			if (rates == NULL)
+			if (!have_rates)
 			{
-				WARNING ("csv plugin: "
-						"uc_get_rate failed.");
-				return (-1);
+				if (uc_get_rate_into (ds, vl, rates,
+							STATIC_ARRAY_SIZE (rates)) != 0)
+				{
+					WARNING ("csv plugin: "
+							"uc_get_rate_into failed.");
+					return (-1);
+				}
+				have_rates = 1;
 			}
-			status = ssnprintf (buffer + offset,
-					buffer_len - offset,
-					",%lf", rates[i]);
+			status = format_number_double (buffer + offset,
+					buffer_len - offset, rates[i]);
 		}
-		else if (ds->ds[i].type == DS_TYPE_COUNTER)
-		{
-			status = ssnprintf (buffer + offset,
-					buffer_len - offset,
-					",%llu",
-					vl->values[i].counter);
-		}
-		else if (ds->ds[i].type == DS_TYPE_DERIVE)
-		{
-			status = ssnprintf (buffer + offset,
-					buffer_len - offset,
-					",%"PRIi64,
-					vl->values[i].derive);
-		}
-		else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+		else
 		{
-			status = ssnprintf (buffer + offset,
+			status = format_number_value (buffer + offset,
 					buffer_len - offset,
-					",%"PRIu64,
-					vl->values[i].absolute);
+					ds->ds[i].type, vl->values[i]);
 		}
 
 		if ((status < 1) || (status >= (buffer_len - offset)))
-		{
-			sfree (rates);
 			return (-1);
-		}
 
 		offset += status;
 	} /* for ds->ds_num */
 
-	sfree (rates);
 	return (0);
 } /* int value_list_to_string */
 
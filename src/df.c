@@ -27,6 +27,16 @@
 #include "configfile.h"
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
+#include "utils_htable.h"
+#include "utils_complain.h"
+
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#if KERNEL_LINUX
+# include <poll.h>
+#endif
 
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
@@ -35,6 +45,7 @@
 # define STATANYFS statvfs
 # define STATANYFS_STR "statvfs"
 # define BLOCKSIZE(s) ((s).f_frsize ? (s).f_frsize : (s).f_bsize)
+typedef struct statvfs statanyfs_t;
 #elif HAVE_STATFS
 # if HAVE_SYS_STATFS_H
 #  include <sys/statfs.h>
@@ -42,6 +53,7 @@
 # define STATANYFS statfs
 # define STATANYFS_STR "statfs"
 # define BLOCKSIZE(s) (s).f_bsize
+typedef struct statfs statanyfs_t;
 #else
 # error "No applicable input method."
 #endif
@@ -54,7 +66,10 @@ static const char *config_keys[] =
 	"IgnoreSelected",
 	"ReportByDevice",
 	"ReportReserved",
-	"ReportInodes"
+	"ReportInodes",
+	"ReportUnresponsive",
+	"Timeout",
+	"Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -64,6 +79,69 @@ static ignorelist_t *il_fstype = NULL;
 
 static _Bool by_device = 0;
 static _Bool report_inodes = 0;
+static _Bool report_unresponsive = 0;
+
+/* STATANYFS may block forever, e.g. on a stale NFS mount, so it is called by
+ * worker threads. If a call doesn't return within `df_timeout', the file
+ * system is skipped and not queried again until the call returns, and the
+ * blocked worker is replaced. */
+static cdtime_t df_timeout = 0; /* default: half the interval */
+static int df_threads_num = 4;
+
+/* State of a mount point, looked up by directory in `df_states'. */
+struct df_state_s
+{
+	char *dir;
+
+	/* set while the directory is queued or being queried */
+	_Bool busy;
+	/* set while a worker is blocked in STATANYFS for this directory */
+	_Bool running;
+	cdtime_t started;
+	/* the query didn't return within the timeout; its worker is replaced */
+	_Bool hung;
+	/* the last query didn't return within the timeout */
+	_Bool slow;
+	/* set once the query issued in round `round' has finished */
+	_Bool done;
+	/* the mount point is gone; free the state once it's not busy anymore */
+	_Bool orphan;
+	unsigned int round;
+
+	int status;
+	int error;
+	statanyfs_t statbuf;
+
+	c_complain_t complaint;
+
+	struct df_state_s *next_job;
+};
+typedef struct df_state_s df_state_t;
+
+static c_htable_t *df_states = NULL;
+
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static df_state_t *df_jobs_head = NULL;
+static df_state_t *df_jobs_tail = NULL;
+static df_state_t *df_slow_jobs_head = NULL;
+static df_state_t *df_slow_jobs_tail = NULL;
+static int df_threads_running = 0;
+/* Number of workers blocked in STATANYFS for longer than the timeout. Up to
+ * DF_HUNG_THREADS_MAX of them are replaced by new workers, so unresponsive
+ * file systems don't keep the others from being queried. */
+#define DF_HUNG_THREADS_MAX 16
+static int df_threads_hung = 0;
+static _Bool df_shutdown_flag = 0;
+static unsigned int df_round = 0;
+
+/* The mount table is only read again if it changed. On Linux, poll(2) on
+ * /proc/self/mounts reports changes; elsewhere it's read in each interval. */
+static cu_mount_t *mnt_list = NULL;
+#if KERNEL_LINUX
+static int mounts_fd = -1;
+#endif
 
 static int df_init (void)
 {
@@ -131,6 +209,33 @@ static int df_config (const char *key, const char *value)
 
 		return (0);
 	}
+	else if (strcasecmp (key, "ReportUnresponsive") == 0)
+	{
+		report_unresponsive = IS_TRUE (value) ? 1 : 0;
+		return (0);
+	}
+	else if (strcasecmp (key, "Timeout") == 0)
+	{
+		double timeout = atof (value);
+		if (timeout <= 0.0)
+		{
+			ERROR ("df plugin: Timeout must be a positive number.");
+			return (1);
+		}
+		df_timeout = DOUBLE_TO_CDTIME_T (timeout);
+		return (0);
+	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int threads = atoi (value);
+		if (threads < 1)
+		{
+			ERROR ("df plugin: Threads must be a positive number.");
+			return (1);
+		}
+		df_threads_num = threads;
+		return (0);
+	}
 
 
 	return (-1);
@@ -161,31 +266,436 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+/* Determines the plugin instance used for a mount point. Returns non-zero if
+ * the mount point is to be skipped. */
+static int df_disk_name (const cu_mount_t *mnt_ptr, /* {{{ */
+		char *disk_name, size_t disk_name_size)
 {
+	if (by_device) 
+	{
+		/* eg, /dev/hda1  -- strip off the "/dev/" */
+		if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
+			sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), disk_name_size);
+		else
+			sstrncpy (disk_name, mnt_ptr->spec_device, disk_name_size);
+
+		if (strlen(disk_name) < 1) 
+		{
+			DEBUG("df: no device name name for mountpoint %s, skipping", mnt_ptr->dir);
+			return (-1);
+		}
+	} 
+	else 
+	{
+		if (strcmp (mnt_ptr->dir, "/") == 0)
+		{
+			if (strcmp (mnt_ptr->type, "rootfs") == 0)
+				return (-1);
+			sstrncpy (disk_name, "root", disk_name_size);
+		}
+		else
+		{
+			int i, len;
+
+			sstrncpy (disk_name, mnt_ptr->dir + 1, disk_name_size);
+			len = strlen (disk_name);
+
+			for (i = 0; i < len; i++)
+				if (disk_name[i] == '/')
+					disk_name[i] = '-';
+		}
+	}
+
+	return (0);
+} /* }}} int df_disk_name */
+
+static void df_submit_statbuf (char *disk_name, /* {{{ */
+		statanyfs_t statbuf)
+{
+	unsigned long long blocksize;
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
+
+	blocksize = BLOCKSIZE(statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
 #if HAVE_STATVFS
-	struct statvfs statbuf;
+	/* Cast and temporary variable are needed to avoid
+	 * compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	int64_t signed_bavail = (int64_t) statbuf.f_bavail;
+	if (signed_bavail < 0)
+		statbuf.f_bavail = 0;
 #elif HAVE_STATFS
-	struct statfs statbuf;
+	if (statbuf.f_bavail < 0)
+		statbuf.f_bavail = 0;
+#endif
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf.f_bfree < statbuf.f_bavail)
+		statbuf.f_bfree = statbuf.f_bavail;
+	if (statbuf.f_blocks < statbuf.f_bfree)
+		statbuf.f_blocks = statbuf.f_bfree;
+
+	blk_free     = (uint64_t) statbuf.f_bavail;
+	blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
+	blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+
+	df_submit_one (disk_name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+	df_submit_one (disk_name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+	df_submit_one (disk_name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+
+	/* inode handling */
+	if (report_inodes)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf.f_ffree < statbuf.f_favail)
+			statbuf.f_ffree = statbuf.f_favail;
+		if (statbuf.f_files < statbuf.f_ffree)
+			statbuf.f_files = statbuf.f_ffree;
+
+		inode_free = (uint64_t) statbuf.f_favail;
+		inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
+		inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+		
+		df_submit_one (disk_name, "df_inodes", "free",
+				(gauge_t) inode_free);
+		df_submit_one (disk_name, "df_inodes", "reserved",
+				(gauge_t) inode_reserved);
+		df_submit_one (disk_name, "df_inodes", "used",
+				(gauge_t) inode_used);
+	}
+} /* }}} void df_submit_statbuf */
+
+static void df_state_free (df_state_t *st) /* {{{ */
+{
+	if (st == NULL)
+		return;
+
+	sfree (st->dir);
+	sfree (st);
+} /* }}} void df_state_free */
+
+static int df_compare_dir (const void *a, const void *b) /* {{{ */
+{
+	return (strcmp ((const char *) a, (const char *) b));
+} /* }}} int df_compare_dir */
+
+static void *df_worker (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&df_lock);
+	while (!df_shutdown_flag)
+	{
+		df_state_t *st;
+		statanyfs_t statbuf;
+		int status;
+		int error = 0;
+
+		if (df_jobs_head != NULL)
+		{
+			st = df_jobs_head;
+			df_jobs_head = st->next_job;
+			if (df_jobs_head == NULL)
+				df_jobs_tail = NULL;
+		}
+		else if (df_slow_jobs_head != NULL)
+		{
+			st = df_slow_jobs_head;
+			df_slow_jobs_head = st->next_job;
+			if (df_slow_jobs_head == NULL)
+				df_slow_jobs_tail = NULL;
+		}
+		else
+		{
+			pthread_cond_wait (&df_job_cond, &df_lock);
+			continue;
+		}
+		st->next_job = NULL;
+		st->running = 1;
+		st->started = cdtime ();
+
+		/* `st' is not freed while it is busy */
+		pthread_mutex_unlock (&df_lock);
+		memset (&statbuf, 0, sizeof (statbuf));
+		status = STATANYFS (st->dir, &statbuf);
+		if (status < 0)
+			error = errno;
+		pthread_mutex_lock (&df_lock);
+
+		st->status = status;
+		st->error = error;
+		st->statbuf = statbuf;
+		st->busy = 0;
+		st->running = 0;
+		st->done = 1;
+
+		if (st->hung)
+		{
+			st->hung = 0;
+			df_threads_hung--;
+		}
+
+		if (st->orphan)
+			df_state_free (st);
+		else
+			pthread_cond_broadcast (&df_done_cond);
+
+		/* This thread has been replaced while it was blocked. */
+		if ((df_threads_running - df_threads_hung) > df_threads_num)
+			break;
+	}
+	df_threads_running--;
+	pthread_mutex_unlock (&df_lock);
+
+	return (NULL);
+} /* }}} void *df_worker */
+
+/* Starts the worker threads, replacing the ones blocked in STATANYFS. They
+ * are detached: a thread blocked in STATANYFS could not be joined anyway.
+ * Must be called with df_lock held. */
+static int df_start_threads (void) /* {{{ */
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+	while (((df_threads_running - df_threads_hung) < df_threads_num)
+			&& (df_threads_running < (df_threads_num + DF_HUNG_THREADS_MAX)))
+	{
+		pthread_t thread;
+		int status;
+
+		status = plugin_thread_create (&thread, /* attr = */ NULL,
+				df_worker, /* arg = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("df plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		pthread_detach (thread);
+		df_threads_running++;
+	}
+
+	if ((df_threads_running > 0) && (df_threads_running <= df_threads_hung))
+		c_complain (LOG_ERR, &complaint,
+				"df plugin: All %i threads are blocked by unresponsive "
+				"file systems.", df_threads_running);
+	else
+		c_release (LOG_INFO, &complaint,
+				"df plugin: Threads are available again.");
+
+	return ((df_threads_running > 0) ? 0 : -1);
+} /* }}} int df_start_threads */
+
+/* Counts the workers which are blocked in STATANYFS for longer than
+ * `timeout', so that df_start_threads() replaces them. Must be called with
+ * df_lock held. */
+static void df_find_hung (cdtime_t timeout) /* {{{ */
+{
+	c_htable_iterator_t *iter;
+	char *key;
+	df_state_t *st;
+	cdtime_t now = cdtime ();
+
+	iter = c_htable_get_iterator (df_states);
+	while (c_htable_iterator_next (iter, (void *) &key, (void *) &st) == 0)
+	{
+		if (st->running && !st->hung && ((st->started + timeout) <= now))
+		{
+			st->hung = 1;
+			df_threads_hung++;
+		}
+	}
+	c_htable_iterator_destroy (iter);
+} /* }}} void df_find_hung */
+
+/* Returns true if the mount table has to be read (again). */
+static _Bool df_mounts_changed (void) /* {{{ */
+{
+#if KERNEL_LINUX
+	struct pollfd pfd;
+
+	/* Open the file before the mount table is read for the first time, so
+	 * changes made after that read are noticed. */
+	if (mounts_fd < 0)
+		mounts_fd = open ("/proc/self/mounts", O_RDONLY);
+
+	if ((mnt_list == NULL) || (mounts_fd < 0))
+		return (1);
+
+	pfd.fd = mounts_fd;
+	pfd.events = POLLPRI;
+	pfd.revents = 0;
+
+	/* The file becomes "exceptional" whenever a file system is mounted or
+	 * unmounted; polling resets that state. */
+	if (poll (&pfd, 1, /* timeout = */ 0) == 0)
+		return (0);
+
+	return ((pfd.revents & (POLLERR | POLLPRI)) != 0);
+#else
+	return (1);
 #endif
-	/* struct STATANYFS statbuf; */
-	cu_mount_t *mnt_list;
+} /* }}} _Bool df_mounts_changed */
+
+/* Frees the states of mount points which are not in the mount table anymore.
+ * Must be called with df_lock held. */
+static void df_states_expire (void) /* {{{ */
+{
+	c_htable_iterator_t *iter;
+	char **stale = NULL;
+	size_t stale_num = 0;
+	size_t i;
+	char *key;
+	df_state_t *st;
+
+	if (c_htable_size (df_states) == 0)
+		return;
+
+	stale = calloc ((size_t) c_htable_size (df_states), sizeof (*stale));
+	if (stale == NULL)
+		return;
+
+	iter = c_htable_get_iterator (df_states);
+	while (c_htable_iterator_next (iter, (void *) &key, (void *) &st) == 0)
+		if (st->round != df_round)
+			stale[stale_num++] = key;
+	c_htable_iterator_destroy (iter);
+
+	for (i = 0; i < stale_num; i++)
+	{
+		if (c_htable_remove (df_states, stale[i], NULL, (void *) &st) != 0)
+			continue;
+
+		if (st->busy)
+			st->orphan = 1;
+		else
+			df_state_free (st);
+	}
+	sfree (stale);
+} /* }}} void df_states_expire */
+
+static df_state_t *df_state_get (const char *dir) /* {{{ */
+{
+	df_state_t *st = NULL;
+
+	if (c_htable_get (df_states, dir, (void *) &st) == 0)
+		return (st);
+
+	st = calloc (1, sizeof (*st));
+	if (st == NULL)
+		return (NULL);
+
+	st->dir = strdup (dir);
+	if (st->dir == NULL)
+	{
+		sfree (st);
+		return (NULL);
+	}
+	C_COMPLAIN_INIT (&st->complaint);
+
+	if (c_htable_insert (df_states, st->dir, st) != 0)
+	{
+		df_state_free (st);
+		return (NULL);
+	}
+
+	return (st);
+} /* }}} df_state_t *df_state_get */
+
+static int df_read (void) /* {{{ */
+{
 	cu_mount_t *mnt_ptr;
+	df_state_t **states;
+	size_t states_num = 0;
+	size_t i;
+	cdtime_t timeout;
+	cdtime_t deadline;
+	struct timespec ts;
+
+	if (df_mounts_changed ())
+	{
+		cu_mount_t *new_list = NULL;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
+		if (cu_mount_getlist (&new_list) == NULL)
+		{
+			ERROR ("df plugin: cu_mount_getlist failed.");
+			return (-1);
+		}
+
+		cu_mount_freelist (mnt_list);
+		mnt_list = new_list;
+	}
+
+	states_num = 0;
+	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+		states_num++;
+
+	/* one entry per mount; mount points listed twice share a state */
+	states = calloc (states_num + 1, sizeof (*states));
+	if (states == NULL)
 	{
-		ERROR ("df plugin: cu_mount_getlist failed.");
+		ERROR ("df plugin: calloc failed.");
 		return (-1);
 	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	pthread_mutex_lock (&df_lock);
+
+	if (df_states == NULL)
 	{
-		unsigned long long blocksize;
-		char disk_name[256];
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		df_states = c_htable_create (c_htable_hash_string,
+				df_compare_dir);
+		if (df_states == NULL)
+		{
+			pthread_mutex_unlock (&df_lock);
+			ERROR ("df plugin: c_htable_create failed.");
+			sfree (states);
+			return (-1);
+		}
+	}
+
+	timeout = (df_timeout > 0) ? df_timeout : (plugin_get_interval () / 2);
+	df_find_hung (timeout);
+
+	if (df_start_threads () != 0)
+	{
+		pthread_mutex_unlock (&df_lock);
+		sfree (states);
+		return (-1);
+	}
+
+	df_round++;
+
+	/* Jobs left over from earlier reads didn't finish in time either, so
+	 * they are queried after the file systems which responded. */
+	if (df_jobs_head != NULL)
+	{
+		if (df_slow_jobs_tail == NULL)
+			df_slow_jobs_head = df_jobs_head;
+		else
+			df_slow_jobs_tail->next_job = df_jobs_head;
+		df_slow_jobs_tail = df_jobs_tail;
+		df_jobs_head = df_jobs_tail = NULL;
+	}
+
+	/* Queue all mount points which aren't still blocked from an earlier
+	 * read. */
+	for (mnt_ptr = mnt_list, i = 0; mnt_ptr != NULL;
+			mnt_ptr = mnt_ptr->next, i++)
+	{
+		df_state_t *st;
 
 		if (ignorelist_match (il_device,
 					(mnt_ptr->spec_device != NULL)
@@ -197,120 +707,144 @@ static int df_read (void)
 		if (ignorelist_match (il_fstype, mnt_ptr->type))
 			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
+		st = df_state_get (mnt_ptr->dir);
+		if (st == NULL)
 		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			ERROR ("df plugin: Allocating state for %s failed.", mnt_ptr->dir);
 			continue;
 		}
+		states[i] = st;
 
-		if (!statbuf.f_blocks)
+		if (st->round == df_round)
 			continue;
+		st->round = df_round;
 
-		if (by_device) 
+		if (st->busy)
 		{
-			/* eg, /dev/hda1  -- strip off the "/dev/" */
-			if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
-				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), sizeof (disk_name));
-			else
-				sstrncpy (disk_name, mnt_ptr->spec_device, sizeof (disk_name));
-
-			if (strlen(disk_name) < 1) 
-			{
-				DEBUG("df: no device name name for mountpoint %s, skipping", mnt_ptr->dir);
-				continue;
-			}
-		} 
-		else 
+			st->done = 0;
+			continue;
+		}
+
+		st->busy = 1;
+		st->done = 0;
+		st->next_job = NULL;
+
+		/* File systems which were slow last time are queried after
+		 * the others, so they can't hold up the responsive ones. */
+		if (st->slow)
 		{
-			if (strcmp (mnt_ptr->dir, "/") == 0)
-			{
-				if (strcmp (mnt_ptr->type, "rootfs") == 0)
-					continue;
-				sstrncpy (disk_name, "root", sizeof (disk_name));
-			}
+			if (df_slow_jobs_tail == NULL)
+				df_slow_jobs_head = st;
 			else
-			{
-				int i, len;
+				df_slow_jobs_tail->next_job = st;
+			df_slow_jobs_tail = st;
+			continue;
+		}
+
+		if (df_jobs_tail == NULL)
+			df_jobs_head = st;
+		else
+			df_jobs_tail->next_job = st;
+		df_jobs_tail = st;
+	}
+	pthread_cond_broadcast (&df_job_cond);
 
-				sstrncpy (disk_name, mnt_ptr->dir + 1, sizeof (disk_name));
-				len = strlen (disk_name);
+	/* Wait for the results, but not forever. */
+	deadline = cdtime () + timeout;
+	CDTIME_T_TO_TIMESPEC (deadline, &ts);
 
-				for (i = 0; i < len; i++)
-					if (disk_name[i] == '/')
-						disk_name[i] = '-';
-			}
-		}
+	for (i = 0; i < states_num; i++)
+	{
+		if (states[i] == NULL)
+			continue;
+
+		while (!states[i]->done && (cdtime () < deadline))
+			pthread_cond_timedwait (&df_done_cond, &df_lock, &ts);
+	}
 
-		blocksize = BLOCKSIZE(statbuf);
+	/* Dispatch without holding the lock. Results of finished states aren't
+	 * touched by the workers anymore, so copy them first. */
+	for (mnt_ptr = mnt_list, i = 0; mnt_ptr != NULL;
+			mnt_ptr = mnt_ptr->next, i++)
+	{
+		df_state_t *st = states[i];
+		char disk_name[256];
+		statanyfs_t statbuf;
+		_Bool done;
+		int status;
+		int error;
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
-#if HAVE_STATVFS
-		/* Cast and temporary variable are needed to avoid
-		 * compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		int64_t signed_bavail = (int64_t) statbuf.f_bavail;
-		if (signed_bavail < 0)
-			statbuf.f_bavail = 0;
-#elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
-#endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
-
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
-
-		df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-		df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-		df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
-
-		/* inode handling */
-		if (report_inodes)
+		if (st == NULL)
+			continue;
+
+		done = st->done;
+		status = st->status;
+		error = st->error;
+		statbuf = st->statbuf;
+
+		st->slow = !done;
+
+		if (!done)
+			c_complain (LOG_WARNING, &st->complaint,
+					"df plugin: "STATANYFS_STR"(%s) did not return within "
+					"%.3f seconds. Skipping this file system until it does.",
+					mnt_ptr->dir, CDTIME_T_TO_DOUBLE (timeout));
+		else
+			c_release (LOG_INFO, &st->complaint,
+					"df plugin: "STATANYFS_STR"(%s) returned again.",
+					mnt_ptr->dir);
+
+		pthread_mutex_unlock (&df_lock);
+
+		if (done && (status < 0))
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
-
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
-
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
-			
-			df_submit_one (disk_name, "df_inodes", "free",
-					(gauge_t) inode_free);
-			df_submit_one (disk_name, "df_inodes", "reserved",
-					(gauge_t) inode_reserved);
-			df_submit_one (disk_name, "df_inodes", "used",
-					(gauge_t) inode_used);
+			char errbuf[1024];
+			ERROR (STATANYFS_STR"(%s) failed: %s",
+					mnt_ptr->dir,
+					sstrerror (error, errbuf,
+						sizeof (errbuf)));
 		}
+		else if ((!done || statbuf.f_blocks)
+				&& (df_disk_name (mnt_ptr, disk_name, sizeof (disk_name)) == 0))
+		{
+			if (done)
+				df_submit_statbuf (disk_name, statbuf);
+			if (report_unresponsive)
+				df_submit_one (disk_name, "gauge", "unresponsive",
+						done ? 0.0 : 1.0);
+		}
+
+		pthread_mutex_lock (&df_lock);
 	}
 
+	df_states_expire ();
+
+	pthread_mutex_unlock (&df_lock);
+
+	sfree (states);
+	return (0);
+} /* }}} int df_read */
+
+static int df_shutdown (void) /* {{{ */
+{
+	/* Threads blocked in STATANYFS and the states they use are left
+	 * alone. */
+	pthread_mutex_lock (&df_lock);
+	df_shutdown_flag = 1;
+	pthread_cond_broadcast (&df_job_cond);
+	pthread_mutex_unlock (&df_lock);
+
 	cu_mount_freelist (mnt_list);
+	mnt_list = NULL;
+
+#if KERNEL_LINUX
+	if (mounts_fd >= 0)
+		close (mounts_fd);
+	mounts_fd = -1;
+#endif
 
 	return (0);
-} /* int df_read */
+} /* }}} int df_shutdown */
 
 void module_register (void)
 {
@@ -318,4 +852,5 @@ void module_register (void)
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown);
 } /* void module_register */
@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if HAVE_MACH_MACH_TYPES_H
 #  include <mach/mach_types.h>
@@ -106,6 +107,11 @@ typedef struct diskstats
 } diskstats_t;
 
 static diskstats_t *disklist;
+
+/* /proc/diskstats or, on Linux 2.4, /proc/partitions. The latter has an
+ * additional field at the beginning of each line. */
+static cu_procfile_t *proc_diskstats = NULL;
+static int proc_fieldshift = 0;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -196,7 +202,23 @@ static int disk_init (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	/* do nothing */
+	if (proc_diskstats == NULL)
+	{
+		if (access ("/proc/diskstats", R_OK) == 0)
+		{
+			proc_diskstats = cu_procfile_create ("/proc/diskstats");
+			proc_fieldshift = 0;
+		}
+		else
+		{
+			/* Kernel is 2.4.* */
+			proc_diskstats = cu_procfile_create ("/proc/partitions");
+			proc_fieldshift = 1;
+		}
+
+		if (proc_diskstats == NULL)
+			return (-1);
+	}
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -470,12 +492,11 @@ static int disk_read (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-	
+	char *buffer;
+
 	char *fields[32];
 	int numfields;
-	int fieldshift = 0;
+	int fieldshift = proc_fieldshift;
 
 	int minor = 0;
 
@@ -492,20 +513,16 @@ static int disk_read (void)
 
 	diskstats_t *ds, *pre_ds;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
+	if (cu_procfile_read (proc_diskstats) != 0)
 	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
-		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
-			return (-1);
-		}
-
-		/* Kernel is 2.4.* */
-		fieldshift = 1;
+		char errbuf[1024];
+		ERROR ("disk plugin: Reading %s failed: %s",
+				cu_procfile_name (proc_diskstats),
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((buffer = cu_procfile_readline (proc_diskstats)) != NULL)
 	{
 		char *disk_name;
 
@@ -676,9 +693,7 @@ static int disk_read (void)
 			disk_submit (disk_name, "disk_merged",
 					read_merged, write_merged);
 		} /* if (is_disk) */
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
-
-	fclose (fh);
+	} /* while (cu_procfile_readline (proc_diskstats) != NULL) */
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -802,10 +817,22 @@ static int disk_read (void)
 	return (0);
 } /* int disk_read */
 
+#if KERNEL_LINUX
+static int disk_shutdown (void)
+{
+  cu_procfile_destroy (proc_diskstats);
+  proc_diskstats = NULL;
+  return (0);
+} /* int disk_shutdown */
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
   plugin_register_config ("disk", disk_config,
       config_keys, config_keys_num);
   plugin_register_init ("disk", disk_init);
   plugin_register_read ("disk", disk_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown ("disk", disk_shutdown);
+#endif
 } /* void module_register */
@@ -35,16 +35,67 @@
 #include <pcap.h>
 #include <pcap-bpf.h>
 
+#if KERNEL_LINUX
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <net/if.h>
+# include <net/if_arp.h>
+# include <linux/if_packet.h>
+# include <linux/if_ether.h>
+# include <linux/filter.h>
+/* TPACKET3_HDRLEN is only defined by headers supporting TPACKET_V3. */
+# ifdef TPACKET3_HDRLEN
+#  define DNS_HAVE_TPACKET 1
+# endif
+#endif
+
+#ifndef DNS_HAVE_TPACKET
+# define DNS_HAVE_TPACKET 0
+#endif
+
 /*
  * Private data types
  */
-struct counter_list_s
+#define RCODE_MAX 16
+/* Query type counters are allocated in pages of 256, because most of the
+ * 65536 possible types are never seen. */
+#define QTYPE_PAGE_SIZE 256
+#define QTYPE_PAGE_NUM (T_MAX / QTYPE_PAGE_SIZE)
+
+/* Each capture thread counts into its own instance, so the threads don't
+ * contend for a lock. The read callback sums them up. */
+struct dns_counters_s
+{
+	pthread_mutex_t lock;
+
+	derive_t tr_queries;
+	derive_t tr_responses;
+	derive_t opcode[OP_MAX];
+	derive_t rcode[RCODE_MAX];
+	derive_t *qtype[QTYPE_PAGE_NUM];
+};
+typedef struct dns_counters_s dns_counters_t;
+
+#define BACKEND_PCAP    0
+#define BACKEND_TPACKET 1
+
+#if DNS_HAVE_TPACKET
+# define TPACKET_BLOCK_SIZE (1 << 20)
+# define TPACKET_BLOCK_NUM  8
+# define TPACKET_FRAME_SIZE 2048
+/* Maximum time, in milliseconds, before a partially filled block is handed to
+ * the capture thread. */
+# define TPACKET_BLOCK_TIMEOUT 100
+
+struct dns_tpacket_s
 {
-	unsigned int key;
-	unsigned int value;
-	struct counter_list_s *next;
+	int fd;
+	uint8_t *map;
+	size_t map_size;
 };
-typedef struct counter_list_s counter_list_t;
+typedef struct dns_tpacket_s dns_tpacket_t;
+#endif /* DNS_HAVE_TPACKET */
 
 /*
  * Private variables
@@ -53,89 +104,95 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSource",
-	"SelectNumericQueryTypes"
+	"SelectNumericQueryTypes",
+	"CaptureBackend",
+	"Threads",
+	"PcapFile"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int select_numeric_qtype = 1;
 
 #define PCAP_SNAPLEN 1460
 static char   *pcap_device = NULL;
-
-static derive_t       tr_queries;
-static derive_t       tr_responses;
-static counter_list_t *qtype_list;
-static counter_list_t *opcode_list;
-static counter_list_t *rcode_list;
-
-static pthread_t       listen_thread;
-static int             listen_thread_init = 0;
-/* The `traffic' mutex if for `tr_queries' and `tr_responses' */
-static pthread_mutex_t traffic_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t qtype_mutex   = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t opcode_mutex  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rcode_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static char   *pcap_file = NULL;
+static int     capture_backend = BACKEND_PCAP;
+static int     capture_threads_num = 1;
+
+static dns_counters_t *counters = NULL;
+static int             counters_num = 0;
+static pthread_key_t   counters_key;
+/* The read callback's sums. Only used by the read callback. */
+static dns_counters_t  counters_sum;
+
+static pthread_t      *listen_threads = NULL;
+static int             listen_threads_num = 0;
+static _Bool           listen_shutdown = 0;
+/* Used to interrupt pcap_loop(). Only set while the pcap thread is running. */
+static pcap_t         *listen_pcap_obj = NULL;
+static pthread_mutex_t listen_pcap_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Private functions
  */
-static counter_list_t *counter_list_search (counter_list_t **list, unsigned int key)
+static int counters_init (dns_counters_t *c)
 {
-	counter_list_t *entry;
-
-	for (entry = *list; entry != NULL; entry = entry->next)
-		if (entry->key == key)
-			break;
+	memset (c, 0, sizeof (*c));
+	return (pthread_mutex_init (&c->lock, /* attr = */ NULL));
+} /* int counters_init */
 
-	return (entry);
-}
-
-static counter_list_t *counter_list_create (counter_list_t **list,
-		unsigned int key, unsigned int value)
+static void counters_destroy (dns_counters_t *c)
 {
-	counter_list_t *entry;
+	int i;
 
-	entry = (counter_list_t *) malloc (sizeof (counter_list_t));
-	if (entry == NULL)
-		return (NULL);
+	for (i = 0; i < QTYPE_PAGE_NUM; i++)
+		sfree (c->qtype[i]);
+	pthread_mutex_destroy (&c->lock);
+} /* void counters_destroy */
 
-	memset (entry, 0, sizeof (counter_list_t));
-	entry->key = key;
-	entry->value = value;
+/* Must be called with c->lock held. */
+static derive_t *counters_qtype (dns_counters_t *c, unsigned int qtype)
+{
+	derive_t **page = c->qtype + (qtype / QTYPE_PAGE_SIZE);
 
-	if (*list == NULL)
-	{
-		*list = entry;
-	}
-	else
+	if (*page == NULL)
 	{
-		counter_list_t *last;
-
-		last = *list;
-		while (last->next != NULL)
-			last = last->next;
-
-		last->next = entry;
+		*page = calloc (QTYPE_PAGE_SIZE, sizeof (**page));
+		if (*page == NULL)
+			return (NULL);
 	}
 
-	return (entry);
-}
+	return ((*page) + (qtype % QTYPE_PAGE_SIZE));
+} /* derive_t *counters_qtype */
 
-static void counter_list_add (counter_list_t **list,
-		unsigned int key, unsigned int increment)
+/* Adds the counters of "src" to "dst". Must be called with src->lock held. */
+static void counters_add (dns_counters_t *dst, const dns_counters_t *src)
 {
-	counter_list_t *entry;
+	int i;
+	int j;
 
-	entry = counter_list_search (list, key);
+	dst->tr_queries += src->tr_queries;
+	dst->tr_responses += src->tr_responses;
+	for (i = 0; i < OP_MAX; i++)
+		dst->opcode[i] += src->opcode[i];
+	for (i = 0; i < RCODE_MAX; i++)
+		dst->rcode[i] += src->rcode[i];
 
-	if (entry != NULL)
+	for (i = 0; i < QTYPE_PAGE_NUM; i++)
 	{
-		entry->value += increment;
-	}
-	else
-	{
-		counter_list_create (list, key, increment);
+		derive_t *value;
+
+		if (src->qtype[i] == NULL)
+			continue;
+
+		/* make sure the page exists */
+		value = counters_qtype (dst, (unsigned int) (i * QTYPE_PAGE_SIZE));
+		if (value == NULL)
+			continue;
+
+		for (j = 0; j < QTYPE_PAGE_SIZE; j++)
+			dst->qtype[i][j] += src->qtype[i][j];
 	}
-}
+} /* void counters_add */
 
 static int dns_config (const char *key, const char *value)
 {
@@ -158,6 +215,42 @@ static int dns_config (const char *key, const char *value)
 		else
 			select_numeric_qtype = 1;
 	}
+	else if (strcasecmp (key, "CaptureBackend") == 0)
+	{
+		if (strcasecmp ("pcap", value) == 0)
+			capture_backend = BACKEND_PCAP;
+		else if (strcasecmp ("tpacket", value) == 0)
+		{
+#if DNS_HAVE_TPACKET
+			capture_backend = BACKEND_TPACKET;
+#else
+			ERROR ("dns plugin: The \"tpacket\" capture backend is "
+					"not available on this system.");
+			return (1);
+#endif
+		}
+		else
+		{
+			ERROR ("dns plugin: Unknown capture backend: %s", value);
+			return (1);
+		}
+	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			ERROR ("dns plugin: Threads must be a positive number.");
+			return (1);
+		}
+		capture_threads_num = tmp;
+	}
+	else if (strcasecmp (key, "PcapFile") == 0)
+	{
+		sfree (pcap_file);
+		if ((pcap_file = strdup (value)) == NULL)
+			return (1);
+	}
 	else
 	{
 		return (-1);
@@ -168,135 +261,461 @@ static int dns_config (const char *key, const char *value)
 
 static void dns_child_callback (const rfc1035_header_t *dns)
 {
+	dns_counters_t *c = pthread_getspecific (counters_key);
+
+	if (c == NULL)
+		return;
+
+	pthread_mutex_lock (&c->lock);
+
 	if (dns->qr == 0)
 	{
 		/* This is a query */
-		int skip = 0;
-		if (!select_numeric_qtype)
-		{
-			const char *str = qtype_str(dns->qtype);
-			if ((str == NULL) || (str[0] == '#'))
-				skip = 1;
-		}
+		derive_t *qtype;
 
-		pthread_mutex_lock (&traffic_mutex);
-		tr_queries += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
+		c->tr_queries += dns->length;
 
-		if (skip == 0)
-		{
-			pthread_mutex_lock (&qtype_mutex);
-			counter_list_add (&qtype_list, dns->qtype,  1);
-			pthread_mutex_unlock (&qtype_mutex);
-		}
+		qtype = counters_qtype (c, dns->qtype);
+		if (qtype != NULL)
+			(*qtype)++;
 	}
 	else
 	{
 		/* This is a reply */
-		pthread_mutex_lock (&traffic_mutex);
-		tr_responses += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
-
-		pthread_mutex_lock (&rcode_mutex);
-		counter_list_add (&rcode_list,  dns->rcode,  1);
-		pthread_mutex_unlock (&rcode_mutex);
+		c->tr_responses += dns->length;
+		c->rcode[dns->rcode % RCODE_MAX]++;
 	}
 
 	/* FIXME: Are queries, replies or both interesting? */
-	pthread_mutex_lock (&opcode_mutex);
-	counter_list_add (&opcode_list, dns->opcode, 1);
-	pthread_mutex_unlock (&opcode_mutex);
+	c->opcode[dns->opcode % OP_MAX]++;
+
+	pthread_mutex_unlock (&c->lock);
 }
 
-static void *dns_child_loop (__attribute__((unused)) void *dummy)
+static pcap_t *dns_pcap_open (void)
 {
 	pcap_t *pcap_obj;
 	char    pcap_error[PCAP_ERRBUF_SIZE];
 	struct  bpf_program fp;
 
-	int status;
-
-	/* Don't block any signals */
+	if (pcap_file != NULL)
 	{
-		sigset_t sigmask;
-		sigemptyset (&sigmask);
-		pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
+		DEBUG ("dns plugin: Opening capture file %s.", pcap_file);
+		pcap_obj = pcap_open_offline (pcap_file, pcap_error);
+		if (pcap_obj == NULL)
+		{
+			ERROR ("dns plugin: Opening capture file `%s' "
+					"failed: %s", pcap_file, pcap_error);
+			return (NULL);
+		}
 	}
-
-	/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
-	DEBUG ("dns plugin: Creating PCAP object..");
-	pcap_obj = pcap_open_live ((pcap_device != NULL) ? pcap_device : "any",
-			PCAP_SNAPLEN,
-			0 /* Not promiscuous */,
-			(int) CDTIME_T_TO_MS (plugin_get_interval () / 2),
-			pcap_error);
-	if (pcap_obj == NULL)
+	else
 	{
-		ERROR ("dns plugin: Opening interface `%s' "
-				"failed: %s",
-				(pcap_device != NULL) ? pcap_device : "any",
+		/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
+		DEBUG ("dns plugin: Creating PCAP object..");
+		pcap_obj = pcap_open_live ((pcap_device != NULL) ? pcap_device : "any",
+				PCAP_SNAPLEN,
+				0 /* Not promiscuous */,
+				(int) CDTIME_T_TO_MS (plugin_get_interval () / 2),
 				pcap_error);
-		return (NULL);
+		if (pcap_obj == NULL)
+		{
+			ERROR ("dns plugin: Opening interface `%s' "
+					"failed: %s",
+					(pcap_device != NULL) ? pcap_device : "any",
+					pcap_error);
+			return (NULL);
+		}
 	}
 
 	memset (&fp, 0, sizeof (fp));
 	if (pcap_compile (pcap_obj, &fp, "udp port 53", 1, 0) < 0)
 	{
 		ERROR ("dns plugin: pcap_compile failed");
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
 	if (pcap_setfilter (pcap_obj, &fp) < 0)
 	{
 		ERROR ("dns plugin: pcap_setfilter failed");
+		pcap_freecode (&fp);
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
+	pcap_freecode (&fp);
 
 	DEBUG ("dns plugin: PCAP object created.");
 
+	return (pcap_obj);
+} /* pcap_t *dns_pcap_open */
+
+/* Reads packets using libpcap, either from the network or, if "PcapFile" is
+ * set, from a file. */
+static void *dns_child_loop (void *arg)
+{
+	pcap_t *pcap_obj;
+	cdtime_t start;
+	int status;
+
+	/* Don't block any signals */
+	{
+		sigset_t sigmask;
+		sigemptyset (&sigmask);
+		pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
+	}
+
+	pthread_setspecific (counters_key, arg);
+
+	pcap_obj = dns_pcap_open ();
+	if (pcap_obj == NULL)
+		return (NULL);
+
 	dnstop_set_pcap_obj (pcap_obj);
 	dnstop_set_callback (dns_child_callback);
 
+	pthread_mutex_lock (&listen_pcap_lock);
+	listen_pcap_obj = pcap_obj;
+	pthread_mutex_unlock (&listen_pcap_lock);
+
+	start = cdtime ();
 	status = pcap_loop (pcap_obj,
 			-1 /* loop forever */,
 			handle_pcap /* callback */,
 			NULL /* Whatever this means.. */);
-	if (status < 0)
+	if (status == -1)
 		ERROR ("dns plugin: Listener thread is exiting "
 				"abnormally: %s", pcap_geterr (pcap_obj));
+	else if ((status == 0) && (pcap_file != NULL))
+	{
+		dns_counters_t *c = arg;
+		derive_t queries;
+		derive_t responses;
+
+		pthread_mutex_lock (&c->lock);
+		queries = c->tr_queries;
+		responses = c->tr_responses;
+		pthread_mutex_unlock (&c->lock);
+
+		INFO ("dns plugin: Finished reading %s after %.3f seconds "
+				"(%"PRIi64" bytes of queries, %"PRIi64" bytes of "
+				"responses).", pcap_file,
+				CDTIME_T_TO_DOUBLE (cdtime () - start),
+				queries, responses);
+	}
 
 	DEBUG ("dns plugin: Child is exiting.");
 
+	pthread_mutex_lock (&listen_pcap_lock);
+	listen_pcap_obj = NULL;
+	pthread_mutex_unlock (&listen_pcap_lock);
+
 	pcap_close (pcap_obj);
-	listen_thread_init = 0;
 	pthread_exit (NULL);
 
 	return (NULL);
 } /* static void dns_child_loop (void) */
 
-static int dns_init (void)
+#if DNS_HAVE_TPACKET
+/* Attaches the filter "udp port 53" to the packet socket. SOCK_DGRAM sockets
+ * pass packets starting with the network header to the filter, which is what
+ * libpcap generates code for with DLT_RAW. */
+static int dns_tpacket_set_filter (int fd)
 {
-	/* clean up an old thread */
+	pcap_t *pcap_obj;
+	struct bpf_program fp;
+	struct sock_fprog prog;
 	int status;
 
-	pthread_mutex_lock (&traffic_mutex);
-	tr_queries   = 0;
-	tr_responses = 0;
-	pthread_mutex_unlock (&traffic_mutex);
+	pcap_obj = pcap_open_dead (DLT_RAW, PCAP_SNAPLEN);
+	if (pcap_obj == NULL)
+	{
+		ERROR ("dns plugin: pcap_open_dead failed.");
+		return (-1);
+	}
 
-	if (listen_thread_init != 0)
+	memset (&fp, 0, sizeof (fp));
+	if (pcap_compile (pcap_obj, &fp, "udp port 53", 1, 0) < 0)
+	{
+		ERROR ("dns plugin: pcap_compile failed: %s",
+				pcap_geterr (pcap_obj));
+		pcap_close (pcap_obj);
 		return (-1);
+	}
+
+	memset (&prog, 0, sizeof (prog));
+	prog.len = (unsigned short) fp.bf_len;
+	prog.filter = (struct sock_filter *) fp.bf_insns;
 
-	status = plugin_thread_create (&listen_thread, NULL, dns_child_loop,
-			(void *) 0);
+	status = setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			&prog, sizeof (prog));
 	if (status != 0)
 	{
 		char errbuf[1024];
-		ERROR ("dns plugin: pthread_create failed: %s",
+		ERROR ("dns plugin: setsockopt (SO_ATTACH_FILTER) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+
+	pcap_freecode (&fp);
+	pcap_close (pcap_obj);
+	return (status);
+} /* int dns_tpacket_set_filter */
+
+static void dns_tpacket_close (dns_tpacket_t *tp)
+{
+	if (tp->map != NULL)
+		munmap (tp->map, tp->map_size);
+	tp->map = NULL;
+
+	if (tp->fd >= 0)
+		close (tp->fd);
+	tp->fd = -1;
+} /* void dns_tpacket_close */
+
+/* Opens a packet socket with a memory mapped TPACKET_V3 receive ring. If
+ * several threads are used, their sockets are joined in a fanout group, so
+ * that the kernel distributes packets among them by flow. */
+static int dns_tpacket_open (dns_tpacket_t *tp)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll addr;
+	int version = TPACKET_V3;
+	int status;
+
+	memset (tp, 0, sizeof (*tp));
+	tp->fd = socket (AF_PACKET, SOCK_DGRAM, htons (ETH_P_ALL));
+	if (tp->fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: socket (AF_PACKET) failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	listen_thread_init = 1;
+	status = setsockopt (tp->fd, SOL_PACKET, PACKET_VERSION,
+			&version, sizeof (version));
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: setsockopt (PACKET_VERSION) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_tpacket_close (tp);
+		return (-1);
+	}
+
+	/* Attach the filter before the ring exists, so that no unfiltered
+	 * packets end up in it. */
+	if (dns_tpacket_set_filter (tp->fd) != 0)
+	{
+		dns_tpacket_close (tp);
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.tp_block_size = TPACKET_BLOCK_SIZE;
+	req.tp_block_nr = TPACKET_BLOCK_NUM;
+	req.tp_frame_size = TPACKET_FRAME_SIZE;
+	req.tp_frame_nr = (TPACKET_BLOCK_SIZE / TPACKET_FRAME_SIZE)
+		* TPACKET_BLOCK_NUM;
+	req.tp_retire_blk_tov = TPACKET_BLOCK_TIMEOUT;
+	status = setsockopt (tp->fd, SOL_PACKET, PACKET_RX_RING,
+			&req, sizeof (req));
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: setsockopt (PACKET_RX_RING) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_tpacket_close (tp);
+		return (-1);
+	}
+
+	tp->map_size = ((size_t) TPACKET_BLOCK_SIZE) * TPACKET_BLOCK_NUM;
+	tp->map = mmap (NULL, tp->map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, tp->fd, 0);
+	if (tp->map == MAP_FAILED)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: mmap failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		tp->map = NULL;
+		dns_tpacket_close (tp);
+		return (-1);
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons (ETH_P_ALL);
+	addr.sll_ifindex = 0; /* any */
+	if ((pcap_device != NULL) && (strcmp ("any", pcap_device) != 0))
+	{
+		addr.sll_ifindex = (int) if_nametoindex (pcap_device);
+		if (addr.sll_ifindex == 0)
+		{
+			ERROR ("dns plugin: Unknown interface: %s", pcap_device);
+			dns_tpacket_close (tp);
+			return (-1);
+		}
+	}
+
+	status = bind (tp->fd, (struct sockaddr *) &addr, sizeof (addr));
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: bind failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_tpacket_close (tp);
+		return (-1);
+	}
+
+	if (capture_threads_num > 1)
+	{
+		int fanout = (((int) getpid ()) & 0xffff)
+			| (PACKET_FANOUT_HASH << 16);
+
+		status = setsockopt (tp->fd, SOL_PACKET, PACKET_FANOUT,
+				&fanout, sizeof (fanout));
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: setsockopt (PACKET_FANOUT) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			dns_tpacket_close (tp);
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* int dns_tpacket_open */
+
+static void dns_tpacket_handle_block (struct tpacket_block_desc *block)
+{
+	struct tpacket3_hdr *hdr;
+	uint32_t i;
+
+	hdr = (struct tpacket3_hdr *) (((uint8_t *) block)
+			+ block->hdr.bh1.offset_to_first_pkt);
+
+	for (i = 0; i < block->hdr.bh1.num_pkts; i++)
+	{
+		const struct sockaddr_ll *addr;
+
+		addr = (const struct sockaddr_ll *) (((uint8_t *) hdr)
+				+ TPACKET_ALIGN (sizeof (*hdr)));
+
+		/* Packets on the loopback device are seen twice, once outgoing
+		 * and once incoming. libpcap skips the former, too. */
+		if ((addr->sll_pkttype != PACKET_OUTGOING)
+				|| (addr->sll_hatype != ARPHRD_LOOPBACK))
+			handle_ip_packet (ntohs (addr->sll_protocol),
+					((uint8_t *) hdr) + hdr->tp_net,
+					(int) hdr->tp_snaplen);
+
+		hdr = (struct tpacket3_hdr *) (((uint8_t *) hdr)
+				+ hdr->tp_next_offset);
+	}
+} /* void dns_tpacket_handle_block */
+
+/* Reads packets from a TPACKET_V3 ring. Packets are handed to the thread in
+ * blocks, which are returned to the kernel after all packets in them have
+ * been parsed. */
+static void *dns_tpacket_loop (void *arg)
+{
+	dns_tpacket_t tp;
+	size_t block_index = 0;
+
+	pthread_setspecific (counters_key, arg);
+	dnstop_set_callback (dns_child_callback);
+
+	if (dns_tpacket_open (&tp) != 0)
+		return (NULL);
+
+	while (!listen_shutdown)
+	{
+		struct tpacket_block_desc *block;
+
+		block = (struct tpacket_block_desc *) (tp.map
+				+ (block_index * TPACKET_BLOCK_SIZE));
+
+		if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			struct pollfd pfd;
+
+			pfd.fd = tp.fd;
+			pfd.events = POLLIN | POLLERR;
+			pfd.revents = 0;
+
+			/* Time out once in a while to check for shutdown. */
+			poll (&pfd, 1, /* timeout = */ 1000);
+			continue;
+		}
+
+		dns_tpacket_handle_block (block);
+
+		__sync_synchronize ();
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		block_index = (block_index + 1) % TPACKET_BLOCK_NUM;
+	}
+
+	dns_tpacket_close (&tp);
+	return (NULL);
+} /* void *dns_tpacket_loop */
+#endif /* DNS_HAVE_TPACKET */
+
+static int dns_init (void)
+{
+	void *(*loop) (void *) = dns_child_loop;
+	int threads_num = 1;
+	int status;
+	int i;
+
+	if (listen_threads != NULL)
+		return (-1);
+
+#if DNS_HAVE_TPACKET
+	/* A capture file is always read using libpcap. */
+	if ((capture_backend == BACKEND_TPACKET) && (pcap_file == NULL))
+	{
+		loop = dns_tpacket_loop;
+		threads_num = capture_threads_num;
+	}
+#endif
+
+	status = pthread_key_create (&counters_key, /* destructor = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("dns plugin: pthread_key_create failed.");
+		return (-1);
+	}
+
+	counters = calloc ((size_t) threads_num, sizeof (*counters));
+	listen_threads = calloc ((size_t) threads_num, sizeof (*listen_threads));
+	if ((counters == NULL) || (listen_threads == NULL))
+	{
+		ERROR ("dns plugin: calloc failed.");
+		sfree (counters);
+		sfree (listen_threads);
+		return (-1);
+	}
+	for (counters_num = 0; counters_num < threads_num; counters_num++)
+		counters_init (counters + counters_num);
+	counters_init (&counters_sum);
+
+	listen_shutdown = 0;
+	for (i = 0; i < threads_num; i++)
+	{
+		status = plugin_thread_create (&listen_threads[i], NULL, loop,
+				(void *) (counters + i));
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		listen_threads_num++;
+	}
+
+	if (listen_threads_num == 0)
+		return (-1);
 
 	return (0);
 } /* int dns_init */
@@ -338,75 +757,120 @@ static void submit_octets (derive_t queries, derive_t responses)
 
 static int dns_read (void)
 {
-	unsigned int keys[T_MAX];
-	unsigned int values[T_MAX];
-	int len;
+	dns_counters_t *sum = &counters_sum;
 	int i;
+	int j;
 
-	counter_list_t *ptr;
-
-	pthread_mutex_lock (&traffic_mutex);
-	values[0] = tr_queries;
-	values[1] = tr_responses;
-	pthread_mutex_unlock (&traffic_mutex);
-
-	if ((values[0] != 0) || (values[1] != 0))
-		submit_octets (values[0], values[1]);
+	if (counters == NULL)
+		return (-1);
 
-	pthread_mutex_lock (&qtype_mutex);
-	for (ptr = qtype_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	/* Reset the sums, keeping the pages allocated. */
+	sum->tr_queries = 0;
+	sum->tr_responses = 0;
+	memset (sum->opcode, 0, sizeof (sum->opcode));
+	memset (sum->rcode, 0, sizeof (sum->rcode));
+	for (i = 0; i < QTYPE_PAGE_NUM; i++)
+		if (sum->qtype[i] != NULL)
+			memset (sum->qtype[i], 0,
+					QTYPE_PAGE_SIZE * sizeof (*sum->qtype[i]));
+
+	for (i = 0; i < counters_num; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		pthread_mutex_lock (&counters[i].lock);
+		counters_add (sum, counters + i);
+		pthread_mutex_unlock (&counters[i].lock);
 	}
-	pthread_mutex_unlock (&qtype_mutex);
 
-	for (i = 0; i < len; i++)
-	{
-		DEBUG ("dns plugin: qtype = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_qtype", qtype_str (keys[i]), values[i]);
-	}
+	if ((sum->tr_queries != 0) || (sum->tr_responses != 0))
+		submit_octets (sum->tr_queries, sum->tr_responses);
 
-	pthread_mutex_lock (&opcode_mutex);
-	for (ptr = opcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < QTYPE_PAGE_NUM; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		if (sum->qtype[i] == NULL)
+			continue;
+
+		for (j = 0; j < QTYPE_PAGE_SIZE; j++)
+		{
+			const char *str;
+
+			if (sum->qtype[i][j] == 0)
+				continue;
+
+			str = qtype_str (i * QTYPE_PAGE_SIZE + j);
+			if (!select_numeric_qtype
+					&& ((str == NULL) || (str[0] == '#')))
+				continue;
+
+			DEBUG ("dns plugin: qtype = %i; counter = %"PRIi64";",
+					i * QTYPE_PAGE_SIZE + j, sum->qtype[i][j]);
+			submit_derive ("dns_qtype", str, sum->qtype[i][j]);
+		}
 	}
-	pthread_mutex_unlock (&opcode_mutex);
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < OP_MAX; i++)
 	{
-		DEBUG ("dns plugin: opcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_opcode", opcode_str (keys[i]), values[i]);
+		if (sum->opcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: opcode = %i; counter = %"PRIi64";",
+				i, sum->opcode[i]);
+		submit_derive ("dns_opcode", opcode_str (i), sum->opcode[i]);
 	}
 
-	pthread_mutex_lock (&rcode_mutex);
-	for (ptr = rcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < RCODE_MAX; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		if (sum->rcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: rcode = %i; counter = %"PRIi64";",
+				i, sum->rcode[i]);
+		submit_derive ("dns_rcode", rcode_str (i), sum->rcode[i]);
 	}
-	pthread_mutex_unlock (&rcode_mutex);
 
-	for (i = 0; i < len; i++)
+	return (0);
+} /* int dns_read */
+
+static int dns_shutdown (void)
+{
+	int i;
+
+	if (listen_threads == NULL)
+		return (0);
+
+	listen_shutdown = 1;
+
+	pthread_mutex_lock (&listen_pcap_lock);
+	if (listen_pcap_obj != NULL)
+		pcap_breakloop (listen_pcap_obj);
+	pthread_mutex_unlock (&listen_pcap_lock);
+
+#if DNS_HAVE_TPACKET
+	/* The TPACKET threads check the shutdown flag at least once per
+	 * second. pcap_loop() may not return before the next packet arrives,
+	 * so the pcap thread is not waited for. */
+	if ((capture_backend == BACKEND_TPACKET) && (pcap_file == NULL))
 	{
-		DEBUG ("dns plugin: rcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_rcode", rcode_str (keys[i]), values[i]);
+		for (i = 0; i < listen_threads_num; i++)
+			pthread_join (listen_threads[i], /* retval = */ NULL);
+
+		for (i = 0; i < counters_num; i++)
+			counters_destroy (counters + i);
+		sfree (counters);
+		counters_num = 0;
 	}
+#endif
+
+	counters_destroy (&counters_sum);
+	sfree (listen_threads);
+	listen_threads_num = 0;
 
 	return (0);
-} /* int dns_read */
+} /* int dns_shutdown */
 
 void module_register (void)
 {
 	plugin_register_config ("dns", dns_config, config_keys, config_keys_num);
 	plugin_register_init ("dns", dns_init);
 	plugin_register_read ("dns", dns_read);
+	plugin_register_shutdown ("dns", dns_shutdown);
 } /* void module_register */
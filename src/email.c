@@ -39,6 +39,8 @@
 
 #include "configfile.h"
 
+#include "utils_htable.h"
+
 #include <stddef.h>
 
 #if HAVE_LIBPTHREAD
@@ -49,6 +51,12 @@
 #include <sys/un.h>
 #include <sys/select.h>
 
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
+
 /* some systems (e.g. Darwin) seem to not define UNIX_PATH_MAX at all */
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
@@ -59,9 +67,15 @@
 #endif /* HAVE_GRP_H */
 
 #define SOCK_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-email"
-#define MAX_CONNS 5
+#define MAX_CONNS 64
 #define MAX_CONNS_LIMIT 16384
 
+/* 256 bytes ought to be enough for anybody ;-) */
+#define MAX_LINE_LEN 256
+
+/* maximum number of events returned by one call to epoll_wait() */
+#define MAX_EVENTS 64
+
 #define log_debug(...) DEBUG ("email: "__VA_ARGS__)
 #define log_err(...) ERROR ("email: "__VA_ARGS__)
 #define log_warn(...) WARNING ("email: "__VA_ARGS__)
@@ -69,40 +83,33 @@
 /*
  * Private data structures
  */
-/* linked list of email and check types */
+/* counter of an email or check type, stored in a hash table by name */
 typedef struct type {
-	char        *name;
-	int         value;
-	struct type *next;
+	char *name;
+	int  value;
 } type_t;
 
+/* copy of a counter, used to submit the values without holding the lock */
 typedef struct {
-	type_t *head;
-	type_t *tail;
-} type_list_t;
+	const char *name;
+	int        value;
+} type_copy_t;
 
-/* collector thread control information */
-typedef struct collector {
-	pthread_t thread;
+/* client connection */
+typedef struct conn {
+	int fd;
 
-	/* socket descriptor of the current/last connection */
-	FILE *socket;
-} collector_t;
+	/* position in `conns' */
+	int index;
 
-/* linked list of pending connections */
-typedef struct conn {
-	/* socket to read data from */
-	FILE *socket;
+	/* data of the current line read so far */
+	char   buffer[MAX_LINE_LEN];
+	size_t fill;
 
-	/* linked list of connections */
-	struct conn *next;
+	/* the current line is too long and is skipped up to the next newline */
+	int discard;
 } conn_t;
 
-typedef struct {
-	conn_t *head;
-	conn_t *tail;
-} conn_list_t;
-
 /*
  * Private variables
  */
@@ -125,42 +132,36 @@ static int  max_conns   = MAX_CONNS;
 /* state of the plugin */
 static int disabled = 0;
 
-/* thread managing "client" connections */
+/* thread accepting and reading "client" connections */
 static pthread_t connector = (pthread_t) 0;
 static int connector_socket = -1;
+/* only used by the connector thread once it has been started */
+static int loop = 0;
 
-/* tell the collector threads that a new connection is available */
-static pthread_cond_t conn_available = PTHREAD_COND_INITIALIZER;
+/* writing to this pipe makes the connector thread shut down */
+static int wake_pipe[2] = { -1, -1 };
 
-/* connections that are waiting to be processed */
-static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
-static conn_list_t conns;
+/* open connections, only used by the connector thread */
+static conn_t **conns = NULL;
+static int conns_num = 0;
 
-/* tell the connector thread that a collector is available */
-static pthread_cond_t collector_available = PTHREAD_COND_INITIALIZER;
+/* set if the connector socket is watched for new connections */
+static int listening = 0;
 
-/* collector threads */
-static collector_t **collectors = NULL;
-
-static pthread_mutex_t available_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int available_collectors;
-
-static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_count;
-static type_list_t list_count_copy;
-
-static pthread_mutex_t size_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_size;
-static type_list_t list_size_copy;
+#if HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#else
+static struct pollfd *poll_fds = NULL;
+#endif
 
-static pthread_mutex_t score_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* counters, updated by the connector thread and reset by email_read () */
+static pthread_mutex_t counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+static c_htable_t *table_count = NULL;
+static c_htable_t *table_size = NULL;
+static c_htable_t *table_check = NULL;
 static double score;
 static int score_count;
 
-static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_check;
-static type_list_t list_check_copy;
-
 /*
  * Private functions
  */
@@ -211,173 +212,442 @@ static int email_config (const char *key, const char *value)
 	return 0;
 } /* static int email_config (char *, char *) */
 
-/* Increment the value of the given name in the given list by incr. */
-static void type_list_incr (type_list_t *list, char *name, int incr)
+static int type_compare (const void *a, const void *b)
 {
-	if (NULL == list->head) {
-		list->head = (type_t *)smalloc (sizeof (type_t));
+	return strcmp ((const char *) a, (const char *) b);
+} /* static int type_compare (const void *, const void *) */
 
-		list->head->name  = sstrdup (name);
-		list->head->value = incr;
-		list->head->next  = NULL;
+/* Increment the value of the given name in the given table by incr. Must be
+ * called with counters_mutex held. */
+static void type_incr (c_htable_t *table, const char *name, int incr)
+{
+	type_t *type = NULL;
 
-		list->tail = list->head;
-	}
-	else {
-		type_t *ptr;
+	if (0 != c_htable_get (table, name, (void *)&type)) {
+		type = (type_t *)smalloc (sizeof (type_t));
 
-		for (ptr = list->head; NULL != ptr; ptr = ptr->next) {
-			if (0 == strcmp (name, ptr->name))
-				break;
+		type->name  = sstrdup (name);
+		type->value = 0;
+
+		if (0 != c_htable_insert (table, type->name, type)) {
+			log_err ("type_incr: c_htable_insert failed");
+			free (type->name);
+			free (type);
+			return;
 		}
+	}
+
+	type->value += incr;
+	return;
+} /* static void type_incr (c_htable_t *, const char *, int) */
+
+/* Free all counters of the given table and the table itself. */
+static void type_table_free (c_htable_t *table)
+{
+	void *key;
+	void *value;
+
+	if (NULL == table)
+		return;
 
-		if (NULL == ptr) {
-			list->tail->next = (type_t *)smalloc (sizeof (type_t));
-			list->tail = list->tail->next;
+	while (0 == c_htable_pick (table, &key, &value)) {
+		type_t *type = (type_t *)value;
 
-			list->tail->name  = sstrdup (name);
-			list->tail->value = incr;
-			list->tail->next  = NULL;
+		free (type->name);
+		free (type);
+	}
+	c_htable_destroy (table);
+} /* static void type_table_free (c_htable_t *) */
+
+/* Handle one line of the protocol. Must be called with counters_mutex
+ * held. */
+static void handle_line (char *line)
+{
+	log_debug ("collect: line = '%s'", line);
+
+	if (('\0' == line[0]) || (':' != line[1])) {
+		log_err ("collect: syntax error in line '%s'", line);
+		return;
+	}
+
+	if ('e' == line[0]) { /* e:<type>:<bytes> */
+		char *ptr  = NULL;
+		char *type = strtok_r (line + 2, ":", &ptr);
+		char *tmp  = strtok_r (NULL, ":", &ptr);
+		int  bytes = 0;
+
+		if (NULL == tmp) {
+			log_err ("collect: syntax error in line '%s'", line);
+			return;
 		}
-		else {
-			ptr->value += incr;
+
+		bytes = atoi (tmp);
+
+		type_incr (table_count, type, 1);
+
+		if (bytes > 0)
+			type_incr (table_size, type, bytes);
+	}
+	else if ('s' == line[0]) { /* s:<value> */
+		score = (score * (double)score_count + atof (line + 2))
+				/ (double)(score_count + 1);
+		++score_count;
+	}
+	else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
+		char *ptr  = NULL;
+		char *type = strtok_r (line + 2, ",", &ptr);
+
+		if (NULL == type) {
+			log_err ("collect: syntax error in line '%s'", line);
+			return;
 		}
+
+		do {
+			type_incr (table_check, type, 1);
+		} while (NULL != (type = strtok_r (NULL, ",", &ptr)));
+	}
+	else {
+		log_err ("collect: unknown type '%c'", line[0]);
 	}
 	return;
-} /* static void type_list_incr (type_list_t *, char *) */
+} /* static void handle_line (char *) */
 
-static void *collect (void *arg)
+/* Start or stop watching the connector socket for new connections. */
+static int set_listening (int enable)
 {
-	collector_t *this = (collector_t *)arg;
+	if (enable == listening)
+		return (0);
 
-	while (1) {
-		int loop = 1;
+#if HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event ev;
+
+		memset (&ev, 0, sizeof (ev));
+		ev.events   = EPOLLIN;
+		ev.data.ptr = NULL;
 
+		errno = 0;
+		if (0 != epoll_ctl (epoll_fd, enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+					connector_socket, &ev)) {
+			char errbuf[1024];
+			log_err ("epoll_ctl() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+#endif /* HAVE_SYS_EPOLL_H */
+
+	listening = enable;
+	return (0);
+} /* static int set_listening (int) */
+
+static void close_connection (conn_t *connection)
+{
+	log_debug ("Shutting down connection on fd #%i", connection->fd);
+
+#if HAVE_SYS_EPOLL_H
+	/* closing the descriptor is not enough if it has been inherited by a
+	 * child process, e.g. one started by the exec plugin */
+	epoll_ctl (epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+#endif
+	close (connection->fd);
+
+	--conns_num;
+	conns[connection->index] = conns[conns_num];
+	conns[connection->index]->index = connection->index;
+	conns[conns_num] = NULL;
+
+	free (connection);
+
+	if (conns_num < max_conns)
+		set_listening (1);
+	return;
+} /* static void close_connection (conn_t *) */
+
+/* Accept new connections until there are no more pending ones or max_conns
+ * is reached. Returns -1 if the connector socket is unusable. */
+static int accept_connections (void)
+{
+	while (conns_num < max_conns) {
 		conn_t *connection;
+		int remote;
 
-		pthread_mutex_lock (&conns_mutex);
+		errno = 0;
+		if (-1 == (remote = accept (connector_socket, NULL, NULL))) {
+			char errbuf[1024];
+
+			if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+				return (0);
+			if ((EINTR == errno) || (ECONNABORTED == errno))
+				continue;
 
-		while (NULL == conns.head) {
-			pthread_cond_wait (&conn_available, &conns_mutex);
+			log_err ("accept() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
 
-		connection = conns.head;
-		conns.head = conns.head->next;
+		fcntl (remote, F_SETFL, fcntl (remote, F_GETFL) | O_NONBLOCK);
 
-		if (NULL == conns.head) {
-			conns.tail = NULL;
+		connection = (conn_t *)smalloc (sizeof (conn_t));
+		memset (connection, 0, sizeof (*connection));
+
+		connection->fd    = remote;
+		connection->index = conns_num;
+
+#if HAVE_SYS_EPOLL_H
+		{
+			struct epoll_event ev;
+
+			memset (&ev, 0, sizeof (ev));
+			ev.events   = EPOLLIN;
+			ev.data.ptr = connection;
+
+			errno = 0;
+			if (0 != epoll_ctl (epoll_fd, EPOLL_CTL_ADD, remote, &ev)) {
+				char errbuf[1024];
+				log_err ("epoll_ctl() failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+				close (remote);
+				free (connection);
+				continue;
+			}
 		}
+#endif /* HAVE_SYS_EPOLL_H */
 
-		pthread_mutex_unlock (&conns_mutex);
+		conns[conns_num] = connection;
+		++conns_num;
 
-		/* make the socket available to the global
-		 * thread and connection management */
-		this->socket = connection->socket;
+		log_debug ("collect: handling connection on fd #%i", remote);
+	}
 
-		log_debug ("collect: handling connection on fd #%i",
-				fileno (this->socket));
+	/* leave further connections in the socket's backlog */
+	set_listening (0);
+	return (0);
+} /* static int accept_connections (void) */
 
-		while (loop) {
-			/* 256 bytes ought to be enough for anybody ;-) */
-			char line[256 + 1]; /* line + '\0' */
-			int  len = 0;
+/* Read the available data from a connection and handle all complete lines.
+ * The connection is closed on EOF or error. */
+static void read_connection (conn_t *connection)
+{
+	while (1) {
+		ssize_t len;
+		char    *line;
+		char    *end;
+
+		errno = 0;
+		len = read (connection->fd, connection->buffer + connection->fill,
+				sizeof (connection->buffer) - connection->fill);
+		if (len < 0) {
+			char errbuf[1024];
 
-			errno = 0;
-			if (NULL == fgets (line, sizeof (line), this->socket)) {
-				loop = 0;
+			if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+				return;
+			if (EINTR == errno)
+				continue;
 
-				if (0 != errno) {
-					char errbuf[1024];
-					log_err ("collect: reading from socket (fd #%i) "
-							"failed: %s", fileno (this->socket),
-							sstrerror (errno, errbuf, sizeof (errbuf)));
-				}
-				break;
-			}
+			log_err ("collect: reading from socket (fd #%i) "
+					"failed: %s", connection->fd,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close_connection (connection);
+			return;
+		}
+		else if (0 == len) {
+			close_connection (connection);
+			return;
+		}
+
+		connection->fill += (size_t)len;
 
-			len = strlen (line);
-			if (('\n' != line[len - 1]) && ('\r' != line[len - 1])) {
+		line = connection->buffer;
+
+		pthread_mutex_lock (&counters_mutex);
+		while (NULL != (end = memchr (line, '\n',
+						connection->fill - (line - connection->buffer)))) {
+			*end = '\0';
+
+			if (connection->discard)
+				connection->discard = 0;
+			else
+				handle_line (line);
+
+			line = end + 1;
+		}
+		pthread_mutex_unlock (&counters_mutex);
+
+		connection->fill -= (size_t)(line - connection->buffer);
+		if (line != connection->buffer)
+			memmove (connection->buffer, line, connection->fill);
+
+		if (connection->fill >= sizeof (connection->buffer)) {
+			if (! connection->discard)
 				log_warn ("collect: line too long (> %zu characters): "
-						"'%s' (truncated)", sizeof (line) - 1, line);
+						"'%.*s' (truncated)", sizeof (connection->buffer) - 1,
+						(int)sizeof (connection->buffer), connection->buffer);
 
-				while (NULL != fgets (line, sizeof (line), this->socket))
-					if (('\n' == line[len - 1]) || ('\r' == line[len - 1]))
-						break;
-				continue;
-			}
+			connection->discard = 1;
+			connection->fill    = 0;
+		}
+	}
+	return;
+} /* static void read_connection (conn_t *) */
 
-			line[len - 1] = '\0';
+static void drain_wake_pipe (void)
+{
+	char buffer[64];
 
-			log_debug ("collect: line = '%s'", line);
+	while (read (wake_pipe[0], buffer, sizeof (buffer)) > 0)
+		/* do nothing */;
+	loop = 0;
+} /* static void drain_wake_pipe (void) */
 
-			if (':' != line[1]) {
-				log_err ("collect: syntax error in line '%s'", line);
-				continue;
-			}
+/* Wait for events and store the connections which are ready in `ready', NULL
+ * standing for the connector socket. Returns the number of entries or -1 on
+ * error. Wake-ups through `wake_pipe' clear `loop' and are not returned. */
+static int wait_events (conn_t **ready)
+{
+	int num = 0;
+	int status;
+	int i;
 
-			if ('e' == line[0]) { /* e:<type>:<bytes> */
-				char *ptr  = NULL;
-				char *type = strtok_r (line + 2, ":", &ptr);
-				char *tmp  = strtok_r (NULL, ":", &ptr);
-				int  bytes = 0;
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event events[MAX_EVENTS];
 
-				if (NULL == tmp) {
-					log_err ("collect: syntax error in line '%s'", line);
-					continue;
-				}
+	status = epoll_wait (epoll_fd, events, MAX_EVENTS, -1);
+	if (status < 0)
+		return (-1);
 
-				bytes = atoi (tmp);
+	for (i = 0; i < status; ++i) {
+		if (events[i].data.ptr == (void *)wake_pipe) {
+			drain_wake_pipe ();
+			continue;
+		}
+		ready[num++] = (conn_t *)events[i].data.ptr;
+	}
+#else /* !HAVE_SYS_EPOLL_H */
+	poll_fds[0].fd      = connector_socket;
+	poll_fds[0].events  = listening ? POLLIN : 0;
+	poll_fds[0].revents = 0;
+
+	poll_fds[1].fd      = wake_pipe[0];
+	poll_fds[1].events  = POLLIN;
+	poll_fds[1].revents = 0;
+
+	for (i = 0; i < conns_num; ++i) {
+		poll_fds[i + 2].fd      = conns[i]->fd;
+		poll_fds[i + 2].events  = POLLIN;
+		poll_fds[i + 2].revents = 0;
+	}
 
-				pthread_mutex_lock (&count_mutex);
-				type_list_incr (&list_count, type, 1);
-				pthread_mutex_unlock (&count_mutex);
+	status = poll (poll_fds, conns_num + 2, -1);
+	if (status < 0)
+		return (-1);
 
-				if (bytes > 0) {
-					pthread_mutex_lock (&size_mutex);
-					type_list_incr (&list_size, type, bytes);
-					pthread_mutex_unlock (&size_mutex);
-				}
-			}
-			else if ('s' == line[0]) { /* s:<value> */
-				pthread_mutex_lock (&score_mutex);
-				score = (score * (double)score_count + atof (line + 2))
-						/ (double)(score_count + 1);
-				++score_count;
-				pthread_mutex_unlock (&score_mutex);
-			}
-			else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
-				char *ptr  = NULL;
-				char *type = strtok_r (line + 2, ",", &ptr);
-
-				do {
-					pthread_mutex_lock (&check_mutex);
-					type_list_incr (&list_check, type, 1);
-					pthread_mutex_unlock (&check_mutex);
-				} while (NULL != (type = strtok_r (NULL, ",", &ptr)));
-			}
-			else {
-				log_err ("collect: unknown type '%c'", line[0]);
-			}
-		} /* while (loop) */
+	if (0 != poll_fds[1].revents)
+		drain_wake_pipe ();
+
+	for (i = 0; i < conns_num + 2; ++i) {
+		if ((0 == poll_fds[i].revents) || (1 == i))
+			continue;
+		ready[num++] = (0 == i) ? NULL : conns[i - 2];
+	}
+#endif /* HAVE_SYS_EPOLL_H */
 
-		log_debug ("Shutting down connection on fd #%i",
-				fileno (this->socket));
+	return (num);
+} /* static int wait_events (conn_t **) */
 
-		fclose (connection->socket);
-		free (connection);
+/* Handle the connector socket and all client connections in this thread. */
+static int collect (void)
+{
+	conn_t **ready;
+
+	conns = (conn_t **)smalloc (max_conns * sizeof (conn_t *));
+	ready = (conn_t **)smalloc ((max_conns + 1) * sizeof (conn_t *));
+	conns_num = 0;
 
-		this->socket = NULL;
+#if HAVE_SYS_EPOLL_H
+	errno = 0;
+	if (-1 == (epoll_fd = epoll_create (MAX_EVENTS))) {
+		char errbuf[1024];
+		log_err ("epoll_create() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (conns);
+		sfree (ready);
+		return (-1);
+	}
 
-		pthread_mutex_lock (&available_mutex);
-		++available_collectors;
-		pthread_mutex_unlock (&available_mutex);
+	{
+		struct epoll_event ev;
 
-		pthread_cond_signal (&collector_available);
-	} /* while (1) */
+		memset (&ev, 0, sizeof (ev));
+		ev.events   = EPOLLIN;
+		ev.data.ptr = (void *)wake_pipe;
 
-	pthread_exit ((void *)0);
-	return ((void *) 0);
-} /* static void *collect (void *) */
+		errno = 0;
+		if (0 != epoll_ctl (epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev)) {
+			char errbuf[1024];
+			log_err ("epoll_ctl() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (epoll_fd);
+			epoll_fd = -1;
+			sfree (conns);
+			sfree (ready);
+			return (-1);
+		}
+	}
+#else
+	poll_fds = (struct pollfd *)smalloc ((max_conns + 2)
+			* sizeof (struct pollfd));
+#endif
+
+	fcntl (connector_socket, F_SETFL,
+			fcntl (connector_socket, F_GETFL) | O_NONBLOCK);
+
+	listening = 0;
+	if (0 != set_listening (1))
+		loop = 0;
+
+	while (loop) {
+		int num;
+		int i;
+
+		errno = 0;
+		if (-1 == (num = wait_events (ready))) {
+			char errbuf[1024];
+
+			if (EINTR == errno)
+				continue;
+
+			log_err ("waiting for events failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		for (i = 0; i < num; ++i) {
+			if (NULL != ready[i]) {
+				read_connection (ready[i]);
+				continue;
+			}
+
+			if (0 != accept_connections ()) {
+				loop = 0;
+				break;
+			}
+		}
+	} /* while (loop) */
+
+	while (conns_num > 0)
+		close_connection (conns[0]);
+
+#if HAVE_SYS_EPOLL_H
+	close (epoll_fd);
+	epoll_fd = -1;
+#else
+	sfree (poll_fds);
+#endif
+	sfree (conns);
+	sfree (ready);
+	return (0);
+} /* static int collect (void) */
 
 static void *open_connection (void __attribute__((unused)) *arg)
 {
@@ -412,8 +682,9 @@ static void *open_connection (void __attribute__((unused)) *arg)
 		pthread_exit ((void *)1);
 	}
 
+	/* many short-lived connections may arrive at once */
 	errno = 0;
-	if (-1 == listen (connector_socket, 5)) {
+	if (-1 == listen (connector_socket, SOMAXCONN)) {
 		char errbuf[1024];
 		disabled = 1;
 		close (connector_socket);
@@ -461,93 +732,9 @@ static void *open_connection (void __attribute__((unused)) *arg)
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 	}
 
-	{ /* initialize collector threads */
-		int i   = 0;
-		int err = 0;
-
-		pthread_attr_t ptattr;
-
-		conns.head = NULL;
-		conns.tail = NULL;
-
-		pthread_attr_init (&ptattr);
-		pthread_attr_setdetachstate (&ptattr, PTHREAD_CREATE_DETACHED);
-
-		available_collectors = max_conns;
-
-		collectors =
-			(collector_t **)smalloc (max_conns * sizeof (collector_t *));
-
-		for (i = 0; i < max_conns; ++i) {
-			collectors[i] = (collector_t *)smalloc (sizeof (collector_t));
-			collectors[i]->socket = NULL;
-
-			if (0 != (err = plugin_thread_create (&collectors[i]->thread,
-							&ptattr, collect, collectors[i]))) {
-				char errbuf[1024];
-				log_err ("pthread_create() failed: %s",
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				collectors[i]->thread = (pthread_t) 0;
-			}
-		}
-
-		pthread_attr_destroy (&ptattr);
-	}
-
-	while (1) {
-		int remote = 0;
-
-		conn_t *connection;
-
-		pthread_mutex_lock (&available_mutex);
-
-		while (0 == available_collectors) {
-			pthread_cond_wait (&collector_available, &available_mutex);
-		}
-
-		--available_collectors;
-
-		pthread_mutex_unlock (&available_mutex);
-
-		do {
-			errno = 0;
-			if (-1 == (remote = accept (connector_socket, NULL, NULL))) {
-				if (EINTR != errno) {
-					char errbuf[1024];
-					disabled = 1;
-					close (connector_socket);
-					connector_socket = -1;
-					log_err ("accept() failed: %s",
-							sstrerror (errno, errbuf, sizeof (errbuf)));
-					pthread_exit ((void *)1);
-				}
-			}
-		} while (EINTR == errno);
-
-		connection = (conn_t *)smalloc (sizeof (conn_t));
-
-		connection->socket = fdopen (remote, "r");
-		connection->next   = NULL;
-
-		if (NULL == connection->socket) {
-			close (remote);
-			continue;
-		}
-
-		pthread_mutex_lock (&conns_mutex);
-
-		if (NULL == conns.head) {
-			conns.head = connection;
-			conns.tail = connection;
-		}
-		else {
-			conns.tail->next = connection;
-			conns.tail = conns.tail->next;
-		}
-
-		pthread_mutex_unlock (&conns_mutex);
-
-		pthread_cond_signal (&conn_available);
+	if (0 != collect ()) {
+		disabled = 1;
+		pthread_exit ((void *)1);
 	}
 
 	pthread_exit ((void *) 0);
@@ -558,10 +745,36 @@ static int email_init (void)
 {
 	int err = 0;
 
+	table_count = c_htable_create (c_htable_hash_string, type_compare);
+	table_size  = c_htable_create (c_htable_hash_string, type_compare);
+	table_check = c_htable_create (c_htable_hash_string, type_compare);
+
+	if ((NULL == table_count) || (NULL == table_size)
+			|| (NULL == table_check)) {
+		disabled = 1;
+		log_err ("c_htable_create() failed");
+		return (-1);
+	}
+
+	errno = 0;
+	if (0 != pipe (wake_pipe)) {
+		char errbuf[1024];
+		disabled = 1;
+		log_err ("pipe() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wake_pipe[0], F_SETFL, fcntl (wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wake_pipe[1], F_SETFL, fcntl (wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	loop = 1;
+
 	if (0 != (err = plugin_thread_create (&connector, NULL,
 				open_connection, NULL))) {
 		char errbuf[1024];
 		disabled = 1;
+		loop = 0;
+		connector = (pthread_t) 0;
 		log_err ("pthread_create() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
@@ -572,76 +785,41 @@ static int email_init (void)
 
 static int email_shutdown (void)
 {
-	type_t *ptr = NULL;
-
-	int i = 0;
+	int i;
 
 	if (connector != ((pthread_t) 0)) {
-		pthread_kill (connector, SIGTERM);
+		char c = 0;
+
+		/* if the pipe is full, the thread is woken up anyway */
+		if (write (wake_pipe[1], &c, sizeof (c)) < 0)
+			log_debug ("writing to the wake-up pipe failed");
+		pthread_join (connector, NULL);
 		connector = (pthread_t) 0;
 	}
 
+	for (i = 0; i < 2; ++i) {
+		if (wake_pipe[i] >= 0)
+			close (wake_pipe[i]);
+		wake_pipe[i] = -1;
+	}
+
 	if (connector_socket >= 0) {
 		close (connector_socket);
 		connector_socket = -1;
 	}
 
-	/* don't allow any more connections to be processed */
-	pthread_mutex_lock (&conns_mutex);
+	pthread_mutex_lock (&counters_mutex);
 
-	available_collectors = 0;
+	type_table_free (table_count);
+	table_count = NULL;
 
-	if (collectors != NULL) {
-		for (i = 0; i < max_conns; ++i) {
-			if (collectors[i] == NULL)
-				continue;
-
-			if (collectors[i]->thread != ((pthread_t) 0)) {
-				pthread_kill (collectors[i]->thread, SIGTERM);
-				collectors[i]->thread = (pthread_t) 0;
-			}
-
-			if (collectors[i]->socket != NULL) {
-				fclose (collectors[i]->socket);
-				collectors[i]->socket = NULL;
-			}
-
-			sfree (collectors[i]);
-		}
-		sfree (collectors);
-	} /* if (collectors != NULL) */
-
-	pthread_mutex_unlock (&conns_mutex);
+	type_table_free (table_size);
+	table_size = NULL;
 
-	for (ptr = list_count.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_count_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_size.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_size_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
+	type_table_free (table_check);
+	table_check = NULL;
 
-	for (ptr = list_check.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_check_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
+	pthread_mutex_unlock (&counters_mutex);
 
 	unlink ((NULL == sock_file) ? SOCK_PATH : sock_file);
 
@@ -667,47 +845,59 @@ static void email_submit (const char *type, const char *type_instance, gauge_t v
 	plugin_dispatch_values (&vl);
 } /* void email_submit */
 
-/* Copy list l1 to list l2. l2 may partly exist already, but it is assumed
- * that neither the order nor the name of any element of either list is
- * changed and no elements are deleted. The values of l1 are reset to zero
- * after they have been copied to l2. */
-static void copy_type_list (type_list_t *l1, type_list_t *l2)
+/* Copy the values of the given table to a newly allocated array and reset
+ * them to zero. Must be called with counters_mutex held. */
+static type_copy_t *copy_type_table (c_htable_t *table, int *ret_num)
 {
-	type_t *ptr1;
-	type_t *ptr2;
+	c_htable_iterator_t *iter;
+	type_copy_t *copy;
+	void *key;
+	void *value;
+	int num = 0;
 
-	type_t *last = NULL;
+	*ret_num = 0;
 
-	for (ptr1 = l1->head, ptr2 = l2->head; NULL != ptr1;
-			ptr1 = ptr1->next, last = ptr2, ptr2 = ptr2->next) {
-		if (NULL == ptr2) {
-			ptr2 = (type_t *)smalloc (sizeof (type_t));
-			ptr2->name = NULL;
-			ptr2->next = NULL;
-
-			if (NULL == last) {
-				l2->head = ptr2;
-			}
-			else {
-				last->next = ptr2;
-			}
+	if (0 == c_htable_size (table))
+		return (NULL);
 
-			l2->tail = ptr2;
-		}
+	copy = (type_copy_t *)smalloc (c_htable_size (table)
+			* sizeof (type_copy_t));
 
-		if (NULL == ptr2->name) {
-			ptr2->name = sstrdup (ptr1->name);
-		}
+	iter = c_htable_get_iterator (table);
+	while (0 == c_htable_iterator_next (iter, &key, &value)) {
+		type_t *type = (type_t *)value;
 
-		ptr2->value = ptr1->value;
-		ptr1->value = 0;
+		/* names are not freed before the plugin is shut down */
+		copy[num].name  = type->name;
+		copy[num].value = type->value;
+		type->value = 0;
+		++num;
 	}
+	c_htable_iterator_destroy (iter);
+
+	*ret_num = num;
+	return (copy);
+} /* static type_copy_t *copy_type_table (c_htable_t *, int *) */
+
+static void submit_type_copy (const char *type, type_copy_t *copy, int num)
+{
+	int i;
+
+	for (i = 0; i < num; ++i)
+		email_submit (type, copy[i].name, copy[i].value);
+
+	sfree (copy);
 	return;
-}
+} /* static void submit_type_copy (const char *, type_copy_t *, int) */
 
 static int email_read (void)
 {
-	type_t *ptr;
+	type_copy_t *count_copy;
+	type_copy_t *size_copy;
+	type_copy_t *check_copy;
+	int count_num;
+	int size_num;
+	int check_num;
 
 	double score_old;
 	int score_count_old;
@@ -715,50 +905,31 @@ static int email_read (void)
 	if (disabled)
 		return (-1);
 
-	/* email count */
-	pthread_mutex_lock (&count_mutex);
-
-	copy_type_list (&list_count, &list_count_copy);
-
-	pthread_mutex_unlock (&count_mutex);
-
-	for (ptr = list_count_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_count", ptr->name, ptr->value);
-	}
-
-	/* email size */
-	pthread_mutex_lock (&size_mutex);
-
-	copy_type_list (&list_size, &list_size_copy);
+	pthread_mutex_lock (&counters_mutex);
 
-	pthread_mutex_unlock (&size_mutex);
-
-	for (ptr = list_size_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_size", ptr->name, ptr->value);
-	}
-
-	/* spam score */
-	pthread_mutex_lock (&score_mutex);
+	count_copy = copy_type_table (table_count, &count_num);
+	size_copy  = copy_type_table (table_size, &size_num);
+	check_copy = copy_type_table (table_check, &check_num);
 
 	score_old = score;
 	score_count_old = score_count;
 	score = 0.0;
 	score_count = 0;
 
-	pthread_mutex_unlock (&score_mutex);
+	pthread_mutex_unlock (&counters_mutex);
 
+	/* email count */
+	submit_type_copy ("email_count", count_copy, count_num);
+
+	/* email size */
+	submit_type_copy ("email_size", size_copy, size_num);
+
+	/* spam score */
 	if (score_count_old > 0)
 		email_submit ("spam_score", "", score_old);
 
 	/* spam checks */
-	pthread_mutex_lock (&check_mutex);
-
-	copy_type_list (&list_check, &list_check_copy);
-
-	pthread_mutex_unlock (&check_mutex);
-
-	for (ptr = list_check_copy.head; NULL != ptr; ptr = ptr->next)
-		email_submit ("spam_check", ptr->name, ptr->value);
+	submit_type_copy ("spam_check", check_copy, check_num);
 
 	return (0);
 } /* int email_read */
@@ -31,11 +31,13 @@
 
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
+#include "utils_parse_option.h"
 
 #include <sys/types.h>
 #include <pwd.h>
 #include <grp.h>
 #include <signal.h>
+#include <poll.h>
 
 #include <pthread.h>
 
@@ -43,17 +45,39 @@
 #define PL_NOTIF_ACTION  0x02
 
 #define PL_RUNNING       0x10
+#define PL_EXITING       0x20
+
+/* Output of the children is read into buffers which start out with
+ * EXEC_BUFFER_INITIAL_SIZE bytes and grow as needed to hold lines up to
+ * EXEC_BUFFER_MAX_SIZE bytes. */
+#define EXEC_BUFFER_INITIAL_SIZE 4096
+#define EXEC_BUFFER_MAX_SIZE     (1024 * 1024)
 
 /*
  * Private data types
  */
+struct exec_buffer_s
+{
+  char   *data;
+  size_t  size;
+  size_t  fill;
+  /* Set while the rest of an overlong line is being discarded. */
+  _Bool   skip_line;
+};
+typedef struct exec_buffer_s exec_buffer_t;
+
 /*
  * Access to this structure is serialized using the `pl_lock' lock and the
  * `PL_RUNNING' flag. The execution of notifications is *not* serialized, so
  * all functions used to handle notifications MUST NOT write to this structure.
  * The `pid' and `status' fields are thus unused if the `PL_NOTIF_ACTION' flag
  * is set.
- * The `PL_RUNNING' flag is set in `exec_read' and unset in `exec_read_one'.
+ * The `PL_RUNNING' flag is set in `exec_read' and unset once the program has
+ * closed its STDOUT and STDERR and has been reaped. If it is still running at
+ * that point, the reader thread sets `PL_EXITING' and `exec_read' reaps it
+ * later, so the reader thread never blocks in `waitpid'.
+ * The `fd_out', `fd_err', `buffer_out', `buffer_err' and `ds' fields are only
+ * used by the reader thread while `PL_RUNNING' is set.
  */
 struct program_list_s;
 typedef struct program_list_s program_list_t;
@@ -66,6 +90,18 @@ struct program_list_s
   int             pid;
   int             status;
   int             flags;
+
+  int             fd_out;
+  int             fd_err;
+  exec_buffer_t   buffer_out;
+  exec_buffer_t   buffer_err;
+
+  /* Data set of the most recent PUTVAL line and a buffer for its values.
+   * Programs usually print many values of the same type in a row. */
+  const data_set_t *ds;
+  value_t        *values;
+  size_t          values_size;
+
   program_list_t *next;
 };
 
@@ -81,6 +117,13 @@ typedef struct program_list_and_notification_s
 static program_list_t *pl_head = NULL;
 static pthread_mutex_t pl_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* A single thread reads the output of all running programs. `reader_pipe' is
+ * used to wake it up when a program has been started or when shutting down. */
+static pthread_t reader_thread;
+static _Bool     reader_thread_running = 0;
+static _Bool     reader_shutdown = 0;
+static int       reader_pipe[2] = { -1, -1 };
+
 /*
  * Functions
  */
@@ -132,6 +175,8 @@ static int exec_config_exec (oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
   memset (pl, '\0', sizeof (program_list_t));
+  pl->fd_out = -1;
+  pl->fd_err = -1;
 
   if (strcasecmp ("NotificationExec", ci->key) == 0)
     pl->flags |= PL_NOTIF_ACTION;
@@ -531,10 +576,157 @@ static int fork_child (program_list_t *pl, int *fd_in, int *fd_out, int *fd_err)
   return (pid);
 } /* int fork_child }}} */
 
-static int parse_line (char *buffer) /* {{{ */
+/* Fast path for PUTVAL lines: Unlike `handle_putval' this doesn't allocate
+ * memory, doesn't print a status line for each command and only looks up the
+ * data set if the type differs from the previous line's. */
+static int exec_putval (program_list_t *pl, char *buffer) /* {{{ */
+{
+  char *command;
+  char *identifier;
+  char *hostname;
+  char *plugin;
+  char *plugin_instance;
+  char *type;
+  char *type_instance;
+  char identifier_copy[6 * DATA_MAX_NAME_LEN];
+  value_list_t vl = VALUE_LIST_INIT;
+  int status;
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if ((status != 0) || (strcasecmp ("PUTVAL", command) != 0))
+  {
+    ERROR ("exec plugin: Cannot parse command from `%s'.", pl->exec);
+    return (-1);
+  }
+
+  identifier = NULL;
+  status = parse_string (&buffer, &identifier);
+  if (status != 0)
+  {
+    ERROR ("exec plugin: Cannot parse identifier from `%s'.", pl->exec);
+    return (-1);
+  }
+
+  /* parse_identifier() modifies its first argument, so work on a copy to
+   * be able to print the identifier in error messages. */
+  if (strlen (identifier) >= sizeof (identifier_copy))
+  {
+    ERROR ("exec plugin: Identifier too long: %s", identifier);
+    return (-1);
+  }
+  sstrncpy (identifier_copy, identifier, sizeof (identifier_copy));
+
+  status = parse_identifier (identifier_copy, &hostname,
+      &plugin, &plugin_instance, &type, &type_instance);
+  if (status != 0)
+  {
+    ERROR ("exec plugin: Cannot parse identifier `%s'.", identifier);
+    return (-1);
+  }
+
+  if ((strlen (hostname) >= sizeof (vl.host))
+      || (strlen (plugin) >= sizeof (vl.plugin))
+      || ((plugin_instance != NULL)
+        && (strlen (plugin_instance) >= sizeof (vl.plugin_instance)))
+      || ((type_instance != NULL)
+        && (strlen (type_instance) >= sizeof (vl.type_instance))))
+  {
+    ERROR ("exec plugin: Identifier too long: %s", identifier);
+    return (-1);
+  }
+
+  if ((pl->ds == NULL) || (strcmp (pl->ds->type, type) != 0))
+  {
+    pl->ds = plugin_get_ds (type);
+    if (pl->ds == NULL)
+    {
+      ERROR ("exec plugin: Type `%s' isn't defined.", type);
+      return (-1);
+    }
+
+    if (pl->values_size < (size_t) pl->ds->ds_num)
+    {
+      value_t *tmp;
+
+      tmp = realloc (pl->values, pl->ds->ds_num * sizeof (*pl->values));
+      if (tmp == NULL)
+      {
+        ERROR ("exec plugin: realloc failed.");
+        pl->ds = NULL;
+        return (-1);
+      }
+      pl->values = tmp;
+      pl->values_size = (size_t) pl->ds->ds_num;
+    }
+  }
+
+  sstrncpy (vl.host, hostname, sizeof (vl.host));
+  sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  if (plugin_instance != NULL)
+    sstrncpy (vl.plugin_instance, plugin_instance,
+        sizeof (vl.plugin_instance));
+  if (type_instance != NULL)
+    sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  vl.values = pl->values;
+  vl.values_len = pl->ds->ds_num;
+
+  /* All the remaining fields are options or values. */
+  while (*buffer != 0)
+  {
+    char *key = NULL;
+    char *value = NULL;
+
+    status = parse_option (&buffer, &key, &value);
+    if (status < 0)
+    {
+      ERROR ("exec plugin: Misformatted option in PUTVAL line "
+          "from `%s'.", pl->exec);
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      if (strcasecmp ("interval", key) == 0)
+      {
+        double tmp;
+        char *endptr = NULL;
+
+        errno = 0;
+        tmp = strtod (value, &endptr);
+        if ((errno == 0) && (endptr != NULL)
+            && (endptr != value) && (tmp > 0.0))
+          vl.interval = DOUBLE_TO_CDTIME_T (tmp);
+      }
+      continue;
+    }
+
+    status = parse_string (&buffer, &value);
+    if (status != 0)
+    {
+      ERROR ("exec plugin: Misformatted value in PUTVAL line "
+          "from `%s'.", pl->exec);
+      return (-1);
+    }
+
+    status = parse_values (value, &vl, pl->ds);
+    if (status != 0)
+    {
+      ERROR ("exec plugin: Parsing the values string `%s' failed.", value);
+      return (-1);
+    }
+
+    plugin_dispatch_values (&vl);
+  } /* while (*buffer != 0) */
+
+  return (0);
+} /* }}} int exec_putval */
+
+static int parse_line (program_list_t *pl, char *buffer) /* {{{ */
 {
   if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
-    return (handle_putval (stdout, buffer));
+    return (exec_putval (pl, buffer));
   else if (strncasecmp ("PUTNOTIF", buffer, strlen ("PUTNOTIF")) == 0)
     return (handle_putnotif (stdout, buffer));
   else
@@ -545,165 +737,406 @@ static int parse_line (char *buffer) /* {{{ */
   }
 } /* int parse_line }}} */
 
-static void *exec_read_one (void *arg) /* {{{ */
+static void exec_handle_line (program_list_t *pl, char *line, /* {{{ */
+    _Bool is_stderr)
+{
+  if (is_stderr)
+    ERROR ("exec plugin: exec_read_one: error = %s", line);
+  else
+    parse_line (pl, line);
+} /* }}} void exec_handle_line */
+
+/* Read whatever is available from `fd' into `buf' and handle all complete
+ * lines. Returns zero on success, a positive value on end of file and a
+ * negative value on error. */
+static int exec_buffer_read (program_list_t *pl, int fd, /* {{{ */
+    exec_buffer_t *buf, _Bool is_stderr)
+{
+  char *line;
+  char *end;
+  ssize_t len;
+
+  if ((buf->size - buf->fill) < 2)
+  {
+    char *tmp;
+    size_t new_size;
+
+    new_size = (buf->size == 0) ? EXEC_BUFFER_INITIAL_SIZE : 2 * buf->size;
+    if (new_size > EXEC_BUFFER_MAX_SIZE)
+    {
+      /* The line doesn't fit into the largest buffer we're willing to
+       * allocate. Drop what we have and skip until the next newline. */
+      ERROR ("exec plugin: `%s' printed a line longer than %i bytes. "
+          "Ignoring it.", pl->exec, EXEC_BUFFER_MAX_SIZE);
+      buf->fill = 0;
+      buf->skip_line = 1;
+    }
+    else
+    {
+      tmp = realloc (buf->data, new_size);
+      if (tmp == NULL)
+      {
+        ERROR ("exec plugin: realloc failed.");
+        return (-1);
+      }
+      buf->data = tmp;
+      buf->size = new_size;
+    }
+  }
+
+  len = read (fd, buf->data + buf->fill, buf->size - buf->fill - 1);
+  if (len < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EINTR))
+      return (0);
+    return (-1);
+  }
+  else if (len == 0)
+  {
+    /* EOF: handle a last line without trailing newline. */
+    if ((buf->fill > 0) && !buf->skip_line)
+    {
+      buf->data[buf->fill] = 0;
+      exec_handle_line (pl, buf->data, is_stderr);
+    }
+    buf->fill = 0;
+    buf->skip_line = 0;
+    return (1);
+  }
+
+  buf->fill += (size_t) len;
+  buf->data[buf->fill] = 0;
+
+  line = buf->data;
+  while ((end = memchr (line, '\n', buf->fill - (line - buf->data))) != NULL)
+  {
+    *end = 0;
+    if ((end > line) && (end[-1] == '\r'))
+      end[-1] = 0;
+
+    if (buf->skip_line)
+      buf->skip_line = 0;
+    else
+      exec_handle_line (pl, line, is_stderr);
+
+    line = end + 1;
+  }
+
+  /* Move the incomplete line to the beginning of the buffer. */
+  buf->fill -= (size_t) (line - buf->data);
+  if ((buf->fill > 0) && (line != buf->data))
+    memmove (buf->data, line, buf->fill);
+
+  return (0);
+} /* }}} int exec_buffer_read */
+
+/* Collects the exit status of a program without blocking. Returns true if
+ * the program is gone and may be started again. Must be called with
+ * `pl_lock' held. */
+static _Bool exec_child_reap (program_list_t *pl) /* {{{ */
 {
-  program_list_t *pl = (program_list_t *) arg;
-  int fd, fd_err, highest_fd;
-  fd_set fdset, copy;
+  pid_t pid;
   int status;
-  char buffer[1200];  /* if not completely read */
-  char buffer_err[1024];
-  char *pbuffer = buffer;
-  char *pbuffer_err = buffer_err;
 
-  status = fork_child (pl, NULL, &fd, &fd_err);
-  if (status < 0)
+  pid = waitpid ((pid_t) pl->pid, &status, WNOHANG);
+  if (pid == 0)
+    return (0);
+
+  /* If waitpid failed, the SIGCHLD handler has reaped the child already and
+   * stored its status. */
+  if (pid > 0)
+    pl->status = status;
+
+  DEBUG ("exec plugin: Child %i exited with status %i.",
+      pl->pid, pl->status);
+
+  pl->pid = 0;
+  pl->flags &= ~(PL_RUNNING | PL_EXITING);
+  return (1);
+} /* }}} _Bool exec_child_reap */
+
+/* Called by the reader thread once a program has closed both, STDOUT and
+ * STDERR. */
+static void exec_child_finished (program_list_t *pl) /* {{{ */
+{
+  sfree (pl->buffer_out.data);
+  sfree (pl->buffer_err.data);
+  memset (&pl->buffer_out, 0, sizeof (pl->buffer_out));
+  memset (&pl->buffer_err, 0, sizeof (pl->buffer_err));
+
+  pthread_mutex_lock (&pl_lock);
+  if (!exec_child_reap (pl))
   {
-    /* Reset the "running" flag */
-    pthread_mutex_lock (&pl_lock);
-    pl->flags &= ~PL_RUNNING;
-    pthread_mutex_unlock (&pl_lock);
-    pthread_exit ((void *) 1);
+    DEBUG ("exec plugin: `%s' has closed its output but is still running.",
+        pl->exec);
+    pl->flags |= PL_EXITING;
   }
-  pl->pid = status;
+  pthread_mutex_unlock (&pl_lock);
+} /* }}} void exec_child_finished */
 
-  assert (pl->pid != 0);
+/* Called by the reader thread before it exits because of an error. Hands all
+ * running programs over to `exec_read' for reaping and makes `exec_read' start
+ * a new reader thread. */
+static void exec_reader_abort (void) /* {{{ */
+{
+  program_list_t *pl;
 
-  FD_ZERO( &fdset );
-  FD_SET(fd, &fdset);
-  FD_SET(fd_err, &fdset);
+  pthread_mutex_lock (&pl_lock);
+  for (pl = pl_head; pl != NULL; pl = pl->next)
+  {
+    if ((pl->flags & PL_RUNNING) == 0)
+      continue;
 
-  /* Determine the highest file descriptor */
-  highest_fd = (fd > fd_err) ? fd : fd_err;
+    if (pl->fd_out >= 0)
+      close (pl->fd_out);
+    if (pl->fd_err >= 0)
+      close (pl->fd_err);
+    pl->fd_out = pl->fd_err = -1;
+    sfree (pl->buffer_out.data);
+    sfree (pl->buffer_err.data);
+    memset (&pl->buffer_out, 0, sizeof (pl->buffer_out));
+    memset (&pl->buffer_err, 0, sizeof (pl->buffer_err));
 
-  /* We use a copy of fdset, as select modifies it */
-  copy = fdset;
+    if (pl->pid > 0)
+      pl->flags |= PL_EXITING;
+    else
+      pl->flags &= ~PL_RUNNING;
+  }
+
+  close (reader_pipe[0]);
+  close (reader_pipe[1]);
+  reader_pipe[0] = reader_pipe[1] = -1;
+
+  pthread_detach (pthread_self ());
+  reader_thread_running = 0;
+  pthread_mutex_unlock (&pl_lock);
+} /* }}} void exec_reader_abort */
 
-  while (1)
+/* Reads the output of all running `Exec' programs. */
+static void *exec_reader_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  struct pollfd *fds = NULL;
+  program_list_t **fds_pl = NULL;
+  size_t fds_size = 0;
+  _Bool failed = 0;
+
+  while (42)
   {
-    int len;
+    program_list_t *pl;
+    size_t fds_num;
+    size_t i;
+    int status;
 
-    status = select (highest_fd + 1, &copy, NULL, NULL, NULL);
-    if (status < 0)
+    /* Build the list of file descriptors to watch. The first one is the
+     * read end of `reader_pipe'. */
+    pthread_mutex_lock (&pl_lock);
+    if (reader_shutdown)
     {
-      if (errno == EINTR)
-        continue;
+      pthread_mutex_unlock (&pl_lock);
       break;
     }
 
-    if (FD_ISSET(fd, &copy))
-    {
-      char *pnl;
-
-      len = read(fd, pbuffer, sizeof(buffer) - 1 - (pbuffer - buffer));
+    fds_num = 1;
+    for (pl = pl_head; pl != NULL; pl = pl->next)
+      fds_num += 2;
 
-      if (len < 0)
+    if (fds_num > fds_size)
+    {
+      struct pollfd *tmp_fds;
+      program_list_t **tmp_pl;
+
+      tmp_fds = realloc (fds, fds_num * sizeof (*fds));
+      if (tmp_fds != NULL)
+        fds = tmp_fds;
+      tmp_pl = realloc (fds_pl, fds_num * sizeof (*fds_pl));
+      if (tmp_pl != NULL)
+        fds_pl = tmp_pl;
+      if ((tmp_fds == NULL) || (tmp_pl == NULL))
       {
-        if (errno == EAGAIN || errno == EINTR)  continue;
+        pthread_mutex_unlock (&pl_lock);
+        ERROR ("exec plugin: exec_reader_thread: realloc failed.");
+        failed = 1;
         break;
       }
-      else if (len == 0) break;  /* We've reached EOF */
+      fds_size = fds_num;
+    }
 
-      pbuffer[len] = '\0';
+    memset (fds, 0, fds_size * sizeof (*fds));
+    fds[0].fd = reader_pipe[0];
+    fds[0].events = POLLIN;
+    fds_pl[0] = NULL;
+    fds_num = 1;
 
-      len += pbuffer - buffer;
-      pbuffer = buffer;
+    for (pl = pl_head; pl != NULL; pl = pl->next)
+    {
+      if ((pl->flags & PL_RUNNING) == 0)
+        continue;
 
-      while ((pnl = strchr(pbuffer, '\n')))
+      if (pl->fd_out >= 0)
       {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
-
-        parse_line (pbuffer);
-
-        pbuffer = ++pnl;
+        fds[fds_num].fd = pl->fd_out;
+        fds[fds_num].events = POLLIN;
+        fds_pl[fds_num] = pl;
+        fds_num++;
       }
-      /* not completely read ? */
-      if (pbuffer - buffer < len)
+      if (pl->fd_err >= 0)
       {
-        len -= pbuffer - buffer;
-        memmove(buffer, pbuffer, len);
-        pbuffer = buffer + len;
+        fds[fds_num].fd = pl->fd_err;
+        fds[fds_num].events = POLLIN;
+        fds_pl[fds_num] = pl;
+        fds_num++;
       }
-      else
-        pbuffer = buffer;
     }
-    else if (FD_ISSET(fd_err, &copy))
+    pthread_mutex_unlock (&pl_lock);
+
+    status = poll (fds, (nfds_t) fds_num, /* timeout = */ -1);
+    if (status < 0)
     {
-      char *pnl;
+      char errbuf[1024];
 
-      len = read(fd_err, pbuffer_err, sizeof(buffer_err) - 1 - (pbuffer_err - buffer_err));
+      if (errno == EINTR)
+        continue;
 
-      if (len < 0)
-      {
-        if (errno == EAGAIN || errno == EINTR)
-          continue;
-        break;
-      }
-      else if (len == 0)
-      {
-        /* We've reached EOF */
-        NOTICE ("exec plugin: Program `%s' has closed STDERR.", pl->exec);
+      ERROR ("exec plugin: poll failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      failed = 1;
+      break;
+    }
 
-        /* Remove file descriptor form select() set. */
-        FD_CLR (fd_err, &fdset);
-        copy = fdset;
-        highest_fd = fd;
+    if (fds[0].revents != 0)
+    {
+      char tmp[64];
+      /* Drain the wake-up pipe. The list is rebuilt in the next iteration. */
+      while (read (reader_pipe[0], tmp, sizeof (tmp)) > 0)
+        /* do nothing */;
+    }
 
-        /* Clean up file descriptor */
-        close (fd_err);
-        fd_err = -1;
-        continue;
-      }
+    for (i = 1; i < fds_num; i++)
+    {
+      _Bool is_stderr;
 
-      pbuffer_err[len] = '\0';
+      if (fds[i].revents == 0)
+        continue;
 
-      len += pbuffer_err - buffer_err;
-      pbuffer_err = buffer_err;
+      pl = fds_pl[i];
+      is_stderr = (fds[i].fd == pl->fd_err);
 
-      while ((pnl = strchr(pbuffer_err, '\n')))
-      {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+      status = exec_buffer_read (pl, fds[i].fd,
+          is_stderr ? &pl->buffer_err : &pl->buffer_out, is_stderr);
+      if (status == 0)
+        continue;
 
-        ERROR ("exec plugin: exec_read_one: error = %s", pbuffer_err);
+      if (is_stderr && (status > 0))
+        NOTICE ("exec plugin: Program `%s' has closed STDERR.", pl->exec);
 
-        pbuffer_err = ++pnl;
-      }
-      /* not completely read ? */
-      if (pbuffer_err - buffer_err < len)
-      {
-        len -= pbuffer_err - buffer_err;
-        memmove(buffer_err, pbuffer_err, len);
-        pbuffer_err = buffer_err + len;
-      }
+      /* EOF or error: Stop watching this file descriptor. */
+      close (fds[i].fd);
+      if (is_stderr)
+        pl->fd_err = -1;
       else
-        pbuffer_err = buffer_err;
-    }
-    /* reset copy */
-    copy = fdset;
+        pl->fd_out = -1;
+
+      if ((pl->fd_out < 0) && (pl->fd_err < 0))
+        exec_child_finished (pl);
+    } /* for (i = 1; i < fds_num; i++) */
+  } /* while (42) */
+
+  sfree (fds);
+  sfree (fds_pl);
+
+  if (failed)
+    exec_reader_abort ();
+
+  pthread_exit ((void *) 0);
+  return (NULL);
+} /* }}} void *exec_reader_thread */
+
+/* Start the reader thread, unless it is already running. */
+static int exec_reader_start (void) /* {{{ */
+{
+  char errbuf[1024];
+  int status;
+  _Bool running;
+
+  pthread_mutex_lock (&pl_lock);
+  running = reader_thread_running;
+  pthread_mutex_unlock (&pl_lock);
+  if (running)
+    return (0);
+
+  status = pipe (reader_pipe);
+  if (status != 0)
+  {
+    ERROR ("exec plugin: pipe failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
   }
+  fcntl (reader_pipe[0], F_SETFL, fcntl (reader_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl (reader_pipe[1], F_SETFL, fcntl (reader_pipe[1], F_GETFL) | O_NONBLOCK);
 
-  DEBUG ("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
-  if (waitpid (pl->pid, &status, 0) > 0)
-    pl->status = status;
+  reader_shutdown = 0;
+  status = plugin_thread_create (&reader_thread, /* attr = */ NULL,
+      exec_reader_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("exec plugin: Starting the reader thread failed.");
+    close (reader_pipe[0]);
+    close (reader_pipe[1]);
+    reader_pipe[0] = reader_pipe[1] = -1;
+    return (-1);
+  }
 
-  DEBUG ("exec plugin: Child %i exited with status %i.",
-      (int) pl->pid, pl->status);
+  pthread_mutex_lock (&pl_lock);
+  reader_thread_running = 1;
+  pthread_mutex_unlock (&pl_lock);
+  return (0);
+} /* }}} int exec_reader_start */
 
-  pl->pid = 0;
+/* Wake up the reader thread so it rebuilds its list of file descriptors. */
+static void exec_reader_wakeup (void) /* {{{ */
+{
+  pthread_mutex_lock (&pl_lock);
+  if (reader_pipe[1] >= 0)
+  {
+    char c = 0;
+    /* If the pipe is full, the thread will wake up anyway. */
+    if (write (reader_pipe[1], &c, 1) < 0)
+      DEBUG ("exec plugin: Writing to the wake-up pipe failed.");
+  }
+  pthread_mutex_unlock (&pl_lock);
+} /* }}} void exec_reader_wakeup */
+
+/* Start a `normal' program and hand its output to the reader thread. */
+static int exec_read_one (program_list_t *pl) /* {{{ */
+{
+  int fd_out;
+  int fd_err;
+  int status;
+
+  status = fork_child (pl, NULL, &fd_out, &fd_err);
+  if (status < 0)
+  {
+    /* Reset the "running" flag */
+    pthread_mutex_lock (&pl_lock);
+    pl->flags &= ~PL_RUNNING;
+    pthread_mutex_unlock (&pl_lock);
+    return (-1);
+  }
+
+  fcntl (fd_out, F_SETFL, fcntl (fd_out, F_GETFL) | O_NONBLOCK);
+  fcntl (fd_err, F_SETFL, fcntl (fd_err, F_GETFL) | O_NONBLOCK);
 
   pthread_mutex_lock (&pl_lock);
-  pl->flags &= ~PL_RUNNING;
+  pl->pid = status;
+  pl->fd_out = fd_out;
+  pl->fd_err = fd_err;
   pthread_mutex_unlock (&pl_lock);
 
-  close (fd);
-  if (fd_err >= 0)
-    close (fd_err);
+  assert (pl->pid != 0);
 
-  pthread_exit ((void *) 0);
-  return (NULL);
-} /* void *exec_read_one }}} */
+  exec_reader_wakeup ();
+  return (0);
+} /* }}} int exec_read_one */
 
 static void *exec_notification_one (void *arg) /* {{{ */
 {
@@ -806,18 +1239,20 @@ static int exec_read (void) /* {{{ */
 {
   program_list_t *pl;
 
+  if (exec_reader_start () != 0)
+    return (-1);
+
   for (pl = pl_head; pl != NULL; pl = pl->next)
   {
-    pthread_t t;
-    pthread_attr_t attr;
-
     /* Only execute `normal' style executables here. */
     if ((pl->flags & PL_NORMAL) == 0)
       continue;
 
     pthread_mutex_lock (&pl_lock);
-    /* Skip if a child is already running. */
-    if ((pl->flags & PL_RUNNING) != 0)
+    /* Skip if a child is already running. A child which has closed its
+     * output but has not exited yet is reaped here. */
+    if (((pl->flags & PL_RUNNING) != 0)
+        && (((pl->flags & PL_EXITING) == 0) || !exec_child_reap (pl)))
     {
       pthread_mutex_unlock (&pl_lock);
       continue;
@@ -825,10 +1260,7 @@ static int exec_read (void) /* {{{ */
     pl->flags |= PL_RUNNING;
     pthread_mutex_unlock (&pl_lock);
 
-    pthread_attr_init (&attr);
-    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
-    plugin_thread_create (&t, &attr, exec_read_one, (void *) pl);
-    pthread_attr_destroy (&attr);
+    exec_read_one (pl);
   } /* for (pl) */
 
   return (0);
@@ -882,17 +1314,48 @@ static int exec_shutdown (void) /* {{{ */
 {
   program_list_t *pl;
   program_list_t *next;
+  _Bool running;
 
-  pl = pl_head;
-  while (pl != NULL)
+  /* Terminate the children first: The reader thread only notices that a
+   * program is gone once it closes its output. */
+  pthread_mutex_lock (&pl_lock);
+  for (pl = pl_head; pl != NULL; pl = pl->next)
   {
-    next = pl->next;
-
     if (pl->pid > 0)
     {
       kill (pl->pid, SIGTERM);
       INFO ("exec plugin: Sent SIGTERM to %hu", (unsigned short int) pl->pid);
     }
+  }
+  running = reader_thread_running;
+  if (running)
+    reader_shutdown = 1;
+  pthread_mutex_unlock (&pl_lock);
+
+  if (running)
+  {
+    exec_reader_wakeup ();
+
+    pthread_join (reader_thread, /* retval = */ NULL);
+    reader_thread_running = 0;
+
+    close (reader_pipe[0]);
+    close (reader_pipe[1]);
+    reader_pipe[0] = reader_pipe[1] = -1;
+  }
+
+  pl = pl_head;
+  while (pl != NULL)
+  {
+    next = pl->next;
+
+    if (pl->fd_out >= 0)
+      close (pl->fd_out);
+    if (pl->fd_err >= 0)
+      close (pl->fd_err);
+    sfree (pl->buffer_out.data);
+    sfree (pl->buffer_err.data);
+    sfree (pl->values);
 
     sfree (pl->user);
     sfree (pl);
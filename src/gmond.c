@@ -19,11 +19,13 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
-#include "utils_avltree.h"
+#include "utils_htable.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -60,6 +62,16 @@
 # define BUFF_SIZE 1400
 #endif
 
+/* Number of messages read from a socket with one system call. */
+#if HAVE_RECVMMSG
+# define MC_RECEIVE_BATCH_SIZE 32
+#else
+# define MC_RECEIVE_BATCH_SIZE 1
+#endif
+/* Maximum number of batches read from one socket before the other sockets
+ * are polled again. */
+#define MC_RECEIVE_ROUNDS 16
+
 struct socket_entry_s
 {
   int                     fd;
@@ -73,9 +85,33 @@ struct staging_entry_s
   char key[2 * DATA_MAX_NAME_LEN];
   value_list_t vl;
   int flags;
+
+  /* List of all entries, most recently used first. */
+  struct staging_entry_s *lru_prev;
+  struct staging_entry_s *lru_next;
 };
 typedef struct staging_entry_s staging_entry_t;
 
+/* Buffers for receiving a batch of messages. Allocated once by the receive
+ * thread. */
+struct mc_receive_batch_s
+{
+  char buffers[MC_RECEIVE_BATCH_SIZE][BUFF_SIZE];
+  struct iovec iovecs[MC_RECEIVE_BATCH_SIZE];
+#if HAVE_RECVMMSG
+  struct mmsghdr headers[MC_RECEIVE_BATCH_SIZE];
+#else
+  struct msghdr headers[MC_RECEIVE_BATCH_SIZE];
+#endif
+  struct msghdr *msgs[MC_RECEIVE_BATCH_SIZE];
+  size_t sizes[MC_RECEIVE_BATCH_SIZE];
+#ifdef SO_RXQ_OVFL
+  /* Linux reports the number of packets dropped by a socket so far. */
+  char control[MC_RECEIVE_BATCH_SIZE][CMSG_SPACE (sizeof (uint32_t))];
+#endif
+};
+typedef struct mc_receive_batch_s mc_receive_batch_t;
+
 struct metric_map_s
 {
   char *ganglia_name;
@@ -94,6 +130,10 @@ static char          *mc_receive_port = NULL;
 
 static struct pollfd *mc_receive_sockets = NULL;
 static size_t         mc_receive_sockets_num = 0;
+/* Number of packets dropped by each receive socket, as reported by the
+ * kernel. Protected by `staging_lock'. */
+static uint32_t      *mc_receive_drops = NULL;
+static _Bool          mc_report_stats = 0;
 
 static socket_entry_t  *mc_send_sockets = NULL;
 static size_t           mc_send_sockets_num = 0;
@@ -129,85 +169,108 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE (metric_map_default);
 
 static metric_map_t *metric_map = NULL;
 static size_t        metric_map_len = 0;
-
-static c_avl_tree_t   *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Maps Ganglia names to entries of `metric_map' and `metric_map_default'. */
+static c_htable_t   *metric_index = NULL;
+
+static c_htable_t      *staging_index = NULL;
+static staging_entry_t *staging_lru_head = NULL;
+static staging_entry_t *staging_lru_tail = NULL;
+static size_t           staging_num = 0;
+/* Maximum number of staging entries, zero means unlimited. If the limit is
+ * reached, the least recently updated entry is evicted. */
+static size_t           staging_max = 0;
+static pthread_mutex_t  staging_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Statistics, protected by `staging_lock'. */
+static derive_t stats_received = 0;
+static derive_t stats_invalid = 0;
+static derive_t stats_evicted = 0;
+
+static int gmond_compare_string (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp ((const char *) a, (const char *) b));
+} /* }}} int gmond_compare_string */
 
 static metric_map_t *metric_lookup (const char *key) /* {{{ */
 {
-  metric_map_t *map;
-  size_t map_len;
-  size_t i;
+  metric_map_t *map = NULL;
 
-  /* Search the user-supplied table first.. */
-  map = metric_map;
-  map_len = metric_map_len;
-  for (i = 0; i < map_len; i++)
-    if (strcmp (map[i].ganglia_name, key) == 0)
-      break;
-
-  /* .. and fall back to the built-in table if nothing is found. */
-  if (i >= map_len)
-  {
-    map = metric_map_default;
-    map_len = metric_map_len_default;
-
-    for (i = 0; i < map_len; i++)
-      if (strcmp (map[i].ganglia_name, key) == 0)
-        break;
-  }
-
-  if (i >= map_len)
+  if (c_htable_get (metric_index, key, (void *) &map) != 0)
     return (NULL);
 
   /* Look up the DS type and ds_index. */
-  if ((map[i].ds_type < 0) || (map[i].ds_index < 0)) /* {{{ */
+  if ((map->ds_type < 0) || (map->ds_index < 0)) /* {{{ */
   {
     const data_set_t *ds;
 
-    ds = plugin_get_ds (map[i].type);
+    ds = plugin_get_ds (map->type);
     if (ds == NULL)
     {
-      WARNING ("gmond plugin: Type not defined: %s", map[i].type);
+      WARNING ("gmond plugin: Type not defined: %s", map->type);
       return (NULL);
     }
 
-    if ((map[i].ds_name == NULL) && (ds->ds_num != 1))
+    if ((map->ds_name == NULL) && (ds->ds_num != 1))
     {
       WARNING ("gmond plugin: No data source name defined for metric %s, "
           "but type %s has more than one data source.",
-          map[i].ganglia_name, map[i].type);
+          map->ganglia_name, map->type);
       return (NULL);
     }
 
-    if (map[i].ds_name == NULL)
+    if (map->ds_name == NULL)
     {
-      map[i].ds_index = 0;
+      map->ds_index = 0;
     }
     else
     {
       int j;
 
       for (j = 0; j < ds->ds_num; j++)
-        if (strcasecmp (ds->ds[j].name, map[i].ds_name) == 0)
+        if (strcasecmp (ds->ds[j].name, map->ds_name) == 0)
           break;
 
       if (j >= ds->ds_num)
       {
         WARNING ("gmond plugin: There is no data source "
             "named `%s' in type `%s'.",
-            map[i].ds_name, ds->type);
+            map->ds_name, ds->type);
         return (NULL);
       }
-      map[i].ds_index = j;
+      map->ds_index = j;
     }
 
-    map[i].ds_type = ds->ds[map[i].ds_index].type;
-  } /* }}} if ((map[i].ds_type < 0) || (map[i].ds_index < 0)) */
+    map->ds_type = ds->ds[map->ds_index].type;
+  } /* }}} if ((map->ds_type < 0) || (map->ds_index < 0)) */
 
-  return (map + i);
+  return (map);
 } /* }}} metric_map_t *metric_lookup */
 
+/* Builds `metric_index'. Entries of the user-supplied table take precedence
+ * over the built-in ones. */
+static int metric_index_create (void) /* {{{ */
+{
+  size_t i;
+
+  metric_index = c_htable_create (c_htable_hash_string, gmond_compare_string);
+  if (metric_index == NULL)
+  {
+    ERROR ("gmond plugin: c_htable_create failed.");
+    return (-1);
+  }
+
+  /* c_htable_insert fails for names which are already known, so the first
+   * mapping of a name is kept. */
+  for (i = 0; i < metric_map_len; i++)
+    c_htable_insert (metric_index, metric_map[i].ganglia_name,
+        metric_map + i);
+  for (i = 0; i < metric_map_len_default; i++)
+    c_htable_insert (metric_index, metric_map_default[i].ganglia_name,
+        metric_map_default + i);
+
+  return (0);
+} /* }}} int metric_index_create */
+
 static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
     size_t *ret_sockets_num,
     const char *node, const char *service, int listen)
@@ -413,6 +476,60 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
   return (0);
 } /* }}} int request_meta_data */
 
+static void staging_lru_unlink (staging_entry_t *se) /* {{{ */
+{
+  if (se->lru_prev != NULL)
+    se->lru_prev->lru_next = se->lru_next;
+  else
+    staging_lru_head = se->lru_next;
+
+  if (se->lru_next != NULL)
+    se->lru_next->lru_prev = se->lru_prev;
+  else
+    staging_lru_tail = se->lru_prev;
+
+  se->lru_prev = NULL;
+  se->lru_next = NULL;
+} /* }}} void staging_lru_unlink */
+
+static void staging_lru_push (staging_entry_t *se) /* {{{ */
+{
+  se->lru_prev = NULL;
+  se->lru_next = staging_lru_head;
+  if (staging_lru_head != NULL)
+    staging_lru_head->lru_prev = se;
+  staging_lru_head = se;
+  if (staging_lru_tail == NULL)
+    staging_lru_tail = se;
+} /* }}} void staging_lru_push */
+
+static void staging_entry_free (staging_entry_t *se) /* {{{ */
+{
+  if (se == NULL)
+    return;
+
+  sfree (se->vl.values);
+  sfree (se);
+} /* }}} void staging_entry_free */
+
+/* Removes the least recently used entry. Must be called with `staging_lock'
+ * held. */
+static void staging_entry_evict (void) /* {{{ */
+{
+  staging_entry_t *se = staging_lru_tail;
+
+  if (se == NULL)
+    return;
+
+  staging_lru_unlink (se);
+  c_htable_remove (staging_index, se->key, NULL, NULL);
+  staging_num--;
+  stats_evicted++;
+
+  DEBUG ("gmond plugin: Evicting staging entry %s.", se->key);
+  staging_entry_free (se);
+} /* }}} void staging_entry_evict */
+
 static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     const char *name,
     const char *type, const char *type_instance,
@@ -422,16 +539,23 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
   staging_entry_t *se;
   int status;
 
-  if (staging_tree == NULL)
+  if (staging_index == NULL)
     return (NULL);
 
   ssnprintf (key, sizeof (key), "%s/%s/%s", host, type,
       (type_instance != NULL) ? type_instance : "");
 
   se = NULL;
-  status = c_avl_get (staging_tree, key, (void *) &se);
+  status = c_htable_get (staging_index, key, (void *) &se);
   if (status == 0)
+  {
+    if (se != staging_lru_head)
+    {
+      staging_lru_unlink (se);
+      staging_lru_push (se);
+    }
     return (se);
+  }
 
   /* insert new entry */
   se = (staging_entry_t *) malloc (sizeof (*se));
@@ -459,14 +583,18 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     sstrncpy (se->vl.type_instance, type_instance,
         sizeof (se->vl.type_instance));
 
-  status = c_avl_insert (staging_tree, se->key, se);
+  if ((staging_max > 0) && (staging_num >= staging_max))
+    staging_entry_evict ();
+
+  status = c_htable_insert (staging_index, se->key, se);
   if (status != 0)
   {
-    ERROR ("gmond plugin: c_avl_insert failed.");
-    sfree (se->vl.values);
-    sfree (se);
+    ERROR ("gmond plugin: c_htable_insert failed.");
+    staging_entry_free (se);
     return (NULL);
   }
+  staging_lru_push (se);
+  staging_num++;
 
   return (se);
 } /* }}} staging_entry_t *staging_entry_get */
@@ -738,14 +866,17 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
   return (0);
 } /* }}} int mc_handle_metadata_msg */
 
+/* Returns non-zero if the message could not be decoded. */
 static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
 {
   XDR xdr;
   Ganglia_msg_formats format;
+  int status = 0;
 
   xdrmem_create (&xdr, buffer, buffer_size, XDR_DECODE);
 
-  xdr_Ganglia_msg_formats (&xdr, &format);
+  if (!xdr_Ganglia_msg_formats (&xdr, &format))
+    return (-1);
   xdr_setpos (&xdr, 0);
 
   switch (format)
@@ -763,6 +894,10 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
       memset (&msg, 0, sizeof (msg));
       if (xdr_Ganglia_value_msg (&xdr, &msg))
         mc_handle_value_msg (&msg);
+      else
+        status = -1;
+      /* Free the strings allocated by the decoder. */
+      xdr_free ((xdrproc_t) xdr_Ganglia_value_msg, (char *) &msg);
       break;
     }
 
@@ -773,6 +908,9 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
       memset (&msg, 0, sizeof (msg));
       if (xdr_Ganglia_metadata_msg (&xdr, &msg))
         mc_handle_metadata_msg (&msg);
+      else
+        status = -1;
+      xdr_free ((xdrproc_t) xdr_Ganglia_metadata_msg, (char *) &msg);
       break;
     }
 
@@ -781,14 +919,104 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
       return (-1);
   } /* switch (format) */
 
-
-  return (0);
+  return (status);
 } /* }}} int mc_handle_metric */
 
-static int mc_handle_socket (struct pollfd *p) /* {{{ */
+static void mc_receive_batch_init (mc_receive_batch_t *b) /* {{{ */
 {
-  char buffer[BUFF_SIZE];
-  ssize_t buffer_size;
+  size_t i;
+
+  memset (b, 0, sizeof (*b));
+
+  for (i = 0; i < MC_RECEIVE_BATCH_SIZE; i++)
+  {
+#if HAVE_RECVMMSG
+    b->msgs[i] = &b->headers[i].msg_hdr;
+#else
+    b->msgs[i] = &b->headers[i];
+#endif
+    b->iovecs[i].iov_base = b->buffers[i];
+    b->iovecs[i].iov_len = sizeof (b->buffers[i]);
+  }
+} /* }}} void mc_receive_batch_init */
+
+/* Reads up to MC_RECEIVE_BATCH_SIZE messages from the non-blocking socket
+ * `fd'. Returns the number of messages read or less than zero on error. */
+static int mc_receive_batch (int fd, mc_receive_batch_t *b) /* {{{ */
+{
+  int num;
+  int i;
+
+  /* The kernel overwrites the lengths, so they're reset every time. */
+  for (i = 0; i < MC_RECEIVE_BATCH_SIZE; i++)
+  {
+    struct msghdr *msg = b->msgs[i];
+
+    msg->msg_name = NULL;
+    msg->msg_namelen = 0;
+    msg->msg_iov = b->iovecs + i;
+    msg->msg_iovlen = 1;
+#ifdef SO_RXQ_OVFL
+    msg->msg_control = b->control[i];
+    msg->msg_controllen = sizeof (b->control[i]);
+#else
+    msg->msg_control = NULL;
+    msg->msg_controllen = 0;
+#endif
+    msg->msg_flags = 0;
+  }
+
+#if HAVE_RECVMMSG
+  num = recvmmsg (fd, b->headers, MC_RECEIVE_BATCH_SIZE,
+      /* flags = */ 0, /* timeout = */ NULL);
+  for (i = 0; i < num; i++)
+    b->sizes[i] = (size_t) b->headers[i].msg_len;
+#else
+  {
+    ssize_t status = recvmsg (fd, b->msgs[0], /* flags = */ 0);
+    if (status < 0)
+      return (-1);
+    b->sizes[0] = (size_t) status;
+    num = 1;
+  }
+#endif
+
+  return (num);
+} /* }}} int mc_receive_batch */
+
+#ifdef SO_RXQ_OVFL
+/* Returns the drop counter of the socket, as reported with the last message
+ * carrying it, or `prev' if no message did. */
+static uint32_t mc_receive_batch_drops (mc_receive_batch_t *b, /* {{{ */
+    int num, uint32_t prev)
+{
+  uint32_t drops = prev;
+  int i;
+
+  for (i = 0; i < num; i++)
+  {
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR (b->msgs[i]);
+        cmsg != NULL;
+        cmsg = CMSG_NXTHDR (b->msgs[i], cmsg))
+    {
+      if ((cmsg->cmsg_level == SOL_SOCKET)
+          && (cmsg->cmsg_type == SO_RXQ_OVFL))
+        memcpy (&drops, CMSG_DATA (cmsg), sizeof (drops));
+    }
+  }
+
+  return (drops);
+} /* }}} uint32_t mc_receive_batch_drops */
+#endif
+
+static int mc_handle_socket (struct pollfd *p, uint32_t *drops, /* {{{ */
+    mc_receive_batch_t *b)
+{
+  derive_t received = 0;
+  derive_t invalid = 0;
+  int round;
 
   if ((p->revents & (POLLIN | POLLPRI)) == 0)
   {
@@ -796,23 +1024,63 @@ static int mc_handle_socket (struct pollfd *p) /* {{{ */
     return (-1);
   }
 
-  buffer_size = recv (p->fd, buffer, sizeof (buffer), /* flags = */ 0);
-  if (buffer_size <= 0)
+  for (round = 0; round < MC_RECEIVE_ROUNDS; round++)
   {
-    char errbuf[1024];
-    ERROR ("gmond plugin: recv failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    p->revents = 0;
-    return (-1);
+    int num;
+    int i;
+
+    num = mc_receive_batch (p->fd, b);
+    if (num < 0)
+    {
+      char errbuf[1024];
+
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        break;
+
+      ERROR ("gmond plugin: recvmsg failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+
+    for (i = 0; i < num; i++)
+    {
+      if ((b->sizes[i] == 0)
+          || (mc_handle_metric (b->buffers[i], b->sizes[i]) != 0))
+        invalid++;
+    }
+    received += num;
+
+#ifdef SO_RXQ_OVFL
+    {
+      uint32_t tmp = mc_receive_batch_drops (b, num, *drops);
+      if (tmp != *drops)
+      {
+        pthread_mutex_lock (&staging_lock);
+        *drops = tmp;
+        pthread_mutex_unlock (&staging_lock);
+      }
+    }
+#endif
+
+    /* The socket's queue is empty. */
+    if (num < MC_RECEIVE_BATCH_SIZE)
+      break;
   }
 
-  mc_handle_metric (buffer, (size_t) buffer_size);
+  p->revents = 0;
+
+  pthread_mutex_lock (&staging_lock);
+  stats_received += received;
+  stats_invalid += invalid;
+  pthread_mutex_unlock (&staging_lock);
+
   return (0);
 } /* }}} int mc_handle_socket */
 
 static void *mc_receive_thread (void *arg) /* {{{ */
 {
   socket_entry_t *mc_receive_socket_entries;
+  mc_receive_batch_t *batch;
   int status;
   size_t i;
 
@@ -840,9 +1108,42 @@ static void *mc_receive_thread (void *arg) /* {{{ */
     return ((void *) -1);
   }
 
+  mc_receive_drops = calloc (mc_receive_sockets_num,
+      sizeof (*mc_receive_drops));
+  batch = malloc (sizeof (*batch));
+  if ((mc_receive_drops == NULL) || (batch == NULL))
+  {
+    ERROR ("gmond plugin: malloc failed.");
+    for (i = 0; i < mc_receive_sockets_num; i++)
+      close (mc_receive_socket_entries[i].fd);
+    free (mc_receive_socket_entries);
+    sfree (mc_receive_sockets);
+    sfree (mc_receive_drops);
+    sfree (batch);
+    mc_receive_sockets_num = 0;
+    return ((void *) -1);
+  }
+  mc_receive_batch_init (batch);
+
   for (i = 0; i < mc_receive_sockets_num; i++)
   {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
+    int fd = mc_receive_socket_entries[i].fd;
+#ifdef SO_RXQ_OVFL
+    int yes = 1;
+
+    if (setsockopt (fd, SOL_SOCKET, SO_RXQ_OVFL,
+          (void *) &yes, sizeof (yes)) != 0)
+    {
+      char errbuf[1024];
+      WARNING ("gmond plugin: setsockopt (SO_RXQ_OVFL) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+#endif
+
+    /* Sockets are read until they're empty. */
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    mc_receive_sockets[i].fd = fd;
     mc_receive_sockets[i].events = POLLIN | POLLPRI;
     mc_receive_sockets[i].revents = 0;
   }
@@ -863,10 +1164,22 @@ static void *mc_receive_thread (void *arg) /* {{{ */
     for (i = 0; i < mc_receive_sockets_num; i++)
     {
       if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket (mc_receive_sockets + i);
+        mc_handle_socket (mc_receive_sockets + i, mc_receive_drops + i,
+            batch);
     }
   } /* while (mc_receive_thread_loop != 0) */
 
+  sfree (batch);
+  free (mc_receive_socket_entries);
+
+  pthread_mutex_lock (&staging_lock);
+  for (i = 0; i < mc_receive_sockets_num; i++)
+    close (mc_receive_sockets[i].fd);
+  sfree (mc_receive_sockets);
+  sfree (mc_receive_drops);
+  mc_receive_sockets_num = 0;
+  pthread_mutex_unlock (&staging_lock);
+
   return ((void *) 0);
 } /* }}} void *mc_receive_thread */
 
@@ -914,6 +1227,8 @@ static int mc_receive_thread_stop (void) /* {{{ */
  *
  * <Plugin gmond>
  *   MCReceiveFrom "239.2.11.71" "8649"
+ *   MaxStagingEntries 100000
+ *   ReportStats false
  *   <Metric "load_one">
  *     Type "load"
  *     [TypeInstance "foo"]
@@ -1065,6 +1380,20 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
       gmond_config_set_address (child, &mc_receive_group, &mc_receive_port);
     else if (strcasecmp ("Metric", child->key) == 0)
       gmond_config_add_metric (child);
+    else if (strcasecmp ("MaxStagingEntries", child->key) == 0)
+    {
+      int tmp = 0;
+      if (cf_util_get_int (child, &tmp) == 0)
+      {
+        if (tmp >= 0)
+          staging_max = (size_t) tmp;
+        else
+          WARNING ("gmond plugin: `MaxStagingEntries' must not be "
+              "negative.");
+      }
+    }
+    else if (strcasecmp ("ReportStats", child->key) == 0)
+      cf_util_get_boolean (child, &mc_report_stats);
     else
     {
       WARNING ("gmond plugin: Unknown configuration option `%s' ignored.",
@@ -1075,6 +1404,61 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int gmond_config */
 
+static int gmond_read (void) /* {{{ */
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[1];
+  derive_t copy_received;
+  derive_t copy_invalid;
+  derive_t copy_evicted;
+  derive_t copy_dropped;
+  size_t copy_staging_num;
+  size_t i;
+
+  pthread_mutex_lock (&staging_lock);
+  copy_received = stats_received;
+  copy_invalid = stats_invalid;
+  copy_evicted = stats_evicted;
+  copy_dropped = 0;
+  if (mc_receive_drops != NULL)
+    for (i = 0; i < mc_receive_sockets_num; i++)
+      copy_dropped += (derive_t) mc_receive_drops[i];
+  copy_staging_num = staging_num;
+  pthread_mutex_unlock (&staging_lock);
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "gmond", sizeof (vl.plugin));
+
+  sstrncpy (vl.type, "total_values", sizeof (vl.type));
+
+  values[0].derive = copy_received;
+  sstrncpy (vl.type_instance, "received", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  values[0].derive = copy_invalid;
+  sstrncpy (vl.type_instance, "invalid", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  values[0].derive = copy_evicted;
+  sstrncpy (vl.type_instance, "evicted", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+#ifdef SO_RXQ_OVFL
+  values[0].derive = copy_dropped;
+  sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+#endif
+
+  values[0].gauge = (gauge_t) copy_staging_num;
+  sstrncpy (vl.type, "cache_size", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "staging", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  return (0);
+} /* }}} int gmond_read */
+
 static int gmond_init (void) /* {{{ */
 {
   create_sockets (&mc_send_sockets, &mc_send_sockets_num,
@@ -1082,15 +1466,22 @@ static int gmond_init (void) /* {{{ */
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
       /* listen = */ 0);
 
-  staging_tree = c_avl_create ((void *) strcmp);
-  if (staging_tree == NULL)
+  if (metric_index_create () != 0)
+    return (-1);
+
+  staging_index = c_htable_create (c_htable_hash_string,
+      gmond_compare_string);
+  if (staging_index == NULL)
   {
-    ERROR ("gmond plugin: c_avl_create failed.");
+    ERROR ("gmond plugin: c_htable_create failed.");
     return (-1);
   }
 
   mc_receive_thread_start ();
 
+  if (mc_report_stats)
+    plugin_register_read ("gmond", gmond_read);
+
   return (0);
 } /* }}} int gmond_init */
 
@@ -1110,6 +1501,20 @@ static int gmond_shutdown (void) /* {{{ */
   mc_send_sockets_num = 0;
   pthread_mutex_unlock (&mc_send_sockets_lock);
 
+  pthread_mutex_lock (&staging_lock);
+  while (staging_lru_head != NULL)
+  {
+    staging_entry_t *se = staging_lru_head;
+    staging_lru_unlink (se);
+    staging_entry_free (se);
+  }
+  c_htable_destroy (staging_index);
+  staging_index = NULL;
+  staging_num = 0;
+  pthread_mutex_unlock (&staging_lock);
+
+  c_htable_destroy (metric_index);
+  metric_index = NULL;
 
   return (0);
 } /* }}} int gmond_shutdown */
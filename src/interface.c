@@ -93,6 +93,11 @@ static int config_keys_num = 2;
 
 static ignorelist_t *ignorelist = NULL;
 
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+# include "utils_procfile.h"
+static cu_procfile_t *proc_net_dev = NULL;
+#endif /* KERNEL_LINUX && !HAVE_GETIFADDRS */
+
 #ifdef HAVE_LIBKSTAT
 #define MAX_NUMIF 256
 extern kstat_ctl_t *kc;
@@ -231,8 +236,7 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
 	derive_t incoming, outgoing;
 	char *device;
 
@@ -240,15 +244,22 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+	if (proc_net_dev == NULL)
+	{
+		proc_net_dev = cu_procfile_create ("/proc/net/dev");
+		if (proc_net_dev == NULL)
+			return (-1);
+	}
+
+	if (cu_procfile_read (proc_net_dev) != 0)
 	{
 		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
+		WARNING ("interface plugin: Reading /proc/net/dev failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	while ((buffer = cu_procfile_readline (proc_net_dev)) != NULL)
 	{
 		if (!(dummy = strchr(buffer, ':')))
 			continue;
@@ -279,8 +290,6 @@ static int interface_read (void)
 		outgoing = atoll (fields[10]);
 		if_submit (device, "if_errors", incoming, outgoing);
 	}
-
-	fclose (fh);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -376,6 +385,15 @@ static int interface_read (void)
 	return (0);
 } /* int interface_read */
 
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+static int interface_shutdown (void)
+{
+	cu_procfile_destroy (proc_net_dev);
+	proc_net_dev = NULL;
+	return (0);
+}
+#endif /* KERNEL_LINUX && !HAVE_GETIFADDRS */
+
 void module_register (void)
 {
 	plugin_register_config ("interface", interface_config,
@@ -384,4 +402,7 @@ void module_register (void)
 	plugin_register_init ("interface", interface_init);
 #endif
 	plugin_register_read ("interface", interface_read);
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+	plugin_register_shutdown ("interface", interface_shutdown);
+#endif
 } /* void module_register */
@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,8 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+static cu_procfile_t *proc_interrupts = NULL;
+
 /*
  * Private functions
  */
@@ -90,12 +93,30 @@ static void irq_submit (const char *irq_name, derive_t value)
 	plugin_dispatch_values (&vl);
 } /* void irq_submit */
 
+/* Returns the number of whitespace separated fields in `buffer'. */
+static int irq_count_fields (const char *buffer)
+{
+	int count = 0;
+
+	while (*buffer != 0)
+	{
+		while (isspace ((int) *buffer))
+			buffer++;
+		if (*buffer == 0)
+			break;
+
+		count++;
+		while ((*buffer != 0) && !isspace ((int) *buffer))
+			buffer++;
+	}
+
+	return (count);
+} /* int irq_count_fields */
+
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
 	int  cpu_count;
-	char *fields[256];
 
 	/*
 	 * Example content:
@@ -104,49 +125,49 @@ static int irq_read (void)
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if (proc_interrupts == NULL)
+	{
+		proc_interrupts = cu_procfile_create ("/proc/interrupts");
+		if (proc_interrupts == NULL)
+			return (-1);
+	}
+
+	if (cu_procfile_read (proc_interrupts) != 0)
 	{
 		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
+		ERROR ("irq plugin: Reading /proc/interrupts failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
 	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
+	if ((buffer = cu_procfile_readline (proc_interrupts)) != NULL) {
+		cpu_count = irq_count_fields (buffer);
 	} else {
 		ERROR ("irq plugin: unable to get CPU count from first line "
 				"of /proc/interrupts");
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	/* The lines are parsed in place rather than split into a fields
+	 * array, because on large systems a line has one field per CPU. */
+	while ((buffer = cu_procfile_readline (proc_interrupts)) != NULL)
 	{
 		char *irq_name;
 		size_t irq_name_len;
 		derive_t irq_value;
+		char *ptr;
 		int i;
-		int fields_num;
-		int irq_values_to_parse;
-
-		fields_num = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
-		if (fields_num < 2)
-			continue;
-
-		/* Parse this many numeric fields, skip the rest
-		 * (+1 because first there is a name of irq in each line) */
-		if (fields_num >= cpu_count + 1)
-			irq_values_to_parse = cpu_count;
-		else
-			irq_values_to_parse = fields_num - 1;
 
 		/* First field is irq name and colon */
-		irq_name = fields[0];
-		irq_name_len = strlen (irq_name);
+		irq_name = buffer;
+		while (isspace ((int) *irq_name))
+			irq_name++;
+
+		irq_name_len = 0;
+		while ((irq_name[irq_name_len] != 0)
+				&& !isspace ((int) irq_name[irq_name_len]))
+			irq_name_len++;
 		if (irq_name_len < 2)
 			continue;
 
@@ -155,38 +176,50 @@ static int irq_read (void)
 		if (irq_name[irq_name_len - 1] != ':')
 			continue;
 
+		ptr = irq_name + irq_name_len;
 		irq_name[irq_name_len - 1] = 0;
 		irq_name_len--;
 
 		irq_value = 0;
-		for (i = 1; i <= irq_values_to_parse; i++)
+		for (i = 0; i < cpu_count; i++)
 		{
 			/* Per-CPU value */
-			value_t v;
-			int status;
+			char *endptr = NULL;
+			long long v;
 
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
-			if (status != 0)
+			errno = 0;
+			v = strtoll (ptr, &endptr, 0);
+			if ((endptr == ptr) || (errno != 0))
+				break;
+			if ((*endptr != 0) && !isspace ((int) *endptr))
 				break;
 
-			irq_value += v.derive;
+			irq_value += (derive_t) v;
+			ptr = endptr;
 		} /* for (i) */
 
 		/* No valid fields -> do not submit anything. */
-		if (i <= 1)
+		if (i == 0)
 			continue;
 
 		irq_submit (irq_name, irq_value);
 	}
 
-	fclose (fh);
-
 	return (0);
 } /* int irq_read */
 
+static int irq_shutdown (void)
+{
+	cu_procfile_destroy (proc_interrupts);
+	proc_interrupts = NULL;
+
+	return (0);
+} /* int irq_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("irq", irq_config,
 			config_keys, config_keys_num);
 	plugin_register_read ("irq", irq_read);
+	plugin_register_shutdown ("irq", irq_shutdown);
 } /* void module_register */
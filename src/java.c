@@ -40,6 +40,9 @@ struct cjni_jvm_env_s /* {{{ */
 {
   JNIEnv *jvm_env;
   int reference_counter;
+  /* If set, the thread stays attached (as a daemon thread) when the
+   * reference counter drops to zero. It is detached when it exits. */
+  _Bool permanent;
 };
 typedef struct cjni_jvm_env_s cjni_jvm_env_t;
 /* }}} */
@@ -63,6 +66,7 @@ typedef struct java_plugin_class_s java_plugin_class_t;
 #define CB_TYPE_NOTIFICATION 8
 #define CB_TYPE_MATCH        9
 #define CB_TYPE_TARGET      10
+#define CB_TYPE_WRITE_BATCH 11
 struct cjni_callback_info_s /* {{{ */
 {
   char     *name;
@@ -74,6 +78,77 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* A value list queued by a batched write callback. The values are stored in
+ * the writer's `values' array; `values_offset' points into it. */
+struct cjni_batch_entry_s /* {{{ */
+{
+  const data_set_t *ds;
+  value_list_t vl;
+  size_t values_offset;
+};
+typedef struct cjni_batch_entry_s cjni_batch_entry_t;
+/* }}} */
+
+struct cjni_batch_writer_s /* {{{ */
+{
+  cjni_callback_info_t *cbi;
+
+  cjni_batch_entry_t *entries;
+  size_t entries_num;
+  size_t entries_size;
+
+  value_t *values;
+  size_t values_num;
+  size_t values_size;
+
+  /* Time the first entry was added to the (currently empty) batch. */
+  cdtime_t first_entry;
+
+  pthread_mutex_t lock;
+};
+typedef struct cjni_batch_writer_s cjni_batch_writer_t;
+/* }}} */
+
+/* Classes and method IDs used when converting value lists. They are looked up
+ * once, right after the JVM has been created, rather than once per value. */
+struct cjni_class_cache_s /* {{{ */
+{
+  jclass    c_valuelist;
+  jmethodID m_valuelist_constructor;
+  jmethodID m_valuelist_set_data_set;
+  jmethodID m_valuelist_set_host;
+  jmethodID m_valuelist_set_plugin;
+  jmethodID m_valuelist_set_plugin_instance;
+  jmethodID m_valuelist_set_type;
+  jmethodID m_valuelist_set_type_instance;
+  jmethodID m_valuelist_set_time;
+  jmethodID m_valuelist_set_interval;
+  jmethodID m_valuelist_add_value;
+
+  jclass    c_dataset;
+  jmethodID m_dataset_constructor;
+  jmethodID m_dataset_add_data_source;
+
+  jclass    c_datasource;
+  jmethodID m_datasource_constructor;
+  jmethodID m_datasource_set_name;
+  jmethodID m_datasource_set_type;
+  jmethodID m_datasource_set_min;
+  jmethodID m_datasource_set_max;
+
+  jclass    c_long;
+  jmethodID m_long_constructor;
+
+  jclass    c_double;
+  jmethodID m_double_constructor;
+
+  jclass    c_arraylist;
+  jmethodID m_arraylist_constructor;
+  jmethodID m_arraylist_add;
+};
+typedef struct cjni_class_cache_s cjni_class_cache_t;
+/* }}} */
+
 /*
  * Global variables
  */
@@ -95,6 +170,14 @@ static pthread_mutex_t       java_callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static oconfig_item_t       *config_block = NULL;
 
+static cjni_class_cache_t    class_cache;
+
+/* Batched write callbacks. Remaining values are written when shutting down. */
+#define CJNI_DEFAULT_BATCH_SIZE 128
+static size_t                batch_size = CJNI_DEFAULT_BATCH_SIZE;
+static cjni_batch_writer_t **batch_writers     = NULL;
+static size_t                batch_writers_num = 0;
+
 /*
  * Prototypes
  *
@@ -109,6 +192,13 @@ static int cjni_callback_register (JNIEnv *jvm_env, jobject o_name,
 static int cjni_read (user_data_t *user_data);
 static int cjni_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t *ud);
+static int cjni_write_batch (const data_set_t *ds, const value_list_t *vl,
+    user_data_t *ud);
+static int cjni_read_batch (user_data_t *ud);
+static int cjni_flush_batch (cdtime_t timeout, const char *identifier,
+    user_data_t *ud);
+static void cjni_batch_writer_destroy (void *arg);
+static JNIEnv *cjni_thread_attach_permanent (void);
 static int cjni_flush (cdtime_t timeout, const char *identifier, user_data_t *ud);
 static void cjni_log (int severity, const char *message, user_data_t *ud);
 static int cjni_notification (const notification_t *n, user_data_t *ud);
@@ -201,81 +291,18 @@ static int ctoj_long (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} int ctoj_long */
 
-static int ctoj_double (JNIEnv *jvm_env, /* {{{ */
-    jdouble value,
-    jclass class_ptr, jobject object_ptr, const char *method_name)
-{
-  jmethodID m_set;
-
-  /* Search for the `void setFoo (double d)' method. */
-  m_set = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      method_name, "(D)V");
-  if (m_set == NULL)
-  {
-    ERROR ("java plugin: ctoj_double: Cannot find method `void %s (double)'.",
-        method_name);
-    return (-1);
-  }
-
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, value);
-
-  return (0);
-} /* }}} int ctoj_double */
-
 /* Convert a jlong to a java.lang.Number */
 static jobject ctoj_jlong_to_number (JNIEnv *jvm_env, jlong value) /* {{{ */
 {
-  jclass c_long;
-  jmethodID m_long_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_long = (*jvm_env)->FindClass (jvm_env, "java/lang/Long");
-  if (c_long == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "java.lang.Long class failed.");
-    return (NULL);
-  }
-
-  m_long_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_long, "<init>", "(J)V");
-  if (m_long_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "`Long (long)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_long, m_long_constructor, value));
+        class_cache.c_long, class_cache.m_long_constructor, value));
 } /* }}} jobject ctoj_jlong_to_number */
 
 /* Convert a jdouble to a java.lang.Number */
 static jobject ctoj_jdouble_to_number (JNIEnv *jvm_env, jdouble value) /* {{{ */
 {
-  jclass c_double;
-  jmethodID m_double_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_double = (*jvm_env)->FindClass (jvm_env, "java/lang/Double");
-  if (c_double == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "java.lang.Double class failed.");
-    return (NULL);
-  }
-
-  m_double_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_double, "<init>", "(D)V");
-  if (m_double_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "`Double (double)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_double, m_double_constructor, value));
+        class_cache.c_double, class_cache.m_double_constructor, value));
 } /* }}} jobject ctoj_jdouble_to_number */
 
 /* Convert a value_t to a java.lang.Number */
@@ -298,34 +325,12 @@ static jobject ctoj_value_to_number (JNIEnv *jvm_env, /* {{{ */
 static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
     const data_source_t *dsrc)
 {
-  jclass c_datasource;
-  jmethodID m_datasource_constructor;
   jobject o_datasource;
-  int status;
-
-  /* Look up the DataSource class */
-  c_datasource = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/DataSource");
-  if (c_datasource == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "FindClass (org/collectd/api/DataSource) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_datasource_constructor = (*jvm_env)->GetMethodID (jvm_env, c_datasource,
-      "<init>", "()V");
-  if (m_datasource_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: Cannot find the "
-        "`DataSource ()' constructor.");
-    return (NULL);
-  }
+  jstring o_name;
 
   /* Create a new instance. */
-  o_datasource = (*jvm_env)->NewObject (jvm_env, c_datasource,
-      m_datasource_constructor);
+  o_datasource = (*jvm_env)->NewObject (jvm_env, class_cache.c_datasource,
+      class_cache.m_datasource_constructor);
   if (o_datasource == NULL)
   {
     ERROR ("java plugin: ctoj_data_source: "
@@ -334,48 +339,28 @@ static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set name via `void setName (String name)' */
-  status = ctoj_string (jvm_env, dsrc->name,
-      c_datasource, o_datasource, "setName");
-  if (status != 0)
+  o_name = (*jvm_env)->NewStringUTF (jvm_env, dsrc->name);
+  if (o_name == NULL)
   {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_string (setName) failed.");
+    ERROR ("java plugin: ctoj_data_source: NewStringUTF failed.");
     (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
     return (NULL);
   }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_name, o_name);
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_name);
 
   /* Set type via `void setType (int type)' */
-  status = ctoj_int (jvm_env, dsrc->type,
-      c_datasource, o_datasource, "setType");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_int (setType) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_type, (jint) dsrc->type);
 
   /* Set min via `void setMin (double min)' */
-  status = ctoj_double (jvm_env, dsrc->min,
-      c_datasource, o_datasource, "setMin");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMin) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_min, (jdouble) dsrc->min);
 
   /* Set max via `void setMax (double max)' */
-  status = ctoj_double (jvm_env, dsrc->max,
-      c_datasource, o_datasource, "setMax");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMax) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_max, (jdouble) dsrc->max);
 
   return (o_datasource);
 } /* }}} jobject ctoj_data_source */
@@ -596,42 +581,10 @@ static jobject ctoj_oconfig_item (JNIEnv *jvm_env, /* {{{ */
 /* Convert a data_set_t to a org/collectd/api/DataSet */
 static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 {
-  jclass c_dataset;
-  jmethodID m_constructor;
-  jmethodID m_add;
   jobject o_type;
   jobject o_dataset;
   int i;
 
-  /* Look up the org/collectd/api/DataSet class */
-  c_dataset = (*jvm_env)->FindClass (jvm_env, "org/collectd/api/DataSet");
-  if (c_dataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "org/collectd/api/DataSet class failed.");
-    return (NULL);
-  }
-
-  /* Search for the `DataSet (String type)' constructor. */
-  m_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "<init>", "(Ljava/lang/String;)V");
-  if (m_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`DataSet (String)' constructor failed.");
-    return (NULL);
-  }
-
-  /* Search for the `void addDataSource (DataSource)' method. */
-  m_add = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "addDataSource", "(Lorg/collectd/api/DataSource;)V");
-  if (m_add == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`addDataSource (DataSource)' method failed.");
-    return (NULL);
-  }
-
   o_type = (*jvm_env)->NewStringUTF (jvm_env, ds->type);
   if (o_type == NULL)
   {
@@ -639,8 +592,8 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
     return (NULL);
   }
 
-  o_dataset = (*jvm_env)->NewObject (jvm_env,
-      c_dataset, m_constructor, o_type);
+  o_dataset = (*jvm_env)->NewObject (jvm_env, class_cache.c_dataset,
+      class_cache.m_dataset_constructor, o_type);
   if (o_dataset == NULL)
   {
     ERROR ("java plugin: ctoj_data_set: Creating a DataSet object failed.");
@@ -664,7 +617,8 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
       return (NULL);
     }
 
-    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset, m_add, o_datasource);
+    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset,
+        class_cache.m_dataset_add_data_source, o_datasource);
 
     (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
   } /* for (i = 0; i < ds->ds_num; i++) */
@@ -673,21 +627,10 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 } /* }}} jobject ctoj_data_set */
 
 static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
-    value_t value, int ds_type,
-    jclass class_ptr, jobject object_ptr)
+    value_t value, int ds_type, jobject object_ptr)
 {
-  jmethodID m_addvalue;
   jobject o_number;
 
-  m_addvalue = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      "addValue", "(Ljava/lang/Number;)V");
-  if (m_addvalue == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_value: "
-        "Cannot find method `void addValue (Number)'.");
-    return (-1);
-  }
-
   o_number = ctoj_value_to_number (jvm_env, value, ds_type);
   if (o_number == NULL)
   {
@@ -696,82 +639,55 @@ static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
     return (-1);
   }
 
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_addvalue, o_number);
+  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr,
+      class_cache.m_valuelist_add_value, o_number);
 
   (*jvm_env)->DeleteLocalRef (jvm_env, o_number);
 
   return (0);
 } /* }}} int ctoj_value_list_add_value */
 
+/* If `o_dataset' is NULL, a new DataSet object is created for `ds'. */
 static int ctoj_value_list_add_data_set (JNIEnv *jvm_env, /* {{{ */
-    jclass c_valuelist, jobject o_valuelist, const data_set_t *ds)
+    jobject o_valuelist, const data_set_t *ds, jobject o_dataset)
 {
-  jmethodID m_setdataset;
-  jobject o_dataset;
+  jobject o_new = NULL;
 
-  /* Look for the `void setDataSource (List<DataSource> ds)' method. */
-  m_setdataset = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
-  if (m_setdataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "Cannot find the `void setDataSet (DataSet)' method.");
-    return (-1);
-  }
-
-  /* Create a DataSet object. */
-  o_dataset = ctoj_data_set (jvm_env, ds);
   if (o_dataset == NULL)
   {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "ctoj_data_set (%s) failed.", ds->type);
-    return (-1);
+    o_new = ctoj_data_set (jvm_env, ds);
+    if (o_new == NULL)
+    {
+      ERROR ("java plugin: ctoj_value_list_add_data_set: "
+          "ctoj_data_set (%s) failed.", ds->type);
+      return (-1);
+    }
+    o_dataset = o_new;
   }
 
-  /* Actually call the method. */
+  /* Actually call the `void setDataSet (DataSet ds)' method. */
   (*jvm_env)->CallVoidMethod (jvm_env,
-      o_valuelist, m_setdataset, o_dataset);
+      o_valuelist, class_cache.m_valuelist_set_data_set, o_dataset);
 
-  /* Decrease reference counter on the List<DataSource> object. */
-  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+  if (o_new != NULL)
+    (*jvm_env)->DeleteLocalRef (jvm_env, o_new);
 
   return (0);
 } /* }}} int ctoj_value_list_add_data_set */
 
-/* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList */
+/* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList.
+ * `o_dataset' is the DataSet object to use; if it is NULL, a new one is
+ * created. */
 static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
-    const data_set_t *ds, const value_list_t *vl)
+    const data_set_t *ds, const value_list_t *vl, jobject o_dataset)
 {
-  jclass c_valuelist;
-  jmethodID m_valuelist_constructor;
   jobject o_valuelist;
   int status;
   int i;
 
-  /* First, create a new ValueList instance..
-   * Look up the class.. */
-  c_valuelist = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/ValueList");
-  if (c_valuelist == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: "
-        "FindClass (org/collectd/api/ValueList) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_valuelist_constructor = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "<init>", "()V");
-  if (m_valuelist_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: Cannot find the "
-        "`ValueList ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_valuelist = (*jvm_env)->NewObject (jvm_env, c_valuelist,
-      m_valuelist_constructor);
+  o_valuelist = (*jvm_env)->NewObject (jvm_env, class_cache.c_valuelist,
+      class_cache.m_valuelist_constructor);
   if (o_valuelist == NULL)
   {
     ERROR ("java plugin: ctoj_value_list: Creating a new ValueList instance "
@@ -779,8 +695,7 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     return (NULL);
   }
 
-  status = ctoj_value_list_add_data_set (jvm_env,
-      c_valuelist, o_valuelist, ds);
+  status = ctoj_value_list_add_data_set (jvm_env, o_valuelist, ds, o_dataset);
   if (status != 0)
   {
     ERROR ("java plugin: ctoj_value_list: "
@@ -790,49 +705,41 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set the strings.. */
-#define SET_STRING(str,method_name) do { \
-  status = ctoj_string (jvm_env, str, \
-      c_valuelist, o_valuelist, method_name); \
-  if (status != 0) { \
-    ERROR ("java plugin: ctoj_value_list: ctoj_string (%s) failed.", \
-        method_name); \
+#define SET_STRING(str,method_id) do { \
+  jstring o_string = (*jvm_env)->NewStringUTF (jvm_env, str); \
+  if (o_string == NULL) { \
+    ERROR ("java plugin: ctoj_value_list: NewStringUTF (%s) failed.", \
+        #str); \
     (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist); \
     return (NULL); \
-  } } while (0)
-
-  SET_STRING (vl->host,            "setHost");
-  SET_STRING (vl->plugin,          "setPlugin");
-  SET_STRING (vl->plugin_instance, "setPluginInstance");
-  SET_STRING (vl->type,            "setType");
-  SET_STRING (vl->type_instance,   "setTypeInstance");
+  } \
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist, method_id, o_string); \
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_string); \
+  } while (0)
+
+  SET_STRING (vl->host,            class_cache.m_valuelist_set_host);
+  SET_STRING (vl->plugin,          class_cache.m_valuelist_set_plugin);
+  SET_STRING (vl->plugin_instance,
+      class_cache.m_valuelist_set_plugin_instance);
+  SET_STRING (vl->type,            class_cache.m_valuelist_set_type);
+  SET_STRING (vl->type_instance,
+      class_cache.m_valuelist_set_type_instance);
 
 #undef SET_STRING
 
   /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long (jvm_env, (jlong) CDTIME_T_TO_MS (vl->time),
-      c_valuelist, o_valuelist, "setTime");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      class_cache.m_valuelist_set_time, (jlong) CDTIME_T_TO_MS (vl->time));
 
   /* Set the `interval' member.. */
-  status = ctoj_long (jvm_env,
-      (jlong) CDTIME_T_TO_MS (vl->interval),
-      c_valuelist, o_valuelist, "setInterval");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setInterval) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      class_cache.m_valuelist_set_interval,
+      (jlong) CDTIME_T_TO_MS (vl->interval));
 
   for (i = 0; i < vl->values_len; i++)
   {
     status = ctoj_value_list_add_value (jvm_env, vl->values[i], ds->ds[i].type,
-        c_valuelist, o_valuelist);
+        o_valuelist);
     if (status != 0)
     {
       ERROR ("java plugin: ctoj_value_list: "
@@ -1451,6 +1358,70 @@ static jint JNICALL cjni_api_register_write (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} jint cjni_api_register_write */
 
+static jint JNICALL cjni_api_register_write_batch (JNIEnv *jvm_env, /* {{{ */
+    jobject this, jobject o_name, jobject o_write)
+{
+  user_data_t ud;
+  cjni_callback_info_t *cbi;
+  cjni_batch_writer_t *bw;
+  cjni_batch_writer_t **tmp;
+  char read_name[1024];
+
+  cbi = cjni_callback_info_create (jvm_env, o_name, o_write,
+      CB_TYPE_WRITE_BATCH);
+  if (cbi == NULL)
+    return (-1);
+
+  DEBUG ("java plugin: Registering new batch write callback: %s", cbi->name);
+
+  bw = (cjni_batch_writer_t *) malloc (sizeof (*bw));
+  if (bw == NULL)
+  {
+    ERROR ("java plugin: cjni_api_register_write_batch: malloc failed.");
+    cjni_callback_info_destroy (cbi);
+    return (-1);
+  }
+  memset (bw, 0, sizeof (*bw));
+  bw->cbi = cbi;
+  bw->entries_size = batch_size;
+  pthread_mutex_init (&bw->lock, /* attr = */ NULL);
+
+  pthread_mutex_lock (&java_callbacks_lock);
+  tmp = (cjni_batch_writer_t **) realloc (batch_writers,
+      (batch_writers_num + 1) * sizeof (*batch_writers));
+  if (tmp == NULL)
+  {
+    pthread_mutex_unlock (&java_callbacks_lock);
+    ERROR ("java plugin: cjni_api_register_write_batch: realloc failed.");
+    cjni_batch_writer_destroy (bw);
+    return (-1);
+  }
+  batch_writers = tmp;
+  batch_writers[batch_writers_num] = bw;
+  batch_writers_num++;
+  pthread_mutex_unlock (&java_callbacks_lock);
+
+  /* The flush and read callbacks share the object but must not free it. The
+   * read callback writes batches which have been waiting for an interval
+   * when no new values arrive. Read callbacks are stopped before the write
+   * callback is destroyed. */
+  memset (&ud, 0, sizeof (ud));
+  ud.data = (void *) bw;
+  ud.free_func = NULL;
+  plugin_register_flush (cbi->name, cjni_flush_batch, &ud);
+
+  ssnprintf (read_name, sizeof (read_name), "%s/batch", cbi->name);
+  plugin_register_complex_read (/* group = */ NULL, read_name,
+      cjni_read_batch, /* interval = */ NULL, &ud);
+
+  ud.free_func = cjni_batch_writer_destroy;
+  plugin_register_write (cbi->name, cjni_write_batch, &ud);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_write);
+
+  return (0);
+} /* }}} jint cjni_api_register_write_batch */
+
 static jint JNICALL cjni_api_register_flush (JNIEnv *jvm_env, /* {{{ */
     jobject this, jobject o_name, jobject o_flush)
 {
@@ -1661,6 +1632,10 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
     "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteInterface;)I",
     cjni_api_register_write },
 
+  { "registerWrite",
+    "(Ljava/lang/String;Lorg/collectd/api/CollectdBatchWriteInterface;)I",
+    cjni_api_register_write_batch },
+
   { "registerFlush",
     "(Ljava/lang/String;Lorg/collectd/api/CollectdFlushInterface;)I",
     cjni_api_register_flush },
@@ -1728,6 +1703,11 @@ static cjni_callback_info_t *cjni_callback_info_create (JNIEnv *jvm_env, /* {{{
       method_signature = "(Lorg/collectd/api/ValueList;)I";
       break;
 
+    case CB_TYPE_WRITE_BATCH:
+      method_name = "write";
+      method_signature = "(Ljava/util/List;)I";
+      break;
+
     case CB_TYPE_FLUSH:
       method_name = "flush";
       method_signature = "(Ljava/lang/Number;Ljava/lang/String;)I";
@@ -1912,6 +1892,16 @@ static void cjni_jvm_env_destroy (void *args) /* {{{ */
         "cjni_env->reference_counter = %i;", cjni_env->reference_counter);
   }
 
+  if (cjni_env->permanent && (cjni_env->reference_counter == 0)
+      && (cjni_env->jvm_env != NULL))
+  {
+    /* Threads attached by `cjni_thread_attach_permanent' are detached when
+     * they exit. */
+    if (jvm != NULL)
+      (*jvm)->DetachCurrentThread (jvm);
+    cjni_env->jvm_env = NULL;
+  }
+
   if (cjni_env->jvm_env != NULL)
   {
     ERROR ("java plugin: cjni_jvm_env_destroy: cjni_env->jvm_env = %p;",
@@ -1949,6 +1939,106 @@ static int cjni_init_native (JNIEnv *jvm_env) /* {{{ */
   return (0);
 } /* }}} int cjni_init_native */
 
+/* Look up the classes and methods used by the value list conversion functions
+ * and store them in `class_cache'. */
+static int cjni_init_class_cache (JNIEnv *jvm_env) /* {{{ */
+{
+  jclass tmp;
+
+#define LOOKUP_CLASS(member,name) do { \
+  tmp = (*jvm_env)->FindClass (jvm_env, name); \
+  if (tmp == NULL) { \
+    ERROR ("java plugin: cjni_init_class_cache: FindClass (%s) failed.", \
+        name); \
+    return (-1); \
+  } \
+  class_cache.member = (*jvm_env)->NewGlobalRef (jvm_env, tmp); \
+  (*jvm_env)->DeleteLocalRef (jvm_env, tmp); \
+  if (class_cache.member == NULL) { \
+    ERROR ("java plugin: cjni_init_class_cache: NewGlobalRef (%s) failed.", \
+        name); \
+    return (-1); \
+  } } while (0)
+
+#define LOOKUP_METHOD(member,class,name,signature) do { \
+  class_cache.member = (*jvm_env)->GetMethodID (jvm_env, class_cache.class, \
+      name, signature); \
+  if (class_cache.member == NULL) { \
+    ERROR ("java plugin: cjni_init_class_cache: Cannot find method " \
+        "`%s' with signature `%s'.", name, signature); \
+    return (-1); \
+  } } while (0)
+
+  LOOKUP_CLASS (c_valuelist, "org/collectd/api/ValueList");
+  LOOKUP_METHOD (m_valuelist_constructor, c_valuelist, "<init>", "()V");
+  LOOKUP_METHOD (m_valuelist_set_data_set, c_valuelist,
+      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
+  LOOKUP_METHOD (m_valuelist_set_host, c_valuelist,
+      "setHost", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_plugin, c_valuelist,
+      "setPlugin", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_plugin_instance, c_valuelist,
+      "setPluginInstance", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_type, c_valuelist,
+      "setType", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_type_instance, c_valuelist,
+      "setTypeInstance", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_time, c_valuelist, "setTime", "(J)V");
+  LOOKUP_METHOD (m_valuelist_set_interval, c_valuelist,
+      "setInterval", "(J)V");
+  LOOKUP_METHOD (m_valuelist_add_value, c_valuelist,
+      "addValue", "(Ljava/lang/Number;)V");
+
+  LOOKUP_CLASS (c_dataset, "org/collectd/api/DataSet");
+  LOOKUP_METHOD (m_dataset_constructor, c_dataset,
+      "<init>", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_dataset_add_data_source, c_dataset,
+      "addDataSource", "(Lorg/collectd/api/DataSource;)V");
+
+  LOOKUP_CLASS (c_datasource, "org/collectd/api/DataSource");
+  LOOKUP_METHOD (m_datasource_constructor, c_datasource, "<init>", "()V");
+  LOOKUP_METHOD (m_datasource_set_name, c_datasource,
+      "setName", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_datasource_set_type, c_datasource, "setType", "(I)V");
+  LOOKUP_METHOD (m_datasource_set_min, c_datasource, "setMin", "(D)V");
+  LOOKUP_METHOD (m_datasource_set_max, c_datasource, "setMax", "(D)V");
+
+  LOOKUP_CLASS (c_long, "java/lang/Long");
+  LOOKUP_METHOD (m_long_constructor, c_long, "<init>", "(J)V");
+
+  LOOKUP_CLASS (c_double, "java/lang/Double");
+  LOOKUP_METHOD (m_double_constructor, c_double, "<init>", "(D)V");
+
+  LOOKUP_CLASS (c_arraylist, "java/util/ArrayList");
+  LOOKUP_METHOD (m_arraylist_constructor, c_arraylist, "<init>", "(I)V");
+  LOOKUP_METHOD (m_arraylist_add, c_arraylist, "add", "(Ljava/lang/Object;)Z");
+
+#undef LOOKUP_METHOD
+#undef LOOKUP_CLASS
+
+  return (0);
+} /* }}} int cjni_init_class_cache */
+
+/* Release the global references held by `class_cache'. */
+static void cjni_free_class_cache (JNIEnv *jvm_env) /* {{{ */
+{
+#define FREE_CLASS(member) do { \
+  if (class_cache.member != NULL) \
+    (*jvm_env)->DeleteGlobalRef (jvm_env, class_cache.member); \
+  } while (0)
+
+  FREE_CLASS (c_valuelist);
+  FREE_CLASS (c_dataset);
+  FREE_CLASS (c_datasource);
+  FREE_CLASS (c_long);
+  FREE_CLASS (c_double);
+  FREE_CLASS (c_arraylist);
+
+#undef FREE_CLASS
+
+  memset (&class_cache, 0, sizeof (class_cache));
+} /* }}} void cjni_free_class_cache */
+
 /* Create the JVM. This is called when the first thread tries to access the JVM
  * via cjni_thread_attach. */
 static int cjni_create_jvm (void) /* {{{ */
@@ -2004,6 +2094,13 @@ static int cjni_create_jvm (void) /* {{{ */
     return (-1);
   }
 
+  status = cjni_init_class_cache (jvm_env);
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_create_jvm: cjni_init_class_cache failed.");
+    return (-1);
+  }
+
   DEBUG ("java plugin: The JVM has been created.");
   return (0);
 } /* }}} int cjni_create_jvm */
@@ -2047,7 +2144,9 @@ static JNIEnv *cjni_thread_attach (void) /* {{{ */
     pthread_setspecific (jvm_env_key, cjni_env);
   }
 
-  if (cjni_env->reference_counter > 0)
+  /* The thread may still be attached with a reference counter of zero if it
+   * was attached by `cjni_thread_attach_permanent'. */
+  if ((cjni_env->reference_counter > 0) || (cjni_env->jvm_env != NULL))
   {
     cjni_env->reference_counter++;
     jvm_env = cjni_env->jvm_env;
@@ -2080,6 +2179,59 @@ static JNIEnv *cjni_thread_attach (void) /* {{{ */
   return (jvm_env);
 } /* }}} JNIEnv *cjni_thread_attach */
 
+/* Like `cjni_thread_attach', but keep the thread attached (as a daemon
+ * thread) when the reference counter drops to zero again. This is used by the
+ * write callbacks, which are called for every value list, so attaching and
+ * detaching the calling thread each time is avoided. */
+static JNIEnv *cjni_thread_attach_permanent (void) /* {{{ */
+{
+  cjni_jvm_env_t *cjni_env;
+  JNIEnv *jvm_env;
+
+  if (jvm == NULL)
+    return (cjni_thread_attach ());
+
+  cjni_env = pthread_getspecific (jvm_env_key);
+  if ((cjni_env == NULL) || (cjni_env->jvm_env == NULL))
+  {
+    int status;
+    JavaVMAttachArgs args;
+
+    if (cjni_env == NULL)
+    {
+      /* This pointer is free'd in `cjni_jvm_env_destroy'. */
+      cjni_env = (cjni_jvm_env_t *) malloc (sizeof (*cjni_env));
+      if (cjni_env == NULL)
+      {
+        ERROR ("java plugin: cjni_thread_attach_permanent: malloc failed.");
+        return (NULL);
+      }
+      memset (cjni_env, 0, sizeof (*cjni_env));
+      pthread_setspecific (jvm_env_key, cjni_env);
+    }
+
+    memset (&args, 0, sizeof (args));
+    args.version = JNI_VERSION_1_2;
+
+    status = (*jvm)->AttachCurrentThreadAsDaemon (jvm, (void *) &jvm_env,
+        (void *) &args);
+    if (status != 0)
+    {
+      ERROR ("java plugin: cjni_thread_attach_permanent: "
+          "AttachCurrentThreadAsDaemon failed with status %i.", status);
+      return (NULL);
+    }
+
+    cjni_env->jvm_env = jvm_env;
+    cjni_env->reference_counter = 0;
+    cjni_env->permanent = 1;
+  }
+
+  cjni_env->reference_counter++;
+  assert (cjni_env->jvm_env != NULL);
+  return (cjni_env->jvm_env);
+} /* }}} JNIEnv *cjni_thread_attach_permanent */
+
 /* Decrease the reference counter of this thread. If it reaches zero, detach
  * from the JVM. */
 static int cjni_thread_detach (void) /* {{{ */
@@ -2101,7 +2253,7 @@ static int cjni_thread_detach (void) /* {{{ */
   DEBUG ("java plugin: cjni_thread_detach: cjni_env->reference_counter = %i",
       cjni_env->reference_counter);
 
-  if (cjni_env->reference_counter > 0)
+  if ((cjni_env->reference_counter > 0) || cjni_env->permanent)
     return (0);
 
   status = (*jvm)->DetachCurrentThread (jvm);
@@ -2155,6 +2307,29 @@ static int cjni_config_add_jvm_arg (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int cjni_config_add_jvm_arg */
 
+static int cjni_config_batch_size (oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+  int status;
+
+  status = cf_util_get_int (ci, &tmp);
+  if (status != 0)
+    return (status);
+
+  if (tmp < 1)
+  {
+    WARNING ("java plugin: `BatchSize' must be a positive integer.");
+    return (-1);
+  }
+
+  if (java_classes_list_len > 0)
+    WARNING ("java plugin: `BatchSize' only affects write callbacks "
+        "registered by classes loaded after (i.e. below) this option.");
+
+  batch_size = (size_t) tmp;
+  return (0);
+} /* }}} int cjni_config_batch_size */
+
 static int cjni_config_load_plugin (oconfig_item_t *ci) /* {{{ */
 {
   JNIEnv *jvm_env;
@@ -2340,6 +2515,14 @@ static int cjni_config_perform (oconfig_item_t *ci) /* {{{ */
       else
         errors++;
     }
+    else if (strcasecmp ("BatchSize", child->key) == 0)
+    {
+      status = cjni_config_batch_size (child);
+      if (status == 0)
+        success++;
+      else
+        errors++;
+    }
     else if (strcasecmp ("LoadPlugin", child->key) == 0)
     {
       status = cjni_config_load_plugin (child);
@@ -2524,16 +2707,17 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     return (-1);
   }
 
-  jvm_env = cjni_thread_attach ();
+  jvm_env = cjni_thread_attach_permanent ();
   if (jvm_env == NULL)
     return (-1);
 
   cbi = (cjni_callback_info_t *) ud->data;
 
-  vl_java = ctoj_value_list (jvm_env, ds, vl);
+  vl_java = ctoj_value_list (jvm_env, ds, vl, /* o_dataset = */ NULL);
   if (vl_java == NULL)
   {
     ERROR ("java plugin: cjni_write: ctoj_value_list failed.");
+    cjni_thread_detach ();
     return (-1);
   }
 
@@ -2552,6 +2736,343 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
   return (ret_status);
 } /* }}} int cjni_write */
 
+/* Convert all value lists in `entries' to Java objects and pass them, in one
+ * java.util.List, to the CB_TYPE_WRITE_BATCH callback `cbi'. Value lists of
+ * the same type within the batch share one DataSet object. */
+static int cjni_write_batch_entries (cjni_callback_info_t *cbi, /* {{{ */
+    cjni_batch_entry_t *entries, size_t entries_num, value_t *values)
+{
+  JNIEnv *jvm_env;
+  jobject o_list;
+  const data_set_t **data_sets;
+  jobject *o_data_sets;
+  size_t data_sets_num = 0;
+  size_t i;
+  size_t j;
+  int ret_status;
+
+  if (entries_num == 0)
+    return (0);
+
+  jvm_env = cjni_thread_attach_permanent ();
+  if (jvm_env == NULL)
+    return (-1);
+
+  data_sets = calloc (entries_num, sizeof (*data_sets));
+  o_data_sets = calloc (entries_num, sizeof (*o_data_sets));
+  if ((data_sets == NULL) || (o_data_sets == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch_entries: calloc failed.");
+    sfree (data_sets);
+    sfree (o_data_sets);
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  o_list = (*jvm_env)->NewObject (jvm_env, class_cache.c_arraylist,
+      class_cache.m_arraylist_constructor, (jint) entries_num);
+  if (o_list == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch_entries: "
+        "Creating a new ArrayList instance failed.");
+    sfree (data_sets);
+    sfree (o_data_sets);
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  for (i = 0; i < entries_num; i++)
+  {
+    jobject o_vl;
+
+    entries[i].vl.values = values + entries[i].values_offset;
+
+    /* A batch usually contains few types, so a linear search is fine. */
+    for (j = 0; j < data_sets_num; j++)
+      if (data_sets[j] == entries[i].ds)
+        break;
+    if (j == data_sets_num)
+    {
+      o_data_sets[j] = ctoj_data_set (jvm_env, entries[i].ds);
+      if (o_data_sets[j] == NULL)
+      {
+        ERROR ("java plugin: cjni_write_batch_entries: "
+            "ctoj_data_set (%s) failed.", entries[i].ds->type);
+        continue;
+      }
+      data_sets[j] = entries[i].ds;
+      data_sets_num++;
+    }
+
+    o_vl = ctoj_value_list (jvm_env, entries[i].ds, &entries[i].vl,
+        o_data_sets[j]);
+    if (o_vl == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch_entries: "
+          "ctoj_value_list failed.");
+      continue;
+    }
+
+    (*jvm_env)->CallBooleanMethod (jvm_env, o_list,
+        class_cache.m_arraylist_add, o_vl);
+    (*jvm_env)->DeleteLocalRef (jvm_env, o_vl);
+  }
+
+  ret_status = (*jvm_env)->CallIntMethod (jvm_env,
+      cbi->object, cbi->method, o_list);
+  if (ret_status != 0)
+  {
+    ERROR ("java plugin: Writing a batch of %zu value lists via `%s' "
+        "failed with status %i.", entries_num, cbi->name, ret_status);
+  }
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_list);
+  for (j = 0; j < data_sets_num; j++)
+    (*jvm_env)->DeleteLocalRef (jvm_env, o_data_sets[j]);
+  sfree (data_sets);
+  sfree (o_data_sets);
+
+  cjni_thread_detach ();
+  return (ret_status);
+} /* }}} int cjni_write_batch_entries */
+
+/* Take the queued value lists away from `bw'. The caller must hold the batch
+ * writer's lock and pass the returned arrays to cjni_write_batch_entries. */
+static void cjni_batch_writer_take (cjni_batch_writer_t *bw, /* {{{ */
+    cjni_batch_entry_t **ret_entries, size_t *ret_entries_num,
+    value_t **ret_values)
+{
+  *ret_entries = bw->entries;
+  *ret_entries_num = bw->entries_num;
+  *ret_values = bw->values;
+
+  bw->entries = NULL;
+  bw->entries_num = 0;
+  bw->values = NULL;
+  bw->values_num = 0;
+  bw->values_size = 0;
+  bw->first_entry = 0;
+} /* }}} void cjni_batch_writer_take */
+
+/* Take the queued value lists away from `bw' and write them. The batch
+ * writer's lock must NOT be held by the caller; the Java method is called
+ * without holding it, so other threads can queue new values meanwhile. */
+static int cjni_batch_writer_flush (cjni_batch_writer_t *bw) /* {{{ */
+{
+  cjni_batch_entry_t *entries;
+  size_t entries_num;
+  value_t *values;
+  int status;
+
+  pthread_mutex_lock (&bw->lock);
+  cjni_batch_writer_take (bw, &entries, &entries_num, &values);
+  pthread_mutex_unlock (&bw->lock);
+
+  status = cjni_write_batch_entries (bw->cbi, entries, entries_num, values);
+
+  sfree (entries);
+  sfree (values);
+
+  return (status);
+} /* }}} int cjni_batch_writer_flush */
+
+/* Queue the value list in the batch writer pointed to by the `user_data_t'
+ * pointer. Once `BatchSize' value lists have been queued or the oldest one
+ * has been waiting for more than one interval, the batch is passed to the
+ * CB_TYPE_WRITE_BATCH callback. */
+static int cjni_write_batch (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl, user_data_t *ud)
+{
+  cjni_batch_writer_t *bw;
+  cjni_batch_entry_t *entry;
+  cjni_batch_entry_t *full_entries = NULL;
+  size_t full_entries_num = 0;
+  value_t *full_values = NULL;
+  cdtime_t now;
+  int status;
+
+  if (jvm == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: jvm == NULL");
+    return (-1);
+  }
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch: Invalid user data.");
+    return (-1);
+  }
+
+  bw = (cjni_batch_writer_t *) ud->data;
+  now = cdtime ();
+
+  pthread_mutex_lock (&bw->lock);
+
+  /* Never append to a full batch. Full batches are normally taken away
+   * below, before the lock is released, so this is only a safeguard. */
+  if ((bw->entries != NULL) && (bw->entries_num >= bw->entries_size))
+    cjni_batch_writer_take (bw, &full_entries, &full_entries_num,
+        &full_values);
+
+  status = 0;
+  if (bw->entries == NULL)
+  {
+    bw->entries = (cjni_batch_entry_t *) calloc (bw->entries_size,
+        sizeof (*bw->entries));
+    if (bw->entries == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch: calloc failed.");
+      status = -1;
+    }
+  }
+
+  if ((status == 0) && ((bw->values_num + vl->values_len) > bw->values_size))
+  {
+    value_t *tmp;
+    size_t new_size;
+
+    new_size = 2 * bw->values_size;
+    if (new_size < (bw->values_num + vl->values_len))
+      new_size = bw->values_num + vl->values_len;
+
+    tmp = (value_t *) realloc (bw->values, new_size * sizeof (*bw->values));
+    if (tmp == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch: realloc failed.");
+      status = -1;
+    }
+    else
+    {
+      bw->values = tmp;
+      bw->values_size = new_size;
+    }
+  }
+
+  if (status == 0)
+  {
+    entry = bw->entries + bw->entries_num;
+    entry->ds = ds;
+    memcpy (&entry->vl, vl, sizeof (entry->vl));
+    entry->vl.values = NULL;
+    entry->vl.meta = NULL;
+    entry->values_offset = bw->values_num;
+    memcpy (bw->values + bw->values_num, vl->values,
+        vl->values_len * sizeof (*vl->values));
+    bw->values_num += vl->values_len;
+    bw->entries_num++;
+
+    if (bw->first_entry == 0)
+      bw->first_entry = now;
+
+    /* Take the batch away while still holding the lock, so no other thread
+     * appends to it once it is full. */
+    if ((full_entries == NULL)
+        && ((bw->entries_num >= bw->entries_size)
+          || ((now - bw->first_entry) >= plugin_get_interval ())))
+      cjni_batch_writer_take (bw, &full_entries, &full_entries_num,
+          &full_values);
+  }
+
+  pthread_mutex_unlock (&bw->lock);
+
+  if (full_entries != NULL)
+  {
+    int write_status;
+
+    write_status = cjni_write_batch_entries (bw->cbi,
+        full_entries, full_entries_num, full_values);
+    if (status == 0)
+      status = write_status;
+  }
+
+  sfree (full_entries);
+  sfree (full_values);
+
+  return (status);
+} /* }}} int cjni_write_batch */
+
+/* Write the batch of the writer pointed to by the `user_data_t' pointer if
+ * its oldest value list has been waiting for more than one interval. This
+ * catches batches which are not completed because no more values arrive. */
+static int cjni_read_batch (user_data_t *ud) /* {{{ */
+{
+  cjni_batch_writer_t *bw;
+  _Bool do_flush;
+
+  if (jvm == NULL)
+    return (0);
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_read_batch: Invalid user data.");
+    return (-1);
+  }
+
+  bw = (cjni_batch_writer_t *) ud->data;
+
+  pthread_mutex_lock (&bw->lock);
+  do_flush = (bw->first_entry != 0)
+    && ((cdtime () - bw->first_entry) >= plugin_get_interval ());
+  pthread_mutex_unlock (&bw->lock);
+
+  if (!do_flush)
+    return (0);
+
+  return (cjni_batch_writer_flush (bw));
+} /* }}} int cjni_read_batch */
+
+/* Write all value lists currently queued by a batch writer. */
+static int cjni_flush_batch (cdtime_t __attribute__((unused)) timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier, user_data_t *ud)
+{
+  if (jvm == NULL)
+    return (0);
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_flush_batch: Invalid user data.");
+    return (-1);
+  }
+
+  return (cjni_batch_writer_flush ((cjni_batch_writer_t *) ud->data));
+} /* }}} int cjni_flush_batch */
+
+/* Free a batch writer, including its callback information. Value lists
+ * still queued at this point are dropped; `cjni_shutdown' writes them
+ * before the JVM is destroyed. */
+static void cjni_batch_writer_destroy (void *arg) /* {{{ */
+{
+  cjni_batch_writer_t *bw;
+  size_t i;
+
+  bw = (cjni_batch_writer_t *) arg;
+  if (bw == NULL)
+    return;
+
+  pthread_mutex_lock (&java_callbacks_lock);
+  for (i = 0; i < batch_writers_num; i++)
+  {
+    if (batch_writers[i] != bw)
+      continue;
+
+    memmove (batch_writers + i, batch_writers + i + 1,
+        (batch_writers_num - (i + 1)) * sizeof (*batch_writers));
+    batch_writers_num--;
+    break;
+  }
+  if (batch_writers_num == 0)
+    sfree (batch_writers);
+  pthread_mutex_unlock (&java_callbacks_lock);
+
+  cjni_callback_info_destroy (bw->cbi);
+  bw->cbi = NULL;
+
+  sfree (bw->entries);
+  sfree (bw->values);
+  pthread_mutex_destroy (&bw->lock);
+  sfree (bw);
+} /* }}} void cjni_batch_writer_destroy */
+
 /* Call the CB_TYPE_FLUSH callback pointed to by the `user_data_t' pointer. */
 static int cjni_flush (cdtime_t timeout, const char *identifier, /* {{{ */
     user_data_t *ud)
@@ -2890,7 +3411,7 @@ static int cjni_match_target_invoke (const data_set_t *ds, /* {{{ */
 
   cbi = (cjni_callback_info_t *) *user_data;
 
-  o_vl = ctoj_value_list (jvm_env, ds, vl);
+  o_vl = ctoj_value_list (jvm_env, ds, vl, /* o_dataset = */ NULL);
   if (o_vl == NULL)
   {
     ERROR ("java plugin: cjni_match_target_invoke: ctoj_value_list failed.");
@@ -3006,6 +3527,18 @@ static int cjni_shutdown (void) /* {{{ */
   if (jvm == NULL)
     return (0);
 
+  /* Write value lists still queued by batch write callbacks. */
+  pthread_mutex_lock (&java_callbacks_lock);
+  for (i = 0; i < batch_writers_num; i++)
+  {
+    cjni_batch_writer_t *bw = batch_writers[i];
+
+    pthread_mutex_unlock (&java_callbacks_lock);
+    cjni_batch_writer_flush (bw);
+    pthread_mutex_lock (&java_callbacks_lock);
+  }
+  pthread_mutex_unlock (&java_callbacks_lock);
+
   jvm_env = NULL;
   memset (&args, 0, sizeof (args));
   args.version = JNI_VERSION_1_2;
@@ -3047,6 +3580,8 @@ static int cjni_shutdown (void) /* {{{ */
   java_classes_list_len = 0;
   sfree (java_classes_list);
 
+  cjni_free_class_cache (jvm_env);
+
   /* Destroy the JVM */
   DEBUG ("java plugin: Destroying the JVM.");
   (*jvm)->DestroyJavaVM (jvm);
@@ -45,6 +45,10 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <regex.h>
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
 
 #include "collectd/client.h"
 
@@ -743,6 +747,286 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return (0);
 } /* }}} int lcc_getval */
 
+/* Values collected by lcc_getval_multi. `idents[i]' is the index of the
+ * identifier `values[i]' belongs to. */
+struct lcc_getval_values_s
+{
+  size_t   num;
+  size_t  *idents;
+  gauge_t *values;
+  char   **names;
+};
+typedef struct lcc_getval_values_s lcc_getval_values_t;
+
+static void lcc_getval_values_free (lcc_getval_values_t *v) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < v->num; i++)
+    free (v->names[i]);
+  free (v->idents);
+  free (v->values);
+  free (v->names);
+  memset (v, 0, sizeof (*v));
+} /* }}} void lcc_getval_values_free */
+
+/* Appends the values of a GETVAL response for the identifiers
+ * `idents_str[first]' to `idents_str[first + count - 1]' to `v'. If more than
+ * one identifier was requested, each line is prefixed with its identifier. */
+static int lcc_getval_multi_parse (lcc_connection_t *c, /* {{{ */
+    lcc_response_t *res, char (*idents_str)[6 * LCC_NAME_LEN],
+    size_t first, size_t count, lcc_getval_values_t *v)
+{
+  size_t new_size;
+  void *tmp;
+  size_t i;
+  size_t j;
+
+  if (res->lines_num == 0)
+    return (0);
+
+  new_size = v->num + res->lines_num;
+
+  tmp = realloc (v->idents, new_size * sizeof (*v->idents));
+  if (tmp == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  v->idents = tmp;
+
+  tmp = realloc (v->values, new_size * sizeof (*v->values));
+  if (tmp == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  v->values = tmp;
+
+  tmp = realloc (v->names, new_size * sizeof (*v->names));
+  if (tmp == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  v->names = tmp;
+
+  for (i = 0; i < res->lines_num; i++)
+  {
+    char *ident;
+    char *key;
+    char *value;
+    char *endptr;
+
+    key = res->lines[i];
+    j = first;
+
+    if (count > 1)
+    {
+      /* The identifier is quoted if it contains special characters. */
+      ident = key;
+      if (*key == '"')
+      {
+        char *dst = key;
+
+        key++;
+        while ((*key != '"') && (*key != 0))
+        {
+          if ((*key == '\\') && (key[1] != 0))
+            key++;
+          *dst = *key;
+          dst++;
+          key++;
+        }
+        if (*key != '"')
+        {
+          lcc_set_errno (c, EILSEQ);
+          return (-1);
+        }
+        *dst = 0;
+        key++;
+      }
+      else
+      {
+        while ((*key != ' ') && (*key != 0))
+          key++;
+      }
+
+      if (*key != ' ')
+      {
+        lcc_set_errno (c, EILSEQ);
+        return (-1);
+      }
+      *key = 0;
+      key++;
+
+      for (j = first; j < first + count; j++)
+        if (strcmp (idents_str[j], ident) == 0)
+          break;
+      if (j >= first + count)
+      {
+        lcc_set_errno (c, EILSEQ);
+        return (-1);
+      }
+    }
+
+    value = strchr (key, '=');
+    if (value == NULL)
+    {
+      lcc_set_errno (c, EILSEQ);
+      return (-1);
+    }
+
+    *value = 0;
+    value++;
+
+    endptr = NULL;
+    errno = 0;
+    v->values[v->num] = strtod (value, &endptr);
+    if ((endptr == value) || (errno != 0))
+    {
+      lcc_set_errno (c, (errno != 0) ? errno : EILSEQ);
+      return (-1);
+    }
+
+    v->names[v->num] = strdup (key);
+    if (v->names[v->num] == NULL)
+    {
+      lcc_set_errno (c, ENOMEM);
+      return (-1);
+    }
+
+    v->idents[v->num] = j;
+    v->num++;
+  } /* for (i = 0; i < res->lines_num; i++) */
+
+  return (0);
+} /* }}} int lcc_getval_multi_parse */
+
+int lcc_getval_multi (lcc_connection_t *c, /* {{{ */
+    const lcc_identifier_t *idents, size_t idents_num,
+    size_t *ret_values_num, size_t **ret_values_idents,
+    gauge_t **ret_values, char ***ret_values_names)
+{
+  char (*idents_str)[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  char command[14 * LCC_NAME_LEN];
+
+  lcc_response_t res;
+  lcc_getval_values_t v;
+  int multi = 1;
+
+  size_t first;
+  size_t count;
+  size_t i;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((idents == NULL) || (idents_num == 0) || (ret_values_num == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  idents_str = calloc (idents_num, sizeof (*idents_str));
+  if (idents_str == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+
+  for (i = 0; i < idents_num; i++)
+  {
+    status = lcc_identifier_to_string (c, idents_str[i],
+        sizeof (idents_str[i]), idents + i);
+    if (status != 0)
+    {
+      free (idents_str);
+      return (status);
+    }
+  }
+
+  memset (&v, 0, sizeof (v));
+
+  /* The daemon limits the length of a command line, so the identifiers are
+   * sent in as many GETVAL commands as needed. */
+  first = 0;
+  while (first < idents_num)
+  {
+    SSTRCPY (command, "GETVAL");
+    for (count = 0; first + count < idents_num; count++)
+    {
+      lcc_strescape (ident_esc, idents_str[first + count], sizeof (ident_esc));
+      if ((count > 0)
+          && ((!multi)
+            || (strlen (command) + strlen (ident_esc) + 2 > sizeof (command))))
+        break;
+      SSTRCATF (command, " %s", ident_esc);
+    }
+
+    status = lcc_sendreceive (c, command, &res);
+    if (status != 0)
+    {
+      lcc_getval_values_free (&v);
+      free (idents_str);
+      return (status);
+    }
+
+    if (res.status != 0)
+    {
+      lcc_response_free (&res);
+
+      /* Older daemons accept only one identifier per GETVAL command. Ask for
+       * the remaining values one at a time. */
+      if (count > 1)
+      {
+        multi = 0;
+        continue;
+      }
+
+      /* A single identifier which is not found is skipped. */
+      first += count;
+      continue;
+    }
+
+    status = lcc_getval_multi_parse (c, &res, idents_str, first, count, &v);
+    lcc_response_free (&res);
+    if (status != 0)
+    {
+      lcc_getval_values_free (&v);
+      free (idents_str);
+      return (-1);
+    }
+
+    first += count;
+  } /* while (first < idents_num) */
+
+  free (idents_str);
+
+  *ret_values_num = v.num;
+  if (ret_values_idents != NULL)
+  {
+    *ret_values_idents = v.idents;
+    v.idents = NULL;
+  }
+  if (ret_values != NULL)
+  {
+    *ret_values = v.values;
+    v.values = NULL;
+  }
+  if (ret_values_names != NULL)
+  {
+    *ret_values_names = v.names;
+    v.names = NULL;
+    v.num = 0;
+  }
+
+  lcc_getval_values_free (&v);
+  return (0);
+} /* }}} int lcc_getval_multi */
+
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 {
   char ident_str[6 * LCC_NAME_LEN];
@@ -863,15 +1147,72 @@ int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
 
 /* TODO: Implement lcc_putnotif */
 
+/* Parses the lines of a LISTVAL response and appends the identifiers to
+ * `*ret_ident'. */
+static int lcc_listval_parse (lcc_connection_t *c, /* {{{ */
+    lcc_response_t *res, lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  lcc_identifier_t *ident;
+  size_t ident_num;
+  size_t i;
+  int status = 0;
+
+  if (res->lines_num == 0)
+    return (0);
+
+  ident_num = *ret_ident_num;
+  ident = (lcc_identifier_t *) realloc (*ret_ident,
+      (ident_num + res->lines_num) * sizeof (*ident));
+  if (ident == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  *ret_ident = ident;
+
+  for (i = 0; i < res->lines_num; i++)
+  {
+    char *time_str;
+    char *ident_str;
+
+    /* First field is the time. */
+    time_str = res->lines[i];
+
+    /* Set `ident_str' to the beginning of the second field. */
+    ident_str = time_str;
+    while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
+      ident_str++;
+    while ((*ident_str == ' ') || (*ident_str == '\t'))
+    {
+      *ident_str = 0;
+      ident_str++;
+    }
+
+    if (*ident_str == 0)
+    {
+      lcc_set_errno (c, EILSEQ);
+      status = -1;
+      break;
+    }
+
+    status = lcc_string_to_identifier (c, ident + ident_num, ident_str);
+    if (status != 0)
+      break;
+    ident_num++;
+  }
+
+  *ret_ident_num = ident_num;
+  return (status);
+} /* }}} int lcc_listval_parse */
+
 int lcc_listval (lcc_connection_t *c, /* {{{ */
     lcc_identifier_t **ret_ident, size_t *ret_ident_num)
 {
   lcc_response_t res;
-  size_t i;
   int status;
 
-  lcc_identifier_t *ident;
-  size_t ident_num;
+  lcc_identifier_t *ident = NULL;
+  size_t ident_num = 0;
 
   if (c == NULL)
     return (-1);
@@ -893,46 +1234,153 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
-  ident_num = res.lines_num;
-  ident = (lcc_identifier_t *) malloc (ident_num * sizeof (*ident));
-  if (ident == NULL)
+  status = lcc_listval_parse (c, &res, &ident, &ident_num);
+  lcc_response_free (&res);
+
+  if (status != 0)
   {
-    lcc_response_free (&res);
-    lcc_set_errno (c, ENOMEM);
+    free (ident);
     return (-1);
   }
 
-  for (i = 0; i < res.lines_num; i++)
-  {
-    char *time_str;
-    char *ident_str;
+  *ret_ident = ident;
+  *ret_ident_num = ident_num;
 
-    /* First field is the time. */
-    time_str = res.lines[i];
+  return (0);
+} /* }}} int lcc_listval */
 
-    /* Set `ident_str' to the beginning of the second field. */
-    ident_str = time_str;
-    while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
-      ident_str++;
-    while ((*ident_str == ' ') || (*ident_str == '\t'))
+/* Removes the identifiers not matching `glob' and `regex' from `ident'. This
+ * is used with daemons which cannot filter LISTVAL themselves. */
+static int lcc_listval_filter (lcc_connection_t *c, /* {{{ */
+    const char *glob, const char *regex,
+    lcc_identifier_t *ident, size_t *ident_num)
+{
+  regex_t re;
+  char name[6 * LCC_NAME_LEN];
+  size_t i;
+  size_t j;
+  int status = 0;
+
+#if !HAVE_FNMATCH_H
+  if (glob != NULL)
+  {
+    LCC_SET_ERRSTR (c, "Filtering by glob is not supported.");
+    return (-1);
+  }
+#endif
+
+  if (regex != NULL)
+  {
+    status = regcomp (&re, regex, REG_EXTENDED | REG_NOSUB);
+    if (status != 0)
     {
-      *ident_str = 0;
-      ident_str++;
+      LCC_SET_ERRSTR (c, "Compiling the regular expression \"%s\" failed.",
+          regex);
+      return (-1);
     }
+  }
 
-    if (*ident_str == 0)
+  j = 0;
+  for (i = 0; i < *ident_num; i++)
+  {
+    status = lcc_identifier_to_string (c, name, sizeof (name), ident + i);
+    if (status != 0)
+      break;
+
+#if HAVE_FNMATCH_H
+    if ((glob != NULL) && (fnmatch (glob, name, /* flags = */ 0) != 0))
+      continue;
+#endif
+    if ((regex != NULL) && (regexec (&re, name, 0, NULL, 0) != 0))
+      continue;
+
+    if (i != j)
+      memcpy (ident + j, ident + i, sizeof (*ident));
+    j++;
+  }
+
+  if (regex != NULL)
+    regfree (&re);
+
+  if (status != 0)
+    return (-1);
+
+  *ident_num = j;
+  return (0);
+} /* }}} int lcc_listval_filter */
+
+int lcc_listval_with_filter (lcc_connection_t *c, /* {{{ */
+    const char *glob, const char *regex,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  char command[1024] = "";
+  char buffer[512];
+  lcc_response_t res;
+  int first_block = 1;
+  int status;
+
+  lcc_identifier_t *ident = NULL;
+  size_t ident_num = 0;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((ret_ident == NULL) || (ret_ident_num == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  /* Ask for the values in blocks, so the daemon doesn't have to buffer the
+   * entire list. */
+  SSTRCPY (command, "LISTVAL chunked=true");
+  if (glob != NULL)
+    SSTRCATF (command, " glob=%s",
+        lcc_strescape (buffer, glob, sizeof (buffer)));
+  if (regex != NULL)
+    SSTRCATF (command, " regex=%s",
+        lcc_strescape (buffer, regex, sizeof (buffer)));
+
+  status = lcc_sendreceive (c, command, &res);
+  while (status == 0)
+  {
+    if ((res.status != 0) && first_block)
     {
-      lcc_set_errno (c, EILSEQ);
+      /* Older daemons don't accept any options. Get the entire list and
+       * filter it here. */
+      lcc_response_free (&res);
+
+      status = lcc_listval (c, &ident, &ident_num);
+      if (status != 0)
+        return (-1);
+
+      status = lcc_listval_filter (c, glob, regex, ident, &ident_num);
+      break;
+    }
+    else if (res.status != 0)
+    {
+      LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+      lcc_response_free (&res);
       status = -1;
       break;
     }
+    first_block = 0;
+
+    /* The last block is a status line without any values. */
+    if (res.lines_num == 0)
+    {
+      lcc_response_free (&res);
+      break;
+    }
 
-    status = lcc_string_to_identifier (c, ident + i, ident_str);
+    status = lcc_listval_parse (c, &res, &ident, &ident_num);
+    lcc_response_free (&res);
     if (status != 0)
       break;
-  }
 
-  lcc_response_free (&res);
+    memset (&res, 0, sizeof (res));
+    status = lcc_receive (c, &res);
+  }
 
   if (status != 0)
   {
@@ -944,7 +1392,7 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
   *ret_ident_num = ident_num;
 
   return (0);
-} /* }}} int lcc_listval */
+} /* }}} int lcc_listval_with_filter */
 
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
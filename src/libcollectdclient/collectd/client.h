@@ -104,6 +104,15 @@ int lcc_disconnect (lcc_connection_t *c);
 int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
     size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
 
+/* Like lcc_getval, but queries several identifiers using as few GETVAL
+ * commands as possible. `(*ret_values_idents)[i]' is the index into `idents'
+ * of the identifier `(*ret_values)[i]' belongs to. Identifiers the daemon
+ * doesn't know are skipped. */
+int lcc_getval_multi (lcc_connection_t *c,
+    const lcc_identifier_t *idents, size_t idents_num,
+    size_t *ret_values_num, size_t **ret_values_idents,
+    gauge_t **ret_values, char ***ret_values_names);
+
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
 int lcc_flush (lcc_connection_t *c, const char *plugin,
@@ -112,6 +121,15 @@ int lcc_flush (lcc_connection_t *c, const char *plugin,
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
+/* Like lcc_listval, but only returns the identifiers matching the shell
+ * wildcard pattern `glob' and the extended regular expression `regex'. Either
+ * may be NULL. The daemon sends the list in blocks if it supports the
+ * "chunked" option of the LISTVAL command. Otherwise, the entire list is
+ * received and filtered by the client. */
+int lcc_listval_with_filter (lcc_connection_t *c,
+    const char *glob, const char *regex,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num);
+
 /* TODO: putnotif */
 
 const char *lcc_strerror (lcc_connection_t *c);
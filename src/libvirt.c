@@ -32,10 +32,15 @@
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 static const char *config_keys[] = {
     "Connection",
 
     "RefreshInterval",
+    "Threads",
 
     "Domain",
     "BlockDevice",
@@ -67,10 +72,33 @@ static ignorelist_t *il_interface_devices = NULL;
 static int ignore_device_match (ignorelist_t *,
                                 const char *domname, const char *devpath);
 
-/* Actual list of domains found on last refresh. */
+/* Actual list of domains found on last refresh. The list is terminated by a
+ * NULL pointer, as expected by virDomainListGetStats. */
 static virDomainPtr *domains = NULL;
 static int nr_domains = 0;
 
+#if HAVE_VIR_DOMAIN_LIST_GET_STATS
+/* Cleared if the daemon does not support querying statistics in bulk. */
+static _Bool use_bulk_stats = 1;
+#endif
+
+/* Number of threads querying domains in parallel if statistics cannot be
+ * queried in bulk. The read callback itself is one of them. */
+static int threads_num = 1;
+
+static pthread_t *workers = NULL;
+static int nr_workers = 0;
+
+/* Domains handed out to the threads: domain `work_next' is the next one to
+ * be read, `work_pending' domains have not been finished yet. */
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done_cond = PTHREAD_COND_INITIALIZER;
+static int work_next = 0;
+static int work_end = 0;
+static int work_pending = 0;
+static _Bool work_shutdown = 0;
+
 static void free_domains (void);
 static int add_domain (virDomainPtr dom);
 
@@ -127,6 +155,9 @@ static time_t last_refresh = (time_t) 0;
 
 static int refresh_lists (void);
 
+static int lv_start_workers (void);
+static void lv_stop_workers (void);
+
 /* ERROR(...) macro for virterrors. */
 #define VIRT_ERROR(conn,s) do {                 \
         virErrorPtr err;                        \
@@ -235,13 +266,56 @@ submit_derive2 (const char *type, derive_t v0, derive_t v1,
     plugin_dispatch_values (&vl);
 } /* void submit_derive2 */
 
+/* Values of -1 are not supported by the hypervisor and not submitted. */
+static void
+submit_interface_stats (const struct interface_device *dev,
+        long long rx_bytes, long long tx_bytes,
+        long long rx_packets, long long tx_packets,
+        long long rx_errs, long long tx_errs,
+        long long rx_drop, long long tx_drop)
+{
+    const char *display_name = NULL;
+
+    switch (interface_format) {
+        case if_address:
+            display_name = dev->address;
+            break;
+        case if_number:
+            display_name = dev->number;
+            break;
+        case if_name:
+        default:
+            display_name = dev->path;
+    }
+
+    if ((rx_bytes != -1) && (tx_bytes != -1))
+        submit_derive2 ("if_octets",
+                (derive_t) rx_bytes, (derive_t) tx_bytes,
+                dev->dom, display_name);
+
+    if ((rx_packets != -1) && (tx_packets != -1))
+        submit_derive2 ("if_packets",
+                (derive_t) rx_packets, (derive_t) tx_packets,
+                dev->dom, display_name);
+
+    if ((rx_errs != -1) && (tx_errs != -1))
+        submit_derive2 ("if_errors",
+                (derive_t) rx_errs, (derive_t) tx_errs,
+                dev->dom, display_name);
+
+    if ((rx_drop != -1) && (tx_drop != -1))
+        submit_derive2 ("if_dropped",
+                (derive_t) rx_drop, (derive_t) tx_drop,
+                dev->dom, display_name);
+} /* void submit_interface_stats */
+
 static int
 lv_init (void)
 {
     if (virInitialize () != 0)
         return -1;
 
-	return 0;
+    return lv_start_workers ();
 }
 
 static int
@@ -275,6 +349,17 @@ lv_config (const char *key, const char *value)
         return 0;
     }
 
+    if (strcasecmp (key, "Threads") == 0) {
+        char *eptr = NULL;
+        threads_num = strtol (value, &eptr, 10);
+        if (eptr == NULL || *eptr != '\0' || threads_num < 1) {
+            ERROR ("libvirt plugin: Threads must be a positive integer.");
+            threads_num = 1;
+            return 1;
+        }
+        return 0;
+    }
+
     if (strcasecmp (key, "Domain") == 0) {
         if (ignorelist_add (il_domains, value)) return 1;
         return 0;
@@ -361,96 +446,55 @@ lv_config (const char *key, const char *value)
     return -1;
 }
 
-static int
-lv_read (void)
+/* Reads the CPU and VCPU statistics of one domain and the statistics of its
+ * block and interface devices. */
+static void
+lv_read_domain (virDomainPtr dom)
 {
-    time_t t;
+    virDomainInfo info;
+    virVcpuInfoPtr vinfo = NULL;
+    int status;
     int i;
 
-    if (conn == NULL) {
-        /* `conn_string == NULL' is acceptable. */
-        conn = virConnectOpenReadOnly (conn_string);
-        if (conn == NULL) {
-            c_complain (LOG_ERR, &conn_complain,
-                    "libvirt plugin: Unable to connect: "
-                    "virConnectOpenReadOnly failed.");
-            return -1;
-        }
+    status = virDomainGetInfo (dom, &info);
+    if (status != 0)
+    {
+        ERROR ("libvirt plugin: virDomainGetInfo failed with status %i.",
+                status);
+        return;
     }
-    c_release (LOG_NOTICE, &conn_complain,
-            "libvirt plugin: Connection established.");
 
-    time (&t);
+    cpu_submit (info.cpuTime, dom, "virt_cpu_total");
 
-    /* Need to refresh domain or device lists? */
-    if ((last_refresh == (time_t) 0) ||
-            ((interval > 0) && ((last_refresh + interval) <= t))) {
-        if (refresh_lists () != 0) {
-            if (conn != NULL)
-                virConnectClose (conn);
-            conn = NULL;
-            return -1;
-        }
-        last_refresh = t;
+    vinfo = malloc (info.nrVirtCpu * sizeof (vinfo[0]));
+    if (vinfo == NULL) {
+        ERROR ("libvirt plugin: malloc failed.");
+        return;
     }
 
-#if 0
-    for (i = 0; i < nr_domains; ++i)
-        fprintf (stderr, "domain %s\n", virDomainGetName (domains[i]));
-    for (i = 0; i < nr_block_devices; ++i)
-        fprintf  (stderr, "block device %d %s:%s\n",
-                  i, virDomainGetName (block_devices[i].dom),
-                  block_devices[i].path);
-    for (i = 0; i < nr_interface_devices; ++i)
-        fprintf (stderr, "interface device %d %s:%s\n",
-                 i, virDomainGetName (interface_devices[i].dom),
-                 interface_devices[i].path);
-#endif
-
-    /* Get CPU usage, VCPU usage for each domain. */
-    for (i = 0; i < nr_domains; ++i) {
-        virDomainInfo info;
-        virVcpuInfoPtr vinfo = NULL;
-        int status;
-        int j;
-
-        status = virDomainGetInfo (domains[i], &info);
-        if (status != 0)
-        {
-            ERROR ("libvirt plugin: virDomainGetInfo failed with status %i.",
-                    status);
-            continue;
-        }
-
-        cpu_submit (info.cpuTime, domains[i], "virt_cpu_total");
-
-        vinfo = malloc (info.nrVirtCpu * sizeof (vinfo[0]));
-        if (vinfo == NULL) {
-            ERROR ("libvirt plugin: malloc failed.");
-            continue;
-        }
-
-        status = virDomainGetVcpus (domains[i], vinfo, info.nrVirtCpu,
-                /* cpu map = */ NULL, /* cpu map length = */ 0);
-        if (status < 0)
-        {
-            ERROR ("libvirt plugin: virDomainGetVcpus failed with status %i.",
-                    status);
-            free (vinfo);
-            continue;
-        }
+    status = virDomainGetVcpus (dom, vinfo, info.nrVirtCpu,
+            /* cpu map = */ NULL, /* cpu map length = */ 0);
+    if (status < 0)
+    {
+        ERROR ("libvirt plugin: virDomainGetVcpus failed with status %i.",
+                status);
+        free (vinfo);
+        return;
+    }
 
-        for (j = 0; j < info.nrVirtCpu; ++j)
-            vcpu_submit (vinfo[j].cpuTime,
-                    domains[i], vinfo[j].number, "virt_vcpu");
+    for (i = 0; i < info.nrVirtCpu; ++i)
+        vcpu_submit (vinfo[i].cpuTime,
+                dom, vinfo[i].number, "virt_vcpu");
 
-        sfree (vinfo);
-    }
+    sfree (vinfo);
 
-    /* Get block device stats for each domain. */
+    /* Get block device stats. */
     for (i = 0; i < nr_block_devices; ++i) {
         struct _virDomainBlockStats stats;
 
+        if (block_devices[i].dom != dom)
+            continue;
+
         if (virDomainBlockStats (block_devices[i].dom, block_devices[i].path,
                     &stats, sizeof stats) != 0)
             continue;
@@ -466,49 +510,331 @@ lv_read (void)
                     block_devices[i].dom, block_devices[i].path);
     } /* for (nr_block_devices) */
 
-    /* Get interface stats for each domain. */
+    /* Get interface stats. */
     for (i = 0; i < nr_interface_devices; ++i) {
         struct _virDomainInterfaceStats stats;
-        char *display_name = NULL;
 
-
-        switch (interface_format) {
-            case if_address:
-                display_name = interface_devices[i].address;
-                break;
-            case if_number:
-                display_name = interface_devices[i].number;
-                break;
-            case if_name:
-            default:
-                display_name = interface_devices[i].path;
-        }
+        if (interface_devices[i].dom != dom)
+            continue;
 
         if (virDomainInterfaceStats (interface_devices[i].dom,
                     interface_devices[i].path,
                     &stats, sizeof stats) != 0)
             continue;
 
-	if ((stats.rx_bytes != -1) && (stats.tx_bytes != -1))
-	    submit_derive2 ("if_octets",
-		    (derive_t) stats.rx_bytes, (derive_t) stats.tx_bytes,
-		    interface_devices[i].dom, display_name);
-
-	if ((stats.rx_packets != -1) && (stats.tx_packets != -1))
-	    submit_derive2 ("if_packets",
-		    (derive_t) stats.rx_packets, (derive_t) stats.tx_packets,
-		    interface_devices[i].dom, display_name);
-
-	if ((stats.rx_errs != -1) && (stats.tx_errs != -1))
-	    submit_derive2 ("if_errors",
-		    (derive_t) stats.rx_errs, (derive_t) stats.tx_errs,
-		    interface_devices[i].dom, display_name);
-
-	if ((stats.rx_drop != -1) && (stats.tx_drop != -1))
-	    submit_derive2 ("if_dropped",
-		    (derive_t) stats.rx_drop, (derive_t) stats.tx_drop,
-		    interface_devices[i].dom, display_name);
+        submit_interface_stats (&interface_devices[i],
+                stats.rx_bytes, stats.tx_bytes,
+                stats.rx_packets, stats.tx_packets,
+                stats.rx_errs, stats.tx_errs,
+                stats.rx_drop, stats.tx_drop);
     } /* for (nr_interface_devices) */
+} /* void lv_read_domain */
+
+/* Reads domains handed out via `work_next' until there are none left. Called
+ * with `work_lock' held. */
+static void
+lv_work (void)
+{
+    while (!work_shutdown && (work_next < work_end)) {
+        virDomainPtr dom = domains[work_next++];
+
+        pthread_mutex_unlock (&work_lock);
+        lv_read_domain (dom);
+        pthread_mutex_lock (&work_lock);
+
+        work_pending--;
+        if (work_pending == 0)
+            pthread_cond_broadcast (&work_done_cond);
+    }
+} /* void lv_work */
+
+static void *
+lv_worker (void *arg)
+{
+    pthread_mutex_lock (&work_lock);
+    while (!work_shutdown) {
+        lv_work ();
+        if (!work_shutdown)
+            pthread_cond_wait (&work_cond, &work_lock);
+    }
+    pthread_mutex_unlock (&work_lock);
+
+    return NULL;
+} /* void *lv_worker */
+
+static void
+lv_stop_workers (void)
+{
+    int i;
+
+    pthread_mutex_lock (&work_lock);
+    work_shutdown = 1;
+    pthread_cond_broadcast (&work_cond);
+    pthread_mutex_unlock (&work_lock);
+
+    for (i = 0; i < nr_workers; ++i)
+        pthread_join (workers[i], NULL);
+    sfree (workers);
+    nr_workers = 0;
+
+    work_shutdown = 0;
+} /* void lv_stop_workers */
+
+static int
+lv_start_workers (void)
+{
+    int i;
+
+    if (threads_num <= 1)
+        return 0;
+
+    workers = calloc (threads_num - 1, sizeof (*workers));
+    if (workers == NULL) {
+        ERROR ("libvirt plugin: calloc failed.");
+        return -1;
+    }
+
+    for (i = 0; i < threads_num - 1; ++i) {
+        int status = plugin_thread_create (&workers[i], NULL, lv_worker, NULL);
+        if (status != 0) {
+            char errbuf[1024];
+            ERROR ("libvirt plugin: pthread_create failed: %s",
+                    sstrerror (errno, errbuf, sizeof (errbuf)));
+            break;
+        }
+        nr_workers++;
+    }
+
+    return 0;
+} /* int lv_start_workers */
+
+/* Reads all domains, using the worker threads if there are any. */
+static void
+lv_read_domains (void)
+{
+    pthread_mutex_lock (&work_lock);
+
+    work_next = 0;
+    work_end = nr_domains;
+    work_pending = nr_domains;
+    if (nr_workers > 0)
+        pthread_cond_broadcast (&work_cond);
+
+    lv_work ();
+    while (work_pending > 0)
+        pthread_cond_wait (&work_done_cond, &work_lock);
+
+    pthread_mutex_unlock (&work_lock);
+} /* void lv_read_domains */
+
+#if HAVE_VIR_DOMAIN_LIST_GET_STATS
+/* Returns the index of `dom' in `domains' or -1. Records are usually returned
+ * in the order of the list, so `hint' is checked first. */
+static int
+lv_domain_index (virDomainPtr dom, int hint)
+{
+    const char *name = virDomainGetName (dom);
+    int i;
+
+    if (name == NULL)
+        return -1;
+
+    if ((hint < nr_domains)
+            && (strcmp (name, virDomainGetName (domains[hint])) == 0))
+        return hint;
+
+    for (i = 0; i < nr_domains; ++i)
+        if (strcmp (name, virDomainGetName (domains[i])) == 0)
+            return i;
+
+    return -1;
+} /* int lv_domain_index */
+
+static int
+lv_stats_get_ullong (virDomainStatsRecordPtr record, const char *prefix,
+        unsigned int num, const char *field, unsigned long long *ret)
+{
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    if (field == NULL)
+        ssnprintf (name, sizeof (name), "%s.%u", prefix, num);
+    else
+        ssnprintf (name, sizeof (name), "%s.%u.%s", prefix, num, field);
+
+    return virTypedParamsGetULLong (record->params, record->nparams,
+            name, ret);
+} /* int lv_stats_get_ullong */
+
+static void
+lv_submit_stats_record (virDomainStatsRecordPtr record, virDomainPtr dom)
+{
+    unsigned long long v0, v1;
+    unsigned int count = 0;
+    unsigned int i;
+    int j;
+
+    if (virTypedParamsGetULLong (record->params, record->nparams,
+                "cpu.time", &v0) == 1)
+        cpu_submit (v0, dom, "virt_cpu_total");
+
+    if (virTypedParamsGetUInt (record->params, record->nparams,
+                "vcpu.current", &count) == 1)
+        for (i = 0; i < count; ++i)
+            if (lv_stats_get_ullong (record, "vcpu", i, "time", &v0) == 1)
+                vcpu_submit ((derive_t) v0, dom, (int) i, "virt_vcpu");
+
+    count = 0;
+    virTypedParamsGetUInt (record->params, record->nparams,
+            "block.count", &count);
+    for (i = 0; i < count; ++i) {
+        const char *devname = NULL;
+        char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+        ssnprintf (name, sizeof (name), "block.%u.name", i);
+        if (virTypedParamsGetString (record->params, record->nparams,
+                    name, &devname) != 1)
+            continue;
+
+        for (j = 0; j < nr_block_devices; ++j)
+            if ((block_devices[j].dom == dom)
+                    && (strcmp (block_devices[j].path, devname) == 0))
+                break;
+        if (j >= nr_block_devices)
+            continue;
+
+        if ((lv_stats_get_ullong (record, "block", i, "rd.reqs", &v0) == 1)
+                && (lv_stats_get_ullong (record, "block", i, "wr.reqs", &v1) == 1))
+            submit_derive2 ("disk_ops", (derive_t) v0, (derive_t) v1,
+                    dom, block_devices[j].path);
+
+        if ((lv_stats_get_ullong (record, "block", i, "rd.bytes", &v0) == 1)
+                && (lv_stats_get_ullong (record, "block", i, "wr.bytes", &v1) == 1))
+            submit_derive2 ("disk_octets", (derive_t) v0, (derive_t) v1,
+                    dom, block_devices[j].path);
+    }
+
+    count = 0;
+    virTypedParamsGetUInt (record->params, record->nparams,
+            "net.count", &count);
+    for (i = 0; i < count; ++i) {
+        const char *devname = NULL;
+        char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+        unsigned long long v[8];
+        static const char *fields[8] = {
+            "rx.bytes", "tx.bytes", "rx.pkts", "tx.pkts",
+            "rx.errs", "tx.errs", "rx.drop", "tx.drop"
+        };
+        int k;
+
+        ssnprintf (name, sizeof (name), "net.%u.name", i);
+        if (virTypedParamsGetString (record->params, record->nparams,
+                    name, &devname) != 1)
+            continue;
+
+        for (j = 0; j < nr_interface_devices; ++j)
+            if ((interface_devices[j].dom == dom)
+                    && (strcmp (interface_devices[j].path, devname) == 0))
+                break;
+        if (j >= nr_interface_devices)
+            continue;
+
+        /* missing fields are reported like -1 by virDomainInterfaceStats */
+        for (k = 0; k < 8; ++k)
+            if (lv_stats_get_ullong (record, "net", i, fields[k], &v[k]) != 1)
+                v[k] = (unsigned long long) -1;
+
+        submit_interface_stats (&interface_devices[j],
+                (long long) v[0], (long long) v[1],
+                (long long) v[2], (long long) v[3],
+                (long long) v[4], (long long) v[5],
+                (long long) v[6], (long long) v[7]);
+    }
+} /* void lv_submit_stats_record */
+
+/* Queries the statistics of all domains with a single call. Returns non-zero
+ * if this isn't possible, so the domains have to be queried one by one. */
+static int
+lv_read_bulk_stats (void)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    unsigned int stats = VIR_DOMAIN_STATS_CPU_TOTAL | VIR_DOMAIN_STATS_VCPU;
+    int records_num;
+    int i;
+
+    if (!use_bulk_stats)
+        return -1;
+    if (nr_domains == 0)
+        return 0;
+
+    if (nr_block_devices > 0)
+        stats |= VIR_DOMAIN_STATS_BLOCK;
+    if (nr_interface_devices > 0)
+        stats |= VIR_DOMAIN_STATS_INTERFACE;
+
+    records_num = virDomainListGetStats (domains, stats, &records, 0);
+    if (records_num < 0) {
+        virErrorPtr err = virConnGetLastError (conn);
+
+        if ((err != NULL) && (err->code == VIR_ERR_NO_SUPPORT)) {
+            INFO ("libvirt plugin: Querying statistics in bulk is not "
+                    "supported by the daemon. Querying domains one by one.");
+            use_bulk_stats = 0;
+        }
+        else
+            VIRT_ERROR (conn, "virDomainListGetStats");
+        return -1;
+    }
+
+    for (i = 0; i < records_num; ++i) {
+        int idx = lv_domain_index (records[i]->dom, i);
+        if (idx < 0)
+            continue;
+        lv_submit_stats_record (records[i], domains[idx]);
+    }
+
+    virDomainStatsRecordListFree (records);
+    return 0;
+} /* int lv_read_bulk_stats */
+#endif /* HAVE_VIR_DOMAIN_LIST_GET_STATS */
+
+static int
+lv_read (void)
+{
+    time_t t;
+
+    if (conn == NULL) {
+        /* `conn_string == NULL' is acceptable. */
+        conn = virConnectOpenReadOnly (conn_string);
+        if (conn == NULL) {
+            c_complain (LOG_ERR, &conn_complain,
+                    "libvirt plugin: Unable to connect: "
+                    "virConnectOpenReadOnly failed.");
+            return -1;
+        }
+    }
+    c_release (LOG_NOTICE, &conn_complain,
+            "libvirt plugin: Connection established.");
+
+    time (&t);
+
+    /* Need to refresh domain or device lists? */
+    if ((last_refresh == (time_t) 0) ||
+            ((interval > 0) && ((last_refresh + interval) <= t))) {
+        if (refresh_lists () != 0) {
+            if (conn != NULL)
+                virConnectClose (conn);
+            conn = NULL;
+            return -1;
+        }
+        last_refresh = t;
+    }
+
+#if HAVE_VIR_DOMAIN_LIST_GET_STATS
+    if (lv_read_bulk_stats () == 0)
+        return 0;
+#endif
+
+    lv_read_domains ();
 
     return 0;
 }
@@ -693,7 +1019,7 @@ static int
 add_domain (virDomainPtr dom)
 {
     virDomainPtr *new_ptr;
-    int new_size = sizeof (domains[0]) * (nr_domains+1);
+    int new_size = sizeof (domains[0]) * (nr_domains+2);
 
     if (domains)
         new_ptr = realloc (domains, new_size);
@@ -705,6 +1031,7 @@ add_domain (virDomainPtr dom)
 
     domains = new_ptr;
     domains[nr_domains] = dom;
+    domains[nr_domains+1] = NULL;
     return nr_domains++;
 }
 
@@ -822,6 +1149,8 @@ ignore_device_match (ignorelist_t *il, const char *domname, const char *devpath)
 static int
 lv_shutdown (void)
 {
+    lv_stop_workers ();
+
     free_block_devices ();
     free_interface_devices ();
     free_domains ();
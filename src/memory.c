@@ -67,7 +67,8 @@ static vm_size_t pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+# include "utils_procfile.h"
+static cu_procfile_t *proc_meminfo = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -102,7 +103,10 @@ static int memory_init (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif defined(KERNEL_LINUX)
-/* no init stuff */
+	if (proc_meminfo == NULL)
+		proc_meminfo = cu_procfile_create ("/proc/meminfo");
+	if (proc_meminfo == NULL)
+		return (-1);
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -261,8 +265,7 @@ static int memory_read (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
 
 	char *fields[8];
 	int numfields;
@@ -272,15 +275,15 @@ static int memory_read (void)
 	long long mem_cached = 0;
 	long long mem_free = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if (cu_procfile_read (proc_meminfo) != 0)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
+		WARNING ("memory: Reading /proc/meminfo failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	while ((buffer = cu_procfile_readline (proc_meminfo)) != NULL)
 	{
 		long long *val = NULL;
 
@@ -303,13 +306,6 @@ static int memory_read (void)
 		*val = atoll (fields[1]) * 1024LL;
 	}
 
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
-
 	if (mem_used >= (mem_free + mem_buffered + mem_cached))
 	{
 		mem_used -= mem_free + mem_buffered + mem_cached;
@@ -446,8 +442,20 @@ static int memory_read (void)
 	return (0);
 }
 
+#if KERNEL_LINUX
+static int memory_shutdown (void)
+{
+	cu_procfile_destroy (proc_meminfo);
+	proc_meminfo = NULL;
+	return (0);
+}
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
 	plugin_register_init ("memory", memory_init);
 	plugin_register_read ("memory", memory_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("memory", memory_shutdown);
+#endif
 } /* void module_register */
@@ -22,15 +22,47 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "meta_data.h"
+#include "utils_avltree.h"
 
 #include <pthread.h>
 
+/*
+ * Memory layout
+ *
+ * The entries of a meta_data_t live in one "body" block: A small header,
+ * followed by an array of entries, followed by a string area holding the
+ * string values. Keys are interned in a process wide table, so entries only
+ * hold a pointer to the shared copy. Once the table is full, keys are stored
+ * in the string area, too.
+ *
+ * Bodies are reference counted: meta_data_clone() only takes another
+ * reference, and the first modification of a shared body copies it
+ * ("copy on write").
+ *
+ * Bodies and meta_data_t handles are allocated in a few size classes. Each
+ * thread keeps a small cache of freed blocks per class, so that the network
+ * plugin, which creates and destroys one meta_data_t per received value, does
+ * not go to malloc(3) for every value.
+ */
+#define MD_ARENA_MIN_SHIFT 6 /* smallest class: 64 bytes */
+#define MD_ARENA_CLASSES 6   /* largest class: 2048 bytes */
+#define MD_ARENA_CLASS_NONE 0xff
+#define MD_ARENA_CACHE_MAX 64
+
+#define MD_INTERN_MAX 4096
+#define MD_INTERN_CACHE_SIZE 64
+
+#define MD_REF_LOCKS 16
+
+#define MD_ENTRIES_MIN 4
+#define MD_ENTRIES_MAX 0xffff
+
 /*
  * Data types
  */
 union meta_value_u
 {
-  char    *mv_string;
+  size_t   mv_string; /* offset into the string area */
   int64_t  mv_signed_int;
   uint64_t mv_unsigned_int;
   double   mv_double;
@@ -38,173 +70,514 @@ union meta_value_u
 };
 typedef union meta_value_u meta_value_t;
 
-struct meta_entry_s;
-typedef struct meta_entry_s meta_entry_t;
 struct meta_entry_s
 {
-  char         *key;
+  /* Interned key, or NULL if the key is stored in the string area at
+   * `key_offset'. */
+  const char   *key;
   meta_value_t  value;
+  uint32_t      key_offset;
   int           type;
-  meta_entry_t *next;
 };
+typedef struct meta_entry_s meta_entry_t;
+
+struct md_body_s
+{
+  int           refcount; /* protected by md_ref_lock () */
+  unsigned char arena_class;
+  uint16_t      entries_num;
+  uint16_t      entries_size;
+  uint32_t      strings_used;
+  uint32_t      strings_size;
+  meta_entry_t  entries[];
+};
+typedef struct md_body_s md_body_t;
 
 struct meta_data_s
 {
-  meta_entry_t   *head;
+  md_body_t      *body; /* NULL if empty */
   pthread_mutex_t lock;
 };
 
+struct md_free_block_s;
+typedef struct md_free_block_s md_free_block_t;
+struct md_free_block_s
+{
+  md_free_block_t *next;
+};
+
+struct md_arena_s
+{
+  md_free_block_t *free_list[MD_ARENA_CLASSES];
+  int              free_num[MD_ARENA_CLASSES];
+  const char      *intern_cache[MD_INTERN_CACHE_SIZE];
+};
+typedef struct md_arena_s md_arena_t;
+
+/*
+ * Private variables
+ */
+static pthread_once_t  md_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   md_arena_key;
+static _Bool           md_arena_key_valid = 0;
+
+static pthread_mutex_t md_ref_locks[MD_REF_LOCKS];
+
+static pthread_mutex_t md_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t   *md_intern_tree = NULL;
+static int             md_intern_num = 0;
+
 /*
  * Private functions
  */
-static char *md_strdup (const char *orig) /* {{{ */
+static void md_arena_destroy (void *arg) /* {{{ */
 {
-  size_t sz;
-  char *dest;
+  md_arena_t *a = arg;
+  int i;
 
-  if (orig == NULL)
+  if (a == NULL)
+    return;
+
+  for (i = 0; i < MD_ARENA_CLASSES; i++)
+  {
+    while (a->free_list[i] != NULL)
+    {
+      md_free_block_t *b = a->free_list[i];
+      a->free_list[i] = b->next;
+      free (b);
+    }
+  }
+
+  free (a);
+} /* }}} void md_arena_destroy */
+
+static void md_init_once (void) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < MD_REF_LOCKS; i++)
+    pthread_mutex_init (&md_ref_locks[i], /* attr = */ NULL);
+
+  if (pthread_key_create (&md_arena_key, md_arena_destroy) == 0)
+    md_arena_key_valid = 1;
+} /* }}} void md_init_once */
+
+static md_arena_t *md_arena_get (void) /* {{{ */
+{
+  md_arena_t *a;
+
+  pthread_once (&md_once, md_init_once);
+  if (!md_arena_key_valid)
     return (NULL);
 
-  sz = strlen (orig) + 1;
-  dest = (char *) malloc (sz);
-  if (dest == NULL)
+  a = pthread_getspecific (md_arena_key);
+  if (a != NULL)
+    return (a);
+
+  /* If this fails, blocks are simply not cached for this thread. */
+  a = calloc (1, sizeof (*a));
+  if (a == NULL)
     return (NULL);
 
-  memcpy (dest, orig, sz);
+  if (pthread_setspecific (md_arena_key, a) != 0)
+  {
+    free (a);
+    return (NULL);
+  }
 
-  return (dest);
-} /* }}} char *md_strdup */
+  return (a);
+} /* }}} md_arena_t *md_arena_get */
 
-static meta_entry_t *md_entry_alloc (const char *key) /* {{{ */
+static unsigned char md_arena_class (size_t size) /* {{{ */
 {
-  meta_entry_t *e;
+  unsigned char c;
+
+  for (c = 0; c < MD_ARENA_CLASSES; c++)
+    if (size <= (((size_t) 1) << (MD_ARENA_MIN_SHIFT + c)))
+      return (c);
+
+  return (MD_ARENA_CLASS_NONE);
+} /* }}} unsigned char md_arena_class */
+
+/* Allocates a block of at least `*size' bytes and updates `*size' to the
+ * usable size. The class to pass to md_block_free() is returned in
+ * `*ret_class'. */
+static void *md_block_alloc (size_t *size, unsigned char *ret_class) /* {{{ */
+{
+  unsigned char c;
+  md_arena_t *a;
+  void *block;
+
+  c = md_arena_class (*size);
+  *ret_class = c;
+  if (c == MD_ARENA_CLASS_NONE)
+    return (malloc (*size));
 
-  e = (meta_entry_t *) malloc (sizeof (*e));
-  if (e == NULL)
+  *size = ((size_t) 1) << (MD_ARENA_MIN_SHIFT + c);
+
+  a = md_arena_get ();
+  if ((a != NULL) && (a->free_list[c] != NULL))
   {
-    ERROR ("md_entry_alloc: malloc failed.");
-    return (NULL);
+    block = a->free_list[c];
+    a->free_list[c] = a->free_list[c]->next;
+    a->free_num[c]--;
+    return (block);
   }
-  memset (e, 0, sizeof (*e));
 
-  e->key = md_strdup (key);
-  if (e->key == NULL)
+  return (malloc (*size));
+} /* }}} void *md_block_alloc */
+
+static void md_block_free (void *block, unsigned char c) /* {{{ */
+{
+  md_arena_t *a;
+
+  if (block == NULL)
+    return;
+
+  if (c == MD_ARENA_CLASS_NONE)
   {
-    free (e);
-    ERROR ("md_entry_alloc: md_strdup failed.");
-    return (NULL);
+    free (block);
+    return;
   }
 
-  e->type = 0;
-  e->next = NULL;
+  /* Blocks go to the cache of the freeing thread, not the allocating one.
+   * That's fine: all blocks come from malloc(3) originally. */
+  a = md_arena_get ();
+  if ((a == NULL) || (a->free_num[c] >= MD_ARENA_CACHE_MAX))
+  {
+    free (block);
+    return;
+  }
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_alloc */
+  ((md_free_block_t *) block)->next = a->free_list[c];
+  a->free_list[c] = block;
+  a->free_num[c]++;
+} /* }}} void md_block_free */
 
-static meta_entry_t *md_entry_clone (const meta_entry_t *orig) /* {{{ */
+static unsigned int md_hash (const char *key) /* {{{ */
 {
-  meta_entry_t *copy;
+  unsigned int hash = 2166136261U;
 
-  if (orig == NULL)
-    return (NULL);
+  while (*key != 0)
+  {
+    hash ^= (unsigned char) *key;
+    hash *= 16777619U;
+    key++;
+  }
+
+  return (hash);
+} /* }}} unsigned int md_hash */
+
+/* Returns the interned copy of `key' or NULL if the table is full or memory
+ * is exhausted. Interned keys are never freed. */
+static const char *md_intern (const char *key) /* {{{ */
+{
+  md_arena_t *a;
+  unsigned int slot = 0;
+  char *ikey = NULL;
+
+  a = md_arena_get ();
+  if (a != NULL)
+  {
+    slot = md_hash (key) % MD_INTERN_CACHE_SIZE;
+    if ((a->intern_cache[slot] != NULL)
+        && (strcmp (a->intern_cache[slot], key) == 0))
+      return (a->intern_cache[slot]);
+  }
 
-  copy = md_entry_alloc (orig->key);
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup (orig->value.mv_string);
+  pthread_mutex_lock (&md_intern_lock);
+
+  if (md_intern_tree == NULL)
+    md_intern_tree = c_avl_create ((void *) strcmp);
+
+  if (md_intern_tree == NULL)
+    ikey = NULL;
+  else if (c_avl_get (md_intern_tree, key, (void *) &ikey) == 0)
+    /* found */;
+  else if (md_intern_num >= MD_INTERN_MAX)
+    ikey = NULL;
   else
-    copy->value = orig->value;
+  {
+    ikey = strdup (key);
+    if ((ikey != NULL) && (c_avl_insert (md_intern_tree, ikey, ikey) != 0))
+    {
+      free (ikey);
+      ikey = NULL;
+    }
+    else if (ikey != NULL)
+      md_intern_num++;
+  }
 
-  copy->next = md_entry_clone (orig->next);
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone */
+  pthread_mutex_unlock (&md_intern_lock);
+
+  if ((a != NULL) && (ikey != NULL))
+    a->intern_cache[slot] = ikey;
 
-static void md_entry_free (meta_entry_t *e) /* {{{ */
+  return (ikey);
+} /* }}} const char *md_intern */
+
+static pthread_mutex_t *md_ref_lock (const md_body_t *b) /* {{{ */
+{
+  return (&md_ref_locks[(((uintptr_t) b) >> 6) % MD_REF_LOCKS]);
+} /* }}} pthread_mutex_t *md_ref_lock */
+
+static void md_body_ref (md_body_t *b) /* {{{ */
+{
+  pthread_mutex_t *lock = md_ref_lock (b);
+
+  pthread_mutex_lock (lock);
+  b->refcount++;
+  pthread_mutex_unlock (lock);
+} /* }}} void md_body_ref */
+
+static void md_body_unref (md_body_t *b) /* {{{ */
 {
-  if (e == NULL)
+  pthread_mutex_t *lock;
+  int refcount;
+
+  if (b == NULL)
     return;
 
-  free (e->key);
+  lock = md_ref_lock (b);
+  pthread_mutex_lock (lock);
+  refcount = --b->refcount;
+  pthread_mutex_unlock (lock);
+
+  if (refcount == 0)
+    md_block_free (b, b->arena_class);
+} /* }}} void md_body_unref */
 
-  if (e->type == MD_TYPE_STRING)
-    free (e->value.mv_string);
+/* A body referenced by only one handle can't become shared while the lock of
+ * that handle is held, so the result stays valid until it is released. */
+static _Bool md_body_is_shared (md_body_t *b) /* {{{ */
+{
+  pthread_mutex_t *lock = md_ref_lock (b);
+  _Bool shared;
 
-  if (e->next != NULL)
-    md_entry_free (e->next);
+  pthread_mutex_lock (lock);
+  shared = (b->refcount > 1);
+  pthread_mutex_unlock (lock);
 
-  free (e);
-} /* }}} void md_entry_free */
+  return (shared);
+} /* }}} _Bool md_body_is_shared */
 
-static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
+static char *md_body_strings (md_body_t *b) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  return ((char *) (b->entries + b->entries_size));
+} /* }}} char *md_body_strings */
 
-  if ((md == NULL) || (e == NULL))
-    return (-EINVAL);
+static const char *md_entry_key (md_body_t *b, /* {{{ */
+    const meta_entry_t *e)
+{
+  if (e->key != NULL)
+    return (e->key);
+  return (md_body_strings (b) + e->key_offset);
+} /* }}} const char *md_entry_key */
+
+/* Copies `str' into the string area, which must have enough room, and
+ * returns its offset. */
+static uint32_t md_body_strdup (md_body_t *b, const char *str) /* {{{ */
+{
+  size_t len = strlen (str) + 1;
+  uint32_t offset = b->strings_used;
 
-  pthread_mutex_lock (&md->lock);
+  assert (b->strings_used + len <= b->strings_size);
+  memcpy (md_body_strings (b) + offset, str, len);
+  b->strings_used += (uint32_t) len;
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+  return (offset);
+} /* }}} uint32_t md_body_strdup */
 
-    prev = this;
-    this = this->next;
-  }
+/* XXX: The lock on md must be held while calling this function! */
+static int md_entry_lookup (meta_data_t *md, const char *key) /* {{{ */
+{
+  md_body_t *b = md->body;
+  int i;
+
+  if (b == NULL)
+    return (-1);
+
+  for (i = 0; i < b->entries_num; i++)
+    if (strcasecmp (key, md_entry_key (b, b->entries + i)) == 0)
+      return (i);
+
+  return (-1);
+} /* }}} int md_entry_lookup */
 
-  if (this == NULL)
+/* Makes sure md->body is private to md and has room for `entries_need' more
+ * entries and `strings_need' more bytes of strings. Copies and compacts the
+ * body if required.
+ * XXX: The lock on md must be held while calling this function! */
+static int md_body_reserve (meta_data_t *md, /* {{{ */
+    size_t entries_need, size_t strings_need)
+{
+  md_body_t *old = md->body;
+  md_body_t *new;
+  size_t entries_size;
+  size_t strings_size = strings_need;
+  size_t size;
+  unsigned char arena_class;
+  int i;
+
+  if ((old != NULL)
+      && (old->entries_num + entries_need <= old->entries_size)
+      && (old->strings_used + strings_need <= old->strings_size)
+      && !md_body_is_shared (old))
+    return (0);
+
+  entries_size = MD_ENTRIES_MIN;
+  if (old != NULL)
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
+    if (entries_size < old->entries_size)
+      entries_size = old->entries_size;
+
+    for (i = 0; i < old->entries_num; i++)
     {
-      assert (prev != NULL);
-      prev->next = e;
+      meta_entry_t *e = old->entries + i;
+
+      if (e->key == NULL)
+        strings_size += strlen (md_entry_key (old, e)) + 1;
+      if (e->type == MD_TYPE_STRING)
+        strings_size += strlen (md_body_strings (old) + e->value.mv_string) + 1;
     }
 
-    e->next = NULL;
+    while (entries_size < old->entries_num + entries_need)
+      entries_size *= 2;
   }
-  else /* (this != NULL) */
+
+  if (entries_size > MD_ENTRIES_MAX)
+    entries_size = MD_ENTRIES_MAX;
+  if (((old != NULL) ? old->entries_num : 0) + entries_need > entries_size)
+    return (-ENOMEM);
+
+  size = sizeof (*new) + entries_size * sizeof (new->entries[0])
+    + strings_size;
+  if (size > UINT32_MAX)
+    return (-ENOMEM);
+
+  new = md_block_alloc (&size, &arena_class);
+  if (new == NULL)
   {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+    ERROR ("md_body_reserve: md_block_alloc failed.");
+    return (-ENOMEM);
+  }
 
-    e->next = this->next;
+  new->refcount = 1;
+  new->arena_class = arena_class;
+  new->entries_num = 0;
+  new->entries_size = (uint16_t) entries_size;
+  new->strings_used = 0;
+  new->strings_size = (uint32_t) (size - sizeof (*new)
+      - entries_size * sizeof (new->entries[0]));
+
+  if (old != NULL)
+  {
+    for (i = 0; i < old->entries_num; i++)
+    {
+      meta_entry_t *src = old->entries + i;
+      meta_entry_t *dst = new->entries + i;
+
+      *dst = *src;
+      if (src->key == NULL)
+        dst->key_offset = md_body_strdup (new, md_entry_key (old, src));
+      if (src->type == MD_TYPE_STRING)
+        dst->value.mv_string = md_body_strdup (new,
+            md_body_strings (old) + src->value.mv_string);
+    }
+    new->entries_num = old->entries_num;
   }
 
-  pthread_mutex_unlock (&md->lock);
+  md->body = new;
+  md_body_unref (old);
+
+  return (0);
+} /* }}} int md_body_reserve */
+
+/* Adds or replaces the entry `key'. If `type' is MD_TYPE_STRING, the value is
+ * taken from `str', otherwise from `value'. */
+static int md_entry_set (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t value, const char *str)
+{
+  const char *ikey = NULL;
+  size_t strings_need = 0;
+  meta_entry_t *e;
+  int index;
+  int status;
+
+  pthread_mutex_lock (&md->lock);
+
+  index = md_entry_lookup (md, key);
+  if (index < 0)
+  {
+    ikey = md_intern (key);
+    if (ikey == NULL)
+      strings_need += strlen (key) + 1;
+  }
+  if (type == MD_TYPE_STRING)
+    strings_need += strlen (str) + 1;
+
+  status = md_body_reserve (md, (index < 0) ? 1 : 0, strings_need);
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&md->lock);
+    return (status);
+  }
 
-  if (this != NULL)
+  /* The order of entries is preserved when the body is copied, so `index'
+   * is still valid. */
+  if (index < 0)
   {
-    this->next = NULL;
-    md_entry_free (this);
+    e = md->body->entries + md->body->entries_num;
+    md->body->entries_num++;
+
+    e->key = ikey;
+    e->key_offset = 0;
+    if (ikey == NULL)
+      e->key_offset = md_body_strdup (md->body, key);
   }
+  else
+    e = md->body->entries + index;
 
+  /* The space used by a replaced string is reclaimed the next time the body
+   * is copied. */
+  e->type = type;
+  if (type == MD_TYPE_STRING)
+    e->value.mv_string = md_body_strdup (md->body, str);
+  else
+    e->value = value;
+
+  pthread_mutex_unlock (&md->lock);
   return (0);
-} /* }}} int md_entry_insert */
+} /* }}} int md_entry_set */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
-    const char *key)
+/* Looks up `key' and checks its type. On success, the lock on md is held and
+ * the entry is returned in `*ret'; the caller must release the lock. */
+static int md_entry_get (meta_data_t *md, const char *key, /* {{{ */
+    int type, const char *func, meta_entry_t **ret)
 {
   meta_entry_t *e;
+  int index;
 
-  if ((md == NULL) || (key == NULL))
-    return (NULL);
+  pthread_mutex_lock (&md->lock);
+
+  index = md_entry_lookup (md, key);
+  if (index < 0)
+  {
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
+  }
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp (key, e->key) == 0)
-      break;
+  e = md->body->entries + index;
+  if (e->type != type)
+  {
+    ERROR ("%s: Type mismatch for key `%s'", func, md_entry_key (md->body, e));
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
+  }
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_lookup */
+  *ret = e;
+  return (0);
+} /* }}} int md_entry_get */
 
 /*
  * Public functions
@@ -212,8 +585,10 @@ static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
 meta_data_t *meta_data_create (void) /* {{{ */
 {
   meta_data_t *md;
+  size_t size = sizeof (*md);
+  unsigned char arena_class;
 
-  md = (meta_data_t *) malloc (sizeof (*md));
+  md = md_block_alloc (&size, &arena_class);
   if (md == NULL)
   {
     ERROR ("meta_data_create: malloc failed.");
@@ -221,7 +596,7 @@ meta_data_t *meta_data_create (void) /* {{{ */
   }
   memset (md, 0, sizeof (*md));
 
-  md->head = NULL;
+  md->body = NULL;
   pthread_mutex_init (&md->lock, /* attr = */ NULL);
 
   return (md);
@@ -239,7 +614,9 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
     return (NULL);
 
   pthread_mutex_lock (&orig->lock);
-  copy->head = md_entry_clone (orig->head);
+  copy->body = orig->body;
+  if (copy->body != NULL)
+    md_body_ref (copy->body);
   pthread_mutex_unlock (&orig->lock);
 
   return (copy);
@@ -250,114 +627,93 @@ void meta_data_destroy (meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  pthread_mutex_destroy(&md->lock);
-  md_entry_free (md->head);
+  md_body_unref (md->body);
   pthread_mutex_destroy (&md->lock);
-  free (md);
+  md_block_free (md, md_arena_class (sizeof (*md)));
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int index;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return (1);
-    }
-  }
-
+  index = md_entry_lookup (md, key);
   pthread_mutex_unlock (&md->lock);
-  return (0);
+
+  return ((index < 0) ? 0 : 1);
 } /* }}} int meta_data_exists */
 
 int meta_data_type (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int index;
+  int type = 0;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return e->type;
-    }
-  }
-
+  index = md_entry_lookup (md, key);
+  if (index >= 0)
+    type = md->body->entries[index].type;
   pthread_mutex_unlock (&md->lock);
-  return 0;
+
+  return type;
 } /* }}} int meta_data_type */
 
 int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
-  meta_entry_t *e;
+  int i, count = 0;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
 
-  for (e = md->head; e != NULL; e = e->next)
-    ++count;    
+  if (md->body != NULL)
+    count = md->body->entries_num;
 
   *toc = malloc(count * sizeof(**toc));
-  for (e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
-  
+  for (i = 0; i < count; i++)
+    (*toc)[i] = strdup(md_entry_key (md->body, md->body->entries + i));
+
   pthread_mutex_unlock (&md->lock);
   return count;
 } /* }}} int meta_data_toc */
 
 int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  md_body_t *b;
+  int index;
+  int status;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+  index = md_entry_lookup (md, key);
+  if (index < 0)
   {
-    if (strcasecmp (key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
   }
 
-  if (this == NULL)
+  status = md_body_reserve (md, /* entries = */ 0, /* strings = */ 0);
+  if (status != 0)
   {
     pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
+    return (status);
   }
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
+  b = md->body;
+  memmove (b->entries + index, b->entries + index + 1,
+      (b->entries_num - index - 1) * sizeof (b->entries[0]));
+  b->entries_num--;
 
   pthread_mutex_unlock (&md->lock);
-
-  this->next = NULL;
-  md_entry_free (this);
-
   return (0);
 } /* }}} int meta_data_delete */
 
@@ -367,97 +723,62 @@ int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 int meta_data_add_string (meta_data_t *md, /* {{{ */
     const char *key, const char *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_string = md_strdup (value);
-  if (e->value.mv_string == NULL)
-  {
-    ERROR ("meta_data_add_string: md_strdup failed.");
-    md_entry_free (e);
-    return (-ENOMEM);
-  }
-  e->type = MD_TYPE_STRING;
-
-  return (md_entry_insert (md, e));
+  memset (&v, 0, sizeof (v));
+  return (md_entry_set (md, key, MD_TYPE_STRING, v, value));
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  v.mv_signed_int = value;
+  return (md_entry_set (md, key, MD_TYPE_SIGNED_INT, v, NULL));
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  v.mv_unsigned_int = value;
+  return (md_entry_set (md, key, MD_TYPE_UNSIGNED_INT, v, NULL));
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double (meta_data_t *md, /* {{{ */
     const char *key, double value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
-
-  return (md_entry_insert (md, e));
+  v.mv_double = value;
+  return (md_entry_set (md, key, MD_TYPE_DOUBLE, v, NULL));
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return (md_entry_insert (md, e));
+  memset (&v, 0, sizeof (v));
+  v.mv_boolean = value;
+  return (md_entry_set (md, key, MD_TYPE_BOOLEAN, v, NULL));
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -468,35 +789,24 @@ int meta_data_get_string (meta_data_t *md, /* {{{ */
 {
   meta_entry_t *e;
   char *temp;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_STRING,
+      "meta_data_get_string", &e);
+  if (status != 0)
+    return (status);
 
-  if (e->type != MD_TYPE_STRING)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  temp = strdup (md_body_strings (md->body) + e->value.mv_string);
+  pthread_mutex_unlock (&md->lock);
 
-  temp = md_strdup (e->value.mv_string);
   if (temp == NULL)
   {
-    pthread_mutex_unlock (&md->lock);
-    ERROR ("meta_data_get_string: md_strdup failed.");
+    ERROR ("meta_data_get_string: strdup failed.");
     return (-ENOMEM);
   }
- 
-  pthread_mutex_unlock (&md->lock);
 
   *value = temp;
 
@@ -507,25 +817,15 @@ int meta_data_get_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t *value)
 {
   meta_entry_t *e;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_SIGNED_INT)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_SIGNED_INT,
+      "meta_data_get_signed_int", &e);
+  if (status != 0)
+    return (status);
 
   *value = e->value.mv_signed_int;
 
@@ -537,25 +837,15 @@ int meta_data_get_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t *value)
 {
   meta_entry_t *e;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_UNSIGNED_INT)
-  {
-    ERROR ("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_UNSIGNED_INT,
+      "meta_data_get_unsigned_int", &e);
+  if (status != 0)
+    return (status);
 
   *value = e->value.mv_unsigned_int;
 
@@ -567,25 +857,15 @@ int meta_data_get_double (meta_data_t *md, /* {{{ */
     const char *key, double *value)
 {
   meta_entry_t *e;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_DOUBLE)
-  {
-    ERROR ("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_DOUBLE,
+      "meta_data_get_double", &e);
+  if (status != 0)
+    return (status);
 
   *value = e->value.mv_double;
 
@@ -597,25 +877,15 @@ int meta_data_get_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool *value)
 {
   meta_entry_t *e;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_BOOLEAN)
-  {
-    ERROR ("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_BOOLEAN,
+      "meta_data_get_boolean", &e);
+  if (status != 0)
+    return (status);
 
   *value = e->value.mv_boolean;
 
@@ -23,6 +23,7 @@
  **/
 
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For sendmmsg(2) */
 
 #include "collectd.h"
 #include "plugin.h"
@@ -127,7 +128,6 @@ struct sockent_server
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
 #endif
 };
 
@@ -283,11 +283,59 @@ static int network_config_stats = 0;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t       receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t        receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t              receive_list_length = 0;
+/* Received packets are verified, decrypted and parsed by one or more dispatch
+ * threads. Packets are assigned to a thread by the sender's address, so the
+ * values of one host are always handled by the same thread and in order. */
+struct dispatch_worker_s
+{
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t              length;
+  pthread_mutex_t       lock;
+  pthread_cond_t        cond;
+
+  /* Packets received but not yet handed to this worker. Only used by the
+   * receive thread. */
+  receive_list_entry_t *private_head;
+  receive_list_entry_t *private_tail;
+  uint64_t              private_length;
+
+  derive_t values_dispatched;
+  derive_t values_not_dispatched;
+
+#if HAVE_LIBGCRYPT
+  /* Keys of the users seen by this worker, see network_get_user_key(). */
+  c_avl_tree_t *user_keys;
+#endif
+
+  _Bool     running;
+  pthread_t thread_id;
+};
+typedef struct dispatch_worker_s dispatch_worker_t;
+
+static int                network_config_dispatch_threads = 1;
+static dispatch_worker_t *dispatch_workers = NULL;
+static size_t             dispatch_workers_num = 0;
+
+#if HAVE_LIBGCRYPT
+/* HMAC and cipher handles of one user, keyed with the user's secret. Setting
+ * up these handles is expensive compared to hashing or decrypting one packet,
+ * so each dispatch thread keeps them around and only re-checks the AuthFile
+ * once every USER_KEY_CHECK_INTERVAL. */
+#define USER_KEY_CHECK_INTERVAL TIME_T_TO_CDTIME_T (1)
+struct user_key_s
+{
+  /* The user DB and the user name form the key of the `user_keys' tree. */
+  fbhash_t *userdb;
+  char     *username;
+
+  char             *secret;
+  gcry_md_hd_t      hmac;   /* HMAC-SHA-256 */
+  gcry_cipher_hd_t  cypher; /* AES-256-OFB */
+  cdtime_t          last_check;
+};
+typedef struct user_key_s user_key_t;
+#endif
 
 static sockent_t     *listen_sockets = NULL;
 static struct pollfd *listen_sockets_pollfd = NULL;
@@ -298,46 +346,247 @@ static size_t         listen_sockets_num = 0;
 static int       listen_loop = 0;
 static int       receive_thread_running = 0;
 static pthread_t receive_thread_id;
-static int       dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
 
-/* Buffer in which to-be-sent network packets are constructed. */
-static char            *send_buffer;
-static char            *send_buffer_ptr;
-static int              send_buffer_fill;
-static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
-static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Buffers in which to-be-sent network packets are constructed. Writing
+ * threads are spread over several buffers, so they don't serialize on a single
+ * lock. Each buffer is turned into a complete packet of its own. */
+#define SEND_BUFFERS_NUM 8
+struct send_buffer_s
+{
+	char            *buffer;
+	char            *ptr;
+	int              fill;
+	value_list_t     vl;
+	cdtime_t         first_value; /* time the first value was added */
+	derive_t         values_sent;
+	pthread_mutex_t  lock;
+};
+typedef struct send_buffer_s send_buffer_t;
+static send_buffer_t send_buffers[SEND_BUFFERS_NUM];
+
+/* Complete packets waiting to be sent by the send thread. Signing, encryption
+ * and the actual sending is done by this thread only, so writers never block
+ * on the network. */
+#define SEND_QUEUE_MAX 1024
+struct send_queue_entry_s
+{
+	char   *data;
+	size_t  data_len;
+	struct send_queue_entry_s *next;
+};
+typedef struct send_queue_entry_s send_queue_entry_t;
+
+static send_queue_entry_t *send_queue_head = NULL;
+static send_queue_entry_t *send_queue_tail = NULL;
+static size_t              send_queue_length = 0;
+static pthread_mutex_t     send_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t      send_queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* Number of packets handed to sendmmsg(2) at once. */
+#define SEND_BATCH_SIZE 32
+static char     *send_thread_buffer = NULL;
+static int       send_loop = 0;
+static int       send_thread_running = 0;
+static pthread_t send_thread_id;
+
+static void network_flush_stale (void);
+
+/* Time of the last value sent, per identifier. Only required to detect
+ * values we sent ourselves coming back in, i.e. only if we also listen. This
+ * used to be stored as meta data in the global value cache; it's kept here in
+ * several independently locked trees so writers don't contend on the cache
+ * lock. */
+#define TIME_SENT_SHARDS_NUM 16
+struct time_sent_shard_s
+{
+	c_avl_tree_t    *tree;
+	pthread_mutex_t  lock;
+};
+typedef struct time_sent_shard_s time_sent_shard_t;
+static time_sent_shard_t time_sent_shards[TIME_SENT_SHARDS_NUM];
+static _Bool             time_sent_enabled = 0;
+static cdtime_t          time_sent_last_purge = 0;
 
 /* XXX: These counters are incremented from one place only. The spot in which
  * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
+ * dispatch or send thread, for example) or locked by some lock (a send
+ * buffer's lock for example). Only if neither is true, the stats_lock is
+ * acquired. The counters are always read without holding a lock in the hope
+ * that writing 8 bytes to memory is an atomic operation. */
 static derive_t stats_octets_rx  = 0;
 static derive_t stats_octets_tx  = 0;
 static derive_t stats_packets_rx = 0;
 static derive_t stats_packets_tx = 0;
-static derive_t stats_values_dispatched = 0;
-static derive_t stats_values_not_dispatched = 0;
-static derive_t stats_values_sent = 0;
 static derive_t stats_values_not_sent = 0;
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Private functions
  */
+static time_sent_shard_t *time_sent_get_shard (const char *name) /* {{{ */
+{
+  uint32_t hash = 5381;
+  const unsigned char *ptr;
+
+  for (ptr = (const unsigned char *) name; *ptr != 0; ptr++)
+    hash = ((hash << 5) + hash) + ((uint32_t) *ptr);
+
+  return (&time_sent_shards[hash % TIME_SENT_SHARDS_NUM]);
+} /* }}} time_sent_shard_t *time_sent_get_shard */
+
+static void time_sent_set (const value_list_t *vl) /* {{{ */
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  time_sent_shard_t *shard;
+  cdtime_t *time_sent = NULL;
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+    return;
+
+  shard = time_sent_get_shard (name);
+  pthread_mutex_lock (&shard->lock);
+
+  if (c_avl_get (shard->tree, name, (void *) &time_sent) == 0)
+  {
+    *time_sent = vl->time;
+  }
+  else
+  {
+    char *key = strdup (name);
+    time_sent = malloc (sizeof (*time_sent));
+    if ((key == NULL) || (time_sent == NULL)
+        || (c_avl_insert (shard->tree, key, time_sent) != 0))
+    {
+      sfree (key);
+      sfree (time_sent);
+    }
+    else
+    {
+      *time_sent = vl->time;
+    }
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+} /* }}} void time_sent_set */
+
+static int time_sent_get (const value_list_t *vl, cdtime_t *ret) /* {{{ */
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  time_sent_shard_t *shard;
+  cdtime_t *time_sent = NULL;
+  int status;
+
+  if (!time_sent_enabled)
+    return (-1);
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+    return (-1);
+
+  shard = time_sent_get_shard (name);
+  pthread_mutex_lock (&shard->lock);
+  status = c_avl_get (shard->tree, name, (void *) &time_sent);
+  if (status == 0)
+    *ret = *time_sent;
+  pthread_mutex_unlock (&shard->lock);
+
+  return (status);
+} /* }}} int time_sent_get */
+
+/* Remove identifiers which haven't been sent for a while. Called from the
+ * send thread only. */
+static void time_sent_purge (void) /* {{{ */
+{
+  cdtime_t now;
+  cdtime_t max_age;
+  size_t i;
+
+  if (!time_sent_enabled)
+    return;
+
+  now = cdtime ();
+  max_age = ((cdtime_t) timeout_g) * interval_g;
+  if ((now - time_sent_last_purge) < max_age)
+    return;
+  time_sent_last_purge = now;
+
+  for (i = 0; i < TIME_SENT_SHARDS_NUM; i++)
+  {
+    time_sent_shard_t *shard = time_sent_shards + i;
+    c_avl_iterator_t *iter;
+    char **expired = NULL;
+    size_t expired_num = 0;
+    char *key;
+    cdtime_t *time_sent;
+    size_t j;
+
+    pthread_mutex_lock (&shard->lock);
+
+    iter = c_avl_get_iterator (shard->tree);
+    while (c_avl_iterator_next (iter, (void *) &key, (void *) &time_sent) == 0)
+    {
+      char **tmp;
+
+      if ((*time_sent + max_age) >= now)
+        continue;
+
+      tmp = realloc (expired, (expired_num + 1) * sizeof (*expired));
+      if (tmp == NULL)
+        break;
+      expired = tmp;
+      expired[expired_num] = key;
+      expired_num++;
+    }
+    c_avl_iterator_destroy (iter);
+
+    for (j = 0; j < expired_num; j++)
+    {
+      if (c_avl_remove (shard->tree, expired[j],
+            (void *) &key, (void *) &time_sent) != 0)
+        continue;
+      sfree (key);
+      sfree (time_sent);
+    }
+
+    pthread_mutex_unlock (&shard->lock);
+    sfree (expired);
+  }
+} /* }}} void time_sent_purge */
+
+static void time_sent_destroy (void) /* {{{ */
+{
+  size_t i;
+
+  if (!time_sent_enabled)
+    return;
+  time_sent_enabled = 0;
+
+  for (i = 0; i < TIME_SENT_SHARDS_NUM; i++)
+  {
+    time_sent_shard_t *shard = time_sent_shards + i;
+    void *key;
+    void *value;
+
+    while (c_avl_pick (shard->tree, &key, &value) == 0)
+    {
+      sfree (key);
+      sfree (value);
+    }
+    c_avl_destroy (shard->tree);
+    shard->tree = NULL;
+    pthread_mutex_destroy (&shard->lock);
+  }
+} /* }}} void time_sent_destroy */
+
 static _Bool check_receive_okay (const value_list_t *vl) /* {{{ */
 {
-  uint64_t time_sent = 0;
+  cdtime_t time_sent = 0;
   int status;
 
-  status = uc_meta_data_get_unsigned_int (vl,
-      "network:time_sent", &time_sent);
+  status = time_sent_get (vl, &time_sent);
 
   /* This is a value we already sent. Don't allow it to be received again in
    * order to avoid looping. */
-  if ((status == 0) && (time_sent >= ((uint64_t) vl->time)))
+  if ((status == 0) && (time_sent >= vl->time))
     return (0);
 
   return (1);
@@ -406,8 +655,8 @@ static _Bool check_send_notify_okay (const notification_t *n) /* {{{ */
   return (!received);
 } /* }}} _Bool check_send_notify_okay */
 
-static int network_dispatch_values (value_list_t *vl, /* {{{ */
-    const char *username)
+static int network_dispatch_values (dispatch_worker_t *dw, /* {{{ */
+    value_list_t *vl, const char *username)
 {
   int status;
 
@@ -426,7 +675,7 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
     DEBUG ("network plugin: network_dispatch_values: "
 	"NOT dispatching %s.", name);
 #endif
-    stats_values_not_dispatched++;
+    dw->values_not_dispatched++;
     return (0);
   }
 
@@ -461,7 +710,7 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
   }
 
   plugin_dispatch_values_secure (vl);
-  stats_values_dispatched++;
+  dw->values_dispatched++;
 
   meta_data_destroy (vl->meta);
   vl->meta = NULL;
@@ -494,37 +743,13 @@ static int network_dispatch_notification (notification_t *n) /* {{{ */
 
 #if HAVE_LIBGCRYPT
 static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
-    const void *iv, size_t iv_size, const char *username)
+    const void *iv, size_t iv_size)
 {
   gcry_error_t err;
   gcry_cipher_hd_t *cyper_ptr;
-  unsigned char password_hash[32];
-
-  if (se->type == SOCKENT_TYPE_CLIENT)
-  {
-	  cyper_ptr = &se->data.client.cypher;
-	  memcpy (password_hash, se->data.client.password_hash,
-			  sizeof (password_hash));
-  }
-  else
-  {
-	  char *secret;
 
-	  cyper_ptr = &se->data.server.cypher;
-
-	  if (username == NULL)
-		  return (NULL);
-
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
-		  return (NULL);
-
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
-
-	  sfree (secret);
-  }
+  assert (se->type == SOCKENT_TYPE_CLIENT);
+  cyper_ptr = &se->data.client.cypher;
 
   if (*cyper_ptr == NULL)
   {
@@ -537,36 +762,224 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
       *cyper_ptr = NULL;
       return (NULL);
     }
+
+    err = gcry_cipher_setkey (*cyper_ptr,
+        se->data.client.password_hash,
+        sizeof (se->data.client.password_hash));
+    if (err != 0)
+    {
+      ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+          gcry_strerror (err));
+      gcry_cipher_close (*cyper_ptr);
+      *cyper_ptr = NULL;
+      return (NULL);
+    }
   }
   else
   {
+    /* Resetting the handle keeps the key schedule. */
     gcry_cipher_reset (*cyper_ptr);
   }
   assert (*cyper_ptr != NULL);
 
-  err = gcry_cipher_setkey (*cyper_ptr,
-      password_hash, sizeof (password_hash));
+  err = gcry_cipher_setiv (*cyper_ptr, iv, iv_size);
   if (err != 0)
   {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+    ERROR ("network plugin: gcry_cipher_setiv returned: %s",
         gcry_strerror (err));
     gcry_cipher_close (*cyper_ptr);
     *cyper_ptr = NULL;
     return (NULL);
   }
 
-  err = gcry_cipher_setiv (*cyper_ptr, iv, iv_size);
+  return (*cyper_ptr);
+} /* }}} int network_get_aes256_cypher */
+
+static int user_key_compare (const user_key_t *k0, /* {{{ */
+    const user_key_t *k1)
+{
+  if (k0->userdb < k1->userdb)
+    return (-1);
+  else if (k0->userdb > k1->userdb)
+    return (1);
+  return (strcmp (k0->username, k1->username));
+} /* }}} int user_key_compare */
+
+static void user_key_free (user_key_t *uk) /* {{{ */
+{
+  if (uk == NULL)
+    return;
+
+  if (uk->hmac != NULL)
+    gcry_md_close (uk->hmac);
+  if (uk->cypher != NULL)
+    gcry_cipher_close (uk->cypher);
+  sfree (uk->secret);
+  sfree (uk->username);
+  sfree (uk);
+} /* }}} void user_key_free */
+
+static void user_keys_destroy (c_avl_tree_t *tree) /* {{{ */
+{
+  user_key_t *key;
+  user_key_t *uk;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, (void *) &key, (void *) &uk) == 0)
+    user_key_free (uk);
+
+  c_avl_destroy (tree);
+} /* }}} void user_keys_destroy */
+
+/* Keys the HMAC and cipher handles of `uk' with `secret'. Takes ownership of
+ * `secret', even if an error occurs. */
+static int user_key_set_secret (user_key_t *uk, char *secret) /* {{{ */
+{
+  unsigned char password_hash[32];
+  gcry_error_t err;
+
+  if (uk->hmac == NULL)
+  {
+    err = gcry_md_open (&uk->hmac, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+    if (err != 0)
+    {
+      ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
+          gcry_strerror (err));
+      uk->hmac = NULL;
+      sfree (secret);
+      return (-1);
+    }
+  }
+
+  err = gcry_md_setkey (uk->hmac, secret, strlen (secret));
+  if (err != 0)
+  {
+    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
+    sfree (secret);
+    return (-1);
+  }
+
+  if (uk->cypher == NULL)
+  {
+    err = gcry_cipher_open (&uk->cypher,
+        GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
+    if (err != 0)
+    {
+      ERROR ("network plugin: gcry_cipher_open returned: %s",
+          gcry_strerror (err));
+      uk->cypher = NULL;
+      sfree (secret);
+      return (-1);
+    }
+  }
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, password_hash,
+      secret, strlen (secret));
+  err = gcry_cipher_setkey (uk->cypher, password_hash, sizeof (password_hash));
   if (err != 0)
   {
     ERROR ("network plugin: gcry_cipher_setkey returned: %s",
         gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
+    sfree (secret);
+    return (-1);
+  }
+
+  sfree (uk->secret);
+  uk->secret = secret;
+
+  return (0);
+} /* }}} int user_key_set_secret */
+
+/* Returns the keyed handles of `username' from the worker's cache. The entry
+ * is validated against the AuthFile of `se' at most once per
+ * USER_KEY_CHECK_INTERVAL, so changes to the file still take effect. Returns
+ * NULL if the user is unknown. */
+static user_key_t *network_get_user_key (dispatch_worker_t *dw, /* {{{ */
+    sockent_t *se, const char *username)
+{
+  user_key_t key;
+  user_key_t *uk = NULL;
+  char *secret;
+  cdtime_t now;
+
+  if (username == NULL)
     return (NULL);
+
+  memset (&key, 0, sizeof (key));
+  key.userdb = se->data.server.userdb;
+  key.username = (char *) username;
+
+  now = cdtime ();
+  if (c_avl_get (dw->user_keys, &key, (void *) &uk) == 0)
+  {
+    if ((now - uk->last_check) < USER_KEY_CHECK_INTERVAL)
+      return (uk);
+  }
+  else
+  {
+    uk = NULL;
   }
 
-  return (*cyper_ptr);
-} /* }}} int network_get_aes256_cypher */
+  secret = fbh_get (se->data.server.userdb, username);
+  if (secret == NULL)
+  {
+    /* The user has been removed from the AuthFile. */
+    if (uk != NULL)
+    {
+      c_avl_remove (dw->user_keys, uk, NULL, NULL);
+      user_key_free (uk);
+    }
+    return (NULL);
+  }
+
+  if (uk != NULL)
+  {
+    uk->last_check = now;
+    if (strcmp (uk->secret, secret) == 0)
+    {
+      sfree (secret);
+      return (uk);
+    }
+
+    if (user_key_set_secret (uk, secret) != 0)
+    {
+      c_avl_remove (dw->user_keys, uk, NULL, NULL);
+      user_key_free (uk);
+      return (NULL);
+    }
+    return (uk);
+  }
+
+  uk = malloc (sizeof (*uk));
+  if (uk == NULL)
+  {
+    sfree (secret);
+    return (NULL);
+  }
+  memset (uk, 0, sizeof (*uk));
+  uk->userdb = se->data.server.userdb;
+  uk->username = strdup (username);
+  uk->last_check = now;
+
+  if (uk->username == NULL)
+  {
+    sfree (secret);
+    user_key_free (uk);
+    return (NULL);
+  }
+
+  /* `secret' is owned by `uk' or has been freed after this call. */
+  if ((user_key_set_secret (uk, secret) != 0)
+      || (c_avl_insert (dw->user_keys, uk, uk) != 0))
+  {
+    user_key_free (uk);
+    return (NULL);
+  }
+
+  return (uk);
+} /* }}} user_key_t *network_get_user_key */
 #endif /* HAVE_LIBGCRYPT */
 
 static int write_part_values (char **ret_buffer, int *ret_buffer_len,
@@ -981,7 +1394,7 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
  * parse_packet and vice versa. */
 #define PP_SIGNED    0x01
 #define PP_ENCRYPTED 0x02
-static int parse_packet (sockent_t *se,
+static int parse_packet (dispatch_worker_t *dw, sockent_t *se,
 		void *buffer, size_t buffer_size, int flags,
 		const char *username);
 
@@ -991,8 +1404,8 @@ static int parse_packet (sockent_t *se,
 } while (0)
 
 #if HAVE_LIBGCRYPT
-static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_len, int flags)
+static int parse_part_sign_sha256 (dispatch_worker_t *dw, /* {{{ */
+    sockent_t *se, void **ret_buffer, size_t *ret_buffer_len, int flags)
 {
   static c_complain_t complain_no_users = C_COMPLAIN_INIT_STATIC;
 
@@ -1001,14 +1414,12 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
+  user_key_t *uk;
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof (pss.hash)];
 
-  gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -1055,55 +1466,29 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == pss_head_length);
 
-  /* Query the password */
-  secret = fbh_get (se->data.server.userdb, pss.username);
-  if (secret == NULL)
+  /* Look up the user's keyed HMAC handle */
+  uk = network_get_user_key (dw, se, pss.username);
+  if (uk == NULL)
   {
     ERROR ("network plugin: Unknown user: %s", pss.username);
     sfree (pss.username);
     return (-ENOENT);
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
-        gcry_strerror (err));
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  err = gcry_md_setkey (hd, secret, strlen (secret));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
-    gcry_md_close (hd);
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  gcry_md_write (hd,
+  /* Resetting an HMAC handle keeps the key. */
+  gcry_md_reset (uk->hmac);
+  gcry_md_write (uk->hmac,
       buffer     + PART_SIGNATURE_SHA256_SIZE,
       buffer_len - PART_SIGNATURE_SHA256_SIZE);
-  hash_ptr = gcry_md_read (hd, GCRY_MD_SHA256);
+  hash_ptr = gcry_md_read (uk->hmac, GCRY_MD_SHA256);
   if (hash_ptr == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
   memcpy (hash, hash_ptr, sizeof (hash));
 
-  /* Clean up */
-  gcry_md_close (hd);
-  hd = NULL;
-
   if (memcmp (pss.hash, hash, sizeof (pss.hash)) != 0)
   {
     WARNING ("network plugin: Verifying HMAC-SHA-256 signature failed: "
@@ -1111,11 +1496,10 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   }
   else
   {
-    parse_packet (se, buffer + buffer_offset, buffer_len - buffer_offset,
+    parse_packet (dw, se, buffer + buffer_offset, buffer_len - buffer_offset,
         flags | PP_SIGNED, pss.username);
   }
 
-  sfree (secret);
   sfree (pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1126,8 +1510,8 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 /* #endif HAVE_LIBGCRYPT */
 
 #else /* if !HAVE_LIBGCRYPT */
-static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_size, int flags)
+static int parse_part_sign_sha256 (dispatch_worker_t *dw, /* {{{ */
+    sockent_t *se, void **ret_buffer, size_t *ret_buffer_size, int flags)
 {
   static int warning_has_been_printed = 0;
 
@@ -1161,7 +1545,7 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
     warning_has_been_printed = 1;
   }
 
-  parse_packet (se, buffer + part_len, buffer_size - part_len, flags,
+  parse_packet (dw, se, buffer + part_len, buffer_size - part_len, flags,
       /* username = */ NULL);
 
   *ret_buffer = buffer + buffer_size;
@@ -1172,8 +1556,8 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 #endif /* !HAVE_LIBGCRYPT */
 
 #if HAVE_LIBGCRYPT
-static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
-		void **ret_buffer, size_t *ret_buffer_len,
+static int parse_part_encr_aes256 (dispatch_worker_t *dw, /* {{{ */
+		sockent_t *se, void **ret_buffer, size_t *ret_buffer_len,
 		int flags)
 {
   char  *buffer = *ret_buffer;
@@ -1185,7 +1569,7 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   part_encryption_aes256_t pea;
   unsigned char hash[sizeof (pea.hash)];
 
-  gcry_cipher_hd_t cypher;
+  user_key_t *uk;
   gcry_error_t err;
 
   /* Make sure at least the header if available. */
@@ -1238,11 +1622,22 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   assert (buffer_offset == (username_len +
         PART_ENCRYPTION_AES256_SIZE - sizeof (pea.hash)));
 
-  cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
-      pea.username);
-  if (cypher == NULL)
+  uk = network_get_user_key (dw, se, pea.username);
+  if (uk == NULL)
+  {
+    ERROR ("network plugin: Unknown user: %s", pea.username);
+    sfree (pea.username);
+    return (-1);
+  }
+
+  /* Resetting the cipher handle keeps the key schedule. */
+  gcry_cipher_reset (uk->cypher);
+  err = gcry_cipher_setiv (uk->cypher, pea.iv, sizeof (pea.iv));
+  if (err != 0)
   {
     sfree (pea.username);
+    ERROR ("network plugin: gcry_cipher_setiv returned: %s",
+        gcry_strerror (err));
     return (-1);
   }
 
@@ -1250,7 +1645,7 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   assert (payload_len > 0);
 
   /* Decrypt the packet in-place */
-  err = gcry_cipher_decrypt (cypher,
+  err = gcry_cipher_decrypt (uk->cypher,
       buffer    + buffer_offset,
       part_size - buffer_offset,
       /* in = */ NULL, /* in len = */ 0);
@@ -1280,7 +1675,7 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
     return (-1);
   }
 
-  parse_packet (se, buffer + buffer_offset, payload_len,
+  parse_packet (dw, se, buffer + buffer_offset, payload_len,
       flags | PP_ENCRYPTED, pea.username);
 
   /* XXX: Free pea.username?!? */
@@ -1296,8 +1691,8 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 /* #endif HAVE_LIBGCRYPT */
 
 #else /* if !HAVE_LIBGCRYPT */
-static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_size, int flags)
+static int parse_part_encr_aes256 (dispatch_worker_t *dw, /* {{{ */
+    sockent_t *se, void **ret_buffer, size_t *ret_buffer_size, int flags)
 {
   static int warning_has_been_printed = 0;
 
@@ -1344,7 +1739,7 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 
 #undef BUFFER_READ
 
-static int parse_packet (sockent_t *se, /* {{{ */
+static int parse_packet (dispatch_worker_t *dw, sockent_t *se, /* {{{ */
 		void *buffer, size_t buffer_size, int flags,
 		const char *username)
 {
@@ -1388,7 +1783,7 @@ static int parse_packet (sockent_t *se, /* {{{ */
 
 		if (pkg_type == TYPE_ENCR_AES256)
 		{
-			status = parse_part_encr_aes256 (se,
+			status = parse_part_encr_aes256 (dw, se,
 					&buffer, &buffer_size, flags);
 			if (status != 0)
 			{
@@ -1414,7 +1809,7 @@ static int parse_packet (sockent_t *se, /* {{{ */
 #endif /* HAVE_LIBGCRYPT */
 		else if (pkg_type == TYPE_SIGN_SHA256)
 		{
-			status = parse_part_sign_sha256 (se,
+			status = parse_part_sign_sha256 (dw, se,
                                         &buffer, &buffer_size, flags);
 			if (status != 0)
 			{
@@ -1446,7 +1841,7 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			if (status != 0)
 				break;
 
-			network_dispatch_values (&vl, username);
+			network_dispatch_values (dw, &vl, username);
 
 			sfree (vl.values);
 		}
@@ -1620,8 +2015,6 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1992,7 +2385,6 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
 #endif
 	}
 	else
@@ -2253,25 +2645,31 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_add */
 
-static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
+static void *dispatch_thread (void *arg) /* {{{ */
 {
+  dispatch_worker_t *dw = arg;
+
   while (42)
   {
     receive_list_entry_t *ent;
     sockent_t *se;
 
     /* Lock and wait for more data to come in */
-    pthread_mutex_lock (&receive_list_lock);
+    pthread_mutex_lock (&dw->lock);
     while ((listen_loop == 0)
-        && (receive_list_head == NULL))
-      pthread_cond_wait (&receive_list_cond, &receive_list_lock);
+        && (dw->head == NULL))
+      pthread_cond_wait (&dw->cond, &dw->lock);
 
     /* Remove the head entry and unlock */
-    ent = receive_list_head;
+    ent = dw->head;
     if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock (&receive_list_lock);
+    {
+      dw->head = ent->next;
+      if (dw->head == NULL)
+        dw->tail = NULL;
+      dw->length--;
+    }
+    pthread_mutex_unlock (&dw->lock);
 
     /* Check whether we are supposed to exit. We do NOT check `listen_loop'
      * because we dispatch all missing packets before shutting down. */
@@ -2304,7 +2702,7 @@ static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
       continue;
     }
 
-    parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
+    parse_packet (dw, se, ent->data, ent->data_len, /* flags = */ 0,
 	/* username = */ NULL);
     sfree (ent->data);
     sfree (ent);
@@ -2313,30 +2711,91 @@ static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
   return (NULL);
 } /* }}} void *dispatch_thread */
 
-static int network_receive (void) /* {{{ */
+/* Selects the dispatch worker for packets from `addr'. All packets of one
+ * sender go to the same worker, so they are dispatched in order. */
+static dispatch_worker_t *dispatch_worker_get ( /* {{{ */
+		const struct sockaddr_storage *addr)
 {
-	char buffer[network_config_packet_size];
-	int  buffer_len;
+	const unsigned char *ptr;
+	size_t ptr_len;
+	uint32_t hash = 5381;
+	size_t i;
 
-	int i;
-	int status;
+	if (dispatch_workers_num == 1)
+		return (dispatch_workers);
 
-	receive_list_entry_t *private_list_head;
-	receive_list_entry_t *private_list_tail;
-	uint64_t              private_list_length;
+	if (addr->ss_family == AF_INET)
+	{
+		const struct sockaddr_in *sa = (const void *) addr;
+		ptr = (const void *) &sa->sin_addr;
+		ptr_len = sizeof (sa->sin_addr);
+	}
+	else if (addr->ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *sa = (const void *) addr;
+		ptr = (const void *) &sa->sin6_addr;
+		ptr_len = sizeof (sa->sin6_addr);
+	}
+	else
+	{
+		return (dispatch_workers);
+	}
 
-        assert (listen_sockets_num > 0);
+	for (i = 0; i < ptr_len; i++)
+		hash = ((hash << 5) + hash) + ((uint32_t) ptr[i]);
 
-	private_list_head = NULL;
-	private_list_tail = NULL;
-	private_list_length = 0;
+	return (dispatch_workers + (hash % dispatch_workers_num));
+} /* }}} dispatch_worker_t *dispatch_worker_get */
 
-	while (listen_loop == 0)
-	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+/* Appends the worker's private list to its shared list. If `block' is false,
+ * this is only done if the lock can be acquired without waiting. */
+static void dispatch_worker_hand_over (dispatch_worker_t *dw, /* {{{ */
+		_Bool block)
+{
+	if (dw->private_head == NULL)
+		return;
 
-		if (status <= 0)
-		{
+	if (block)
+		pthread_mutex_lock (&dw->lock);
+	else if (pthread_mutex_trylock (&dw->lock) != 0)
+		return;
+
+	assert (((dw->head == NULL) && (dw->length == 0))
+			|| ((dw->head != NULL) && (dw->length != 0)));
+
+	if (dw->head == NULL)
+		dw->head = dw->private_head;
+	else
+		dw->tail->next = dw->private_head;
+	dw->tail = dw->private_tail;
+	dw->length += dw->private_length;
+
+	pthread_cond_signal (&dw->cond);
+	pthread_mutex_unlock (&dw->lock);
+
+	dw->private_head = NULL;
+	dw->private_tail = NULL;
+	dw->private_length = 0;
+} /* }}} void dispatch_worker_hand_over */
+
+static int network_receive (void) /* {{{ */
+{
+	char buffer[network_config_packet_size];
+	int  buffer_len;
+
+	int i;
+	size_t j;
+	int status;
+
+	assert (listen_sockets_num > 0);
+	assert (dispatch_workers_num > 0);
+
+	while (listen_loop == 0)
+	{
+		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+
+		if (status <= 0)
+		{
 			char errbuf[1024];
 			if (errno == EINTR)
 				continue;
@@ -2348,15 +2807,20 @@ static int network_receive (void) /* {{{ */
 		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
 		{
 			receive_list_entry_t *ent;
+			dispatch_worker_t *dw;
+			struct sockaddr_storage addr;
+			socklen_t addrlen = sizeof (addr);
 
 			if ((listen_sockets_pollfd[i].revents
 						& (POLLIN | POLLPRI)) == 0)
 				continue;
 			status--;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
+			memset (&addr, 0, sizeof (addr));
+			buffer_len = recvfrom (listen_sockets_pollfd[i].fd,
 					buffer, sizeof (buffer),
-					0 /* no flags */);
+					0 /* no flags */,
+					(struct sockaddr *) &addr, &addrlen);
 			if (buffer_len < 0)
 			{
 				char errbuf[1024];
@@ -2393,56 +2857,29 @@ static int network_receive (void) /* {{{ */
 			memcpy (ent->data, buffer, buffer_len);
 			ent->data_len = buffer_len;
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
+			dw = dispatch_worker_get (&addr);
+			if (dw->private_head == NULL)
+				dw->private_head = ent;
 			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+				dw->private_tail->next = ent;
+			dw->private_tail = ent;
+			dw->private_length++;
 
 			/* Do not block here. Blocking here has led to
 			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
-			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
-				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
-
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
-
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
-			}
+			dispatch_worker_hand_over (dw, /* block = */ 0);
 		} /* for (listen_sockets_pollfd) */
+
+		/* Retry workers whose lock was busy, so packets don't wait
+		 * for the next packet of the same sender. */
+		for (j = 0; j < dispatch_workers_num; j++)
+			dispatch_worker_hand_over (dispatch_workers + j,
+					/* block = */ 0);
 	} /* while (listen_loop == 0) */
 
 	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
-	{
-		pthread_mutex_lock (&receive_list_lock);
-
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
-
-		private_list_head = NULL;
-		private_list_tail = NULL;
-		private_list_length = 0;
-
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-	}
+	for (j = 0; j < dispatch_workers_num; j++)
+		dispatch_worker_hand_over (dispatch_workers + j, /* block = */ 1);
 
 	return (0);
 } /* }}} int network_receive */
@@ -2452,52 +2889,28 @@ static void *receive_thread (void __attribute__((unused)) *arg)
 	return (network_receive () ? (void *) 1 : (void *) 0);
 } /* void *receive_thread */
 
-static void network_init_buffer (void)
+static void network_init_buffer (send_buffer_t *sb)
 {
-	memset (send_buffer, 0, network_config_packet_size);
-	send_buffer_ptr = send_buffer;
-	send_buffer_fill = 0;
+	memset (sb->buffer, 0, network_config_packet_size);
+	sb->ptr = sb->buffer;
+	sb->fill = 0;
 
-	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
+	memset (&sb->vl, 0, sizeof (sb->vl));
 } /* int network_init_buffer */
 
-static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
-		const char *buffer, size_t buffer_size)
-{
-	int status;
-
-	while (42)
-	{
-		status = sendto (se->data.client.fd, buffer, buffer_size,
-                    /* flags = */ 0,
-                    (struct sockaddr *) se->data.client.addr,
-                    se->data.client.addrlen);
-                if (status < 0)
-		{
-			char errbuf[1024];
-			if (errno == EINTR)
-				continue;
-			ERROR ("network plugin: sendto failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			break;
-		}
-
-		break;
-	} /* while (42) */
-} /* }}} void networt_send_buffer_plain */
-
 #if HAVE_LIBGCRYPT
 #define BUFFER_ADD(p,s) do { \
   memcpy (buffer + buffer_offset, (p), (s)); \
   buffer_offset += (s); \
 } while (0)
 
-static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+/* Writes the signed packet to `buffer', which must be able to hold
+ * BUFF_SIG_SIZE + in_buffer_size bytes. Returns the size of the packet or
+ * less than zero on failure. */
+static ssize_t network_build_signed (const sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size, char *buffer)
 {
   part_signature_sha256_t ps;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_offset;
   size_t username_len;
 
@@ -2511,7 +2924,7 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: Creating HMAC object failed: %s",
         gcry_strerror (err));
-    return;
+    return (-1);
   }
 
   err = gcry_md_setkey (hd, se->data.client.password,
@@ -2521,7 +2934,7 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
     ERROR ("network plugin: gcry_md_setkey failed: %s",
         gcry_strerror (err));
     gcry_md_close (hd);
-    return;
+    return (-1);
   }
 
   username_len = strlen (se->data.client.username);
@@ -2529,7 +2942,7 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: Username too long: %s",
         se->data.client.username);
-    return;
+    return (-1);
   }
 
   memcpy (buffer + PART_SIGNATURE_SHA256_SIZE,
@@ -2550,7 +2963,7 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: gcry_md_read failed.");
     gcry_md_close (hd);
-    return;
+    return (-1);
   }
   memcpy (ps.hash, hash, sizeof (ps.hash));
 
@@ -2567,14 +2980,16 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   hd = NULL;
 
   buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
-  networt_send_buffer_plain (se, buffer, buffer_offset);
-} /* }}} void networt_send_buffer_signed */
-
-static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+  return ((ssize_t) buffer_offset);
+} /* }}} ssize_t network_build_signed */
+
+/* Writes the encrypted packet to `buffer', which must be able to hold
+ * BUFF_SIG_SIZE + in_buffer_size bytes. Returns the size of the packet or
+ * less than zero on failure. */
+static ssize_t network_build_encrypted (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size, char *buffer)
 {
   part_encryption_aes256_t pea;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_size;
   size_t buffer_offset;
   size_t header_size;
@@ -2592,15 +3007,15 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   if ((PART_ENCRYPTION_AES256_SIZE + username_len) > BUFF_SIG_SIZE)
   {
     ERROR ("network plugin: Username too long: %s", pea.username);
-    return;
+    return (-1);
   }
 
   buffer_size = PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size;
   header_size = PART_ENCRYPTION_AES256_SIZE + username_len
     - sizeof (pea.hash);
 
-  assert (buffer_size <= sizeof (buffer));
-  DEBUG ("network plugin: networt_send_buffer_encrypted: "
+  assert (buffer_size <= (BUFF_SIG_SIZE + in_buffer_size));
+  DEBUG ("network plugin: network_build_encrypted: "
       "buffer_size = %zu;", buffer_size);
 
   pea.head.length = htons ((uint16_t) (PART_ENCRYPTION_AES256_SIZE
@@ -2615,7 +3030,7 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
 
   /* Initialize the buffer */
   buffer_offset = 0;
-  memset (buffer, 0, sizeof (buffer));
+  memset (buffer, 0, buffer_size);
 
 
   BUFFER_ADD (&pea.head.type, sizeof (pea.head.type));
@@ -2629,10 +3044,9 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == buffer_size);
 
-  cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
-      se->data.client.password);
+  cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv));
   if (cypher == NULL)
-    return;
+    return (-1);
 
   /* Encrypt the buffer in-place */
   err = gcry_cipher_encrypt (cypher,
@@ -2643,33 +3057,278 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: gcry_cipher_encrypt returned: %s",
         gcry_strerror (err));
-    return;
+    return (-1);
   }
 
-  /* Send it out without further modifications */
-  networt_send_buffer_plain (se, buffer, buffer_size);
-} /* }}} void networt_send_buffer_encrypted */
+  return ((ssize_t) buffer_size);
+} /* }}} ssize_t network_build_encrypted */
 #undef BUFFER_ADD
 #endif /* HAVE_LIBGCRYPT */
 
-static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
+/* Returns the packet to be sent to `se' in `ret_packet', signing or
+ * encrypting `buffer' into `tmp' if required. `tmp' must be able to hold
+ * BUFF_SIG_SIZE + buffer_len bytes. */
+static ssize_t network_prepare_packet (sockent_t *se, /* {{{ */
+		char *buffer, size_t buffer_len, char *tmp, char **ret_packet)
 {
-  sockent_t *se;
-
-  DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
-
-  for (se = sending_sockets; se != NULL; se = se->next)
-  {
 #if HAVE_LIBGCRYPT
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      networt_send_buffer_encrypted (se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      networt_send_buffer_signed (se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
+	if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+	{
+		*ret_packet = tmp;
+		return (network_build_encrypted (se, buffer, buffer_len, tmp));
+	}
+	else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
+	{
+		*ret_packet = tmp;
+		return (network_build_signed (se, buffer, buffer_len, tmp));
+	}
 #endif /* HAVE_LIBGCRYPT */
-      networt_send_buffer_plain (se, buffer, buffer_len);
-  } /* for (sending_sockets) */
-} /* }}} void network_send_buffer */
+
+	*ret_packet = buffer;
+	return ((ssize_t) buffer_len);
+} /* }}} ssize_t network_prepare_packet */
+
+#if !HAVE_SENDMMSG
+static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
+{
+	int status;
+
+	while (42)
+	{
+		status = sendto (se->data.client.fd, buffer, buffer_size,
+                    /* flags = */ 0,
+                    (struct sockaddr *) se->data.client.addr,
+                    se->data.client.addrlen);
+                if (status < 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("network plugin: sendto failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			break;
+		}
+
+		break;
+	} /* while (42) */
+} /* }}} void networt_send_buffer_plain */
+#endif /* !HAVE_SENDMMSG */
+
+static void network_send_batch (const sockent_t *se, /* {{{ */
+		struct iovec *iov, size_t iov_num)
+{
+#if HAVE_SENDMMSG
+	struct mmsghdr msgs[SEND_BATCH_SIZE];
+	size_t sent;
+	size_t i;
+
+	assert (iov_num <= SEND_BATCH_SIZE);
+
+	memset (msgs, 0, sizeof (msgs));
+	for (i = 0; i < iov_num; i++)
+	{
+		msgs[i].msg_hdr.msg_name = (void *) se->data.client.addr;
+		msgs[i].msg_hdr.msg_namelen = se->data.client.addrlen;
+		msgs[i].msg_hdr.msg_iov = iov + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	sent = 0;
+	while (sent < iov_num)
+	{
+		int status;
+
+		status = sendmmsg (se->data.client.fd, msgs + sent,
+				(unsigned int) (iov_num - sent), /* flags = */ 0);
+		if (status < 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("network plugin: sendmmsg failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			/* Skip the packet which couldn't be sent. */
+			sent++;
+			continue;
+		}
+
+		sent += (size_t) status;
+	}
+#else
+	size_t i;
+
+	for (i = 0; i < iov_num; i++)
+		networt_send_buffer_plain (se, iov[i].iov_base, iov[i].iov_len);
+#endif
+} /* }}} void network_send_batch */
+
+/* Sends all packets in the list to all servers. Called by the send thread
+ * only. */
+static void network_send_packets (send_queue_entry_t *head) /* {{{ */
+{
+	size_t slot_size = network_config_packet_size + BUFF_SIG_SIZE;
+	send_queue_entry_t *ent;
+	sockent_t *se;
+
+	for (se = sending_sockets; se != NULL; se = se->next)
+	{
+		ent = head;
+		while (ent != NULL)
+		{
+			struct iovec iov[SEND_BATCH_SIZE];
+			size_t iov_num = 0;
+
+			for (; (ent != NULL) && (iov_num < SEND_BATCH_SIZE);
+					ent = ent->next)
+			{
+				char *packet = NULL;
+				ssize_t packet_len;
+
+				packet_len = network_prepare_packet (se,
+						ent->data, ent->data_len,
+						send_thread_buffer + (iov_num * slot_size),
+						&packet);
+				if (packet_len < 0)
+					continue;
+
+				iov[iov_num].iov_base = packet;
+				iov[iov_num].iov_len = (size_t) packet_len;
+				iov_num++;
+			}
+
+			if (iov_num > 0)
+				network_send_batch (se, iov, iov_num);
+		}
+	} /* for (sending_sockets) */
+
+	for (ent = head; ent != NULL; ent = ent->next)
+	{
+		stats_octets_tx += ((uint64_t) ent->data_len);
+		stats_packets_tx++;
+	}
+} /* }}} void network_send_packets */
+
+static void *send_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	/* Partially filled buffers are checked once per interval, no matter
+	 * whether the queue is busy or not. */
+	cdtime_t flush_deadline = cdtime () + interval_g;
+
+	while (42)
+	{
+		send_queue_entry_t *head;
+		cdtime_t now;
+
+		/* Lock and wait for packets to send. Wake up at the flush
+		 * deadline at the latest to send partially filled buffers. */
+		pthread_mutex_lock (&send_queue_lock);
+		while ((send_loop == 0) && (send_queue_head == NULL))
+		{
+			struct timespec ts;
+			int status;
+
+			CDTIME_T_TO_TIMESPEC (flush_deadline, &ts);
+			status = pthread_cond_timedwait (&send_queue_cond,
+					&send_queue_lock, &ts);
+			if (status == ETIMEDOUT)
+				break;
+		}
+
+		/* Take all queued packets at once */
+		head = send_queue_head;
+		send_queue_head = NULL;
+		send_queue_tail = NULL;
+		send_queue_length = 0;
+		pthread_mutex_unlock (&send_queue_lock);
+
+		if (head != NULL)
+		{
+			network_send_packets (head);
+
+			while (head != NULL)
+			{
+				send_queue_entry_t *next = head->next;
+				sfree (head->data);
+				sfree (head);
+				head = next;
+			}
+
+			time_sent_purge ();
+		}
+		else if (send_loop != 0)
+		{
+			/* We only exit when the queue is empty because we
+			 * send all queued packets before shutting down. */
+			break;
+		}
+
+		now = cdtime ();
+		if (now >= flush_deadline)
+		{
+			network_flush_stale ();
+			flush_deadline = now + interval_g;
+		}
+	} /* while (42) */
+
+	return (NULL);
+} /* }}} void *send_thread */
+
+/* Hands a copy of the packet to the send thread. */
+static int network_send_buffer (const char *buffer, size_t buffer_len) /* {{{ */
+{
+	static c_complain_t complain_queue = C_COMPLAIN_INIT_STATIC;
+	send_queue_entry_t *ent;
+
+	DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
+
+	ent = malloc (sizeof (*ent));
+	if (ent == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		return (ENOMEM);
+	}
+	memset (ent, 0, sizeof (*ent));
+
+	ent->data = malloc (buffer_len);
+	if (ent->data == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		sfree (ent);
+		return (ENOMEM);
+	}
+	memcpy (ent->data, buffer, buffer_len);
+	ent->data_len = buffer_len;
+
+	pthread_mutex_lock (&send_queue_lock);
+	if (send_queue_length >= SEND_QUEUE_MAX)
+	{
+		pthread_mutex_unlock (&send_queue_lock);
+		c_complain (LOG_WARNING, &complain_queue,
+				"network plugin: The send queue is full; "
+				"dropping packets. Is the network down?");
+		sfree (ent->data);
+		sfree (ent);
+		return (ENOBUFS);
+	}
+
+	if (send_queue_tail == NULL)
+		send_queue_head = ent;
+	else
+		send_queue_tail->next = ent;
+	send_queue_tail = ent;
+	send_queue_length++;
+
+	pthread_cond_signal (&send_queue_cond);
+	pthread_mutex_unlock (&send_queue_lock);
+
+	c_release (LOG_INFO, &complain_queue,
+			"network plugin: The send queue is no longer full.");
+
+	return (0);
+} /* }}} int network_send_buffer */
 
 static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 		value_list_t *vl_def,
@@ -2741,22 +3400,44 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 	return (buffer - buffer_orig);
 } /* }}} int add_to_buffer */
 
-static void flush_buffer (void)
+/* The caller must hold `sb->lock'. */
+static void flush_buffer (send_buffer_t *sb)
 {
-	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %i",
-			send_buffer_fill);
+	DEBUG ("network plugin: flush_buffer: fill = %i", sb->fill);
 
-	network_send_buffer (send_buffer, (size_t) send_buffer_fill);
+	network_send_buffer (sb->buffer, (size_t) sb->fill);
+	network_init_buffer (sb);
+}
 
-	stats_octets_tx += ((uint64_t) send_buffer_fill);
-	stats_packets_tx++;
+/* Lock one of the send buffers. Each thread prefers "its" buffer, but uses
+ * any buffer that isn't locked if that one is busy. */
+static send_buffer_t *send_buffer_lock_any (void) /* {{{ */
+{
+	pthread_t self = pthread_self ();
+	const unsigned char *ptr = (const unsigned char *) &self;
+	uint32_t hash = 5381;
+	size_t start;
+	size_t i;
 
-	network_init_buffer ();
-}
+	for (i = 0; i < sizeof (self); i++)
+		hash = ((hash << 5) + hash) + ((uint32_t) ptr[i]);
+	start = (size_t) (hash % SEND_BUFFERS_NUM);
+
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
+	{
+		send_buffer_t *sb = send_buffers + ((start + i) % SEND_BUFFERS_NUM);
+		if (pthread_mutex_trylock (&sb->lock) == 0)
+			return (sb);
+	}
+
+	pthread_mutex_lock (&send_buffers[start].lock);
+	return (send_buffers + start);
+} /* }}} send_buffer_t *send_buffer_lock_any */
 
 static int network_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
+	send_buffer_t *sb;
 	int status;
 
 	if (!check_send_okay (vl))
@@ -2776,38 +3457,40 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	  return (0);
 	}
 
-	uc_meta_data_add_unsigned_int (vl,
-	    "network:time_sent", (uint64_t) vl->time);
+	if (time_sent_enabled)
+		time_sent_set (vl);
 
-	pthread_mutex_lock (&send_buffer_lock);
+	sb = send_buffer_lock_any ();
+	if (sb->fill == 0)
+		sb->first_value = cdtime ();
 
-	status = add_to_buffer (send_buffer_ptr,
-			network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-			&send_buffer_vl,
+	status = add_to_buffer (sb->ptr,
+			network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+			&sb->vl,
 			ds, vl);
 	if (status >= 0)
 	{
 		/* status == bytes added to the buffer */
-		send_buffer_fill += status;
-		send_buffer_ptr  += status;
+		sb->fill += status;
+		sb->ptr  += status;
 
-		stats_values_sent++;
+		sb->values_sent++;
 	}
 	else
 	{
-		flush_buffer ();
+		flush_buffer (sb);
 
-		status = add_to_buffer (send_buffer_ptr,
-				network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-				&send_buffer_vl,
+		status = add_to_buffer (sb->ptr,
+				network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+				&sb->vl,
 				ds, vl);
 
 		if (status >= 0)
 		{
-			send_buffer_fill += status;
-			send_buffer_ptr  += status;
+			sb->fill += status;
+			sb->ptr  += status;
 
-			stats_values_sent++;
+			sb->values_sent++;
 		}
 	}
 
@@ -2816,16 +3499,54 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 		ERROR ("network plugin: Unable to append to the "
 				"buffer for some weird reason");
 	}
-	else if ((network_config_packet_size - send_buffer_fill) < 15)
+	else if ((network_config_packet_size - sb->fill) < 15)
 	{
-		flush_buffer ();
+		flush_buffer (sb);
 	}
 
-	pthread_mutex_unlock (&send_buffer_lock);
+	pthread_mutex_unlock (&sb->lock);
 
 	return ((status < 0) ? -1 : 0);
 } /* int network_write */
 
+/* Hand partially filled send buffers which haven't been sent for more than
+ * an interval to the send thread. With several buffers, each one fills up
+ * more slowly than a single buffer would. */
+static void network_flush_stale (void) /* {{{ */
+{
+	cdtime_t now = cdtime ();
+	size_t i;
+
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
+	{
+		send_buffer_t *sb = send_buffers + i;
+
+		pthread_mutex_lock (&sb->lock);
+		if ((sb->fill > 0) && ((sb->first_value + interval_g) <= now))
+			flush_buffer (sb);
+		pthread_mutex_unlock (&sb->lock);
+	}
+} /* }}} void network_flush_stale */
+
+/* Hand all partially filled send buffers to the send thread. */
+static void network_flush_all (void) /* {{{ */
+{
+	size_t i;
+
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
+	{
+		send_buffer_t *sb = send_buffers + i;
+
+		if (sb->buffer == NULL)
+			continue;
+
+		pthread_mutex_lock (&sb->lock);
+		if (sb->fill > 0)
+			flush_buffer (sb);
+		pthread_mutex_unlock (&sb->lock);
+	}
+} /* }}} void network_flush_all */
+
 static int network_config_set_boolean (const oconfig_item_t *ci, /* {{{ */
     int *retval)
 {
@@ -2920,6 +3641,31 @@ static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_dispatch_threads ( /* {{{ */
+    const oconfig_item_t *ci)
+{
+  int tmp;
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+  {
+    WARNING ("network plugin: The `DispatchThreads' config option needs "
+        "exactly one numeric argument.");
+    return (-1);
+  }
+
+  tmp = (int) ci->values[0].value.number;
+  if ((tmp >= 1) && (tmp <= 64))
+    network_config_dispatch_threads = tmp;
+  else
+  {
+    WARNING ("network plugin: The `DispatchThreads' option must be between "
+        "1 and 64.");
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_dispatch_threads */
+
 #if HAVE_LIBGCRYPT
 static int network_config_set_string (const oconfig_item_t *ci, /* {{{ */
     char **ret_string)
@@ -3157,6 +3903,8 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
       network_config_set_boolean (child, &network_config_forward);
     else if (strcasecmp ("ReportStats", child->key) == 0)
       network_config_set_boolean (child, &network_config_stats);
+    else if (strcasecmp ("DispatchThreads", child->key) == 0)
+      network_config_set_dispatch_threads (child);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3243,6 +3991,8 @@ static int network_notification (const notification_t *n,
 
 static int network_shutdown (void)
 {
+	size_t i;
+
 	listen_loop++;
 
 	/* Kill the listening thread */
@@ -3255,23 +4005,53 @@ static int network_shutdown (void)
 		receive_thread_running = 0;
 	}
 
-	/* Shutdown the dispatching thread */
-	if (dispatch_thread_running != 0)
+	/* Shutdown the dispatching threads */
+	for (i = 0; i < dispatch_workers_num; i++)
 	{
-		INFO ("network plugin: Stopping dispatch thread.");
-		pthread_mutex_lock (&receive_list_lock);
-		pthread_cond_broadcast (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-		pthread_join (dispatch_thread_id, /* ret = */ NULL);
-		dispatch_thread_running = 0;
+		dispatch_worker_t *dw = dispatch_workers + i;
+
+		if (dw->running)
+		{
+			INFO ("network plugin: Stopping dispatch thread %zu.", i);
+			pthread_mutex_lock (&dw->lock);
+			pthread_cond_broadcast (&dw->cond);
+			pthread_mutex_unlock (&dw->lock);
+			pthread_join (dw->thread_id, /* ret = */ NULL);
+			dw->running = 0;
+		}
+
+#if HAVE_LIBGCRYPT
+		user_keys_destroy (dw->user_keys);
+		dw->user_keys = NULL;
+#endif
+		pthread_mutex_destroy (&dw->lock);
+		pthread_cond_destroy (&dw->cond);
 	}
+	sfree (dispatch_workers);
+	dispatch_workers_num = 0;
 
 	sockent_destroy (listen_sockets);
 
-	if (send_buffer_fill > 0)
-		flush_buffer ();
+	/* Queue the remaining values and let the send thread send all
+	 * queued packets before it exits. */
+	network_flush_all ();
 
-	sfree (send_buffer);
+	if (send_thread_running != 0)
+	{
+		INFO ("network plugin: Stopping send thread.");
+		pthread_mutex_lock (&send_queue_lock);
+		send_loop++;
+		pthread_cond_broadcast (&send_queue_cond);
+		pthread_mutex_unlock (&send_queue_lock);
+		pthread_join (send_thread_id, /* ret = */ NULL);
+		send_thread_running = 0;
+	}
+
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
+		sfree (send_buffers[i].buffer);
+	sfree (send_thread_buffer);
+
+	time_sent_destroy ();
 
 	/* TODO: Close `sending_sockets' */
 
@@ -3296,16 +4076,25 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_receive_list_length;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
+	size_t i;
 
 	copy_octets_rx = stats_octets_rx;
 	copy_octets_tx = stats_octets_tx;
 	copy_packets_rx = stats_packets_rx;
 	copy_packets_tx = stats_packets_tx;
-	copy_values_dispatched = stats_values_dispatched;
-	copy_values_not_dispatched = stats_values_not_dispatched;
-	copy_values_sent = stats_values_sent;
+	copy_values_dispatched = 0;
+	copy_values_not_dispatched = 0;
+	copy_receive_list_length = 0;
+	for (i = 0; i < dispatch_workers_num; i++)
+	{
+		copy_values_dispatched += dispatch_workers[i].values_dispatched;
+		copy_values_not_dispatched += dispatch_workers[i].values_not_dispatched;
+		copy_receive_list_length += (derive_t) dispatch_workers[i].length;
+	}
+	copy_values_sent = 0;
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
+		copy_values_sent += send_buffers[i].values_sent;
 	copy_values_not_sent = stats_values_not_sent;
-	copy_receive_list_length = receive_list_length;
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3362,6 +4151,7 @@ static int network_stats_read (void) /* {{{ */
 static int network_init (void)
 {
 	static _Bool have_init = 0;
+	size_t i;
 
 	/* Check if we were already initialized. If so, just return - there's
 	 * nothing more to do (for now, that is). */
@@ -3388,17 +4178,67 @@ static int network_init (void)
 
 	plugin_register_shutdown ("network", network_shutdown);
 
-	send_buffer = malloc (network_config_packet_size);
-	if (send_buffer == NULL)
+	for (i = 0; i < SEND_BUFFERS_NUM; i++)
 	{
-		ERROR ("network plugin: malloc failed.");
-		return (-1);
+		send_buffer_t *sb = send_buffers + i;
+
+		pthread_mutex_init (&sb->lock, /* attr = */ NULL);
+		sb->values_sent = 0;
+		sb->buffer = malloc (network_config_packet_size);
+		if (sb->buffer == NULL)
+		{
+			ERROR ("network plugin: malloc failed.");
+			return (-1);
+		}
+		network_init_buffer (sb);
+	}
+
+	/* Values we sent can only come back if we also listen. */
+	if ((sending_sockets != NULL) && (listen_sockets_num > 0))
+	{
+		for (i = 0; i < TIME_SENT_SHARDS_NUM; i++)
+		{
+			time_sent_shard_t *shard = time_sent_shards + i;
+
+			pthread_mutex_init (&shard->lock, /* attr = */ NULL);
+			shard->tree = c_avl_create ((void *) strcmp);
+			if (shard->tree == NULL)
+			{
+				ERROR ("network plugin: c_avl_create failed.");
+				return (-1);
+			}
+		}
+		time_sent_last_purge = cdtime ();
+		time_sent_enabled = 1;
 	}
-	network_init_buffer ();
 
 	/* setup socket(s) and so on */
 	if (sending_sockets != NULL)
 	{
+		int status;
+
+		send_thread_buffer = malloc (SEND_BATCH_SIZE
+				* (network_config_packet_size + BUFF_SIG_SIZE));
+		if (send_thread_buffer == NULL)
+		{
+			ERROR ("network plugin: malloc failed.");
+			return (-1);
+		}
+
+		status = plugin_thread_create (&send_thread_id,
+				NULL /* no attributes */,
+				send_thread,
+				NULL /* no argument */);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("network: pthread_create failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			return (-1);
+		}
+		send_thread_running = 1;
+
 		plugin_register_write ("network", network_write,
 				/* user_data = */ NULL);
 		plugin_register_notification ("network", network_notification,
@@ -3407,27 +4247,50 @@ static int network_init (void)
 
 	/* If no threads need to be started, return here. */
 	if ((listen_sockets_num == 0)
-			|| ((dispatch_thread_running != 0)
+			|| ((dispatch_workers_num != 0)
 				&& (receive_thread_running != 0)))
 		return (0);
 
-	if (dispatch_thread_running == 0)
+	if (dispatch_workers_num == 0)
 	{
-		int status;
-		status = plugin_thread_create (&dispatch_thread_id,
-				NULL /* no attributes */,
-				dispatch_thread,
-				NULL /* no argument */);
-		if (status != 0)
+		dispatch_workers = calloc ((size_t) network_config_dispatch_threads,
+				sizeof (*dispatch_workers));
+		if (dispatch_workers == NULL)
 		{
-			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			ERROR ("network plugin: calloc failed.");
+			return (-1);
 		}
-		else
+		dispatch_workers_num = (size_t) network_config_dispatch_threads;
+
+		for (i = 0; i < dispatch_workers_num; i++)
 		{
-			dispatch_thread_running = 1;
+			dispatch_worker_t *dw = dispatch_workers + i;
+			int status;
+
+			pthread_mutex_init (&dw->lock, /* attr = */ NULL);
+			pthread_cond_init (&dw->cond, /* attr = */ NULL);
+#if HAVE_LIBGCRYPT
+			dw->user_keys = c_avl_create ((void *) user_key_compare);
+			if (dw->user_keys == NULL)
+			{
+				ERROR ("network plugin: c_avl_create failed.");
+				return (-1);
+			}
+#endif
+
+			status = plugin_thread_create (&dw->thread_id,
+					NULL /* no attributes */,
+					dispatch_thread,
+					(void *) dw);
+			if (status != 0)
+			{
+				char errbuf[1024];
+				ERROR ("network: pthread_create failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				return (-1);
+			}
+			dw->running = 1;
 		}
 	}
 
@@ -3465,12 +4328,7 @@ static int network_flush (__attribute__((unused)) cdtime_t timeout,
 		__attribute__((unused)) const char *identifier,
 		__attribute__((unused)) user_data_t *user_data)
 {
-	pthread_mutex_lock (&send_buffer_lock);
-
-	if (send_buffer_fill > 0)
-	  flush_buffer ();
-
-	pthread_mutex_unlock (&send_buffer_lock);
+	network_flush_all ();
 
 	return (0);
 } /* int network_flush */
@@ -27,6 +27,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -38,6 +39,9 @@
 
 static int max_node = -1;
 
+/* One "numastat" file per node, indexed by node number. */
+static cu_procfile_t **node_files = NULL;
+
 static void numa_dispatch_value (int node, /* {{{ */
     const char *type_instance, value_t v)
 {
@@ -57,25 +61,32 @@ static void numa_dispatch_value (int node, /* {{{ */
 
 static int numa_read_node (int node) /* {{{ */
 {
-  char path[PATH_MAX];
-  FILE *fh;
-  char buffer[128];
+  char *buffer;
   int status;
   int success;
 
-  ssnprintf (path, sizeof (path), NUMA_ROOT_DIR "/node%i/numastat", node);
+  if (node_files[node] == NULL)
+  {
+    char path[PATH_MAX];
+
+    ssnprintf (path, sizeof (path), NUMA_ROOT_DIR "/node%i/numastat", node);
+    node_files[node] = cu_procfile_create (path);
+    if (node_files[node] == NULL)
+      return (-1);
+  }
 
-  fh = fopen (path, "r");
-  if (fh == NULL)
+  status = cu_procfile_read (node_files[node]);
+  if (status != 0)
   {
     char errbuf[1024];
-    ERROR ("numa plugin: Reading node %i failed: open(%s): %s",
-        node, path, sstrerror (errno, errbuf, sizeof (errbuf)));
+    ERROR ("numa plugin: Reading node %i failed: read(%s): %s",
+        node, cu_procfile_name (node_files[node]),
+        sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   success = 0;
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while ((buffer = cu_procfile_readline (node_files[node])) != NULL)
   {
     char *fields[4];
     value_t v;
@@ -97,7 +108,6 @@ static int numa_read_node (int node) /* {{{ */
     success++;
   }
 
-  fclose (fh);
   return (success ? 0 : -1);
 } /* }}} int numa_read_node */
 
@@ -156,13 +166,39 @@ static int numa_init (void) /* {{{ */
   }
 
   DEBUG ("numa plugin: Found %i nodes.", max_node + 1);
+
+  if (max_node >= 0)
+  {
+    node_files = calloc ((size_t) (max_node + 1), sizeof (*node_files));
+    if (node_files == NULL)
+    {
+      ERROR ("numa plugin: calloc failed.");
+      return (-1);
+    }
+  }
+
   return (0);
 } /* }}} int numa_init */
 
+static int numa_shutdown (void) /* {{{ */
+{
+  int i;
+
+  if (node_files == NULL)
+    return (0);
+
+  for (i = 0; i <= max_node; i++)
+    cu_procfile_destroy (node_files[i]);
+  sfree (node_files);
+
+  return (0);
+} /* }}} int numa_shutdown */
+
 void module_register (void)
 {
   plugin_register_init ("numa", numa_init);
   plugin_register_read ("numa", numa_read);
+  plugin_register_shutdown ("numa", numa_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et : */
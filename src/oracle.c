@@ -53,6 +53,9 @@
 
 #include <oci.h>
 
+/* Number of rows fetched per round trip to the server. */
+#define O_PREFETCH_ROWS 1000
+
 /*
  * Data types
  */
@@ -434,6 +437,21 @@ static int o_read_database_query (o_database_t *db, /* {{{ */
       oci_statement = NULL;
       return (-1);
     }
+
+    /* Let the client library fetch rows in batches instead of doing one
+     * round trip per row in OCIStmtFetch2. Failing to set this is not fatal. */
+    do
+    {
+      ub4 prefetch_rows = O_PREFETCH_ROWS;
+
+      status = OCIAttrSet (oci_statement, OCI_HTYPE_STMT,
+          &prefetch_rows, /* size = */ 0, OCI_ATTR_PREFETCH_ROWS, oci_error);
+      if (status != OCI_SUCCESS)
+        o_report_error ("o_read_database_query", db->name,
+            udb_query_get_name (q), "OCIAttrSet (OCI_ATTR_PREFETCH_ROWS)",
+            oci_error);
+    } while (0);
+
     udb_query_set_user_data (q, oci_statement);
 
     DEBUG ("oracle plugin: o_read_database_query (%s, %s): "
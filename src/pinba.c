@@ -27,6 +27,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_htable.h"
 
 #include <pthread.h>
 #include <sys/socket.h>
@@ -54,6 +55,17 @@
 # define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Latency histograms: request times are counted in microseconds. Values below
+ * 16 us get a bucket each, above that each power of two is split into 16
+ * buckets, i.e. the relative error is below 6.25%. Times above 2^41 us (25
+ * days) are counted in the last bucket. */
+#define PINBA_HISTOGRAM_SUB_BITS 4
+#define PINBA_HISTOGRAM_SUB_NUM (1 << PINBA_HISTOGRAM_SUB_BITS)
+#define PINBA_HISTOGRAM_MAX_BIT 40
+#define PINBA_HISTOGRAM_BUCKETS \
+  ((PINBA_HISTOGRAM_MAX_BIT - PINBA_HISTOGRAM_SUB_BITS + 2) \
+   * PINBA_HISTOGRAM_SUB_NUM)
+
 /*
  * Private data structures
  */
@@ -73,6 +85,53 @@ struct float_counter_s
 };
 typedef struct float_counter_s float_counter_t;
 
+struct pinba_histogram_s
+{
+  uint64_t count;
+  uint64_t buckets[PINBA_HISTOGRAM_BUCKETS];
+};
+typedef struct pinba_histogram_s pinba_histogram_t;
+
+/* The data accounted for one view. */
+struct pinba_statdata_s
+{
+  derive_t req_count;
+
+  float_counter_t req_time;
+  float_counter_t ru_utime;
+  float_counter_t ru_stime;
+
+  derive_t doc_size;
+  gauge_t mem_peak;
+
+  /* only allocated if percentiles have been configured */
+  pinba_histogram_t *histogram;
+};
+typedef struct pinba_statdata_s pinba_statdata_t;
+
+/* Each receive thread accounts into its own shard, so the threads don't
+ * contend for a lock. The read callback merges the shards into the views. */
+struct pinba_shard_s
+{
+  pthread_mutex_t lock;
+  pinba_statdata_t *data; /* one per view, same order as "stat_nodes" */
+};
+typedef struct pinba_shard_s pinba_shard_t;
+
+/* Key of the view index. NULL matches all values. */
+struct pinba_view_key_s
+{
+  const char *host;
+  const char *server;
+  const char *script;
+};
+typedef struct pinba_view_key_s pinba_view_key_t;
+
+#define PINBA_VIEW_HOST   0x01
+#define PINBA_VIEW_SERVER 0x02
+#define PINBA_VIEW_SCRIPT 0x04
+#define PINBA_VIEW_MASKS  8
+
 struct pinba_statnode_s
 {
   /* collector name, used as plugin instance */
@@ -83,14 +142,14 @@ struct pinba_statnode_s
   char *server;
   char *script;
 
-  derive_t req_count;
+  double *percentiles;
+  size_t percentiles_num;
 
-  float_counter_t req_time;
-  float_counter_t ru_utime;
-  float_counter_t ru_stime;
+  /* counters, merged from the shards by the read callback */
+  pinba_statdata_t data;
 
-  derive_t doc_size;
-  gauge_t mem_peak;
+  /* next view with the same host, server and script */
+  struct pinba_statnode_s *next_same;
 };
 typedef struct pinba_statnode_s pinba_statnode_t;
 /* }}} */
@@ -101,14 +160,27 @@ typedef struct pinba_statnode_s pinba_statnode_t;
 /* {{{ */
 static pinba_statnode_t *stat_nodes = NULL;
 static unsigned int stat_nodes_num = 0;
-static pthread_mutex_t stat_nodes_lock;
+static pthread_mutex_t stat_nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Maps host, server and script to the first view matching exactly these
+ * values. Views with wildcards are found by looking up the request with the
+ * respective fields set to NULL, for each combination used by a view. */
+static c_htable_t *view_index = NULL;
+static pinba_view_key_t *view_keys = NULL;
+static _Bool view_masks[PINBA_VIEW_MASKS];
+
+static pinba_shard_t *shards = NULL;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+static int conf_threads_num = 1;
+
+static pinba_socket_t *pinba_sockets = NULL;
 
 static _Bool collector_thread_running = 0;
 static _Bool collector_thread_do_shutdown = 0;
-static pthread_t collector_thread_id;
+static pthread_t *collector_threads = NULL;
+static int collector_threads_num = 0;
 /* }}} */
 
 /*
@@ -146,6 +218,105 @@ static derive_t float_counter_get (const float_counter_t *fc, /* {{{ */
   return (ret);
 } /* }}} derive_t float_counter_get */
 
+static void float_counter_merge (float_counter_t *dst, /* {{{ */
+    const float_counter_t *src)
+{
+  dst->i += src->i;
+  dst->n += src->n;
+
+  if (dst->n >= 1000000000)
+  {
+    dst->i += 1;
+    dst->n -= 1000000000;
+    assert (dst->n < 1000000000);
+  }
+} /* }}} void float_counter_merge */
+
+static size_t histogram_bucket (float val) /* {{{ */
+{
+  uint64_t us;
+  int bit;
+
+  if (!(val > 0.0))
+    return (0);
+
+  if (val >= ((double) (((uint64_t) 1) << (PINBA_HISTOGRAM_MAX_BIT + 1)))
+      / 1000000.0)
+    return (PINBA_HISTOGRAM_BUCKETS - 1);
+
+  us = (uint64_t) ((((double) val) * 1000000.0) + .5);
+  if (us < PINBA_HISTOGRAM_SUB_NUM)
+    return ((size_t) us);
+
+  /* position of the most significant bit */
+  for (bit = PINBA_HISTOGRAM_SUB_BITS; (us >> (bit + 1)) != 0; bit++)
+    /* do nothing */;
+
+  return ((size_t) ((bit - PINBA_HISTOGRAM_SUB_BITS + 1)
+        * PINBA_HISTOGRAM_SUB_NUM)
+      + ((us >> (bit - PINBA_HISTOGRAM_SUB_BITS))
+        & (PINBA_HISTOGRAM_SUB_NUM - 1)));
+} /* }}} size_t histogram_bucket */
+
+/* Returns the center of a bucket in seconds. */
+static double histogram_bucket_value (size_t index) /* {{{ */
+{
+  uint64_t lower;
+  uint64_t width;
+  int shift;
+
+  if (index < PINBA_HISTOGRAM_SUB_NUM)
+    return (((double) index) / 1000000.0);
+
+  shift = (int) (index / PINBA_HISTOGRAM_SUB_NUM) - 1;
+  lower = ((uint64_t) (PINBA_HISTOGRAM_SUB_NUM
+        + (index % PINBA_HISTOGRAM_SUB_NUM))) << shift;
+  width = ((uint64_t) 1) << shift;
+
+  return ((((double) lower) + (((double) width) / 2.0)) / 1000000.0);
+} /* }}} double histogram_bucket_value */
+
+static void histogram_merge (pinba_histogram_t *dst, /* {{{ */
+    const pinba_histogram_t *src)
+{
+  size_t i;
+
+  if (src->count == 0)
+    return;
+
+  for (i = 0; i < PINBA_HISTOGRAM_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+  dst->count += src->count;
+} /* }}} void histogram_merge */
+
+/* Returns the request time in seconds below which "percent" percent of the
+ * requests have been, or NAN if the histogram is empty. */
+static gauge_t histogram_percentile (const pinba_histogram_t *h, /* {{{ */
+    double percent)
+{
+  uint64_t rank;
+  uint64_t sum = 0;
+  size_t i;
+
+  if (h->count == 0)
+    return (NAN);
+
+  rank = (uint64_t) ceil ((percent / 100.0) * ((double) h->count));
+  if (rank < 1)
+    rank = 1;
+
+  for (i = 0; i < PINBA_HISTOGRAM_BUCKETS; i++)
+  {
+    sum += h->buckets[i];
+    if (sum >= rank)
+      break;
+  }
+  if (i >= PINBA_HISTOGRAM_BUCKETS)
+    i = PINBA_HISTOGRAM_BUCKETS - 1;
+
+  return ((gauge_t) histogram_bucket_value (i));
+} /* }}} gauge_t histogram_percentile */
+
 static void strset (char **str, const char *new) /* {{{ */
 {
   char *tmp;
@@ -161,10 +332,13 @@ static void strset (char **str, const char *new) /* {{{ */
   *str = tmp;
 } /* }}} void strset */
 
+/* Takes ownership of "percentiles". */
 static void service_statnode_add(const char *name, /* {{{ */
     const char *host,
     const char *server,
-    const char *script)
+    const char *script,
+    double *percentiles,
+    size_t percentiles_num)
 {
   pinba_statnode_t *node;
   
@@ -173,6 +347,7 @@ static void service_statnode_add(const char *name, /* {{{ */
   if (node == NULL)
   {
     ERROR ("pinba plugin: realloc failed");
+    sfree (percentiles);
     return;
   }
   stat_nodes = node;
@@ -186,7 +361,9 @@ static void service_statnode_add(const char *name, /* {{{ */
   node->server = NULL;
   node->script = NULL;
 
-  node->mem_peak = NAN;
+  node->data.mem_peak = NAN;
+  node->percentiles = percentiles;
+  node->percentiles_num = percentiles_num;
   
   /* fill query data */
   strset (&node->name, name);
@@ -198,89 +375,285 @@ static void service_statnode_add(const char *name, /* {{{ */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
-/* Copy the data from the global "stat_nodes" list into the buffer pointed to
- * by "res", doing the derivation in the process. Returns the next index or
- * zero if the end of the list has been reached. */
-static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
-    unsigned int index)
+static int strcmp_null (const char *a, const char *b) /* {{{ */
 {
-  pinba_statnode_t *node;
-  
-  if (stat_nodes_num == 0)
-    return 0;
-  
-  /* begin collecting */
-  if (index == 0)
-    pthread_mutex_lock (&stat_nodes_lock);
-  
-  /* end collecting */
-  if (index >= stat_nodes_num)
+  if ((a == NULL) || (b == NULL))
+    return ((a == b) ? 0 : ((a == NULL) ? -1 : 1));
+  return (strcmp (a, b));
+} /* }}} int strcmp_null */
+
+static unsigned int view_key_hash (const void *arg) /* {{{ */
+{
+  const pinba_view_key_t *key = arg;
+  unsigned int hash = 0;
+
+  if (key->host != NULL)
+    hash ^= c_htable_hash_string (key->host);
+  hash *= 31;
+  if (key->server != NULL)
+    hash ^= c_htable_hash_string (key->server);
+  hash *= 31;
+  if (key->script != NULL)
+    hash ^= c_htable_hash_string (key->script);
+
+  return (hash);
+} /* }}} unsigned int view_key_hash */
+
+static int view_key_compare (const void *a, const void *b) /* {{{ */
+{
+  const pinba_view_key_t *ka = a;
+  const pinba_view_key_t *kb = b;
+  int status;
+
+  status = strcmp_null (ka->host, kb->host);
+  if (status == 0)
+    status = strcmp_null (ka->server, kb->server);
+  if (status == 0)
+    status = strcmp_null (ka->script, kb->script);
+
+  return (status);
+} /* }}} int view_key_compare */
+
+static void statdata_free (pinba_statdata_t *data) /* {{{ */
+{
+  sfree (data->histogram);
+} /* }}} void statdata_free */
+
+static int statdata_init (pinba_statdata_t *data, /* {{{ */
+    const pinba_statnode_t *node)
+{
+  memset (data, 0, sizeof (*data));
+  data->mem_peak = NAN;
+
+  if (node->percentiles_num == 0)
+    return (0);
+
+  data->histogram = calloc (1, sizeof (*data->histogram));
+  if (data->histogram == NULL)
   {
-    pthread_mutex_unlock (&stat_nodes_lock);
-    return 0;
+    ERROR ("pinba plugin: calloc failed.");
+    return (-1);
   }
 
-  node = stat_nodes + index;
-  memcpy (res, node, sizeof (*res));
+  return (0);
+} /* }}} int statdata_init */
 
-  /* reset node */
-  node->mem_peak = NAN;
-  
-  return (index + 1);
-} /* }}} unsigned int service_statnode_collect */
+/* Adds the interval data in "src" to "dst" and resets "src". */
+static void statdata_merge (pinba_statdata_t *dst, /* {{{ */
+    pinba_statdata_t *src)
+{
+  dst->req_count += src->req_count;
+  src->req_count = 0;
+
+  float_counter_merge (&dst->req_time, &src->req_time);
+  float_counter_merge (&dst->ru_utime, &src->ru_utime);
+  float_counter_merge (&dst->ru_stime, &src->ru_stime);
+  memset (&src->req_time, 0, sizeof (src->req_time));
+  memset (&src->ru_utime, 0, sizeof (src->ru_utime));
+  memset (&src->ru_stime, 0, sizeof (src->ru_stime));
+
+  dst->doc_size += src->doc_size;
+  src->doc_size = 0;
+
+  if (isnan (dst->mem_peak)
+      || (!isnan (src->mem_peak) && (dst->mem_peak < src->mem_peak)))
+    dst->mem_peak = src->mem_peak;
+  src->mem_peak = NAN;
+
+  if ((dst->histogram != NULL) && (src->histogram != NULL)
+      && (src->histogram->count != 0))
+  {
+    histogram_merge (dst->histogram, src->histogram);
+    memset (src->histogram, 0, sizeof (*src->histogram));
+  }
+} /* }}} void statdata_merge */
+
+static void service_statnodes_free (void) /* {{{ */
+{
+  unsigned int i;
+  int j;
+
+  if (shards != NULL)
+  {
+    for (j = 0; j < conf_threads_num; j++)
+    {
+      if (shards[j].data == NULL)
+        continue;
+      for (i = 0; i < stat_nodes_num; i++)
+        statdata_free (shards[j].data + i);
+      sfree (shards[j].data);
+      pthread_mutex_destroy (&shards[j].lock);
+    }
+    sfree (shards);
+  }
+
+  for (i = 0; i < stat_nodes_num; i++)
+    statdata_free (&stat_nodes[i].data);
+
+  c_htable_destroy (view_index);
+  view_index = NULL;
+  sfree (view_keys);
+} /* }}} void service_statnodes_free */
+
+/* Builds the view index and allocates one shard per receive thread. The list
+ * of views must not change afterwards. */
+static int service_statnodes_init (void) /* {{{ */
+{
+  unsigned int i;
+  int j;
+
+  view_index = c_htable_create (view_key_hash, view_key_compare);
+  view_keys = calloc (stat_nodes_num, sizeof (*view_keys));
+  shards = calloc ((size_t) conf_threads_num, sizeof (*shards));
+  if ((view_index == NULL) || (view_keys == NULL) || (shards == NULL))
+  {
+    ERROR ("pinba plugin: Allocating the view index failed.");
+    service_statnodes_free ();
+    return (-1);
+  }
+
+  memset (view_masks, 0, sizeof (view_masks));
+  for (i = 0; i < stat_nodes_num; i++)
+  {
+    pinba_statnode_t *node = stat_nodes + i;
+    pinba_view_key_t *key = view_keys + i;
+    pinba_statnode_t *first = NULL;
+    int mask = 0;
+
+    key->host = node->host;
+    key->server = node->server;
+    key->script = node->script;
+
+    if (key->host != NULL)
+      mask |= PINBA_VIEW_HOST;
+    if (key->server != NULL)
+      mask |= PINBA_VIEW_SERVER;
+    if (key->script != NULL)
+      mask |= PINBA_VIEW_SCRIPT;
+    view_masks[mask] = 1;
+
+    node->next_same = NULL;
+    if (statdata_init (&node->data, node) != 0)
+    {
+      service_statnodes_free ();
+      return (-1);
+    }
+
+    /* Views with identical filters are chained, keeping the configured
+     * order. */
+    if (c_htable_get (view_index, key, (void *) &first) == 0)
+    {
+      while (first->next_same != NULL)
+        first = first->next_same;
+      first->next_same = node;
+    }
+    else if (c_htable_insert (view_index, key, node) != 0)
+    {
+      ERROR ("pinba plugin: c_htable_insert failed.");
+      service_statnodes_free ();
+      return (-1);
+    }
+  }
+
+  for (j = 0; j < conf_threads_num; j++)
+  {
+    shards[j].data = calloc (stat_nodes_num, sizeof (*shards[j].data));
+    if (shards[j].data == NULL)
+    {
+      ERROR ("pinba plugin: calloc failed.");
+      service_statnodes_free ();
+      return (-1);
+    }
+    pthread_mutex_init (&shards[j].lock, /* attr = */ NULL);
 
-static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
+    for (i = 0; i < stat_nodes_num; i++)
+    {
+      if (statdata_init (shards[j].data + i, stat_nodes + i) != 0)
+      {
+        service_statnodes_free ();
+        return (-1);
+      }
+    }
+  }
+
+  return (0);
+} /* }}} int service_statnodes_init */
+
+/* Merges the data accounted by the receive threads into the global
+ * "stat_nodes" list. */
+static void service_statnodes_collect (void) /* {{{ */
+{
+  unsigned int i;
+  int j;
+
+  for (j = 0; j < conf_threads_num; j++)
+  {
+    pthread_mutex_lock (&shards[j].lock);
+    for (i = 0; i < stat_nodes_num; i++)
+      statdata_merge (&stat_nodes[i].data, shards[j].data + i);
+    pthread_mutex_unlock (&shards[j].lock);
+  }
+} /* }}} void service_statnodes_collect */
+
+static void service_statnode_process (pinba_statdata_t *data, /* {{{ */
     Pinba__Request* request)
 {
-  node->req_count++;
+  data->req_count++;
 
-  float_counter_add (&node->req_time, request->request_time);
-  float_counter_add (&node->ru_utime, request->ru_utime);
-  float_counter_add (&node->ru_stime, request->ru_stime);
+  float_counter_add (&data->req_time, request->request_time);
+  float_counter_add (&data->ru_utime, request->ru_utime);
+  float_counter_add (&data->ru_stime, request->ru_stime);
 
-  node->doc_size += request->document_size;
+  data->doc_size += request->document_size;
 
-  if (isnan (node->mem_peak)
-      || (node->mem_peak < ((gauge_t) request->memory_peak)))
-    node->mem_peak = (gauge_t) request->memory_peak;
+  if (isnan (data->mem_peak)
+      || (data->mem_peak < ((gauge_t) request->memory_peak)))
+    data->mem_peak = (gauge_t) request->memory_peak;
 
+  if (data->histogram != NULL)
+  {
+    data->histogram->buckets[histogram_bucket (request->request_time)]++;
+    data->histogram->count++;
+  }
 } /* }}} void service_statnode_process */
 
-static void service_process_request (Pinba__Request *request) /* {{{ */
+static void service_process_request (pinba_shard_t *shard, /* {{{ */
+    Pinba__Request *request)
 {
-  unsigned int i;
+  int mask;
 
-  pthread_mutex_lock (&stat_nodes_lock);
-  
-  for (i = 0; i < stat_nodes_num; i++)
+  pthread_mutex_lock (&shard->lock);
+
+  for (mask = 0; mask < PINBA_VIEW_MASKS; mask++)
   {
-    if ((stat_nodes[i].host != NULL)
-        && (strcmp (request->hostname, stat_nodes[i].host) != 0))
-      continue;
+    pinba_view_key_t key;
+    pinba_statnode_t *node = NULL;
 
-    if ((stat_nodes[i].server != NULL)
-      && (strcmp (request->server_name, stat_nodes[i].server) != 0))
+    if (!view_masks[mask])
       continue;
 
-    if ((stat_nodes[i].script != NULL)
-      && (strcmp (request->script_name, stat_nodes[i].script) != 0))
+    key.host = (mask & PINBA_VIEW_HOST) ? request->hostname : NULL;
+    key.server = (mask & PINBA_VIEW_SERVER) ? request->server_name : NULL;
+    key.script = (mask & PINBA_VIEW_SCRIPT) ? request->script_name : NULL;
+
+    if (c_htable_get (view_index, &key, (void *) &node) != 0)
       continue;
 
-    service_statnode_process(&stat_nodes[i], request);
+    for (; node != NULL; node = node->next_same)
+      service_statnode_process (shard->data + (node - stat_nodes), request);
   }
   
-  pthread_mutex_unlock(&stat_nodes_lock);
+  pthread_mutex_unlock(&shard->lock);
 } /* }}} void service_process_request */
 
+/* Removes a socket from a receive thread's poll set. The sockets are shared
+ * by all receive threads, so they are only closed by pinba_socket_free(). */
 static int pb_del_socket (pinba_socket_t *s, /* {{{ */
     nfds_t index)
 {
   if (index >= s->fd_num)
     return (EINVAL);
 
-  close (s->fd[index].fd);
-  s->fd[index].fd = -1;
-
   /* When deleting the last element in the list, no memmove is necessary. */
   if (index < (s->fd_num - 1))
   {
@@ -422,8 +795,8 @@ static void pinba_socket_free (pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
-    size_t buffer_size)
+static int pinba_process_stats_packet (pinba_shard_t *shard, /* {{{ */
+    const uint8_t *buffer, size_t buffer_size)
 {
   Pinba__Request *request;  
   
@@ -432,13 +805,14 @@ static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
   if (!request)
     return (-1);
 
-  service_process_request(request);
+  service_process_request (shard, request);
   pinba__request__free_unpacked (request, NULL);
     
   return (0);
 } /* }}} int pinba_process_stats_packet */
 
-static int pinba_udp_read_callback_fn (int sock) /* {{{ */
+static int pinba_udp_read_callback_fn (pinba_shard_t *shard, /* {{{ */
+    int sock)
 {
   uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
   size_t buffer_size;
@@ -452,14 +826,16 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
     {
       char errbuf[1024];
 
-      if ((errno == EINTR)
+      if (errno == EINTR)
+        continue;
+
+      /* Another receive thread got the packet first. */
+      if ((errno == EAGAIN)
 #ifdef EWOULDBLOCK
           || (errno == EWOULDBLOCK)
 #endif
-          || (errno == EAGAIN))
-      {
-        continue;
-      }
+         )
+        return (0);
 
       WARNING("pinba plugin: recvfrom(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
@@ -476,7 +852,7 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
       buffer_size = (size_t) status;
       buffer[buffer_size] = 0;
 
-      status = pinba_process_stats_packet (buffer, buffer_size);
+      status = pinba_process_stats_packet (shard, buffer, buffer_size);
       if (status != 0)
         DEBUG("pinba plugin: Parsing packet failed.");
       return (status);
@@ -488,16 +864,14 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
   return (-1);
 } /* }}} void pinba_udp_read_callback_fn */
 
-static int receive_loop (void) /* {{{ */
+static int receive_loop (pinba_shard_t *shard) /* {{{ */
 {
-  pinba_socket_t *s;
+  pinba_socket_t sockets;
+  pinba_socket_t *s = &sockets;
 
-  s = pinba_socket_open (conf_node, conf_service);
-  if (s == NULL)
-  {
-    ERROR ("pinba plugin: Collector thread is exiting prematurely.");
-    return (-1);
-  }
+  /* Each thread polls its own copy of the socket list, so that it can remove
+   * broken sockets without affecting the other threads. */
+  memcpy (s, pinba_sockets, sizeof (*s));
 
   while (!collector_thread_do_shutdown)
   {
@@ -521,7 +895,6 @@ static int receive_loop (void) /* {{{ */
 
       ERROR ("pinba plugin: poll(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
-      pinba_socket_free (s);
       return (-1);
     }
 
@@ -534,23 +907,19 @@ static int receive_loop (void) /* {{{ */
       }
       else if (s->fd[i].revents & (POLLIN | POLLPRI))
       {
-        pinba_udp_read_callback_fn (s->fd[i].fd);
+        pinba_udp_read_callback_fn (shard, s->fd[i].fd);
       }
     } /* for (s->fd) */
   } /* while (!collector_thread_do_shutdown) */
 
-  pinba_socket_free (s);
-  s = NULL;
-
   return (0);
 } /* }}} int receive_loop */
 
 static void *collector_thread (void *arg) /* {{{ */
 {
-  receive_loop ();
+  if (receive_loop (arg) != 0)
+    ERROR ("pinba plugin: Collector thread is exiting prematurely.");
 
-  memset (&collector_thread_id, 0, sizeof (collector_thread_id));
-  collector_thread_running = 0;
   pthread_exit (NULL);
   return (NULL);
 } /* }}} void *collector_thread */
@@ -558,12 +927,57 @@ static void *collector_thread (void *arg) /* {{{ */
 /*
  * Plugin declaration section
  */
+static int pinba_config_percentiles (const oconfig_item_t *ci, /* {{{ */
+    double **percentiles, size_t *percentiles_num)
+{
+  double *tmp;
+  int i;
+
+  if (ci->values_num < 1)
+  {
+    WARNING ("pinba plugin: The `Percentile' option requires at least one "
+        "numeric argument.");
+    return (-1);
+  }
+
+  for (i = 0; i < ci->values_num; i++)
+  {
+    if ((ci->values[i].type != OCONFIG_TYPE_NUMBER)
+        || !(ci->values[i].value.number > 0.0)
+        || (ci->values[i].value.number > 100.0))
+    {
+      WARNING ("pinba plugin: The arguments of the `Percentile' option must "
+          "be numbers between 0 (exclusive) and 100 (inclusive).");
+      return (-1);
+    }
+  }
+
+  tmp = realloc (*percentiles, sizeof (*tmp)
+      * (*percentiles_num + (size_t) ci->values_num));
+  if (tmp == NULL)
+  {
+    ERROR ("pinba plugin: realloc failed.");
+    return (-1);
+  }
+  *percentiles = tmp;
+
+  for (i = 0; i < ci->values_num; i++)
+  {
+    tmp[*percentiles_num] = ci->values[i].value.number;
+    (*percentiles_num)++;
+  }
+
+  return (0);
+} /* }}} int pinba_config_percentiles */
+
 static int pinba_config_view (const oconfig_item_t *ci) /* {{{ */
 {
   char *name   = NULL;
   char *host   = NULL;
   char *server = NULL;
   char *script = NULL;
+  double *percentiles = NULL;
+  size_t percentiles_num = 0;
   int status;
   int i;
 
@@ -581,6 +995,9 @@ static int pinba_config_view (const oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string (child, &server);
     else if (strcasecmp ("Script", child->key) == 0)
       status = cf_util_get_string (child, &script);
+    else if (strcasecmp ("Percentile", child->key) == 0)
+      status = pinba_config_percentiles (child,
+          &percentiles, &percentiles_num);
     else
     {
       WARNING ("pinba plugin: Unknown config option: %s", child->key);
@@ -592,12 +1009,17 @@ static int pinba_config_view (const oconfig_item_t *ci) /* {{{ */
   }
 
   if (status == 0)
-    service_statnode_add (name, host, server, script);
+  {
+    service_statnode_add (name, host, server, script,
+        percentiles, percentiles_num);
+    percentiles = NULL;
+  }
 
   sfree (name);
   sfree (host);
   sfree (server);
   sfree (script);
+  sfree (percentiles);
 
   return (status);
 } /* }}} int pinba_config_view */
@@ -618,6 +1040,15 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
       cf_util_get_string (child, &conf_node);
     else if (strcasecmp ("Port", child->key) == 0)
       cf_util_get_service (child, &conf_service);
+    else if (strcasecmp ("Threads", child->key) == 0)
+    {
+      int tmp = conf_threads_num;
+      if ((cf_util_get_int (child, &tmp) != 0) || (tmp < 1))
+        WARNING ("pinba plugin: The `Threads' option requires a positive "
+            "integer argument.");
+      else
+        conf_threads_num = tmp;
+    }
     else if (strcasecmp ("View", child->key) == 0)
       pinba_config_view (child);
     else
@@ -629,9 +1060,44 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int pinba_config */
 
+static int plugin_shutdown (void) /* {{{ */
+{
+  if (collector_thread_running)
+  {
+    int status;
+    int i;
+
+    DEBUG ("pinba plugin: Shutting down collector threads.");
+    collector_thread_do_shutdown = 1;
+
+    for (i = 0; i < collector_threads_num; i++)
+    {
+      status = pthread_join (collector_threads[i], /* retval = */ NULL);
+      if (status != 0)
+      {
+        char errbuf[1024];
+        ERROR ("pinba plugin: pthread_join(3) failed: %s",
+            sstrerror (status, errbuf, sizeof (errbuf)));
+      }
+    }
+    sfree (collector_threads);
+    collector_threads_num = 0;
+
+    pinba_socket_free (pinba_sockets);
+    pinba_sockets = NULL;
+    service_statnodes_free ();
+
+    collector_thread_running = 0;
+    collector_thread_do_shutdown = 0;
+  } /* if (collector_thread_running) */
+
+  return (0);
+} /* }}} int plugin_shutdown */
+
 static int plugin_init (void) /* {{{ */
 {
   int status;
+  int i;
 
   if (stat_nodes == NULL)
   {
@@ -639,62 +1105,72 @@ static int plugin_init (void) /* {{{ */
     service_statnode_add ("total",
         /* host   = */ NULL,
         /* server = */ NULL,
-        /* script = */ NULL);
+        /* script = */ NULL,
+        /* percentiles = */ NULL, /* percentiles_num = */ 0);
   }
 
   if (collector_thread_running)
     return (0);
 
-  status = plugin_thread_create (&collector_thread_id,
-      /* attrs = */ NULL,
-      collector_thread,
-      /* args = */ NULL);
-  if (status != 0)
+  if (service_statnodes_init () != 0)
+    return (-1);
+
+  pinba_sockets = pinba_socket_open (conf_node, conf_service);
+  if (pinba_sockets == NULL)
   {
-    char errbuf[1024];
-    ERROR ("pinba plugin: pthread_create(3) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
+    service_statnodes_free ();
     return (-1);
   }
-  collector_thread_running = 1;
 
-  return (0);
-} /* }}} */
-
-static int plugin_shutdown (void) /* {{{ */
-{
-  if (collector_thread_running)
+  collector_threads = calloc ((size_t) conf_threads_num,
+      sizeof (*collector_threads));
+  if (collector_threads == NULL)
   {
-    int status;
-
-    DEBUG ("pinba plugin: Shutting down collector thread.");
-    collector_thread_do_shutdown = 1;
+    ERROR ("pinba plugin: calloc failed.");
+    pinba_socket_free (pinba_sockets);
+    pinba_sockets = NULL;
+    service_statnodes_free ();
+    return (-1);
+  }
 
-    status = pthread_join (collector_thread_id, /* retval = */ NULL);
+  for (i = 0; i < conf_threads_num; i++)
+  {
+    status = plugin_thread_create (&collector_threads[i],
+        /* attrs = */ NULL,
+        collector_thread,
+        /* args = */ shards + i);
     if (status != 0)
     {
       char errbuf[1024];
-      ERROR ("pinba plugin: pthread_join(3) failed: %s",
-          sstrerror (status, errbuf, sizeof (errbuf)));
+      ERROR ("pinba plugin: pthread_create(3) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
     }
+    collector_threads_num++;
+  }
 
-    collector_thread_running = 0;
-    collector_thread_do_shutdown = 0;
-  } /* if (collector_thread_running) */
+  collector_thread_running = 1;
+  if (collector_threads_num < 1)
+  {
+    plugin_shutdown ();
+    return (-1);
+  }
 
   return (0);
-} /* }}} int plugin_shutdown */
+} /* }}} */
 
-static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
+static int plugin_submit (const pinba_statnode_t *node) /* {{{ */
 {
+  const pinba_statdata_t *res = &node->data;
   value_t value;
   value_list_t vl = VALUE_LIST_INIT;
+  size_t i;
   
   vl.values = &value;
   vl.values_len = 1;
   sstrncpy (vl.host, hostname_g, sizeof (vl.host));
   sstrncpy (vl.plugin, "pinba", sizeof (vl.plugin));
-  sstrncpy (vl.plugin_instance, res->name, sizeof (vl.plugin_instance));
+  sstrncpy (vl.plugin_instance, node->name, sizeof (vl.plugin_instance));
 
   value.derive = res->req_count;
   sstrncpy (vl.type, "total_requests", sizeof (vl.type)); 
@@ -723,17 +1199,37 @@ static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
   sstrncpy (vl.type_instance, "peak", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
 
+  for (i = 0; i < node->percentiles_num; i++)
+  {
+    value.gauge = histogram_percentile (res->histogram, node->percentiles[i]);
+    sstrncpy (vl.type, "response_time", sizeof (vl.type));
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+        "percentile-%g", node->percentiles[i]);
+    plugin_dispatch_values (&vl);
+  }
+
   return (0);
 } /* }}} int plugin_submit */
 
 static int plugin_read (void) /* {{{ */
 {
-  unsigned int i=0;
-  pinba_statnode_t data;
-  
-  while ((i = service_statnode_collect (&data, i)) != 0)
+  unsigned int i;
+
+  if (shards == NULL)
+    return (-1);
+
+  service_statnodes_collect ();
+
+  for (i = 0; i < stat_nodes_num; i++)
   {
-    plugin_submit (&data);
+    pinba_statdata_t *data = &stat_nodes[i].data;
+
+    plugin_submit (stat_nodes + i);
+
+    /* The peak memory and the percentiles refer to one interval. */
+    data->mem_peak = NAN;
+    if (data->histogram != NULL)
+      memset (data->histogram, 0, sizeof (*data->histogram));
   }
   
   return 0;
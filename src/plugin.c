@@ -32,7 +32,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
+#include "utils_htable.h"
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_cache.h"
@@ -49,6 +49,10 @@ struct callback_func_s
 };
 typedef struct callback_func_s callback_func_t;
 
+/* Number of rates plugin_dispatch_values keeps on the stack. Data sets with
+ * more data sources use a buffer allocated on the heap. */
+#define DISPATCH_RATES_STACK_NUM 16
+
 #define RF_SIMPLE  0
 #define RF_COMPLEX 1
 #define RF_REMOVE  65535
@@ -83,7 +87,7 @@ static llist_t *list_notification;
 static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
 
-static c_avl_tree_t *data_sets;
+static c_htable_t *data_sets;
 
 static char *plugindir = NULL;
 
@@ -942,14 +946,15 @@ int plugin_register_data_set (const data_set_t *ds)
 	int i;
 
 	if ((data_sets != NULL)
-			&& (c_avl_get (data_sets, ds->type, NULL) == 0))
+			&& (c_htable_get (data_sets, ds->type, NULL) == 0))
 	{
 		NOTICE ("Replacing DS `%s' with another version.", ds->type);
 		plugin_unregister_data_set (ds->type);
 	}
 	else if (data_sets == NULL)
 	{
-		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		data_sets = c_htable_create (c_htable_hash_string,
+				(int (*) (const void *, const void *)) strcmp);
 		if (data_sets == NULL)
 			return (-1);
 	}
@@ -970,7 +975,7 @@ int plugin_register_data_set (const data_set_t *ds)
 	for (i = 0; i < ds->ds_num; i++)
 		memcpy (ds_copy->ds + i, ds->ds + i, sizeof (data_source_t));
 
-	return (c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
+	return (c_htable_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
 } /* int plugin_register_data_set */
 
 int plugin_register_log (const char *name,
@@ -1132,7 +1137,7 @@ int plugin_unregister_data_set (const char *name)
 	if (data_sets == NULL)
 		return (-1);
 
-	if (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0)
+	if (c_htable_remove (data_sets, name, NULL, (void *) &ds) != 0)
 		return (-1);
 
 	sfree (ds->ds);
@@ -1500,6 +1505,10 @@ int plugin_dispatch_values (value_list_t *vl)
 
 	data_set_t *ds;
 
+	gauge_t  rates_stack[DISPATCH_RATES_STACK_NUM];
+	gauge_t *rates_buffer;
+	uc_rates_t rates;
+
 	int free_meta_data = 0;
 
 	if ((vl == NULL) || (vl->type[0] == 0)
@@ -1530,7 +1539,7 @@ int plugin_dispatch_values (value_list_t *vl)
 		return (-1);
 	}
 
-	if (c_avl_get (data_sets, vl->type, (void *) &ds) != 0)
+	if (c_htable_get (data_sets, vl->type, (void *) &ds) != 0)
 	{
 		char ident[6 * DATA_MAX_NAME_LEN];
 
@@ -1651,8 +1660,28 @@ int plugin_dispatch_values (value_list_t *vl)
 		}
 	}
 
-	/* Update the value cache */
-	uc_update (ds, vl);
+	/* Update the value cache. The rates computed for this value list are
+	 * kept until all write callbacks have run, so write callbacks calling
+	 * uc_get_rate() don't need to look them up again. */
+	if (ds->ds_num <= DISPATCH_RATES_STACK_NUM)
+		rates_buffer = rates_stack;
+	else
+		rates_buffer = malloc (ds->ds_num * sizeof (*rates_buffer));
+	if (rates_buffer == NULL)
+	{
+		ERROR ("plugin_dispatch_values: malloc failed.");
+		if (saved_values != NULL)
+		{
+			free (vl->values);
+			vl->values     = saved_values;
+			vl->values_len = saved_values_len;
+		}
+		return (-1);
+	}
+
+	rates.rates = rates_buffer;
+	rates.rates_num = (size_t) ds->ds_num;
+	uc_update_dispatch (ds, vl, &rates);
 
 	if (post_cache_chain != NULL)
 	{
@@ -1668,6 +1697,10 @@ int plugin_dispatch_values (value_list_t *vl)
 	else
 		fc_default_action (ds, vl);
 
+	uc_update_dispatch_done (&rates);
+	if (rates_buffer != rates_stack)
+		sfree (rates_buffer);
+
 	/* Restore the state of the value_list so that plugins don't get
 	 * confused.. */
 	if (saved_values != NULL)
@@ -1854,7 +1887,7 @@ const data_set_t *plugin_get_ds (const char *name)
 {
 	data_set_t *ds;
 
-	if (c_avl_get (data_sets, name, (void *) &ds) != 0)
+	if (c_htable_get (data_sets, name, (void *) &ds) != 0)
 	{
 		DEBUG ("No such dataset registered: %s", name);
 		return (NULL);
@@ -62,6 +62,13 @@
 # define C_PSQL_DEFAULT_CONF PKGDATADIR "/postgresql_default.conf"
 #endif
 
+/* Default settings for writers using "COPY ... FROM STDIN" statements. Rows
+ * are dropped if the buffer reaches twice the configured size, i.e. if the
+ * server does not keep up. */
+#define C_PSQL_COPY_BUFFER_SIZE     (1024 * 1024)
+#define C_PSQL_COPY_FLUSH_INTERVAL  TIME_T_TO_CDTIME_T (1)
+#define C_PSQL_COPY_ROW_SIZE        4096
+
 /* Appends the (parameter, value) pair to the string
  * pointed to by 'buf' suitable to be used as argument
  * for PQconnectdb(). If value equals NULL, the pair
@@ -114,8 +121,25 @@ typedef struct {
 	char *name;
 	char *statement;
 	_Bool store_rates;
+	/* statement is a "COPY ... FROM STDIN" statement */
+	_Bool copy;
 } c_psql_writer_t;
 
+/* Rows buffered for a COPY writer. New rows are appended to `buffer' (guarded
+ * by the database's copy_lock); c_psql_copy_flush() swaps it with `send' and
+ * streams the rows to the server (guarded by the database's db_lock). */
+typedef struct {
+	c_psql_writer_t *writer;
+
+	char  *buffer;
+	size_t buffer_len;
+	size_t buffer_size;
+
+	char  *send;
+	size_t send_len;
+	size_t send_size;
+} c_psql_copy_t;
+
 typedef struct {
 	PGconn      *conn;
 	c_complain_t conn_complaint;
@@ -125,11 +149,19 @@ typedef struct {
 
 	int max_params_num;
 
+	/* incremented whenever a new session has been established; prepared
+	 * statements belong to a session */
+	unsigned int conn_generation;
+
 	/* user configuration */
 	udb_query_preparation_area_t **q_prep_areas;
 	udb_query_t    **queries;
 	size_t           queries_num;
 
+	/* the connection generation in which the query has been prepared as
+	 * statement "collectd_<index>" or -1 if it cannot be prepared */
+	int             *q_prepared;
+
 	c_psql_writer_t **writers;
 	size_t            writers_num;
 
@@ -142,6 +174,27 @@ typedef struct {
 	cdtime_t commit_interval;
 	cdtime_t next_commit;
 
+	/* COPY writers; the buffers are flushed by `copy_thread' */
+	c_psql_copy_t    *copies;
+	size_t            copies_num;
+
+	size_t            copy_buffer_size;
+	cdtime_t          copy_flush_interval;
+
+	pthread_mutex_t   copy_lock;
+	pthread_cond_t    copy_cond;
+	pthread_t         copy_thread;
+	_Bool             copy_thread_running;
+	_Bool             copy_shutdown;
+
+	/* time the oldest buffered row was added and of the next attempt to
+	 * send rows after an error */
+	cdtime_t          copy_oldest;
+	cdtime_t          copy_retry;
+
+	c_complain_t      copy_complaint;
+	uint64_t          copy_dropped;
+
 	char *host;
 	char *port;
 	char *database;
@@ -242,7 +295,10 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 
 	db->max_params_num = 0;
 
+	db->conn_generation = 0;
+
 	db->q_prep_areas   = NULL;
+	db->q_prepared     = NULL;
 	db->queries        = NULL;
 	db->queries_num    = 0;
 
@@ -256,6 +312,23 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 	db->commit_interval = 0;
 	db->next_commit     = 0;
 
+	db->copies     = NULL;
+	db->copies_num = 0;
+
+	db->copy_buffer_size    = C_PSQL_COPY_BUFFER_SIZE;
+	db->copy_flush_interval = C_PSQL_COPY_FLUSH_INTERVAL;
+
+	pthread_mutex_init (&db->copy_lock, /* attrs = */ NULL);
+	pthread_cond_init (&db->copy_cond, /* attrs = */ NULL);
+	db->copy_thread_running = 0;
+	db->copy_shutdown       = 0;
+
+	db->copy_oldest = 0;
+	db->copy_retry  = 0;
+
+	C_COMPLAIN_INIT (&db->copy_complaint);
+	db->copy_dropped = 0;
+
 	db->database   = sstrdup (name);
 	db->host       = NULL;
 	db->port       = NULL;
@@ -274,6 +347,9 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 	return db;
 } /* c_psql_database_new */
 
+static int c_psql_check_connection (c_psql_database_t *db);
+static int c_psql_copy_flush (c_psql_database_t *db);
+
 static void c_psql_database_delete (void *data)
 {
 	size_t i;
@@ -285,9 +361,22 @@ static void c_psql_database_delete (void *data)
 	if (db->ref_cnt > 0)
 		return;
 
+	if (db->copy_thread_running) {
+		pthread_mutex_lock (&db->copy_lock);
+		db->copy_shutdown = 1;
+		pthread_cond_signal (&db->copy_cond);
+		pthread_mutex_unlock (&db->copy_lock);
+
+		pthread_join (db->copy_thread, /* retval = */ NULL);
+		db->copy_thread_running = 0;
+	}
+
 	/* wait for the lock to be released by the last writer */
 	pthread_mutex_lock (&db->db_lock);
 
+	if ((db->copies_num > 0) && (0 == c_psql_check_connection (db)))
+		c_psql_copy_flush (db);
+
 	if (db->next_commit > 0)
 		c_psql_commit (db);
 
@@ -298,6 +387,7 @@ static void c_psql_database_delete (void *data)
 		for (i = 0; i < db->queries_num; ++i)
 			udb_query_delete_preparation_area (db->q_prep_areas[i]);
 	free (db->q_prep_areas);
+	sfree (db->q_prepared);
 
 	sfree (db->queries);
 	db->queries_num = 0;
@@ -305,9 +395,18 @@ static void c_psql_database_delete (void *data)
 	sfree (db->writers);
 	db->writers_num = 0;
 
+	for (i = 0; i < db->copies_num; ++i) {
+		sfree (db->copies[i].buffer);
+		sfree (db->copies[i].send);
+	}
+	sfree (db->copies);
+	db->copies_num = 0;
+
 	pthread_mutex_unlock (&db->db_lock);
 
 	pthread_mutex_destroy (&db->db_lock);
+	pthread_mutex_destroy (&db->copy_lock);
+	pthread_cond_destroy (&db->copy_cond);
 
 	sfree (db->database);
 	sfree (db->host);
@@ -354,6 +453,7 @@ static int c_psql_connect (c_psql_database_t *db)
 
 	db->conn = PQconnectdb (conninfo);
 	db->proto_version = PQprotocolVersion (db->conn);
+	++db->conn_generation;
 	return 0;
 } /* c_psql_connect */
 
@@ -376,6 +476,7 @@ static int c_psql_check_connection (c_psql_database_t *db)
 
 	if (CONNECTION_OK != PQstatus (db->conn)) {
 		PQreset (db->conn);
+		++db->conn_generation;
 
 		/* trigger c_release() */
 		if (0 == db->conn_complaint.interval)
@@ -423,15 +524,62 @@ static PGresult *c_psql_exec_query_noparams (c_psql_database_t *db,
 	return PQexec (db->conn, udb_query_get_statement (q));
 } /* c_psql_exec_query_noparams */
 
+/* Prepares the query as a named statement once per session, so that the
+ * server does not have to parse and plan it again in each interval. Returns
+ * the name of the statement or NULL if the query has to be executed without
+ * preparing it. */
+static const char *c_psql_prepare_query (c_psql_database_t *db,
+		udb_query_t *q, size_t idx, c_psql_user_data_t *data,
+		char *name, size_t name_size)
+{
+	PGresult *res;
+
+	if ((db->q_prepared == NULL) || (db->q_prepared[idx] < 0))
+		return NULL;
+
+	ssnprintf (name, name_size, "collectd_%zu", idx);
+
+	if ((unsigned int)db->q_prepared[idx] == db->conn_generation)
+		return name;
+
+	res = PQprepare (db->conn, name, udb_query_get_statement (q),
+			(data != NULL) ? data->params_num : 0, /* paramTypes = */ NULL);
+
+	if (PGRES_COMMAND_OK != PQresultStatus (res)) {
+		/* e.g. multiple commands, which are fine with PQexec() */
+		if (CONNECTION_OK == PQstatus (db->conn)) {
+			log_info ("Query \"%s\" cannot be prepared, executing it as is: %s",
+					udb_query_get_name (q), PQerrorMessage (db->conn));
+			db->q_prepared[idx] = -1;
+		}
+		PQclear (res);
+		return NULL;
+	}
+	PQclear (res);
+
+	db->q_prepared[idx] = (int)db->conn_generation;
+	return name;
+} /* c_psql_prepare_query */
+
 static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
-		udb_query_t *q, c_psql_user_data_t *data)
+		udb_query_t *q, size_t idx, c_psql_user_data_t *data)
 {
-	char *params[db->max_params_num];
+	char *params[db->max_params_num + 1];
 	char  interval[64];
+	char  stmt_name[32];
 	int   i;
 
-	if ((data == NULL) || (data->params_num == 0))
+	const char *prepared;
+
+	prepared = c_psql_prepare_query (db, q, idx, data,
+			stmt_name, sizeof (stmt_name));
+
+	if ((data == NULL) || (data->params_num == 0)) {
+		if (prepared != NULL)
+			return PQexecPrepared (db->conn, prepared, 0, NULL,
+					NULL, NULL, /* return text data */ 0);
 		return (c_psql_exec_query_noparams (db, q));
+	}
 
 	assert (db->max_params_num >= data->params_num);
 
@@ -462,6 +610,11 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 		}
 	}
 
+	if (prepared != NULL)
+		return PQexecPrepared (db->conn, prepared, data->params_num,
+				(const char *const *) params,
+				NULL, NULL, /* return text data */ 0);
+
 	return PQexecParams (db->conn, udb_query_get_statement (q),
 			data->params_num, NULL,
 			(const char *const *) params,
@@ -470,7 +623,7 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 
 /* db->db_lock must be locked when calling this function */
 static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
-		udb_query_preparation_area_t *prep_area)
+		size_t idx, udb_query_preparation_area_t *prep_area)
 {
 	PGresult *res;
 
@@ -491,7 +644,7 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 
 	/* Versions up to `3' don't know how to handle parameters. */
 	if (3 <= db->proto_version)
-		res = c_psql_exec_query_params (db, q, data);
+		res = c_psql_exec_query_params (db, q, idx, data);
 	else if ((NULL == data) || (0 == data->params_num))
 		res = c_psql_exec_query_noparams (db, q);
 	else {
@@ -637,7 +790,7 @@ static int c_psql_read (user_data_t *ud)
 				&& (udb_query_check_version (q, db->server_version) <= 0))
 			continue;
 
-		if (0 == c_psql_exec_query (db, q, prep_area))
+		if (0 == c_psql_exec_query (db, q, (size_t)i, prep_area))
 			success = 1;
 	}
 
@@ -814,6 +967,393 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 	return string;
 } /* values_to_sqlarray */
 
+/* Appends a string field in COPY's text format to the row. NULL and empty
+ * strings are stored as NULL. */
+static int copy_append_field (char *row, size_t row_size, size_t *row_len,
+		const char *str, _Bool first)
+{
+	size_t len = *row_len;
+
+	if (! first) {
+		if (len + 1 >= row_size)
+			return -1;
+		row[len++] = '\t';
+	}
+
+	if ((str == NULL) || (*str == '\0'))
+		str = NULL;
+
+	if (str == NULL) {
+		if (len + 2 >= row_size)
+			return -1;
+		row[len++] = '\\';
+		row[len++] = 'N';
+	}
+
+	for (; (str != NULL) && (*str != '\0'); ++str) {
+		char esc = 0;
+
+		if (*str == '\\')
+			esc = '\\';
+		else if (*str == '\t')
+			esc = 't';
+		else if (*str == '\n')
+			esc = 'n';
+		else if (*str == '\r')
+			esc = 'r';
+
+		if (len + 2 >= row_size)
+			return -1;
+
+		if (esc != 0) {
+			row[len++] = '\\';
+			row[len++] = esc;
+		}
+		else
+			row[len++] = *str;
+	}
+
+	row[len] = '\0';
+	*row_len = len;
+	return 0;
+} /* copy_append_field */
+
+/* Appends preformatted text (array literals) to the row. */
+static int copy_append_raw (char *row, size_t row_size, size_t *row_len,
+		const char *format, ...)
+{
+	va_list ap;
+	int status;
+
+	va_start (ap, format);
+	status = vsnprintf (row + *row_len, row_size - *row_len, format, ap);
+	va_end (ap);
+
+	if ((status < 0) || ((size_t)status >= row_size - *row_len))
+		return -1;
+
+	*row_len += (size_t)status;
+	return 0;
+} /* copy_append_raw */
+
+/* Formats one row for a COPY writer. The columns match the parameters passed
+ * to regular writer statements: time, host, plugin, plugin instance, type,
+ * type instance and the arrays of value names, types and values. */
+static int c_psql_copy_format (const data_set_t *ds, const value_list_t *vl,
+		const char *time_str, _Bool store_rates,
+		char *row, size_t row_size, size_t *ret_len)
+{
+	gauge_t *rates = NULL;
+
+	size_t len = 0;
+	int status = 0;
+	int i;
+
+	status |= copy_append_field (row, row_size, &len, time_str, 1);
+	status |= copy_append_field (row, row_size, &len, vl->host, 0);
+	status |= copy_append_field (row, row_size, &len, vl->plugin, 0);
+	status |= copy_append_field (row, row_size, &len,
+			vl->plugin_instance, 0);
+	status |= copy_append_field (row, row_size, &len, vl->type, 0);
+	status |= copy_append_field (row, row_size, &len,
+			vl->type_instance, 0);
+
+	for (i = 0; i < ds->ds_num; ++i)
+		status |= copy_append_raw (row, row_size, &len, "%s\"%s\"",
+				(i == 0) ? "\t{" : ",", ds->ds[i].name);
+
+	for (i = 0; i < ds->ds_num; ++i)
+		status |= copy_append_raw (row, row_size, &len, "%s%s",
+				(i == 0) ? "}\t{" : ",",
+				store_rates ? "gauge" : DS_TYPE_TO_STRING (ds->ds[i].type));
+
+	for (i = 0; i < ds->ds_num; ++i) {
+		const char *sep = (i == 0) ? "}\t{" : ",";
+		gauge_t g;
+
+		if (ds->ds[i].type == DS_TYPE_GAUGE)
+			g = vl->values[i].gauge;
+		else if (store_rates) {
+			if (rates == NULL)
+				rates = uc_get_rate (ds, vl);
+
+			if (rates == NULL) {
+				log_err ("c_psql_write: Failed to determine rate");
+				return -1;
+			}
+			g = rates[i];
+		}
+		else if (ds->ds[i].type == DS_TYPE_COUNTER) {
+			status |= copy_append_raw (row, row_size, &len, "%s%llu",
+					sep, vl->values[i].counter);
+			continue;
+		}
+		else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+			status |= copy_append_raw (row, row_size, &len, "%s%"PRIi64,
+					sep, vl->values[i].derive);
+			continue;
+		}
+		else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+			status |= copy_append_raw (row, row_size, &len, "%s%"PRIu64,
+					sep, vl->values[i].absolute);
+			continue;
+		}
+		else {
+			log_err ("c_psql_write: Unknown data source type: %i",
+					ds->ds[i].type);
+			sfree (rates);
+			return -1;
+		}
+
+		if (isnan (g))
+			status |= copy_append_raw (row, row_size, &len, "%sNaN", sep);
+		else if (isinf (g))
+			status |= copy_append_raw (row, row_size, &len, "%s%sInfinity",
+					sep, (g < 0) ? "-" : "");
+		else
+			status |= copy_append_raw (row, row_size, &len, "%s%.15g",
+					sep, g);
+	}
+	sfree (rates);
+
+	status |= copy_append_raw (row, row_size, &len, "}\n");
+
+	if (status != 0) {
+		log_err ("c_psql_write: Failed to format COPY row for %s/%s/%s",
+				vl->host, vl->plugin, vl->type);
+		return -1;
+	}
+
+	*ret_len = len;
+	return 0;
+} /* c_psql_copy_format */
+
+static int c_psql_copy_due (c_psql_database_t *db)
+{
+	cdtime_t now;
+	size_t i;
+
+	if ((db->copy_oldest == 0) || (db->copy_retry > cdtime ()))
+		return 0;
+
+	for (i = 0; i < db->copies_num; ++i)
+		if (db->copies[i].buffer_len >= db->copy_buffer_size)
+			return 1;
+
+	now = cdtime ();
+	return (now >= db->copy_oldest + db->copy_flush_interval);
+} /* c_psql_copy_due */
+
+/* Streams the rows in copy->send to the server. The caller must hold
+ * db->db_lock. */
+static int c_psql_copy_send (c_psql_database_t *db, c_psql_copy_t *copy)
+{
+	PGresult *res;
+	int status;
+
+	res = PQexec (db->conn, copy->writer->statement);
+	if (PGRES_COPY_IN != PQresultStatus (res)) {
+		log_err ("Failed to start COPY: %s", PQerrorMessage (db->conn));
+		log_info ("SQL query was: '%s'", copy->writer->statement);
+		PQclear (res);
+		return -1;
+	}
+	PQclear (res);
+
+	status = PQputCopyData (db->conn, copy->send, (int)copy->send_len);
+	if (1 == status)
+		status = PQputCopyEnd (db->conn, /* errormsg = */ NULL);
+	else
+		PQputCopyEnd (db->conn, "collectd: failed to send data");
+
+	if (1 != status)
+		log_err ("Failed to send COPY data: %s", PQerrorMessage (db->conn));
+
+	/* fetch the result of the COPY command */
+	while ((res = PQgetResult (db->conn)) != NULL) {
+		if ((1 == status) && (PGRES_COMMAND_OK != PQresultStatus (res))) {
+			log_err ("COPY failed: %s", PQerrorMessage (db->conn));
+			status = -1;
+		}
+		PQclear (res);
+	}
+
+	return (1 == status) ? 0 : -1;
+} /* c_psql_copy_send */
+
+/* Sends all rows buffered for the COPY writers of this database. The caller
+ * must hold db->db_lock. Rows which could not be sent because the connection
+ * broke are kept and sent on the next call; all other failures drop the
+ * rows. */
+static int c_psql_copy_flush (c_psql_database_t *db)
+{
+	int status = 0;
+	size_t i;
+
+	pthread_mutex_lock (&db->copy_lock);
+	for (i = 0; i < db->copies_num; ++i) {
+		c_psql_copy_t *copy = db->copies + i;
+		char  *tmp      = copy->send;
+		size_t tmp_size = copy->send_size;
+
+		/* rows left over from a failed attempt are sent first */
+		if (copy->send_len > 0)
+			continue;
+
+		copy->send      = copy->buffer;
+		copy->send_len  = copy->buffer_len;
+		copy->send_size = copy->buffer_size;
+
+		copy->buffer      = tmp;
+		copy->buffer_len  = 0;
+		copy->buffer_size = tmp_size;
+	}
+	db->copy_oldest = 0;
+	pthread_mutex_unlock (&db->copy_lock);
+
+	for (i = 0; i < db->copies_num; ++i) {
+		c_psql_copy_t *copy = db->copies + i;
+
+		if (copy->send_len == 0)
+			continue;
+
+		if (0 == c_psql_copy_send (db, copy)) {
+			copy->send_len = 0;
+			continue;
+		}
+
+		status = -1;
+
+		/* this will abort any current transaction -> restart */
+		if (db->next_commit > 0)
+			c_psql_commit (db);
+
+		if (CONNECTION_OK == PQstatus (db->conn)) {
+			log_warn ("Dropping %zu bytes of COPY data of writer %s.",
+					copy->send_len, copy->writer->name);
+			copy->send_len = 0;
+		}
+	}
+
+	pthread_mutex_lock (&db->copy_lock);
+	if (status != 0) {
+		db->copy_retry = cdtime () + db->copy_flush_interval;
+		/* make sure the thread tries again */
+		if (db->copy_oldest == 0)
+			db->copy_oldest = cdtime ();
+	}
+	else {
+		db->copy_retry = 0;
+		c_release (LOG_INFO, &db->copy_complaint,
+				"postgresql: Sending rows to database %s works again.",
+				db->database);
+	}
+	pthread_mutex_unlock (&db->copy_lock);
+
+	return status;
+} /* c_psql_copy_flush */
+
+static void *c_psql_copy_thread (void *arg)
+{
+	c_psql_database_t *db = arg;
+
+	pthread_mutex_lock (&db->copy_lock);
+	while (! db->copy_shutdown) {
+		if (! c_psql_copy_due (db)) {
+			struct timespec ts;
+
+			if (db->copy_oldest == 0) {
+				pthread_cond_wait (&db->copy_cond, &db->copy_lock);
+				continue;
+			}
+
+			if (db->copy_retry > db->copy_oldest + db->copy_flush_interval)
+				CDTIME_T_TO_TIMESPEC (db->copy_retry, &ts);
+			else
+				CDTIME_T_TO_TIMESPEC (db->copy_oldest
+						+ db->copy_flush_interval, &ts);
+			pthread_cond_timedwait (&db->copy_cond, &db->copy_lock, &ts);
+			continue;
+		}
+		pthread_mutex_unlock (&db->copy_lock);
+
+		pthread_mutex_lock (&db->db_lock);
+		if (0 == c_psql_check_connection (db))
+			c_psql_copy_flush (db);
+		else {
+			pthread_mutex_lock (&db->copy_lock);
+			db->copy_retry = cdtime () + db->copy_flush_interval;
+			pthread_mutex_unlock (&db->copy_lock);
+		}
+		pthread_mutex_unlock (&db->db_lock);
+
+		pthread_mutex_lock (&db->copy_lock);
+	}
+	pthread_mutex_unlock (&db->copy_lock);
+
+	return NULL;
+} /* c_psql_copy_thread */
+
+/* Appends a row to the buffer of a COPY writer. The row is dropped if the
+ * buffer is full, i.e. if the server does not keep up. */
+static int c_psql_copy_append (c_psql_database_t *db, c_psql_copy_t *copy,
+		const char *row, size_t row_len)
+{
+	pthread_mutex_lock (&db->copy_lock);
+
+	if (! db->copy_thread_running && ! db->copy_shutdown) {
+		int status = plugin_thread_create (&db->copy_thread, /* attr = */ NULL,
+				c_psql_copy_thread, db);
+		if (status != 0) {
+			char errbuf[1024];
+			pthread_mutex_unlock (&db->copy_lock);
+			log_err ("Starting COPY thread failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return -1;
+		}
+		db->copy_thread_running = 1;
+	}
+
+	if (copy->buffer_len + row_len > 2 * db->copy_buffer_size) {
+		++db->copy_dropped;
+		c_complain (LOG_WARNING, &db->copy_complaint,
+				"postgresql: The COPY buffer of database %s is full, dropping "
+				"rows (%"PRIu64" so far).", db->database, db->copy_dropped);
+		pthread_mutex_unlock (&db->copy_lock);
+		return -1;
+	}
+
+	if (copy->buffer_len + row_len > copy->buffer_size) {
+		size_t new_size = (copy->buffer_size > 0) ? copy->buffer_size : 4096;
+		char  *tmp;
+
+		while (new_size < copy->buffer_len + row_len)
+			new_size *= 2;
+
+		tmp = realloc (copy->buffer, new_size);
+		if (tmp == NULL) {
+			pthread_mutex_unlock (&db->copy_lock);
+			log_err ("Out of memory.");
+			return -1;
+		}
+		copy->buffer      = tmp;
+		copy->buffer_size = new_size;
+	}
+
+	memcpy (copy->buffer + copy->buffer_len, row, row_len);
+	copy->buffer_len += row_len;
+
+	if (db->copy_oldest == 0) {
+		db->copy_oldest = cdtime ();
+		pthread_cond_signal (&db->copy_cond);
+	}
+	else if (copy->buffer_len >= db->copy_buffer_size)
+		pthread_cond_signal (&db->copy_cond);
+
+	pthread_mutex_unlock (&db->copy_lock);
+	return 0;
+} /* c_psql_copy_append */
+
 static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t *ud)
 {
@@ -843,6 +1383,23 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		return -1;
 	}
 
+	/* COPY writers only buffer the row; it's sent by c_psql_copy_thread() */
+	for (i = 0; (size_t)i < db->copies_num; ++i) {
+		c_psql_copy_t *copy = db->copies + i;
+		char row[C_PSQL_COPY_ROW_SIZE];
+		size_t row_len = 0;
+
+		if (c_psql_copy_format (ds, vl, time_str, copy->writer->store_rates,
+					row, sizeof (row), &row_len) != 0)
+			continue;
+
+		if (c_psql_copy_append (db, copy, row, row_len) == 0)
+			success = 1;
+	}
+
+	if (db->copies_num >= db->writers_num)
+		return success ? 0 : -1;
+
 	if (values_name_to_sqlarray (ds,
 				values_name_str, sizeof (values_name_str)) == NULL)
 		return -1;
@@ -875,6 +1432,8 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		PGresult *res;
 
 		writer = db->writers[i];
+		if (writer->copy)
+			continue;
 
 		if (values_type_to_sqlarray (ds,
 					values_type_str, sizeof (values_type_str),
@@ -970,6 +1529,14 @@ static int c_psql_flush (cdtime_t timeout,
 		 * committed */
 		if ((db->next_commit > 0) && (db->commit_interval > timeout))
 			c_psql_commit (db);
+
+		/* the same applies to rows buffered for COPY writers */
+		if ((db->copies_num > 0) && (db->copy_flush_interval > timeout)) {
+			pthread_mutex_lock (&db->db_lock);
+			if (0 == c_psql_check_connection (db))
+				c_psql_copy_flush (db);
+			pthread_mutex_unlock (&db->db_lock);
+		}
 	}
 	return 0;
 } /* c_psql_flush */
@@ -1148,6 +1715,7 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 	writer->name = sstrdup (ci->values[0].value.string);
 	writer->statement = NULL;
 	writer->store_rates = 1;
+	writer->copy = 0;
 
 	for (i = 0; i < ci->children_num; ++i) {
 		oconfig_item_t *c = ci->children + i;
@@ -1160,16 +1728,47 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
 
+	if ((status == 0) && (writer->statement == NULL)) {
+		log_err ("Writer \"%s\": Missing `Statement' option.", writer->name);
+		status = -1;
+	}
+
 	if (status != 0) {
 		sfree (writer->statement);
 		sfree (writer->name);
-		sfree (writer);
+		--writers_num;
 		return status;
 	}
 
+	/* rows for "COPY ... FROM STDIN" statements are buffered and streamed
+	 * to the server in bulk, see c_psql_copy_flush() */
+	for (i = 0; isspace ((int)writer->statement[i]); ++i)
+		/* nothing */;
+	writer->copy = (strncasecmp ("COPY", writer->statement + i, 4) == 0);
+
 	return 0;
 } /* c_psql_config_writer */
 
+static int c_psql_config_copy_buffer_size (oconfig_item_t *ci,
+		size_t *ret_size)
+{
+	int size = 0;
+
+	if (cf_util_get_int (ci, &size) != 0)
+		return -1;
+
+	/* the buffer has to hold at least one row and twice its size has to be
+	 * passed to PQputCopyData() as an int */
+	if ((size < C_PSQL_COPY_ROW_SIZE) || (size > INT_MAX / 2)) {
+		log_err ("CopyBufferSize %i is out of range [%i, %i].",
+				size, C_PSQL_COPY_ROW_SIZE, INT_MAX / 2);
+		return -1;
+	}
+
+	*ret_size = (size_t)size;
+	return 0;
+} /* c_psql_config_copy_buffer_size */
+
 static int c_psql_config_database (oconfig_item_t *ci)
 {
 	c_psql_database_t *db;
@@ -1223,6 +1822,10 @@ static int c_psql_config_database (oconfig_item_t *ci)
 			cf_util_get_cdtime (c, &db->interval);
 		else if (strcasecmp ("CommitInterval", c->key) == 0)
 			cf_util_get_cdtime (c, &db->commit_interval);
+		else if (strcasecmp ("CopyBufferSize", c->key) == 0)
+			c_psql_config_copy_buffer_size (c, &db->copy_buffer_size);
+		else if (strcasecmp ("CopyFlushInterval", c->key) == 0)
+			cf_util_get_cdtime (c, &db->copy_flush_interval);
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
@@ -1235,11 +1838,37 @@ static int c_psql_config_database (oconfig_item_t *ci)
 					&db->queries, &db->queries_num);
 	}
 
+	for (i = 0; (size_t)i < db->writers_num; ++i) {
+		c_psql_copy_t *tmp;
+
+		if (! db->writers[i]->copy)
+			continue;
+
+		tmp = (c_psql_copy_t *)realloc (db->copies,
+				sizeof (*db->copies) * (db->copies_num + 1));
+		if (tmp == NULL) {
+			log_err ("Out of memory.");
+			c_psql_database_delete (db);
+			return -1;
+		}
+
+		db->copies = tmp;
+		memset (db->copies + db->copies_num, 0, sizeof (*db->copies));
+		db->copies[db->copies_num].writer = db->writers[i];
+		++db->copies_num;
+	}
+
+	if (db->copy_flush_interval == 0)
+		db->copy_flush_interval = C_PSQL_COPY_FLUSH_INTERVAL;
+
 	if (db->queries_num > 0) {
 		db->q_prep_areas = (udb_query_preparation_area_t **) calloc (
 				db->queries_num, sizeof (*db->q_prep_areas));
 
-		if (db->q_prep_areas == NULL) {
+		db->q_prepared = (int *) calloc (db->queries_num,
+				sizeof (*db->q_prepared));
+
+		if ((db->q_prep_areas == NULL) || (db->q_prepared == NULL)) {
 			log_err ("Out of memory.");
 			c_psql_database_delete (db);
 			return -1;
@@ -92,6 +92,18 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include "utils_avltree.h"
+#  include <pthread.h>
+#  if HAVE_LINUX_CONNECTOR_H && HAVE_LINUX_CN_PROC_H
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <linux/netlink.h>
+#    include <linux/connector.h>
+#    include <linux/cn_proc.h>
+#    define HAVE_PROC_CONNECTOR 1
+#  else
+#    define HAVE_PROC_CONNECTOR 0
+#  endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -208,6 +220,46 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* Per-process cache. The (expensive) matching against all `Process' and
+ * `ProcessMatch' entries is only done when a process is seen for the first
+ * time or when it has changed, i.e. its name or start time differs, the proc
+ * connector reported an exec(2) or, if a `ProcessMatch' is configured, its
+ * command line differs (e.g. because of setproctitle(3)). */
+typedef struct ps_cache_entry_s
+{
+	pid_t pid;
+	unsigned long long starttime;
+	char name[PROCSTAT_NAME_LEN];
+	/* Command line the matches were computed with. Only set if
+	 * `ps_need_cmdline' is true. */
+	char *cmdline;
+
+	/* `procstat_t' entries this process matches. */
+	procstat_t **matches;
+	size_t matches_num;
+
+	_Bool valid;
+	unsigned int generation;
+} ps_cache_entry_t;
+
+static c_avl_tree_t *ps_cache = NULL;
+static pthread_mutex_t ps_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ps_cache_generation = 0;
+
+/* Set if at least one `ProcessMatch' is configured, i.e. if the command line
+ * of processes is required at all. */
+static _Bool ps_need_cmdline = 0;
+
+#if HAVE_PROC_CONNECTOR
+static _Bool     ps_use_proc_connector = 0;
+static int       ps_connector_fd = -1;
+static pthread_t ps_connector_thread;
+static _Bool     ps_connector_thread_running = 0;
+static _Bool     ps_connector_shutdown = 0;
+
+static int ps_connector_start (void);
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -263,6 +315,9 @@ static void ps_list_register (const char *name, const char *regexp)
 			sfree(new->re);
 			return;
 		}
+#if KERNEL_LINUX
+		ps_need_cmdline = 1;
+#endif
 	}
 #else
 	if (regexp != NULL)
@@ -331,143 +386,156 @@ static int ps_list_match (const char *name, const char *cmdline, procstat_t *ps)
 	return (0);
 } /* int ps_list_match */
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to 'instances' of the matching process 'ps' (or refresh
+ * it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		procstat_entry_t *new;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
+		if (new == NULL)
+			return;
+		memset (new, 0, sizeof (procstat_entry_t));
+		new->id = entry->id;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
+		pse = new;
+	}
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	if ((entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0))
+	{
+		pse->vmem_minflt_counter += entry->vmem_minflt;
+		pse->vmem_minflt = entry->vmem_minflt;
 
-			pse = new;
+		pse->vmem_majflt_counter += entry->vmem_majflt;
+		pse->vmem_majflt = entry->vmem_majflt;
+	}
+	else
+	{
+		if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
+		{
+			pse->vmem_minflt = entry->vmem_minflt_counter
+				+ (ULONG_MAX - pse->vmem_minflt_counter);
 		}
-
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
+		else
 		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+			pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
+		}
+		pse->vmem_minflt_counter = entry->vmem_minflt_counter;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
+		if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
+		{
+			pse->vmem_majflt = entry->vmem_majflt_counter
+				+ (ULONG_MAX - pse->vmem_majflt_counter);
 		}
 		else
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
-			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+			pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
 		}
+		pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+	}
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
+	ps->vmem_minflt_counter += pse->vmem_minflt;
+	ps->vmem_majflt_counter += pse->vmem_majflt;
 
-		if ((entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0))
-		{
-			pse->cpu_user_counter += entry->cpu_user;
-			pse->cpu_user = entry->cpu_user;
+	if ((entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0))
+	{
+		pse->cpu_user_counter += entry->cpu_user;
+		pse->cpu_user = entry->cpu_user;
 
-			pse->cpu_system_counter += entry->cpu_system;
-			pse->cpu_system = entry->cpu_system;
+		pse->cpu_system_counter += entry->cpu_system;
+		pse->cpu_system = entry->cpu_system;
+	}
+	else
+	{
+		if (entry->cpu_user_counter < pse->cpu_user_counter)
+		{
+			pse->cpu_user = entry->cpu_user_counter
+				+ (ULONG_MAX - pse->cpu_user_counter);
 		}
 		else
 		{
-			if (entry->cpu_user_counter < pse->cpu_user_counter)
-			{
-				pse->cpu_user = entry->cpu_user_counter
-					+ (ULONG_MAX - pse->cpu_user_counter);
-			}
-			else
-			{
-				pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
-			}
-			pse->cpu_user_counter = entry->cpu_user_counter;
+			pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
+		}
+		pse->cpu_user_counter = entry->cpu_user_counter;
 
-			if (entry->cpu_system_counter < pse->cpu_system_counter)
-			{
-				pse->cpu_system = entry->cpu_system_counter
-					+ (ULONG_MAX - pse->cpu_system_counter);
-			}
-			else
-			{
-				pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
-			}
-			pse->cpu_system_counter = entry->cpu_system_counter;
+		if (entry->cpu_system_counter < pse->cpu_system_counter)
+		{
+			pse->cpu_system = entry->cpu_system_counter
+				+ (ULONG_MAX - pse->cpu_system_counter);
+		}
+		else
+		{
+			pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
 		}
+		pse->cpu_system_counter = entry->cpu_system_counter;
+	}
+
+	ps->cpu_user_counter   += pse->cpu_user;
+	ps->cpu_system_counter += pse->cpu_system;
+} /* void ps_list_add_entry */
+
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
 
-		ps->cpu_user_counter   += pse->cpu_user;
-		ps->cpu_system_counter += pse->cpu_system;
+	if (entry->id == 0)
+		return;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
+
+		ps_list_add_entry (ps, entry);
 	}
-}
+} /* void ps_list_add */
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -573,6 +641,16 @@ static int ps_config (oconfig_item_t *ci)
 			ps_list_register (c->values[0].value.string,
 					c->values[1].value.string);
 		}
+		else if (strcasecmp (c->key, "UseProcConnector") == 0)
+		{
+#if KERNEL_LINUX && HAVE_PROC_CONNECTOR
+			cf_util_get_boolean (c, &ps_use_proc_connector);
+#else
+			WARNING ("processes plugin: The `UseProcConnector' option "
+					"is not supported on this system and will be "
+					"ignored.");
+#endif
+		}
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -617,6 +695,17 @@ static int ps_init (void)
 	pagesize_g = sysconf(_SC_PAGESIZE);
 	DEBUG ("pagesize_g = %li; CONFIG_HZ = %i;",
 			pagesize_g, CONFIG_HZ);
+
+#if HAVE_PROC_CONNECTOR
+	if (ps_use_proc_connector && !ps_connector_thread_running)
+	{
+		/* Not fatal: without the connector, processes are re-matched
+		 * when their name or start time changes. */
+		if (ps_connector_start () != 0)
+			WARNING ("processes plugin: Falling back to detecting "
+					"exec(2) calls by polling.");
+	}
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -904,7 +993,12 @@ static procstat_t *ps_read_io (int pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-int ps_read_process (int pid, procstat_t *ps, char *state)
+/* Read /proc/<pid>/stat. Only the information required for every process is
+ * filled in; the number of threads, memory details and I/O statistics are
+ * read by `ps_read_process_details' for processes which are actually
+ * selected by a `Process' or `ProcessMatch' option. */
+int ps_read_process (int pid, procstat_t *ps, char *state,
+		unsigned long long *starttime)
 {
 	char  filename[64];
 	char  buffer[1024];
@@ -979,6 +1073,7 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 
 	*state = fields[0][0];
+	*starttime = atoll (fields[19]);
 
 	if (*state == 'Z')
 	{
@@ -987,11 +1082,10 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 	else
 	{
-		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
-		{
-			/* returns -1 => kernel 2.4 */
-			ps->num_lwp = 1;
-		}
+		/* The number of threads is available in field 20 since
+		 * Linux 2.6; `ps_read_process_details' falls back to counting
+		 * the entries of /proc/<pid>/task if it is zero. */
+		ps->num_lwp  = atol (fields[17]);
 		ps->num_proc = 1;
 	}
 
@@ -1024,6 +1118,33 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	cpu_system_counter = cpu_system_counter * 1000000 / CONFIG_HZ;
 	vmem_rss = vmem_rss * pagesize_g;
 
+	ps->cpu_user_counter = cpu_user_counter;
+	ps->cpu_system_counter = cpu_system_counter;
+	ps->vmem_size = (unsigned long) vmem_size;
+	ps->vmem_rss = (unsigned long) vmem_rss;
+	ps->stack_size = (unsigned long) stack_size;
+
+	/* success */
+	return (0);
+} /* int ps_read_process (...) */
+
+/* Read the information not contained in /proc/<pid>/stat, see
+ * `ps_read_process'. */
+static void ps_read_process_details (int pid, procstat_t *ps)
+{
+	/* Leave the rest at zero if this is only a zombi */
+	if (ps->num_proc == 0)
+		return;
+
+	if (ps->num_lwp <= 0)
+	{
+		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
+		{
+			/* returns -1 => kernel 2.4 */
+			ps->num_lwp = 1;
+		}
+	}
+
 	if ( (ps_read_vmem(pid, ps)) == NULL)
 	{
 		/* No VMem data */
@@ -1032,12 +1153,6 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 		DEBUG("ps_read_process: did not get vmem data for pid %i",pid);
 	}
 
-	ps->cpu_user_counter = cpu_user_counter;
-	ps->cpu_system_counter = cpu_system_counter;
-	ps->vmem_size = (unsigned long) vmem_size;
-	ps->vmem_rss = (unsigned long) vmem_rss;
-	ps->stack_size = (unsigned long) stack_size;
-
 	if ( (ps_read_io (pid, ps)) == NULL)
 	{
 		/* no io data */
@@ -1048,12 +1163,9 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 		DEBUG("ps_read_process: not get io data for pid %i",pid);
 	}
+} /* void ps_read_process_details */
 
-	/* success */
-	return (0);
-} /* int ps_read_process (...) */
-
-static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
+static char *ps_get_cmdline (pid_t pid, const char *name, char *buf, size_t buf_len)
 {
 	char  *buf_ptr;
 	size_t len;
@@ -1192,6 +1304,384 @@ static int read_fork_rate ()
 	ps_submit_fork_rate (value.derive);
 	return (0);
 }
+
+static int ps_cache_compare (const void *a, const void *b)
+{
+	pid_t pid_a = *((const pid_t *) a);
+	pid_t pid_b = *((const pid_t *) b);
+
+	if (pid_a < pid_b)
+		return (-1);
+	else if (pid_a > pid_b)
+		return (1);
+	return (0);
+} /* int ps_cache_compare */
+
+static void ps_cache_entry_free (ps_cache_entry_t *ce)
+{
+	if (ce == NULL)
+		return;
+
+	sfree (ce->matches);
+	sfree (ce->cmdline);
+	sfree (ce);
+} /* void ps_cache_entry_free */
+
+/* Mark the cache entry of `pid' as invalid, so it's matched again. The
+ * caller must hold `ps_cache_lock'. */
+static void ps_cache_invalidate (pid_t pid)
+{
+	ps_cache_entry_t *ce = NULL;
+
+	if (ps_cache == NULL)
+		return;
+
+	if (c_avl_get (ps_cache, &pid, (void *) &ce) == 0)
+		ce->valid = 0;
+} /* void ps_cache_invalidate */
+
+/* Remove the cache entry of `pid'. The caller must hold `ps_cache_lock'. */
+static void ps_cache_remove (pid_t pid)
+{
+	ps_cache_entry_t *ce = NULL;
+	void *key = NULL;
+
+	if (ps_cache == NULL)
+		return;
+
+	if (c_avl_remove (ps_cache, &pid, &key, (void *) &ce) == 0)
+		ps_cache_entry_free (ce);
+} /* void ps_cache_remove */
+
+/* Mark all cache entries as invalid. The caller must hold `ps_cache_lock'. */
+static void ps_cache_invalidate_all (void)
+{
+	c_avl_iterator_t *iter;
+	void *key;
+	ps_cache_entry_t *ce;
+
+	if (ps_cache == NULL)
+		return;
+
+	iter = c_avl_get_iterator (ps_cache);
+	while (c_avl_iterator_next (iter, &key, (void *) &ce) == 0)
+		ce->valid = 0;
+	c_avl_iterator_destroy (iter);
+} /* void ps_cache_invalidate_all */
+
+/* Remove all entries which have not been seen during the current read. The
+ * caller must hold `ps_cache_lock'. */
+static void ps_cache_expire (void)
+{
+	c_avl_iterator_t *iter;
+	void *key;
+	ps_cache_entry_t *ce;
+	pid_t *expired = NULL;
+	size_t expired_num = 0;
+	size_t expired_size = 0;
+	size_t i;
+
+	if (ps_cache == NULL)
+		return;
+
+	iter = c_avl_get_iterator (ps_cache);
+	while (c_avl_iterator_next (iter, &key, (void *) &ce) == 0)
+	{
+		if (ce->generation == ps_cache_generation)
+			continue;
+
+		if (expired_num >= expired_size)
+		{
+			pid_t *tmp;
+			size_t new_size = (expired_size == 0) ? 64 : 2 * expired_size;
+
+			tmp = realloc (expired, new_size * sizeof (*expired));
+			if (tmp == NULL)
+				break;
+			expired = tmp;
+			expired_size = new_size;
+		}
+		expired[expired_num] = ce->pid;
+		expired_num++;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+		ps_cache_remove (expired[i]);
+	sfree (expired);
+} /* void ps_cache_expire */
+
+/* Return the cache entry for the process, (re-)computing the list of matching
+ * `procstat_t' entries if required. The caller must hold `ps_cache_lock'. */
+static ps_cache_entry_t *ps_cache_get (pid_t pid, const char *name,
+		unsigned long long starttime)
+{
+	ps_cache_entry_t *ce = NULL;
+	procstat_t *ps;
+	char cmdline[ARG_MAX];
+	const char *cmdline_ptr;
+	size_t matches_num;
+
+	if (ps_cache == NULL)
+	{
+		ps_cache = c_avl_create (ps_cache_compare);
+		if (ps_cache == NULL)
+			return (NULL);
+	}
+
+	if (c_avl_get (ps_cache, &pid, (void *) &ce) != 0)
+	{
+		ce = (ps_cache_entry_t *) malloc (sizeof (*ce));
+		if (ce == NULL)
+			return (NULL);
+		memset (ce, 0, sizeof (*ce));
+		ce->pid = pid;
+
+		if (c_avl_insert (ps_cache, &ce->pid, ce) != 0)
+		{
+			sfree (ce);
+			return (NULL);
+		}
+	}
+
+	ce->generation = ps_cache_generation;
+
+	/* Processes may change their command line at any time, so it has to be
+	 * read again if any `ProcessMatch' is configured. Reading it is still
+	 * much cheaper than matching it against all regular expressions. */
+	cmdline_ptr = NULL;
+	if (ps_need_cmdline)
+		cmdline_ptr = ps_get_cmdline (pid, name, cmdline, sizeof (cmdline));
+
+	if (ce->valid && (ce->starttime == starttime)
+			&& (strcmp (ce->name, name) == 0)
+			&& (!ps_need_cmdline
+				|| ((cmdline_ptr == NULL) && (ce->cmdline == NULL))
+				|| ((cmdline_ptr != NULL) && (ce->cmdline != NULL)
+					&& (strcmp (ce->cmdline, cmdline_ptr) == 0))))
+		return (ce);
+
+	/* New or changed process: match it against all entries. */
+	ce->starttime = starttime;
+	sstrncpy (ce->name, name, sizeof (ce->name));
+	ce->matches_num = 0;
+
+	sfree (ce->cmdline);
+	if (cmdline_ptr != NULL)
+		ce->cmdline = strdup (cmdline_ptr);
+
+	matches_num = 0;
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+		if (ps_list_match (ce->name, cmdline_ptr, ps) == 0)
+			continue;
+
+		tmp = realloc (ce->matches, (matches_num + 1) * sizeof (*ce->matches));
+		if (tmp == NULL)
+			break;
+		ce->matches = tmp;
+		ce->matches[matches_num] = ps;
+		matches_num++;
+	}
+	ce->matches_num = matches_num;
+	ce->valid = 1;
+
+	return (ce);
+} /* ps_cache_entry_t *ps_cache_get */
+
+static void ps_cache_destroy (void)
+{
+	void *key;
+	ps_cache_entry_t *ce;
+
+	if (ps_cache == NULL)
+		return;
+
+	while (c_avl_pick (ps_cache, &key, (void *) &ce) == 0)
+		ps_cache_entry_free (ce);
+	c_avl_destroy (ps_cache);
+	ps_cache = NULL;
+} /* void ps_cache_destroy */
+
+#if HAVE_PROC_CONNECTOR
+/* Subscribe to (or unsubscribe from) process events. */
+static int ps_connector_send (int fd, enum proc_cn_mcast_op op)
+{
+	struct __attribute__ ((aligned(NLMSG_ALIGNTO))) {
+		struct nlmsghdr hdr;
+		struct __attribute__ ((__packed__)) {
+			struct cn_msg msg;
+			enum proc_cn_mcast_op op;
+		} body;
+	} req;
+
+	memset (&req, 0, sizeof (req));
+	req.hdr.nlmsg_len = sizeof (req);
+	req.hdr.nlmsg_pid = 0;
+	req.hdr.nlmsg_type = NLMSG_DONE;
+
+	req.body.msg.id.idx = CN_IDX_PROC;
+	req.body.msg.id.val = CN_VAL_PROC;
+	req.body.msg.len = sizeof (enum proc_cn_mcast_op);
+	req.body.op = op;
+
+	if (send (fd, &req, sizeof (req), 0) < 0)
+		return (-1);
+	return (0);
+} /* int ps_connector_send */
+
+static void ps_connector_handle_event (const struct proc_event *ev)
+{
+	pthread_mutex_lock (&ps_cache_lock);
+	switch (ev->what)
+	{
+		case PROC_EVENT_EXEC:
+			ps_cache_invalidate (ev->event_data.exec.process_tgid);
+			break;
+
+		case PROC_EVENT_EXIT:
+			/* Ignore threads exiting. */
+			if (ev->event_data.exit.process_pid
+					== ev->event_data.exit.process_tgid)
+				ps_cache_remove (ev->event_data.exit.process_tgid);
+			break;
+
+		default:
+			break;
+	}
+	pthread_mutex_unlock (&ps_cache_lock);
+} /* void ps_connector_handle_event */
+
+static void *ps_connector_thread_main (void __attribute__((unused)) *arg)
+{
+	char buffer[4096];
+
+	while (!ps_connector_shutdown)
+	{
+		struct pollfd pfd;
+		struct nlmsghdr *nlh;
+		ssize_t len;
+		int status;
+		char errbuf[1024];
+
+		pfd.fd = ps_connector_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		/* Wake up once a second to check `ps_connector_shutdown'. */
+		status = poll (&pfd, 1, 1000);
+		if (status <= 0)
+			continue;
+
+		len = recv (ps_connector_fd, buffer, sizeof (buffer), 0);
+		if (len < 0)
+		{
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+
+			if (errno == ENOBUFS)
+			{
+				/* Events have been lost, so the cache may be stale. */
+				pthread_mutex_lock (&ps_cache_lock);
+				ps_cache_invalidate_all ();
+				pthread_mutex_unlock (&ps_cache_lock);
+				continue;
+			}
+
+			ERROR ("processes plugin: Reading from the proc connector "
+					"failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		for (nlh = (struct nlmsghdr *) buffer;
+				NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			struct cn_msg *msg;
+
+			if ((nlh->nlmsg_type == NLMSG_ERROR)
+					|| (nlh->nlmsg_type == NLMSG_NOOP))
+				continue;
+
+			msg = (struct cn_msg *) NLMSG_DATA (nlh);
+			if ((msg->id.idx != CN_IDX_PROC)
+					|| (msg->id.val != CN_VAL_PROC))
+				continue;
+
+			ps_connector_handle_event ((struct proc_event *) msg->data);
+		}
+	} /* while (!ps_connector_shutdown) */
+
+	return ((void *) 0);
+} /* void *ps_connector_thread_main */
+
+static int ps_connector_start (void)
+{
+	struct sockaddr_nl addr;
+	char errbuf[1024];
+	int status;
+
+	ps_connector_fd = socket (PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+	if (ps_connector_fd < 0)
+	{
+		ERROR ("processes plugin: Opening the proc connector socket "
+				"failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0; /* let the kernel choose */
+
+	status = bind (ps_connector_fd, (struct sockaddr *) &addr, sizeof (addr));
+	if (status == 0)
+		status = ps_connector_send (ps_connector_fd, PROC_CN_MCAST_LISTEN);
+	if (status != 0)
+	{
+		ERROR ("processes plugin: Subscribing to the proc connector "
+				"failed: %s. This requires the CAP_NET_ADMIN "
+				"capability.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (ps_connector_fd);
+		ps_connector_fd = -1;
+		return (-1);
+	}
+
+	ps_connector_shutdown = 0;
+	status = plugin_thread_create (&ps_connector_thread, /* attr = */ NULL,
+			ps_connector_thread_main, /* arg = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("processes plugin: Starting the proc connector thread "
+				"failed.");
+		close (ps_connector_fd);
+		ps_connector_fd = -1;
+		return (-1);
+	}
+	ps_connector_thread_running = 1;
+
+	return (0);
+} /* int ps_connector_start */
+
+static void ps_connector_stop (void)
+{
+	if (!ps_connector_thread_running)
+		return;
+
+	ps_connector_shutdown = 1;
+	pthread_join (ps_connector_thread, /* retval = */ NULL);
+	ps_connector_thread_running = 0;
+
+	ps_connector_send (ps_connector_fd, PROC_CN_MCAST_IGNORE);
+	close (ps_connector_fd);
+	ps_connector_fd = -1;
+} /* void ps_connector_stop */
+#endif /* HAVE_PROC_CONNECTOR */
 #endif /*KERNEL_LINUX */
 
 #if KERNEL_SOLARIS
@@ -1686,12 +2176,13 @@ static int ps_read (void)
 	DIR           *proc;
 	int            pid;
 
-	char cmdline[ARG_MAX];
-
 	int        status;
 	procstat_t ps;
 	procstat_entry_t pse;
 	char       state;
+	unsigned long long starttime;
+	ps_cache_entry_t *ce;
+	size_t     i;
 
 	procstat_t *ps_ptr;
 
@@ -1706,6 +2197,9 @@ static int ps_read (void)
 		return (-1);
 	}
 
+	pthread_mutex_lock (&ps_cache_lock);
+	ps_cache_generation++;
+
 	while ((ent = readdir (proc)) != NULL)
 	{
 		if (!isdigit (ent->d_name[0]))
@@ -1714,13 +2208,29 @@ static int ps_read (void)
 		if ((pid = atoi (ent->d_name)) < 1)
 			continue;
 
-		status = ps_read_process (pid, &ps, &state);
+		status = ps_read_process (pid, &ps, &state, &starttime);
 		if (status != 0)
 		{
 			DEBUG ("ps_read_process failed: %i", status);
 			continue;
 		}
 
+		switch (state)
+		{
+			case 'R': running++;  break;
+			case 'S': sleeping++; break;
+			case 'D': blocked++;  break;
+			case 'Z': zombies++;  break;
+			case 'T': stopped++;  break;
+			case 'W': paging++;   break;
+		}
+
+		ce = ps_cache_get ((pid_t) pid, ps.name, starttime);
+		if ((ce == NULL) || (ce->matches_num == 0))
+			continue;
+
+		ps_read_process_details (pid, &ps);
+
 		pse.id       = pid;
 		pse.age      = 0;
 
@@ -1747,21 +2257,14 @@ static int ps_read (void)
 		pse.io_syscr = ps.io_syscr;
 		pse.io_syscw = ps.io_syscw;
 
-		switch (state)
-		{
-			case 'R': running++;  break;
-			case 'S': sleeping++; break;
-			case 'D': blocked++;  break;
-			case 'Z': zombies++;  break;
-			case 'T': stopped++;  break;
-			case 'W': paging++;   break;
-		}
-
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
+		for (i = 0; i < ce->matches_num; i++)
+			ps_list_add_entry (ce->matches[i], &pse);
 	}
 
+	/* Forget about processes which have disappeared. */
+	ps_cache_expire ();
+	pthread_mutex_unlock (&ps_cache_lock);
+
 	closedir (proc);
 
 	ps_submit_state ("running",  running);
@@ -2169,9 +2672,27 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+#if KERNEL_LINUX
+static int ps_shutdown (void)
+{
+#if HAVE_PROC_CONNECTOR
+	ps_connector_stop ();
+#endif
+
+	pthread_mutex_lock (&ps_cache_lock);
+	ps_cache_destroy ();
+	pthread_mutex_unlock (&ps_cache_lock);
+
+	return (0);
+} /* int ps_shutdown */
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("processes", ps_shutdown);
+#endif
 } /* void module_register */
@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_format_number.h"
 #include "utils_rrdcreate.h"
 
 #undef HAVE_CONFIG_H
@@ -46,8 +47,12 @@ static rrdcreate_config_t rrdcreate_config =
 	/* timespans_num = */ 0,
 
 	/* consolidation_functions = */ NULL,
-	/* consolidation_functions_num = */ 0
+	/* consolidation_functions_num = */ 0,
+
+	/* async = */ 0,
+	/* create_threads = */ 1
 };
+static cu_rrd_creator_t *creator = NULL;
 
 /*
  * Prototypes.
@@ -67,10 +72,8 @@ static int value_list_to_string (char *buffer, int buffer_len,
 
   assert (0 == strcmp (ds->type, vl->type));
 
-  memset (buffer, '\0', buffer_len);
-
   t = CDTIME_T_TO_TIME_T (vl->time);
-  status = ssnprintf (buffer, buffer_len, "%lu", (unsigned long) t);
+  status = format_number_uint64 (buffer, buffer_len, (uint64_t) t);
   if ((status < 1) || (status >= buffer_len))
     return (-1);
   offset = status;
@@ -83,25 +86,13 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
       return (-1);
 
-    if (ds->ds[i].type == DS_TYPE_COUNTER)
-    {
-      status = ssnprintf (buffer + offset, buffer_len - offset,
-          ":%llu", vl->values[i].counter);
-    }
-    else if (ds->ds[i].type == DS_TYPE_GAUGE) 
-    {
-      status = ssnprintf (buffer + offset, buffer_len - offset,
-          ":%f", vl->values[i].gauge);
-    }
-    else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-      status = ssnprintf (buffer + offset, buffer_len - offset,
-	  ":%"PRIi64, vl->values[i].derive);
-    }
-    else /* if (ds->ds[i].type == DS_TYPE_ABSOLUTE) */ {
-      status = ssnprintf (buffer + offset, buffer_len - offset,
-	  ":%"PRIu64, vl->values[i].absolute);
- 
-    }
+    if ((offset + 1) >= buffer_len)
+      return (-1);
+    buffer[offset] = ':';
+    offset++;
+
+    status = format_number_value (buffer + offset, buffer_len - offset,
+        ds->ds[i].type, vl->values[i]);
 
     if ((status < 1) || (status >= (buffer_len - offset)))
       return (-1);
@@ -250,6 +241,11 @@ static int rc_config (oconfig_item_t *ci)
       status = cf_util_get_string (child, &daemon_address);
     else if (strcasecmp ("CreateFiles", key) == 0)
       status = cf_util_get_boolean (child, &config_create_files);
+    else if (strcasecmp ("CreateFilesAsync", key) == 0)
+      status = cf_util_get_boolean (child, &rrdcreate_config.async);
+    else if (strcasecmp ("CreateThreads", key) == 0)
+      status = rc_config_get_int_positive (child,
+          &rrdcreate_config.create_threads);
     else if (strcasecmp ("CollectStatistics", key) == 0)
       status = cf_util_get_boolean (child, &config_collect_stats);
     else if (strcasecmp ("StepSize", key) == 0)
@@ -393,11 +389,58 @@ static int rc_read (void)
   return (0);
 } /* int rc_read */
 
+static int rc_update (const char *filename, const char *value) /* {{{ */
+{
+  const char *values_array[2];
+  int status;
+
+  values_array[0] = value;
+  values_array[1] = NULL;
+
+  status = rrdc_connect (daemon_address);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
+        daemon_address, status);
+    return (-1);
+  }
+
+  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
+        "status %i.",
+        filename, values_array[0], status);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_update */
+
+/* Called by the creator threads for values received while a file was being
+ * created. */
+static void rc_created_value_callback (const char *filename, /* {{{ */
+    const char *value, __attribute__((unused)) cdtime_t value_time,
+    __attribute__((unused)) void *user_data)
+{
+  rc_update (filename, value);
+} /* }}} void rc_created_value_callback */
+
 static int rc_init (void)
 {
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  if ((daemon_address != NULL) && config_create_files
+      && rrdcreate_config.async)
+  {
+    creator = cu_rrd_creator_create (&rrdcreate_config,
+        rc_created_value_callback, /* user_data = */ NULL);
+    if (creator == NULL)
+      ERROR ("rrdcached plugin: Starting the file creation threads failed. "
+          "Creating files synchronously.");
+  }
+
   return (0);
 } /* int rc_init */
 
@@ -406,7 +449,6 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
 {
   char filename[PATH_MAX];
   char values[512];
-  char *values_array[2];
   int status;
 
   if (daemon_address == NULL)
@@ -434,13 +476,20 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
   if (config_create_files)
   {
     struct stat statbuf;
 
+    /* If the file is being created, stat(2) may see a partially written
+     * file. Let the creator buffer the value instead. */
+    if (creator != NULL)
+    {
+      status = cu_rrd_creator_submit (creator, filename,
+          /* ds = */ NULL, vl, values);
+      if (status != ENOENT)
+        return (status);
+    }
+
     status = stat (filename, &statbuf);
     if (status != 0)
     {
@@ -452,6 +501,9 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
         return (-1);
       }
 
+      if (creator != NULL)
+        return (cu_rrd_creator_submit (creator, filename, ds, vl, values));
+
       status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
       if (status != 0)
       {
@@ -462,24 +514,7 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     }
   }
 
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
-    return (-1);
-  }
-
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
-    return (-1);
-  }
-
-  return (0);
+  return (rc_update (filename, values));
 } /* int rc_write */
 
 static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
@@ -519,6 +554,13 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  /* Wait for pending files to be created and their values to be sent. */
+  if (creator != NULL)
+  {
+    cu_rrd_creator_destroy (creator);
+    creator = NULL;
+  }
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -26,7 +26,8 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
-#include "utils_avltree.h"
+#include "utils_htable.h"
+#include "utils_format_number.h"
 #include "utils_rrdcreate.h"
 
 #include <rrd.h>
@@ -82,7 +83,9 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"CreateFilesAsync",
+	"CreateThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -102,7 +105,10 @@ static rrdcreate_config_t rrdcreate_config =
 	/* timespans_num = */ 0,
 
 	/* consolidation_functions = */ NULL,
-	/* consolidation_functions_num = */ 0
+	/* consolidation_functions_num = */ 0,
+
+	/* async = */ 0,
+	/* create_threads = */ 1
 };
 
 /* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
@@ -111,7 +117,7 @@ static cdtime_t    cache_timeout = 0;
 static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
 static cdtime_t    cache_flush_last;
-static c_avl_tree_t *cache = NULL;
+static c_htable_t *cache = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static rrd_queue_t    *queue_head = NULL;
@@ -127,6 +133,8 @@ static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+static cu_rrd_creator_t *creator = NULL;
+
 static int do_shutdown = 0;
 
 #if HAVE_THREADSAFE_LIBRRD
@@ -202,10 +210,8 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	time_t tt;
 	int i;
 
-	memset (buffer, '\0', buffer_len);
-
 	tt = CDTIME_T_TO_TIME_T (vl->time);
-	status = ssnprintf (buffer, buffer_len, "%u", (unsigned int) tt);
+	status = format_number_uint64 (buffer, buffer_len, (uint64_t) tt);
 	if ((status < 1) || (status >= buffer_len))
 		return (-1);
 	offset = status;
@@ -218,18 +224,13 @@ static int value_list_to_string (char *buffer, int buffer_len,
 				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
 			return (-1);
 
-		if (ds->ds[i].type == DS_TYPE_COUNTER)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%llu", vl->values[i].counter);
-		else if (ds->ds[i].type == DS_TYPE_GAUGE)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%lf", vl->values[i].gauge);
-		else if (ds->ds[i].type == DS_TYPE_DERIVE)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIi64, vl->values[i].derive);
-		else /*if (ds->ds[i].type == DS_TYPE_ABSOLUTE) */
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIu64, vl->values[i].absolute);
+		if ((offset + 1) >= buffer_len)
+			return (-1);
+		buffer[offset] = ':';
+		offset++;
+
+		status = format_number_value (buffer + offset, buffer_len - offset,
+				ds->ds[i].type, vl->values[i]);
 
 		if ((status < 1) || (status >= (buffer_len - offset)))
 			return (-1);
@@ -382,7 +383,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		 * we make a copy of it's values */
 		pthread_mutex_lock (&cache_lock);
 
-		status = c_avl_get (cache, queue_entry->filename,
+		status = c_htable_get (cache, queue_entry->filename,
 				(void *) &cache_entry);
 
 		if (status == 0)
@@ -522,7 +523,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 	int    keys_num = 0;
 
 	char *key;
-	c_avl_iterator_t *iter;
+	c_htable_iterator_t *iter;
 	int i;
 
 	DEBUG ("rrdtool plugin: Flushing cache, timeout = %.3f",
@@ -532,8 +533,8 @@ static void rrd_cache_flush (cdtime_t timeout)
 	timeout = TIME_T_TO_CDTIME_T (timeout);
 
 	/* Build a list of entries to be flushed */
-	iter = c_avl_get_iterator (cache);
-	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
+	iter = c_htable_get_iterator (cache);
+	while (c_htable_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
 	{
 		if (rc->flags != FLAG_NONE)
 			continue;
@@ -560,7 +561,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 						"realloc failed: %s",
 						sstrerror (errno, errbuf,
 							sizeof (errbuf)));
-				c_avl_iterator_destroy (iter);
+				c_htable_iterator_destroy (iter);
 				sfree (keys);
 				return;
 			}
@@ -568,14 +569,14 @@ static void rrd_cache_flush (cdtime_t timeout)
 			keys[keys_num] = key;
 			keys_num++;
 		}
-	} /* while (c_avl_iterator_next) */
-	c_avl_iterator_destroy (iter);
+	} /* while (c_htable_iterator_next) */
+	c_htable_iterator_destroy (iter);
 	
 	for (i = 0; i < keys_num; i++)
 	{
-		if (c_avl_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
+		if (c_htable_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
 		{
-			DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
+			DEBUG ("rrdtool plugin: c_htable_remove (%s) failed.", keys[i]);
 			continue;
 		}
 
@@ -616,11 +617,11 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
         datadir, identifier);
   key[sizeof (key) - 1] = 0;
 
-  status = c_avl_get (cache, key, (void *) &rc);
+  status = c_htable_get (cache, key, (void *) &rc);
   if (status != 0)
   {
     INFO ("rrdtool plugin: rrd_cache_flush_identifier: "
-        "c_avl_get (%s) failed. Does that file really exist?",
+        "c_htable_get (%s) failed. Does that file really exist?",
         key);
     return (status);
   }
@@ -703,7 +704,7 @@ static int rrd_cache_insert (const char *filename,
 		return (-1);
 	}
 
-	c_avl_get (cache, filename, (void *) &rc);
+	c_htable_get (cache, filename, (void *) &rc);
 
 	if (rc == NULL)
 	{
@@ -737,7 +738,7 @@ static int rrd_cache_insert (const char *filename,
 
 		sstrerror (errno, errbuf, sizeof (errbuf));
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
+		c_htable_remove (cache, filename, &cache_key, NULL);
 		pthread_mutex_unlock (&cache_lock);
 
 		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
@@ -777,7 +778,7 @@ static int rrd_cache_insert (const char *filename,
 			return (-1);
 		}
 
-		c_avl_insert (cache, cache_key, rc);
+		c_htable_insert (cache, cache_key, rc);
 	}
 
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
@@ -829,7 +830,7 @@ static int rrd_cache_destroy (void) /* {{{ */
     return (0);
   }
 
-  while (c_avl_pick (cache, &key, &value) == 0)
+  while (c_htable_pick (cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
     int i;
@@ -849,7 +850,7 @@ static int rrd_cache_destroy (void) /* {{{ */
     sfree (rc);
   }
 
-  c_avl_destroy (cache);
+  c_htable_destroy (cache);
   cache = NULL;
 
   if (non_empty > 0)
@@ -880,6 +881,15 @@ static int rrd_compare_numeric (const void *a_ptr, const void *b_ptr)
 		return (0);
 } /* int rrd_compare_numeric */
 
+/* Called by the creator threads for values received while a file was being
+ * created. */
+static void rrd_created_value_callback (const char *filename,
+		const char *value, cdtime_t value_time,
+		void __attribute__((unused)) *user_data)
+{
+	rrd_cache_insert (filename, value, value_time);
+} /* void rrd_created_value_callback */
+
 static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
@@ -902,9 +912,24 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
 		return (-1);
 
+	/* If the file is being created, stat(2) may see a partially written
+	 * file. Let the creator buffer the value instead. */
+	if (creator != NULL)
+	{
+		status = cu_rrd_creator_submit (creator, filename,
+				/* ds = */ NULL, vl, values);
+		if (status != ENOENT)
+			return (status);
+	}
+
 	if (stat (filename, &statbuf) == -1)
 	{
-		if (errno == ENOENT)
+		if ((errno == ENOENT) && (creator != NULL))
+		{
+			return (cu_rrd_creator_submit (creator, filename,
+						ds, vl, values));
+		}
+		else if (errno == ENOENT)
 		{
 			status = cu_rrd_create_file (filename,
 					ds, vl, &rrdcreate_config);
@@ -1109,6 +1134,23 @@ static int rrd_config (const char *key, const char *value)
 			random_timeout = DOUBLE_TO_CDTIME_T (tmp);
 		}
 	}
+	else if (strcasecmp ("CreateFilesAsync", key) == 0)
+	{
+		rrdcreate_config.async = IS_TRUE (value) ? 1 : 0;
+	}
+	else if (strcasecmp ("CreateThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			fprintf (stderr, "rrdtool: `CreateThreads' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `CreateThreads' must "
+					"be greater than 0.");
+			return (1);
+		}
+		rrdcreate_config.create_threads = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -1118,6 +1160,14 @@ static int rrd_config (const char *key, const char *value)
 
 static int rrd_shutdown (void)
 {
+	/* Wait for pending files to be created, so their buffered values end up
+	 * in the cache and are flushed below. */
+	if (creator != NULL)
+	{
+		cu_rrd_creator_destroy (creator);
+		creator = NULL;
+	}
+
 	pthread_mutex_lock (&cache_lock);
 	rrd_cache_flush (0);
 	pthread_mutex_unlock (&cache_lock);
@@ -1167,10 +1217,11 @@ static int rrd_init (void)
 	/* Set the cache up */
 	pthread_mutex_lock (&cache_lock);
 
-	cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	cache = c_htable_create (c_htable_hash_string,
+			(int (*) (const void *, const void *)) strcmp);
 	if (cache == NULL)
 	{
-		ERROR ("rrdtool plugin: c_avl_create failed.");
+		ERROR ("rrdtool plugin: c_htable_create failed.");
 		return (-1);
 	}
 
@@ -1193,6 +1244,18 @@ static int rrd_init (void)
 	}
 	queue_thread_running = 1;
 
+	if (rrdcreate_config.async)
+	{
+		creator = cu_rrd_creator_create (&rrdcreate_config,
+				rrd_created_value_callback, /* user_data = */ NULL);
+		if (creator == NULL)
+		{
+			ERROR ("rrdtool plugin: Starting the file creation "
+					"threads failed. Creating files "
+					"synchronously.");
+		}
+	}
+
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
 			" heartbeat = %i; rrarows = %i; xff = %lf;",
 			(datadir == NULL) ? "(null)" : datadir,
@@ -70,6 +70,7 @@
 #endif
 
 #if KERNEL_LINUX
+# include "utils_procfile.h"
 # include <asm/types.h>
 /* sys/socket.h is necessary to compile when using netlink on older systems. */
 # include <sys/socket.h>
@@ -161,6 +162,9 @@ static const char *tcp_state[] =
 # define TCP_STATE_LISTEN 10
 # define TCP_STATE_MIN 1
 # define TCP_STATE_MAX 11
+
+static cu_procfile_t *proc_net_tcp  = NULL;
+static cu_procfile_t *proc_net_tcp6 = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -632,21 +636,25 @@ static int conn_handle_line (char *buffer)
   return (conn_handle_ports (port_local, port_remote, state));
 } /* int conn_handle_line */
 
-static int conn_read_file (const char *file)
+static int conn_read_file (cu_procfile_t **pf, const char *file)
 {
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+
+  if (*pf == NULL)
+  {
+    *pf = cu_procfile_create (file);
+    if (*pf == NULL)
+      return (-1);
+  }
 
-  fh = fopen (file, "r");
-  if (fh == NULL)
+  /* Missing files are not an error: IPv6 may not be available. */
+  if (cu_procfile_read (*pf) != 0)
     return (-1);
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while ((buffer = cu_procfile_readline (*pf)) != NULL)
   {
     conn_handle_line (buffer);
-  } /* while (fgets) */
-
-  fclose (fh);
+  } /* while (cu_procfile_readline) */
 
   return (0);
 } /* int conn_read_file */
@@ -708,6 +716,16 @@ static int conn_init (void)
   return (0);
 } /* int conn_init */
 
+static int conn_shutdown (void)
+{
+  cu_procfile_destroy (proc_net_tcp);
+  proc_net_tcp = NULL;
+  cu_procfile_destroy (proc_net_tcp6);
+  proc_net_tcp6 = NULL;
+
+  return (0);
+} /* int conn_shutdown */
+
 static int conn_read (void)
 {
   int status;
@@ -722,9 +740,9 @@ static int conn_read (void)
   {
     int errors_num = 0;
 
-    if (conn_read_file ("/proc/net/tcp") != 0)
+    if (conn_read_file (&proc_net_tcp, "/proc/net/tcp") != 0)
       errors_num++;
-    if (conn_read_file ("/proc/net/tcp6") != 0)
+    if (conn_read_file (&proc_net_tcp6, "/proc/net/tcp6") != 0)
       errors_num++;
 
     if (errors_num < 2)
@@ -1011,6 +1029,7 @@ void module_register (void)
 			config_keys, config_keys_num);
 #if KERNEL_LINUX
 	plugin_register_init ("tcpconns", conn_init);
+	plugin_register_shutdown ("tcpconns", conn_shutdown);
 #elif HAVE_SYSCTLBYNAME
 	/* no initialization */
 #elif HAVE_LIBKVM_NLIST
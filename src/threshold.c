@@ -870,7 +870,7 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     __attribute__((unused)) user_data_t *ud)
 { /* {{{ */
   threshold_t *th;
-  gauge_t *values;
+  gauge_t values[ds->ds_num];
   int status;
 
   int worst_state = -1;
@@ -890,8 +890,7 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
 
   DEBUG ("ut_check_threshold: Found matching threshold(s)");
 
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
+  if (uc_get_rate_into (ds, vl, values, STATIC_ARRAY_SIZE (values)) != 0)
     return (0);
 
   while (th != NULL)
@@ -902,7 +901,6 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     if (status < 0)
     {
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
       return (-1);
     }
 
@@ -921,12 +919,9 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
   if (status != 0)
   {
     ERROR ("ut_check_threshold: ut_report_state failed.");
-    sfree (values);
     return (-1);
   }
 
-  sfree (values);
-
   return (0);
 } /* }}} int ut_check_threshold */
 
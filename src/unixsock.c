@@ -37,6 +37,12 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
+
 #include <grp.h>
 
 #ifndef UNIX_PATH_MAX
@@ -45,6 +51,50 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+/* Maximum length of a command, including the newline. */
+#define US_MAX_LINE_LEN 1024
+/* Size of the receive buffer of each client. */
+#define US_BUFFER_SIZE 16384
+/* Maximum number of reads from one client before other clients are served. */
+#define US_MAX_READS 16
+/* Clients which don't read their responses for this many seconds are
+ * disconnected, so they can't block a worker thread any longer. */
+#define US_SEND_TIMEOUT 5
+#define US_DEFAULT_THREADS 4
+
+/*
+ * Private data types
+ */
+struct us_client_s;
+typedef struct us_client_s us_client_t;
+struct us_client_s
+{
+	int   fd;
+	FILE *fhout;
+
+	/* Data received but not handled yet. */
+	char   buffer[US_BUFFER_SIZE];
+	size_t buffer_fill;
+	/* Set while the rest of a too long line is skipped. */
+	_Bool  discard;
+
+	/* Set between "BATCH BEGIN" and "BATCH END". */
+	_Bool          batch;
+	putval_batch_t putval_batch;
+
+#if !HAVE_SYS_EPOLL_H
+	/* Set while the client is handled by a worker and must not be polled. */
+	_Bool busy;
+#endif
+
+	/* List of all clients, protected by `clients_lock'. */
+	us_client_t *prev;
+	us_client_t *next;
+
+	/* Queue of clients with pending data, protected by `queue_lock'. */
+	us_client_t *queue_next;
+};
+
 /*
  * Private variables
  */
@@ -54,7 +104,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -69,6 +120,27 @@ static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
 
+/* The listen thread waits for events and hands clients with pending data to
+ * the worker threads. A client is watched again once a worker is done with
+ * it, so only one worker at a time handles a client. */
+static pthread_t *workers     = NULL;
+static size_t     workers_num = US_DEFAULT_THREADS;
+
+static us_client_t    *clients      = NULL;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static us_client_t    *queue_head = NULL;
+static us_client_t    *queue_tail = NULL;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* Writing to this pipe wakes up the listen thread. */
+static int wake_pipe[2] = { -1, -1 };
+
+#if HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#endif
+
 /*
  * Functions
  */
@@ -174,211 +246,666 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+static void us_wake_listen_thread (void)
+{
+	char c = 0;
+
+	if (write (wake_pipe[1], &c, sizeof (c)) < 0)
+	{
+		/* The pipe is full, so the listen thread will wake up anyway. */
+		if (errno != EAGAIN)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: write failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+} /* void us_wake_listen_thread */
+
+static us_client_t *us_client_create (int fd)
 {
-	int fdin;
+	us_client_t *c;
 	int fdout;
-	FILE *fhin, *fhout;
 
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
+	c = (us_client_t *) malloc (sizeof (*c));
+	if (c == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (c, 0, sizeof (*c));
+	c->fd = fd;
 
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+	/* Responses are written with blocking writes and flushed once all
+	 * received commands have been handled. The timeout keeps clients which
+	 * don't read them from blocking the worker. */
+	{
+		struct timeval tv;
 
-	fdout = dup (fdin);
+		tv.tv_sec = US_SEND_TIMEOUT;
+		tv.tv_usec = 0;
+		if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) != 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: setsockopt (SO_SNDTIMEO) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+
+	fdout = dup (fd);
 	if (fdout < 0)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: dup failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
+		free (c);
+		return (NULL);
 	}
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+	c->fhout = fdopen (fdout, "w");
+	if (c->fhout == NULL)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: fdopen failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
 		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		free (c);
+		return (NULL);
 	}
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	return (c);
+} /* us_client_t *us_client_create */
+
+/* Closes the connection and frees the client. Must only be called by the
+ * thread handling the client. */
+static void us_client_close (us_client_t *c)
+{
+	DEBUG ("unixsock plugin: Closing connection on fd #%i.", c->fd);
+
+	pthread_mutex_lock (&clients_lock);
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		clients = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	pthread_mutex_unlock (&clients_lock);
+
+#if HAVE_SYS_EPOLL_H
+	epoll_ctl (epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
+
+	fclose (c->fhout);
+	close (c->fd);
+	putval_batch_destroy (&c->putval_batch);
+	free (c);
+} /* void us_client_close */
+
+/* Lets the listen thread watch the client again. */
+static int us_client_arm (us_client_t *c)
+{
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = c;
+
+	if (epoll_ctl (epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) != 0)
 	{
 		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
+		ERROR ("unixsock plugin: epoll_ctl failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		return (-1);
+	}
+#else
+	pthread_mutex_lock (&clients_lock);
+	c->busy = 0;
+	pthread_mutex_unlock (&clients_lock);
+
+	us_wake_listen_thread ();
+#endif
+
+	return (0);
+} /* int us_client_arm */
+
+static void us_queue_push (us_client_t *c)
+{
+	pthread_mutex_lock (&queue_lock);
+	c->queue_next = NULL;
+	if (queue_tail == NULL)
+		queue_head = c;
+	else
+		queue_tail->queue_next = c;
+	queue_tail = c;
+	pthread_cond_signal (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
+} /* void us_queue_push */
+
+/* Returns the next client with pending data or NULL if the plugin is shut
+ * down. */
+static us_client_t *us_queue_pop (void)
+{
+	us_client_t *c;
+
+	pthread_mutex_lock (&queue_lock);
+	while ((loop != 0) && (queue_head == NULL))
+		pthread_cond_wait (&queue_cond, &queue_lock);
+
+	c = queue_head;
+	if (loop == 0)
+		c = NULL;
+	else
+	{
+		queue_head = c->queue_next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		c->queue_next = NULL;
 	}
+	pthread_mutex_unlock (&queue_lock);
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	return (c);
+} /* us_client_t *us_queue_pop */
+
+/* Counts a command which is not allowed in batch mode as failed. */
+static void us_batch_fail (us_client_t *c, const char *command)
+{
+	putval_batch_t *pb = &c->putval_batch;
+
+	pb->commands_num++;
+	if (pb->errors_num == 0)
+		ssnprintf (pb->error, sizeof (pb->error),
+				"command #%i: Unexpected command in batch mode: `%s'.",
+				pb->commands_num, command);
+	pb->errors_num++;
+} /* void us_batch_fail */
+
+static int us_handle_batch (us_client_t *c, char **fields, int fields_num)
+{
+	putval_batch_t *pb = &c->putval_batch;
+
+	if ((fields_num == 2) && (strcasecmp ("BEGIN", fields[1]) == 0)
+			&& !c->batch)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: setvbuf failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
-		return ((void *) 0);
+		/* No response, so clients don't have to wait for one. */
+		putval_batch_reset (pb);
+		c->batch = 1;
+		return (0);
 	}
 
-	while (42)
+	if ((fields_num == 2) && (strcasecmp ("END", fields[1]) == 0)
+			&& c->batch)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+		c->batch = 0;
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
+		if (pb->errors_num == 0)
+			fprintf (c->fhout, "0 Success: %i %s been dispatched.\n",
+					pb->values_num,
+					(pb->values_num == 1) ? "value has" : "values have");
+		else
+			fprintf (c->fhout, "-1 %i of %i commands failed, "
+					"%i values have been dispatched. First error: %s\n",
+					pb->errors_num, pb->commands_num, pb->values_num,
+					pb->error);
+		return (0);
+	}
+
+	if (c->batch)
+		us_batch_fail (c, fields[0]);
+	else
+		fprintf (c->fhout, "-1 Usage: BATCH BEGIN|END\n");
+
+	return (0);
+} /* int us_handle_batch */
+
+/* Handles one command. Returns non-zero if the connection should be
+ * closed. */
+static int us_handle_line (us_client_t *c, char *buffer)
+{
+	FILE *fhout = c->fhout;
+	char buffer_copy[US_MAX_LINE_LEN];
+	char *fields[128];
+	int   fields_num;
+
+	sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+
+	fields_num = strsplit (buffer_copy, fields,
+			sizeof (fields) / sizeof (fields[0]));
+	if (fields_num < 1)
+	{
+		fprintf (fhout, "-1 Internal error\n");
+		return (-1);
+	}
+
+	if (strcasecmp (fields[0], "batch") == 0)
+	{
+		us_handle_batch (c, fields, fields_num);
+	}
+	else if (c->batch)
+	{
+		if (strcasecmp (fields[0], "putval") == 0)
+			handle_putval_batch (&c->putval_batch, buffer);
+		else
+			us_batch_fail (c, fields[0]);
+	}
+	else if (strcasecmp (fields[0], "getval") == 0)
+	{
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
 		{
-			if ((errno == EINTR) || (errno == EAGAIN))
-				continue;
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
 
-			if (errno != 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
-			break;
+	return (0);
+} /* int us_handle_line */
+
+/* Handles all complete lines in the client's buffer. Returns non-zero if the
+ * connection should be closed. */
+static int us_handle_buffer (us_client_t *c)
+{
+	char *line = c->buffer;
+	char *end;
+	int status = 0;
+
+	while ((status == 0) && (line < c->buffer + c->buffer_fill)
+			&& ((end = memchr (line, '\n',
+						c->buffer_fill - (line - c->buffer))) != NULL))
+	{
+		size_t len = end - line;
+
+		*end = 0;
+		while ((len > 0) && (line[len - 1] == '\r'))
+			line[--len] = 0;
+
+		if (c->discard)
+			c->discard = 0;
+		else if (len >= US_MAX_LINE_LEN)
+		{
+			if (c->batch)
+				us_batch_fail (c, "(too long)");
+			else
+				fprintf (c->fhout, "-1 Command too long.\n");
 		}
+		else if (len > 0)
+			status = us_handle_line (c, line);
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+		/* Writing a response failed or timed out. */
+		if (ferror (c->fhout))
+			status = -1;
 
-		if (len == 0)
-			continue;
+		line = end + 1;
+	}
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+	c->buffer_fill -= line - c->buffer;
+	if ((c->buffer_fill > 0) && (line != c->buffer))
+		memmove (c->buffer, line, c->buffer_fill);
 
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
+	/* Skip the rest of a line which doesn't fit into the buffer. */
+	if (c->buffer_fill >= sizeof (c->buffer))
+	{
+		if (!c->discard)
 		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
+			if (c->batch)
+				us_batch_fail (c, "(too long)");
+			else
+				fprintf (c->fhout, "-1 Command too long.\n");
 		}
+		c->discard = 1;
+		c->buffer_fill = 0;
+	}
+
+	return (status);
+} /* int us_handle_buffer */
+
+/* Reads and handles the data sent by a client. Returns zero if all data has
+ * been read, greater than zero if more data is pending and less than zero if
+ * the connection should be closed. */
+static int us_handle_client (us_client_t *c)
+{
+	int status = 0;
+	int i;
+
+	for (i = 0; i < US_MAX_READS; i++)
+	{
+		ssize_t len;
 
-		if (strcasecmp (fields[0], "getval") == 0)
+		len = recv (c->fd, c->buffer + c->buffer_fill,
+				sizeof (c->buffer) - c->buffer_fill, MSG_DONTWAIT);
+		if (len < 0)
 		{
-			handle_getval (fhout, buffer);
+			char errbuf[1024];
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			if (errno == EINTR)
+				continue;
+
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			break;
 		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+		else if (len == 0)
 		{
-			handle_putval (fhout, buffer);
+			status = -1;
+			break;
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+
+		c->buffer_fill += (size_t) len;
+
+		if (us_handle_buffer (c) != 0)
 		{
-			handle_listval (fhout, buffer);
+			status = -1;
+			break;
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+	}
+
+	/* Send the responses of all commands at once. */
+	if (ferror (c->fhout) || (fflush (c->fhout) != 0))
+	{
+		char errbuf[1024];
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			WARNING ("unixsock plugin: Client on socket #%i didn't read "
+					"its responses within %i seconds. Closing the "
+					"connection.", c->fd, US_SEND_TIMEOUT);
+		else
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+		status = -1;
+	}
+
+	if ((status == 0) && (i >= US_MAX_READS))
+		status = 1;
+
+	return (status);
+} /* int us_handle_client */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg)
+{
+	us_client_t *c;
+
+	while ((c = us_queue_pop ()) != NULL)
+	{
+		int status;
+
+		status = us_handle_client (c);
+		if (status > 0)
+			us_queue_push (c);
+		else if ((status < 0) || (us_client_arm (c) != 0))
+			us_client_close (c);
+	}
+
+	return ((void *) 0);
+} /* void *us_worker_thread */
+
+static int us_accept_clients (void)
+{
+	while (loop != 0)
+	{
+		us_client_t *c;
+		int fd;
+
+		fd = accept (sock_fd, NULL, NULL);
+		if (fd < 0)
 		{
-			handle_putnotif (fhout, buffer);
+			char errbuf[1024];
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (0);
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+
+			ERROR ("unixsock plugin: accept failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+
+		c = us_client_create (fd);
+		if (c == NULL)
 		{
-			handle_flush (fhout, buffer);
+			close (fd);
+			continue;
 		}
-		else
+
+		DEBUG ("unixsock plugin: Handling connection on fd #%i.", fd);
+
+		pthread_mutex_lock (&clients_lock);
+		c->next = clients;
+		if (clients != NULL)
+			clients->prev = c;
+		clients = c;
+#if !HAVE_SYS_EPOLL_H
+		c->busy = 0;
+#endif
+		pthread_mutex_unlock (&clients_lock);
+
+#if HAVE_SYS_EPOLL_H
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			struct epoll_event ev;
+
+			memset (&ev, 0, sizeof (ev));
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.ptr = c;
+
+			if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
 			{
 				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
+				ERROR ("unixsock plugin: epoll_ctl failed: %s",
 						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
+				us_client_close (c);
+				continue;
 			}
 		}
-	} /* while (fgets) */
+#endif
+	}
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+	return (0);
+} /* int us_accept_clients */
 
-	pthread_exit ((void *) 0);
-	return ((void *) 0);
-} /* void *us_handle_client */
+#if HAVE_SYS_EPOLL_H
+static int us_wait_events (void)
+{
+	struct epoll_event events[64];
+	int status;
+	int i;
 
-static void *us_server_thread (void __attribute__((unused)) *arg)
+	status = epoll_wait (epoll_fd, events, STATIC_ARRAY_SIZE (events), -1);
+	if (status < 0)
+		return (-1);
+
+	/* The listening socket and the pipe are registered with pointers to the
+	 * variables holding their descriptors, clients with their own. */
+	for (i = 0; i < status; i++)
+	{
+		if (events[i].data.ptr == (void *) &sock_fd)
+		{
+			if (us_accept_clients () != 0)
+				return (-1);
+		}
+		else if (events[i].data.ptr == (void *) wake_pipe)
+		{
+			char buffer[64];
+			while (read (wake_pipe[0], buffer, sizeof (buffer)) > 0);
+		}
+		else
+			us_queue_push ((us_client_t *) events[i].data.ptr);
+	}
+
+	return (0);
+} /* int us_wait_events */
+#else /* !HAVE_SYS_EPOLL_H */
+static int us_wait_events (void)
 {
-	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
+	struct pollfd *fds;
+	us_client_t  **fds_clients;
+	us_client_t   *c;
+	size_t fds_num;
+	size_t i;
+	int status;
+
+	/* Workers only close clients which are busy, so the pointers to the
+	 * other clients stay valid while polling. */
+	pthread_mutex_lock (&clients_lock);
+	fds_num = 2;
+	for (c = clients; c != NULL; c = c->next)
+		fds_num++;
+
+	fds = calloc (fds_num, sizeof (*fds));
+	fds_clients = calloc (fds_num, sizeof (*fds_clients));
+	if ((fds == NULL) || (fds_clients == NULL))
+	{
+		pthread_mutex_unlock (&clients_lock);
+		sfree (fds);
+		sfree (fds_clients);
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	fds[0].fd = sock_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wake_pipe[0];
+	fds[1].events = POLLIN;
+	fds_num = 2;
+	for (c = clients; c != NULL; c = c->next)
+	{
+		if (c->busy)
+			continue;
+		fds[fds_num].fd = c->fd;
+		fds[fds_num].events = POLLIN;
+		fds_clients[fds_num] = c;
+		fds_num++;
+	}
+	pthread_mutex_unlock (&clients_lock);
+
+	status = poll (fds, (nfds_t) fds_num, -1);
+	if (status < 0)
+	{
+		sfree (fds);
+		sfree (fds_clients);
+		return (-1);
+	}
+
+	for (i = 2; i < fds_num; i++)
+	{
+		if (fds[i].revents == 0)
+			continue;
+
+		pthread_mutex_lock (&clients_lock);
+		fds_clients[i]->busy = 1;
+		pthread_mutex_unlock (&clients_lock);
+
+		us_queue_push (fds_clients[i]);
+	}
+
+	if (fds[1].revents != 0)
+	{
+		char buffer[64];
+		while (read (wake_pipe[0], buffer, sizeof (buffer)) > 0);
+	}
+
+	status = 0;
+	if (fds[0].revents != 0)
+		status = us_accept_clients ();
 
-	pthread_attr_init (&th_attr);
-	pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+	sfree (fds);
+	sfree (fds_clients);
+	return (status);
+} /* int us_wait_events */
+#endif /* HAVE_SYS_EPOLL_H */
+
+static void *us_server_thread (void __attribute__((unused)) *arg)
+{
+	int status;
 
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
-	while (loop != 0)
+	/* Clients are accepted until there are no more pending ones. */
+	fcntl (sock_fd, F_SETFL, fcntl (sock_fd, F_GETFL) | O_NONBLOCK);
+
+#if HAVE_SYS_EPOLL_H
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
-		if (status < 0)
+		struct epoll_event ev;
+
+		epoll_fd = epoll_create (64);
+		if (epoll_fd < 0)
 		{
 			char errbuf[1024];
-
-			if (errno == EINTR)
-				continue;
-
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: epoll_create failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 			close (sock_fd);
 			sock_fd = -1;
-			pthread_attr_destroy (&th_attr);
 			pthread_exit ((void *) 1);
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		memset (&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = (void *) &sock_fd;
+		status = epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev);
+
+		if (status == 0)
+		{
+			ev.data.ptr = (void *) wake_pipe;
+			status = epoll_ctl (epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev);
+		}
+
+		if (status != 0)
 		{
 			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
+			ERROR ("unixsock plugin: epoll_ctl failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
+			close (epoll_fd);
+			epoll_fd = -1;
+			close (sock_fd);
+			sock_fd = -1;
+			pthread_exit ((void *) 1);
 		}
-		*remote_fd = status;
-
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
+	}
+#endif
 
-		status = plugin_thread_create (&th, &th_attr,
-				us_handle_client, (void *) remote_fd);
+	while (loop != 0)
+	{
+		status = us_wait_events ();
 		if (status != 0)
 		{
 			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("unixsock plugin: Waiting for events failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			break;
 		}
 	} /* while (loop) */
 
 	close (sock_fd);
 	sock_fd = -1;
-	pthread_attr_destroy (&th_attr);
 
 	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
@@ -423,6 +950,17 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: Invalid number of threads: %s. "
+					"Using the default of %i.", val, US_DEFAULT_THREADS);
+			tmp = US_DEFAULT_THREADS;
+		}
+		workers_num = (size_t) tmp;
+	}
 	else
 	{
 		return (-1);
@@ -436,14 +974,52 @@ static int us_init (void)
 	static int have_init = 0;
 
 	int status;
+	size_t i;
 
 	/* Initialize only once. */
 	if (have_init != 0)
 		return (0);
 	have_init = 1;
 
+	if (pipe (wake_pipe) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wake_pipe[0], F_SETFL, fcntl (wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wake_pipe[1], F_SETFL, fcntl (wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	workers = calloc (workers_num, sizeof (*workers));
+	if (workers == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
 	loop = 1;
 
+	for (i = 0; i < workers_num; i++)
+	{
+		status = plugin_thread_create (workers + i, NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			workers[i] = (pthread_t) 0;
+			break;
+		}
+	}
+
+	if (i == 0)
+	{
+		loop = 0;
+		return (-1);
+	}
+
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -460,16 +1036,60 @@ static int us_init (void)
 static int us_shutdown (void)
 {
 	void *ret;
+	size_t i;
 
 	loop = 0;
 
 	if (listen_thread != (pthread_t) 0)
 	{
-		pthread_kill (listen_thread, SIGTERM);
+		us_wake_listen_thread ();
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	/* Wake up workers blocked writing to a client which doesn't read. */
+	pthread_mutex_lock (&clients_lock);
+	{
+		us_client_t *c;
+		for (c = clients; c != NULL; c = c->next)
+			shutdown (c->fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock (&clients_lock);
+
+	pthread_mutex_lock (&queue_lock);
+	pthread_cond_broadcast (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
+
+	for (i = 0; (workers != NULL) && (i < workers_num); i++)
+	{
+		if (workers[i] == (pthread_t) 0)
+			continue;
+		pthread_join (workers[i], &ret);
+		workers[i] = (pthread_t) 0;
+	}
+	sfree (workers);
+
+	/* No other thread is left, so all clients can be closed here. */
+	while (clients != NULL)
+		us_client_close (clients);
+	queue_head = NULL;
+	queue_tail = NULL;
+
+#if HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0)
+	{
+		close (epoll_fd);
+		epoll_fd = -1;
+	}
+#endif
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (wake_pipe); i++)
+	{
+		if (wake_pipe[i] >= 0)
+			close (wake_pipe[i]);
+		wake_pipe[i] = -1;
+	}
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
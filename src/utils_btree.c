@@ -0,0 +1,669 @@
+/**
+ * collectd - src/utils_btree.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils_btree.h"
+
+/* Minimum degree: Nodes other than the root hold between BTREE_MIN_KEYS and
+ * BTREE_MAX_KEYS keys. */
+#define BTREE_DEGREE 16
+#define BTREE_MIN_KEYS (BTREE_DEGREE - 1)
+#define BTREE_MAX_KEYS (2 * BTREE_DEGREE - 1)
+
+/*
+ * private data types
+ */
+struct c_btree_node_s;
+typedef struct c_btree_node_s c_btree_node_t;
+struct c_btree_node_s
+{
+	int num;
+	_Bool leaf;
+	void *keys[BTREE_MAX_KEYS];
+	void *values[BTREE_MAX_KEYS];
+	c_btree_node_t *children[BTREE_MAX_KEYS + 1];
+};
+
+struct c_btree_s
+{
+	c_btree_node_t *root; /* never NULL */
+	int (*compare) (const void *, const void *);
+	int size;
+	unsigned long generation; /* incremented on every modification */
+};
+
+struct c_btree_iterator_s
+{
+	c_btree_t *tree;
+	void *last_key;
+	_Bool started;
+
+	/* Position of `last_key', valid while the tree's generation is
+	 * unchanged. */
+	c_btree_node_t *node;
+	int index;
+	unsigned long generation;
+};
+
+/*
+ * private functions
+ */
+static c_btree_node_t *node_alloc (_Bool leaf) /* {{{ */
+{
+	c_btree_node_t *n;
+
+	n = malloc (sizeof (*n));
+	if (n == NULL)
+		return (NULL);
+
+	n->num = 0;
+	n->leaf = leaf;
+	return (n);
+} /* }}} c_btree_node_t *node_alloc */
+
+static void node_free (c_btree_node_t *n) /* {{{ */
+{
+	int i;
+
+	if (n == NULL)
+		return;
+
+	if (!n->leaf)
+		for (i = 0; i <= n->num; i++)
+			node_free (n->children[i]);
+
+	free (n);
+} /* }}} void node_free */
+
+/* Returns the index of the first key which is greater than or equal to `key'.
+ * `*found' is set to true if it is equal. */
+static int node_search (c_btree_t *t, c_btree_node_t *n, /* {{{ */
+		const void *key, _Bool *found)
+{
+	int lo = 0;
+	int hi = n->num;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		int cmp = t->compare (key, n->keys[mid]);
+
+		if (cmp == 0)
+		{
+			*found = 1;
+			return (mid);
+		}
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	*found = 0;
+	return (lo);
+} /* }}} int node_search */
+
+/* Makes room at position `i' of `n'. If `n' is an inner node, the child
+ * right of the new key is shifted, too. */
+static void node_open (c_btree_node_t *n, int i) /* {{{ */
+{
+	memmove (n->keys + i + 1, n->keys + i,
+			(n->num - i) * sizeof (n->keys[0]));
+	memmove (n->values + i + 1, n->values + i,
+			(n->num - i) * sizeof (n->values[0]));
+	if (!n->leaf)
+		memmove (n->children + i + 2, n->children + i + 1,
+				(n->num - i) * sizeof (n->children[0]));
+	n->num++;
+} /* }}} void node_open */
+
+/* Removes key `i' and, for inner nodes, the child right of it. */
+static void node_close (c_btree_node_t *n, int i) /* {{{ */
+{
+	memmove (n->keys + i, n->keys + i + 1,
+			(n->num - i - 1) * sizeof (n->keys[0]));
+	memmove (n->values + i, n->values + i + 1,
+			(n->num - i - 1) * sizeof (n->values[0]));
+	if (!n->leaf)
+		memmove (n->children + i + 1, n->children + i + 2,
+				(n->num - i - 1) * sizeof (n->children[0]));
+	n->num--;
+} /* }}} void node_close */
+
+/* Splits the full child `i' of `n', moving its median key up into `n'. */
+static int split_child (c_btree_node_t *n, int i) /* {{{ */
+{
+	c_btree_node_t *y = n->children[i];
+	c_btree_node_t *z;
+
+	assert (y->num == BTREE_MAX_KEYS);
+	assert (n->num < BTREE_MAX_KEYS);
+
+	z = node_alloc (y->leaf);
+	if (z == NULL)
+		return (-1);
+
+	z->num = BTREE_MIN_KEYS;
+	memcpy (z->keys, y->keys + BTREE_DEGREE,
+			BTREE_MIN_KEYS * sizeof (z->keys[0]));
+	memcpy (z->values, y->values + BTREE_DEGREE,
+			BTREE_MIN_KEYS * sizeof (z->values[0]));
+	if (!y->leaf)
+		memcpy (z->children, y->children + BTREE_DEGREE,
+				BTREE_DEGREE * sizeof (z->children[0]));
+	y->num = BTREE_MIN_KEYS;
+
+	node_open (n, i);
+	n->keys[i] = y->keys[BTREE_MIN_KEYS];
+	n->values[i] = y->values[BTREE_MIN_KEYS];
+	n->children[i + 1] = z;
+
+	return (0);
+} /* }}} int split_child */
+
+/* Merges child `i + 1' and key `i' of `n' into child `i'. */
+static void merge_children (c_btree_node_t *n, int i) /* {{{ */
+{
+	c_btree_node_t *left = n->children[i];
+	c_btree_node_t *right = n->children[i + 1];
+
+	assert (left->num + right->num < BTREE_MAX_KEYS);
+
+	left->keys[left->num] = n->keys[i];
+	left->values[left->num] = n->values[i];
+	memcpy (left->keys + left->num + 1, right->keys,
+			right->num * sizeof (left->keys[0]));
+	memcpy (left->values + left->num + 1, right->values,
+			right->num * sizeof (left->values[0]));
+	if (!left->leaf)
+		memcpy (left->children + left->num + 1, right->children,
+				(right->num + 1) * sizeof (left->children[0]));
+	left->num += right->num + 1;
+
+	node_close (n, i);
+	free (right);
+} /* }}} void merge_children */
+
+/* Makes sure child `i' of `n' has more than the minimum number of keys, so a
+ * key can be removed from it. Returns the index of the child to descend
+ * into, which changes if the child was merged with its left sibling. */
+static int fill_child (c_btree_node_t *n, int i) /* {{{ */
+{
+	c_btree_node_t *child = n->children[i];
+	c_btree_node_t *sibling;
+
+	if (child->num > BTREE_MIN_KEYS)
+		return (i);
+
+	if ((i > 0) && (n->children[i - 1]->num > BTREE_MIN_KEYS))
+	{
+		/* Rotate right: last key of the left sibling goes up into `n', key
+		 * `i - 1' of `n' goes down into `child'. */
+		sibling = n->children[i - 1];
+
+		memmove (child->keys + 1, child->keys,
+				child->num * sizeof (child->keys[0]));
+		memmove (child->values + 1, child->values,
+				child->num * sizeof (child->values[0]));
+		if (!child->leaf)
+			memmove (child->children + 1, child->children,
+					(child->num + 1) * sizeof (child->children[0]));
+
+		child->keys[0] = n->keys[i - 1];
+		child->values[0] = n->values[i - 1];
+		if (!child->leaf)
+			child->children[0] = sibling->children[sibling->num];
+		child->num++;
+
+		n->keys[i - 1] = sibling->keys[sibling->num - 1];
+		n->values[i - 1] = sibling->values[sibling->num - 1];
+		sibling->num--;
+
+		return (i);
+	}
+
+	if ((i < n->num) && (n->children[i + 1]->num > BTREE_MIN_KEYS))
+	{
+		/* Rotate left */
+		sibling = n->children[i + 1];
+
+		child->keys[child->num] = n->keys[i];
+		child->values[child->num] = n->values[i];
+		if (!child->leaf)
+			child->children[child->num + 1] = sibling->children[0];
+		child->num++;
+
+		n->keys[i] = sibling->keys[0];
+		n->values[i] = sibling->values[0];
+
+		memmove (sibling->keys, sibling->keys + 1,
+				(sibling->num - 1) * sizeof (sibling->keys[0]));
+		memmove (sibling->values, sibling->values + 1,
+				(sibling->num - 1) * sizeof (sibling->values[0]));
+		if (!sibling->leaf)
+			memmove (sibling->children, sibling->children + 1,
+					sibling->num * sizeof (sibling->children[0]));
+		sibling->num--;
+
+		return (i);
+	}
+
+	if (i < n->num)
+	{
+		merge_children (n, i);
+		return (i);
+	}
+
+	merge_children (n, i - 1);
+	return (i - 1);
+} /* }}} int fill_child */
+
+/* Removes the smallest (`max' false) or largest (`max' true) entry of the
+ * subtree rooted at `n', which must have more than the minimum number of
+ * keys. */
+static void remove_extreme (c_btree_node_t *n, _Bool max, /* {{{ */
+		void **rkey, void **rvalue)
+{
+	while (!n->leaf)
+	{
+		int i = fill_child (n, max ? n->num : 0);
+		n = n->children[i];
+	}
+
+	if (max)
+	{
+		*rkey = n->keys[n->num - 1];
+		*rvalue = n->values[n->num - 1];
+		n->num--;
+	}
+	else
+	{
+		*rkey = n->keys[0];
+		*rvalue = n->values[0];
+		node_close (n, 0);
+	}
+} /* }}} void remove_extreme */
+
+/* Finds the entry following (`forward' true) or preceding `key' in the
+ * tree. If `key' is NULL, the first or last entry is returned. */
+static int find_neighbor (c_btree_t *t, const void *key, /* {{{ */
+		_Bool forward, c_btree_node_t **rnode, int *rindex)
+{
+	c_btree_node_t *n = t->root;
+	_Bool have_result = 0;
+
+	while (n != NULL)
+	{
+		_Bool found = 0;
+		int i;
+
+		if (key == NULL)
+			i = forward ? 0 : n->num;
+		else
+		{
+			i = node_search (t, n, key, &found);
+			if (found && forward)
+				i++;
+		}
+
+		if (forward && (i < n->num))
+		{
+			*rnode = n;
+			*rindex = i;
+			have_result = 1;
+		}
+		else if (!forward && (i > 0))
+		{
+			*rnode = n;
+			*rindex = i - 1;
+			have_result = 1;
+		}
+
+		if (n->leaf)
+			break;
+		n = n->children[i];
+	}
+
+	return (have_result ? 0 : -1);
+} /* }}} int find_neighbor */
+
+static int iterator_step (c_btree_iterator_t *iter, _Bool forward, /* {{{ */
+		void **key, void **value)
+{
+	c_btree_node_t *n = NULL;
+	int i = 0;
+
+	if ((iter == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	/* Within a leaf, the neighbor is simply the next slot. Everything else
+	 * requires a search from the root. */
+	if (iter->started && (iter->node != NULL)
+			&& (iter->generation == iter->tree->generation)
+			&& iter->node->leaf
+			&& (forward ? (iter->index + 1 < iter->node->num)
+				: (iter->index > 0)))
+	{
+		n = iter->node;
+		i = forward ? iter->index + 1 : iter->index - 1;
+	}
+	else if (find_neighbor (iter->tree,
+				iter->started ? iter->last_key : NULL, forward, &n, &i) != 0)
+		return (-1);
+
+	iter->started = 1;
+	iter->last_key = n->keys[i];
+	iter->node = n;
+	iter->index = i;
+	iter->generation = iter->tree->generation;
+
+	*key = n->keys[i];
+	*value = n->values[i];
+
+	return (0);
+} /* }}} int iterator_step */
+
+/*
+ * public functions
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *)) /* {{{ */
+{
+	c_btree_t *t;
+
+	if (compare == NULL)
+		return (NULL);
+
+	t = calloc (1, sizeof (*t));
+	if (t == NULL)
+		return (NULL);
+
+	t->root = node_alloc (/* leaf = */ 1);
+	if (t->root == NULL)
+	{
+		free (t);
+		return (NULL);
+	}
+	t->compare = compare;
+	t->size = 0;
+
+	return (t);
+} /* }}} c_btree_t *c_btree_create */
+
+void c_btree_destroy (c_btree_t *t) /* {{{ */
+{
+	if (t == NULL)
+		return;
+
+	node_free (t->root);
+	free (t);
+} /* }}} void c_btree_destroy */
+
+int c_btree_insert (c_btree_t *t, void *key, void *value) /* {{{ */
+{
+	c_btree_node_t *n;
+
+	if (t == NULL)
+		return (-1);
+
+	/* Split full nodes on the way down, so there is always room for the key
+	 * moved up by a split. */
+	if (t->root->num == BTREE_MAX_KEYS)
+	{
+		n = node_alloc (/* leaf = */ 0);
+		if (n == NULL)
+			return (-1);
+		n->children[0] = t->root;
+		if (split_child (n, 0) != 0)
+		{
+			free (n);
+			return (-1);
+		}
+		t->root = n;
+	}
+
+	n = t->root;
+	while (42)
+	{
+		_Bool found;
+		int i;
+
+		i = node_search (t, n, key, &found);
+		if (found)
+			return (1);
+
+		if (n->leaf)
+		{
+			node_open (n, i);
+			n->keys[i] = key;
+			n->values[i] = value;
+			t->size++;
+			t->generation++;
+			return (0);
+		}
+
+		if (n->children[i]->num == BTREE_MAX_KEYS)
+		{
+			int cmp;
+
+			if (split_child (n, i) != 0)
+				return (-1);
+
+			cmp = t->compare (key, n->keys[i]);
+			if (cmp == 0)
+				return (1);
+			else if (cmp > 0)
+				i++;
+		}
+
+		n = n->children[i];
+	}
+} /* }}} int c_btree_insert */
+
+int c_btree_remove (c_btree_t *t, const void *key, /* {{{ */
+		void **rkey, void **rvalue)
+{
+	c_btree_node_t *n;
+	void *k = NULL;
+	void *v = NULL;
+	int status = -1;
+
+	if (t == NULL)
+		return (-1);
+
+	/* Every node we descend into has more than the minimum number of keys
+	 * (fill_child), so removing a key never requires walking back up. */
+	n = t->root;
+	while (42)
+	{
+		_Bool found;
+		int i;
+
+		i = node_search (t, n, key, &found);
+		if (found)
+		{
+			k = n->keys[i];
+			v = n->values[i];
+
+			if (n->leaf)
+			{
+				node_close (n, i);
+				status = 0;
+				break;
+			}
+			else if (n->children[i]->num > BTREE_MIN_KEYS)
+			{
+				remove_extreme (n->children[i], /* max = */ 1,
+						&n->keys[i], &n->values[i]);
+				status = 0;
+				break;
+			}
+			else if (n->children[i + 1]->num > BTREE_MIN_KEYS)
+			{
+				remove_extreme (n->children[i + 1], /* max = */ 0,
+						&n->keys[i], &n->values[i]);
+				status = 0;
+				break;
+			}
+
+			/* Both neighbors are minimal: Move the key down into the merged
+			 * child and continue there. */
+			merge_children (n, i);
+			n = n->children[i];
+			continue;
+		}
+
+		if (n->leaf)
+			break;
+
+		i = fill_child (n, i);
+		n = n->children[i];
+	}
+
+	/* Merging may have moved the last key out of the root. */
+	while ((t->root->num == 0) && !t->root->leaf)
+	{
+		n = t->root;
+		t->root = n->children[0];
+		free (n);
+	}
+
+	if (status != 0)
+		return (status);
+
+	t->size--;
+	t->generation++;
+	if (rkey != NULL)
+		*rkey = k;
+	if (rvalue != NULL)
+		*rvalue = v;
+
+	return (0);
+} /* }}} int c_btree_remove */
+
+int c_btree_get (c_btree_t *t, const void *key, void **value) /* {{{ */
+{
+	c_btree_node_t *n;
+
+	if (t == NULL)
+		return (-1);
+
+	n = t->root;
+	while (42)
+	{
+		_Bool found;
+		int i;
+
+		i = node_search (t, n, key, &found);
+		if (found)
+		{
+			if (value != NULL)
+				*value = n->values[i];
+			return (0);
+		}
+
+		if (n->leaf)
+			return (-1);
+		n = n->children[i];
+	}
+} /* }}} int c_btree_get */
+
+int c_btree_pick (c_btree_t *t, void **key, void **value) /* {{{ */
+{
+	c_btree_node_t *n;
+	int i;
+
+	if ((t == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	if (t->size == 0)
+		return (-1);
+
+	/* Taking the largest entry is cheap: it never requires moving keys within
+	 * the leaf. */
+	if (find_neighbor (t, NULL, /* forward = */ 0, &n, &i) != 0)
+		return (-1);
+
+	return (c_btree_remove (t, n->keys[i], key, value));
+} /* }}} int c_btree_pick */
+
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t) /* {{{ */
+{
+	c_btree_iterator_t *iter;
+
+	if (t == NULL)
+		return (NULL);
+
+	iter = calloc (1, sizeof (*iter));
+	if (iter == NULL)
+		return (NULL);
+	iter->tree = t;
+	iter->last_key = NULL;
+	iter->started = 0;
+
+	return (iter);
+} /* }}} c_btree_iterator_t *c_btree_get_iterator */
+
+int c_btree_iterator_next (c_btree_iterator_t *iter, /* {{{ */
+		void **key, void **value)
+{
+	return (iterator_step (iter, /* forward = */ 1, key, value));
+} /* }}} int c_btree_iterator_next */
+
+int c_btree_iterator_prev (c_btree_iterator_t *iter, /* {{{ */
+		void **key, void **value)
+{
+	return (iterator_step (iter, /* forward = */ 0, key, value));
+} /* }}} int c_btree_iterator_prev */
+
+int c_btree_iterator_seek (c_btree_iterator_t *iter, /* {{{ */
+		const void *key)
+{
+	if ((iter == NULL) || (key == NULL))
+		return (-1);
+
+	/* The next step searches for the neighbor of `key' from the root, which
+	 * works for keys not stored in the tree, too. */
+	iter->started = 1;
+	iter->last_key = (void *) key;
+	iter->node = NULL;
+	iter->index = 0;
+
+	return (0);
+} /* }}} int c_btree_iterator_seek */
+
+void c_btree_iterator_destroy (c_btree_iterator_t *iter) /* {{{ */
+{
+	free (iter);
+} /* }}} void c_btree_iterator_destroy */
+
+int c_btree_size (c_btree_t *t) /* {{{ */
+{
+	if (t == NULL)
+		return (0);
+	return (t->size);
+} /* }}} int c_btree_size */
+
+/* vim: set sw=8 sts=8 noet fdm=marker : */
@@ -0,0 +1,95 @@
+/**
+ * collectd - src/utils_btree.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Ordered container implemented as a B-tree. Each node stores up to 31 key
+ *   and value pointers in arrays, so a tree with a million entries is only
+ *   four levels deep and needs one allocation per 16-31 entries instead of one
+ *   per entry.
+ *
+ *   The interface mirrors `utils_avltree.h'; the functions behave like their
+ *   `c_avl_*' counterparts. Use this instead of the AVL tree when the order of
+ *   the keys is needed and `utils_htable.h' otherwise.
+ **/
+
+#ifndef UTILS_BTREE_H
+#define UTILS_BTREE_H 1
+
+struct c_btree_s;
+typedef struct c_btree_s c_btree_t;
+
+struct c_btree_iterator_s;
+typedef struct c_btree_iterator_s c_btree_iterator_t;
+
+/*
+ * NAME
+ *   c_btree_create
+ *
+ * PARAMETERS
+ *   `compare'  The function-pointer `compare' is used to compare two keys. See
+ *              `c_avl_create'.
+ *
+ * RETURN VALUE
+ *   A c_btree_t-pointer upon success or NULL upon failure.
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *));
+
+/* Deallocates the tree. Stored key- and value-pointers are not freed. */
+void c_btree_destroy (c_btree_t *t);
+
+/* Returns zero upon success, less than zero if an error occurred and greater
+ * than zero if the key is already stored in the tree. */
+int c_btree_insert (c_btree_t *t, void *key, void *value);
+
+/* Returns zero upon success or non-zero if the key isn't found in the tree.
+ * `rkey' and `rvalue' may be NULL. */
+int c_btree_remove (c_btree_t *t, const void *key, void **rkey, void **rvalue);
+
+/* Returns zero upon success or non-zero if the key isn't found in the tree.
+ * `value' may be NULL. */
+int c_btree_get (c_btree_t *t, const void *key, void **value);
+
+/* Removes an arbitrary entry from the tree. Returns zero upon success or
+ * non-zero if the tree is empty or key or value is NULL. */
+int c_btree_pick (c_btree_t *t, void **key, void **value);
+
+/*
+ * Iterators return the entries in ascending (c_btree_iterator_next) or
+ * descending (c_btree_iterator_prev) order, starting at the smallest or
+ * largest key respectively. An iterator remembers the last key it returned,
+ * so entries may be removed from the tree while iterating, as long as that
+ * key is not freed before the next call.
+ */
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t);
+int c_btree_iterator_next (c_btree_iterator_t *iter, void **key, void **value);
+int c_btree_iterator_prev (c_btree_iterator_t *iter, void **key, void **value);
+/* Positions the iterator at `key', which doesn't have to be stored in the
+ * tree: the next call to c_btree_iterator_next returns the smallest entry
+ * greater than `key', c_btree_iterator_prev the largest entry smaller than
+ * `key'. `key' must stay valid until then. This allows resuming an iteration
+ * after the tree has been unlocked and modified. */
+int c_btree_iterator_seek (c_btree_iterator_t *iter, const void *key);
+void c_btree_iterator_destroy (c_btree_iterator_t *iter);
+
+/* Returns the number of entries in the tree, 0 if the tree is empty or
+ * NULL. */
+int c_btree_size (c_btree_t *t);
+
+#endif /* UTILS_BTREE_H */
@@ -22,17 +22,49 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
-#include "utils_avltree.h"
+#include "utils_btree.h"
+#include "utils_htable.h"
 #include "utils_cache.h"
 #include "meta_data.h"
 
 #include <assert.h>
 #include <pthread.h>
 
+/* String which is not necessarily null-terminated. */
+struct uc_str_s
+{
+  const char *ptr;
+  size_t      len;
+};
+typedef struct uc_str_s uc_str_t;
+
+/* Interned string. Reference counted, protected by `cache_lock'. */
+struct uc_atom_s
+{
+  uc_str_t str; /* key in `atom_tree', must be the first member */
+  size_t   refcount;
+  char     data[];
+};
+typedef struct uc_atom_s uc_atom_t;
+
+/* Identifiers are split at the first and the last slash, i.e. into the host,
+ * "plugin[-instance]" and "type[-instance]". In the cache, the parts point to
+ * interned strings, so each distinct host, plugin instance and type instance
+ * is stored once. Lookups use the same structure pointing into the name being
+ * looked up. */
+#define UC_NAME_PARTS 3
+struct uc_name_s
+{
+  const uc_str_t *parts[UC_NAME_PARTS];
+  int             parts_num;
+};
+typedef struct uc_name_s uc_name_t;
+
 typedef struct cache_entry_s
 {
-	char name[6 * DATA_MAX_NAME_LEN];
+	uc_name_t  name; /* key in `cache_tree' */
 	int        values_num;
+	/* Both point to memory allocated together with the entry. */
 	gauge_t   *values_gauge;
 	value_t   *values_raw;
 	/* Time contained in the package
@@ -47,6 +79,12 @@ typedef struct cache_entry_s
 	int state;
 	int hits;
 
+	/* Time at which the entry times out, i.e. last_update + timeout_g *
+	 * interval, and the neighbors in the timing wheel's slot. */
+	cdtime_t expire;
+	struct cache_entry_s *wheel_prev;
+	struct cache_entry_s *wheel_next;
+
 	/*
 	 * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
 	 * !  0  !  1  !  2  !  3  !  4  !  5  !  6  !  7  !  8  ! ...
@@ -63,37 +101,339 @@ typedef struct cache_entry_s
 	meta_data_t *meta;
 } cache_entry_t;
 
-static c_avl_tree_t   *cache_tree = NULL;
+/* Entry which has timed out, collected by uc_check_timeout. */
+struct uc_expired_s
+{
+  char    *key;
+  cdtime_t time;
+  cdtime_t interval;
+};
+typedef struct uc_expired_s uc_expired_t;
+
+/* Number of entries copied from the cache at once by uc_iterator_next. */
+#define UC_ITERATOR_CHUNK_SIZE 256
+
+struct uc_iterator_s
+{
+  /* Names and times of the current chunk. The names are stored one after
+   * another in `pool'. */
+  char     pool[32768];
+  size_t   offsets[UC_ITERATOR_CHUNK_SIZE];
+  cdtime_t times[UC_ITERATOR_CHUNK_SIZE];
+  size_t   num;
+  size_t   pos; /* index of the next entry to return */
+  _Bool    done;
+
+  /* Name of the last entry looked at, where the next chunk starts. */
+  char      last[6 * DATA_MAX_NAME_LEN];
+  uc_str_t  last_parts[UC_NAME_PARTS];
+  uc_name_t last_name;
+  _Bool     started;
+};
+
+static c_htable_t     *cache_tree = NULL;
+static c_htable_t     *atom_tree = NULL;
+/* The entries of `cache_tree' ordered by name, so the names can be listed in
+ * chunks without holding the lock all the time, see uc_iterator_next. */
+static c_btree_t      *cache_index = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
+/* Timing wheel: All entries are linked into the slot of the second they time
+ * out in, modulo the number of slots. uc_check_timeout only looks at the slots
+ * of the seconds passed since it was last called, instead of scanning the
+ * entire cache. Entries timing out more than UC_WHEEL_SLOTS seconds in the
+ * future are looked at (and skipped) once per revolution. Protected by
+ * `cache_lock'. */
+#define UC_WHEEL_SLOTS 4096
+#define UC_WHEEL_TICK(t) ((uint64_t) CDTIME_T_TO_TIME_T (t))
+static cache_entry_t *wheel[UC_WHEEL_SLOTS];
+static uint64_t       wheel_last_tick = 0;
+
+/* Points to the uc_rates_t of the value list being dispatched by the calling
+ * thread, see uc_update_dispatch(). */
+static pthread_key_t  rates_key;
+static _Bool          rates_key_initialized = 0;
+
+static unsigned int uc_str_hash (const void *arg) /* {{{ */
+{
+  const uc_str_t *str = arg;
+  unsigned int hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < str->len; i++)
+  {
+    hash ^= (unsigned char) str->ptr[i];
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} unsigned int uc_str_hash */
+
+static int uc_str_compare (const void *arg0, const void *arg1) /* {{{ */
+{
+  const uc_str_t *a = arg0;
+  const uc_str_t *b = arg1;
+
+  if (a == b)
+    return (0);
+  if (a->len != b->len)
+    return ((a->len < b->len) ? -1 : 1);
+  return (memcmp (a->ptr, b->ptr, a->len));
+} /* }}} int uc_str_compare */
+
+/* Same as hashing the identifier as a string with c_htable_hash_string. */
+static unsigned int uc_name_hash (const void *arg) /* {{{ */
+{
+  const uc_name_t *name = arg;
+  unsigned int hash = 2166136261U;
+  int i;
+  size_t j;
+
+  for (i = 0; i < name->parts_num; i++)
+  {
+    if (i > 0)
+    {
+      hash ^= (unsigned char) '/';
+      hash *= 16777619U;
+    }
+
+    for (j = 0; j < name->parts[i]->len; j++)
+    {
+      hash ^= (unsigned char) name->parts[i]->ptr[j];
+      hash *= 16777619U;
+    }
+  }
+
+  return (hash);
+} /* }}} unsigned int uc_name_hash */
+
+static int uc_name_compare (const void *arg0, const void *arg1) /* {{{ */
+{
+  const uc_name_t *a = arg0;
+  const uc_name_t *b = arg1;
+  int i;
+
+  if (a->parts_num != b->parts_num)
+    return (a->parts_num - b->parts_num);
+
+  for (i = 0; i < a->parts_num; i++)
+  {
+    int status = uc_str_compare (a->parts[i], b->parts[i]);
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int uc_name_compare */
+
+/* Returns the next character of the formatted name, i.e. of the parts joined
+ * by slashes, or zero at the end. */
+static int uc_name_getc (const uc_name_t *name, /* {{{ */
+    int *part, size_t *offset)
 {
-  assert ((a != NULL) && (b != NULL));
-  return (strcmp (a->name, b->name));
-} /* int cache_compare */
+  if (*offset < name->parts[*part]->len)
+  {
+    (*offset)++;
+    return ((unsigned char) name->parts[*part]->ptr[*offset - 1]);
+  }
+
+  if (*part + 1 >= name->parts_num)
+    return (0);
 
-static cache_entry_t *cache_alloc (int values_num)
+  (*part)++;
+  *offset = 0;
+  return ('/');
+} /* }}} int uc_name_getc */
+
+/* Orders names the way strcmp orders the formatted names. Used for
+ * `cache_index'. */
+static int uc_name_order (const void *arg0, const void *arg1) /* {{{ */
+{
+  const uc_name_t *a = arg0;
+  const uc_name_t *b = arg1;
+  int a_part = 0;
+  int b_part = 0;
+  size_t a_offset = 0;
+  size_t b_offset = 0;
+
+  while (42)
+  {
+    int a_char = uc_name_getc (a, &a_part, &a_offset);
+    int b_char = uc_name_getc (b, &b_part, &b_offset);
+
+    if (a_char != b_char)
+      return (a_char - b_char);
+    if (a_char == 0)
+      return (0);
+  }
+} /* }}} int uc_name_order */
+
+/* Splits `str' into `parts' and makes `name' point to them. The result is
+ * only valid as long as `str' is. */
+static void uc_name_parse (uc_name_t *name, uc_str_t *parts, /* {{{ */
+    const char *str)
+{
+  const char *first = strchr (str, '/');
+  const char *last = strrchr (str, '/');
+  int i;
+
+  if (first == NULL)
+  {
+    parts[0].ptr = str;
+    parts[0].len = strlen (str);
+    name->parts_num = 1;
+  }
+  else if (first == last)
+  {
+    parts[0].ptr = str;
+    parts[0].len = (size_t) (first - str);
+    parts[1].ptr = first + 1;
+    parts[1].len = strlen (first + 1);
+    name->parts_num = 2;
+  }
+  else
+  {
+    parts[0].ptr = str;
+    parts[0].len = (size_t) (first - str);
+    parts[1].ptr = first + 1;
+    parts[1].len = (size_t) (last - (first + 1));
+    parts[2].ptr = last + 1;
+    parts[2].len = strlen (last + 1);
+    name->parts_num = 3;
+  }
+
+  for (i = 0; i < UC_NAME_PARTS; i++)
+    name->parts[i] = (i < name->parts_num) ? &parts[i] : NULL;
+} /* }}} void uc_name_parse */
+
+/* Writes the identifier to `buffer'. Returns zero on success and non-zero if
+ * the buffer is too small. */
+static int uc_name_format (char *buffer, size_t buffer_size, /* {{{ */
+    const uc_name_t *name)
+{
+  size_t offset = 0;
+  int i;
+
+  for (i = 0; i < name->parts_num; i++)
+  {
+    const uc_str_t *part = name->parts[i];
+
+    if (offset + part->len + 1 >= buffer_size)
+      return (-1);
+
+    if (i > 0)
+      buffer[offset++] = '/';
+    memcpy (buffer + offset, part->ptr, part->len);
+    offset += part->len;
+  }
+  buffer[offset] = 0;
+
+  return (0);
+} /* }}} int uc_name_format */
+
+static char *uc_name_strdup (const uc_name_t *name) /* {{{ */
+{
+  char buffer[6 * DATA_MAX_NAME_LEN];
+
+  if (uc_name_format (buffer, sizeof (buffer), name) != 0)
+    return (NULL);
+  return (strdup (buffer));
+} /* }}} char *uc_name_strdup */
+
+/* `cache_lock' must be held when calling the atom functions. */
+static const uc_str_t *uc_atom_get (const uc_str_t *str) /* {{{ */
+{
+  uc_atom_t *atom = NULL;
+
+  if (c_htable_get (atom_tree, str, (void *) &atom) == 0)
+  {
+    atom->refcount++;
+    return (&atom->str);
+  }
+
+  atom = malloc (sizeof (*atom) + str->len + 1);
+  if (atom == NULL)
+    return (NULL);
+
+  memcpy (atom->data, str->ptr, str->len);
+  atom->data[str->len] = 0;
+  atom->str.ptr = atom->data;
+  atom->str.len = str->len;
+  atom->refcount = 1;
+
+  if (c_htable_insert (atom_tree, &atom->str, atom) != 0)
+  {
+    sfree (atom);
+    return (NULL);
+  }
+
+  return (&atom->str);
+} /* }}} const uc_str_t *uc_atom_get */
+
+static void uc_atom_put (const uc_str_t *str) /* {{{ */
+{
+  uc_atom_t *atom = (uc_atom_t *) str;
+
+  if (atom == NULL)
+    return;
+
+  assert (atom->refcount > 0);
+  atom->refcount--;
+  if (atom->refcount > 0)
+    return;
+
+  c_htable_remove (atom_tree, &atom->str, NULL, NULL);
+  sfree (atom);
+} /* }}} void uc_atom_put */
+
+/* Looks up an entry by its identifier. `cache_lock' must be held. */
+static int cache_lookup (const char *str, cache_entry_t **ret) /* {{{ */
+{
+  uc_str_t parts[UC_NAME_PARTS];
+  uc_name_t name;
+
+  uc_name_parse (&name, parts, str);
+  return (c_htable_get (cache_tree, &name, (void *) ret));
+} /* }}} int cache_lookup */
+
+/* Allocates the entry with room for the values and sets its name to interned
+ * copies of the parts of `str'. `cache_lock' must be held. */
+static cache_entry_t *cache_alloc (const char *str, int values_num)
 {
   cache_entry_t *ce;
+  uc_str_t parts[UC_NAME_PARTS];
+  uc_name_t name;
+  size_t size;
+  int i;
 
-  ce = (cache_entry_t *) malloc (sizeof (cache_entry_t));
+  size = sizeof (*ce)
+    + values_num * (sizeof (*ce->values_raw) + sizeof (*ce->values_gauge));
+  ce = (cache_entry_t *) malloc (size);
   if (ce == NULL)
   {
     ERROR ("utils_cache: cache_alloc: malloc failed.");
     return (NULL);
   }
-  memset (ce, '\0', sizeof (cache_entry_t));
+  memset (ce, '\0', size);
   ce->values_num = values_num;
 
-  ce->values_gauge = calloc (values_num, sizeof (*ce->values_gauge));
-  ce->values_raw   = calloc (values_num, sizeof (*ce->values_raw));
-  if ((ce->values_gauge == NULL) || (ce->values_raw == NULL))
+  /* value_t is the larger type, so the gauges are aligned, too. */
+  ce->values_raw = (value_t *) (ce + 1);
+  ce->values_gauge = (gauge_t *) (ce->values_raw + values_num);
+
+  uc_name_parse (&name, parts, str);
+  ce->name.parts_num = name.parts_num;
+  for (i = 0; i < name.parts_num; i++)
   {
-    sfree (ce->values_gauge);
-    sfree (ce->values_raw);
-    sfree (ce);
-    ERROR ("utils_cache: cache_alloc: calloc failed.");
-    return (NULL);
+    ce->name.parts[i] = uc_atom_get (name.parts[i]);
+    if (ce->name.parts[i] == NULL)
+    {
+      while (--i >= 0)
+        uc_atom_put (ce->name.parts[i]);
+      sfree (ce);
+      ERROR ("utils_cache: cache_alloc: uc_atom_get failed.");
+      return (NULL);
+    }
   }
 
   ce->history = NULL;
@@ -103,13 +443,17 @@ static cache_entry_t *cache_alloc (int values_num)
   return (ce);
 } /* cache_entry_t *cache_alloc */
 
+/* `cache_lock' must be held. */
 static void cache_free (cache_entry_t *ce)
 {
+  int i;
+
   if (ce == NULL)
     return;
 
-  sfree (ce->values_gauge);
-  sfree (ce->values_raw);
+  for (i = 0; i < ce->name.parts_num; i++)
+    uc_atom_put (ce->name.parts[i]);
+
   sfree (ce->history);
   if (ce->meta != NULL)
   {
@@ -119,6 +463,39 @@ static void cache_free (cache_entry_t *ce)
   sfree (ce);
 } /* void cache_free */
 
+/* `cache_lock' must be held when calling the wheel functions. */
+static void wheel_insert (cache_entry_t *ce) /* {{{ */
+{
+  size_t slot;
+
+  ce->expire = ce->last_update + (timeout_g * ce->interval);
+  slot = (size_t) (UC_WHEEL_TICK (ce->expire) % UC_WHEEL_SLOTS);
+
+  ce->wheel_prev = NULL;
+  ce->wheel_next = wheel[slot];
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_prev = ce;
+  wheel[slot] = ce;
+} /* }}} void wheel_insert */
+
+static void wheel_remove (cache_entry_t *ce) /* {{{ */
+{
+  if (ce->wheel_prev != NULL)
+    ce->wheel_prev->wheel_next = ce->wheel_next;
+  else
+  {
+    size_t slot = (size_t) (UC_WHEEL_TICK (ce->expire) % UC_WHEEL_SLOTS);
+    assert (wheel[slot] == ce);
+    wheel[slot] = ce->wheel_next;
+  }
+
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_prev = ce->wheel_prev;
+
+  ce->wheel_prev = NULL;
+  ce->wheel_next = NULL;
+} /* }}} void wheel_remove */
+
 static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
 {
   int i;
@@ -135,31 +512,20 @@ static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
 } /* void uc_check_range */
 
 static int uc_insert (const data_set_t *ds, const value_list_t *vl,
-    const char *key)
+    const char *key, gauge_t *ret_rates)
 {
   int i;
-  char *key_copy;
   cache_entry_t *ce;
 
   /* `cache_lock' has been locked by `uc_update' */
 
-  key_copy = strdup (key);
-  if (key_copy == NULL)
-  {
-    ERROR ("uc_insert: strdup failed.");
-    return (-1);
-  }
-
-  ce = cache_alloc (ds->ds_num);
+  ce = cache_alloc (key, ds->ds_num);
   if (ce == NULL)
   {
-    sfree (key_copy);
     ERROR ("uc_insert: cache_alloc (%i) failed.", ds->ds_num);
     return (-1);
   }
 
-  sstrncpy (ce->name, key, sizeof (ce->name));
-
   for (i = 0; i < ds->ds_num; i++)
   {
     switch (ds->ds[i].type)
@@ -191,6 +557,7 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 	/* This shouldn't happen. */
 	ERROR ("uc_insert: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
+	cache_free (ce);
 	return (-1);
     } /* switch (ds->ds[i].type) */
   } /* for (i) */
@@ -203,12 +570,23 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert (cache_tree, key_copy, ce) != 0)
+  if (c_htable_insert (cache_tree, &ce->name, ce) != 0)
+  {
+    cache_free (ce);
+    ERROR ("uc_insert: c_htable_insert failed.");
+    return (-1);
+  }
+  if (c_btree_insert (cache_index, &ce->name, ce) != 0)
   {
-    sfree (key_copy);
-    ERROR ("uc_insert: c_avl_insert failed.");
+    c_htable_remove (cache_tree, &ce->name, NULL, NULL);
+    cache_free (ce);
+    ERROR ("uc_insert: c_btree_insert failed.");
     return (-1);
   }
+  wheel_insert (ce);
+
+  if (ret_rates != NULL)
+    memcpy (ret_rates, ce->values_gauge, ds->ds_num * sizeof (*ret_rates));
 
   DEBUG ("uc_insert: Added %s to the cache.", key);
   return (0);
@@ -217,8 +595,19 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 int uc_init (void)
 {
   if (cache_tree == NULL)
-    cache_tree = c_avl_create ((int (*) (const void *, const void *))
-	cache_compare);
+    cache_tree = c_htable_create (uc_name_hash, uc_name_compare);
+  if (cache_index == NULL)
+    cache_index = c_btree_create (uc_name_order);
+  if (atom_tree == NULL)
+    atom_tree = c_htable_create (uc_str_hash, uc_str_compare);
+
+  if (!rates_key_initialized)
+  {
+    if (pthread_key_create (&rates_key, /* destructor = */ NULL) == 0)
+      rates_key_initialized = 1;
+    else
+      ERROR ("uc_init: pthread_key_create failed.");
+  }
 
   return (0);
 } /* int uc_init */
@@ -227,83 +616,83 @@ int uc_check_timeout (void)
 {
   cdtime_t now;
   cache_entry_t *ce;
+  uint64_t tick;
+  uint64_t now_tick;
 
-  char **keys = NULL;
-  cdtime_t *keys_time = NULL;
-  cdtime_t *keys_interval = NULL;
-  int keys_len = 0;
-
-  char *key;
-  c_avl_iterator_t *iter;
+  uc_expired_t *expired = NULL;
+  size_t expired_num = 0;
+  size_t expired_size = 0;
 
   int status;
-  int i;
+  size_t i;
   
   pthread_mutex_lock (&cache_lock);
 
   now = cdtime ();
+  now_tick = UC_WHEEL_TICK (now);
+
+  /* Look at all slots passed since the last call, including the slot of the
+   * last call itself, since it may contain entries that were not due yet. If
+   * more time than one revolution has passed, or the clock was set back, each
+   * slot is looked at once. */
+  tick = wheel_last_tick;
+  if ((tick == 0) || (tick > now_tick)
+      || ((now_tick - tick) >= UC_WHEEL_SLOTS))
+    tick = now_tick - (UC_WHEEL_SLOTS - 1);
 
   /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+  for (; tick <= now_tick; tick++)
   {
-    char **tmp;
-    cdtime_t *tmp_time;
-
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
-
-    /* If entry has not been updated, add to `keys' array */
-    tmp = (char **) realloc ((void *) keys,
-	(keys_len + 1) * sizeof (char *));
-    if (tmp == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys = tmp;
-
-    tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
-    if (tmp_time == NULL)
+    for (ce = wheel[tick % UC_WHEEL_SLOTS]; ce != NULL; ce = ce->wheel_next)
     {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_time = tmp_time;
+      /* If the entry is fresh enough, continue. This is the case for entries
+       * due in a later revolution of the wheel. */
+      if (ce->expire > now)
+        continue;
 
-    tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_interval = tmp_time;
+      if (expired_num >= expired_size)
+      {
+        size_t tmp_size = (expired_size == 0) ? 64 : (2 * expired_size);
+        uc_expired_t *tmp;
+
+        tmp = realloc (expired, tmp_size * sizeof (*expired));
+        if (tmp == NULL)
+        {
+          ERROR ("uc_check_timeout: realloc failed.");
+          break;
+        }
+        expired = tmp;
+        expired_size = tmp_size;
+      }
 
-    keys[keys_len] = strdup (key);
-    if (keys[keys_len] == NULL)
-    {
-      ERROR ("uc_check_timeout: strdup failed.");
-      continue;
-    }
-    keys_time[keys_len] = ce->last_time;
-    keys_interval[keys_len] = ce->interval;
+      expired[expired_num].key = uc_name_strdup (&ce->name);
+      if (expired[expired_num].key == NULL)
+      {
+        ERROR ("uc_check_timeout: uc_name_strdup failed.");
+        continue;
+      }
+      expired[expired_num].time = ce->last_time;
+      expired[expired_num].interval = ce->interval;
 
-    keys_len++;
-  } /* while (c_avl_iterator_next) */
+      expired_num++;
+    } /* for (ce) */
+  } /* for (tick) */
 
-  c_avl_iterator_destroy (iter);
+  wheel_last_tick = now_tick;
   pthread_mutex_unlock (&cache_lock);
 
-  if (keys_len == 0)
+  if (expired_num == 0)
+  {
+    sfree (expired);
     return (0);
+  }
 
   /* Call the "missing" callback for each value. Do this before removing the
    * value from the cache, so that callbacks can still access the data stored,
    * including plugin specific meta data, rates, history, …. This must be done
    * without holding the lock, otherwise we will run into a deadlock if a
    * plugin calls the cache interface. */
-  for (i = 0; i < keys_len; i++)
+  for (i = 0; i < expired_num; i++)
   {
     value_list_t vl = VALUE_LIST_INIT;
 
@@ -311,52 +700,62 @@ int uc_check_timeout (void)
     vl.values_len = 0;
     vl.meta = NULL;
 
-    status = parse_identifier_vl (keys[i], &vl);
+    status = parse_identifier_vl (expired[i].key, &vl);
     if (status != 0)
     {
-      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.", keys[i]);
-      cache_free (ce);
+      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.",
+          expired[i].key);
       continue;
     }
 
-    vl.time = keys_time[i];
-    vl.interval = keys_interval[i];
+    vl.time = expired[i].time;
+    vl.interval = expired[i].interval;
 
     plugin_dispatch_missing (&vl);
-  } /* for (i = 0; i < keys_len; i++) */
+  } /* for (i = 0; i < expired_num; i++) */
 
-  /* Now actually remove all the values from the cache. We don't re-evaluate
-   * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
+  /* Now actually remove all the values from the cache. Entries updated while
+   * the "missing" callbacks were running are kept. */
   pthread_mutex_lock (&cache_lock);
-  for (i = 0; i < keys_len; i++)
+  now = cdtime ();
+  for (i = 0; i < expired_num; i++)
   {
-    key = NULL;
     ce = NULL;
 
-    status = c_avl_remove (cache_tree, keys[i],
-	(void *) &key, (void *) &ce);
+    status = cache_lookup (expired[i].key, &ce);
+    if ((status == 0) && (ce->expire > now))
+    {
+      sfree (expired[i].key);
+      continue;
+    }
+
+    if (status == 0)
+      status = c_htable_remove (cache_tree, &ce->name, NULL, NULL);
     if (status != 0)
     {
-      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", keys[i]);
-      sfree (keys[i]);
+      ERROR ("uc_check_timeout: c_htable_remove (\"%s\") failed.",
+          expired[i].key);
+      sfree (expired[i].key);
       continue;
     }
 
-    sfree (keys[i]);
-    sfree (key);
+    c_btree_remove (cache_index, &ce->name, NULL, NULL);
+    wheel_remove (ce);
+
+    sfree (expired[i].key);
     cache_free (ce);
-  } /* for (i = 0; i < keys_len; i++) */
+  } /* for (i = 0; i < expired_num; i++) */
   pthread_mutex_unlock (&cache_lock);
 
-  sfree (keys);
-  sfree (keys_time);
-  sfree (keys_interval);
+  sfree (expired);
 
   return (0);
 } /* int uc_check_timeout */
 
-int uc_update (const data_set_t *ds, const value_list_t *vl)
+/* If `ret_rates' is not NULL, the rates of `vl' are copied to it. It must have
+ * room for ds->ds_num values. */
+static int uc_update_internal (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates)
 {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
@@ -371,10 +770,10 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
 
   pthread_mutex_lock (&cache_lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
+  status = cache_lookup (name, &ce);
   if (status != 0) /* entry does not yet exist */
   {
-    status = uc_insert (ds, vl, name);
+    status = uc_insert (ds, vl, name, ret_rates);
     pthread_mutex_unlock (&cache_lock);
     return (status);
   }
@@ -477,11 +876,78 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   ce->last_update = cdtime ();
   ce->interval = vl->interval;
 
+  /* Move the entry to the slot of its new time out. */
+  wheel_remove (ce);
+  wheel_insert (ce);
+
+  /* Like uc_get_rate_by_name, don't report rates of missing values. */
+  status = 0;
+  if (ce->state == STATE_MISSING)
+    status = 1;
+  else if (ret_rates != NULL)
+    memcpy (ret_rates, ce->values_gauge, ds->ds_num * sizeof (*ret_rates));
+
   pthread_mutex_unlock (&cache_lock);
 
-  return (0);
+  return (status);
+} /* int uc_update_internal */
+
+int uc_update (const data_set_t *ds, const value_list_t *vl)
+{
+  int status;
+
+  status = uc_update_internal (ds, vl, /* ret_rates = */ NULL);
+  return ((status < 0) ? status : 0);
 } /* int uc_update */
 
+int uc_update_dispatch (const data_set_t *ds, const value_list_t *vl,
+    uc_rates_t *r)
+{
+  int status;
+
+  assert (r->rates_num == (size_t) ds->ds_num);
+
+  status = uc_update_internal (ds, vl, r->rates);
+
+  r->vl = vl;
+  r->time = vl->time;
+  r->valid = (status == 0) ? 1 : 0;
+  r->prev = NULL;
+
+  if (rates_key_initialized)
+  {
+    r->prev = pthread_getspecific (rates_key);
+    pthread_setspecific (rates_key, r);
+  }
+
+  return ((status < 0) ? status : 0);
+} /* int uc_update_dispatch */
+
+void uc_update_dispatch_done (uc_rates_t *r)
+{
+  if (rates_key_initialized)
+    pthread_setspecific (rates_key, r->prev);
+} /* void uc_update_dispatch_done */
+
+/* Returns the rates stored by uc_update_dispatch if `vl' is the value list
+ * currently being dispatched by this thread, NULL otherwise. */
+static const uc_rates_t *uc_dispatch_rates (const data_set_t *ds,
+    const value_list_t *vl)
+{
+  const uc_rates_t *r;
+
+  if (!rates_key_initialized)
+    return (NULL);
+
+  r = pthread_getspecific (rates_key);
+  if ((r == NULL) || !r->valid
+      || (r->vl != vl) || (r->time != vl->time)
+      || (r->rates_num != (size_t) ds->ds_num))
+    return (NULL);
+
+  return (r);
+} /* const uc_rates_t *uc_dispatch_rates */
+
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
 {
   gauge_t *ret = NULL;
@@ -491,7 +957,7 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
 
@@ -532,13 +998,81 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
   return (status);
 } /* gauge_t *uc_get_rate_by_name */
 
+int uc_get_rate_into (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates, size_t ret_rates_num)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  const uc_rates_t *r;
+  cache_entry_t *ce = NULL;
+  int status = 0;
+
+  if (ret_rates_num != (size_t) ds->ds_num)
+  {
+    ERROR ("utils_cache: uc_get_rate_into: ds[%s] has %i values, "
+	"but the buffer has room for %zu.",
+	ds->type, ds->ds_num, ret_rates_num);
+    return (-1);
+  }
+
+  r = uc_dispatch_rates (ds, vl);
+  if (r != NULL)
+  {
+    memcpy (ret_rates, r->rates, ret_rates_num * sizeof (*ret_rates));
+    return (0);
+  }
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("utils_cache: uc_get_rate_into: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (cache_lookup (name, &ce) != 0)
+  {
+    DEBUG ("utils_cache: uc_get_rate_into: No such value: %s", name);
+    status = -1;
+  }
+  /* remove missing values from getval */
+  else if (ce->state == STATE_MISSING)
+    status = -1;
+  else if (ce->values_num != ds->ds_num)
+  {
+    ERROR ("utils_cache: uc_get_rate_into: ds[%s] has %i values, "
+	"but the cache entry has %i.",
+	ds->type, ds->ds_num, ce->values_num);
+    status = -1;
+  }
+  else
+    memcpy (ret_rates, ce->values_gauge, ret_rates_num * sizeof (*ret_rates));
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (status);
+} /* int uc_get_rate_into */
+
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
+  const uc_rates_t *r;
   gauge_t *ret = NULL;
   size_t ret_num = 0;
   int status;
 
+  r = uc_dispatch_rates (ds, vl);
+  if (r != NULL)
+  {
+    ret = malloc (r->rates_num * sizeof (*ret));
+    if (ret == NULL)
+    {
+      ERROR ("utils_cache: uc_get_rate: malloc failed.");
+      return (NULL);
+    }
+    memcpy (ret, r->rates, r->rates_num * sizeof (*ret));
+    return (ret);
+  }
+
   if (FORMAT_VL (name, sizeof (name), vl) != 0)
   {
     ERROR ("utils_cache: uc_get_rate: FORMAT_VL failed.");
@@ -563,59 +1097,176 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
   return (ret);
 } /* gauge_t *uc_get_rate */
 
-int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+/* Copies the next chunk of names and times from the cache to `iter'. At most
+ * UC_ITERATOR_CHUNK_SIZE entries are looked at while holding the lock. */
+static int uc_iterator_fill (uc_iterator_t *iter) /* {{{ */
 {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
-
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-  size_t size_arrays = 0;
-
+  c_btree_iterator_t *bi;
+  uc_name_t *key;
+  uc_name_t *last = NULL;
+  cache_entry_t *ce;
+  size_t pool_used = 0;
+  size_t i;
   int status = 0;
 
-  if ((ret_names == NULL) || (ret_number == NULL))
-    return (-1);
+  iter->num = 0;
+  iter->pos = 0;
 
   pthread_mutex_lock (&cache_lock);
 
-  size_arrays = (size_t) c_avl_size (cache_tree);
-  if (size_arrays < 1)
+  bi = c_btree_get_iterator (cache_index);
+  if (bi == NULL)
   {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
     pthread_mutex_unlock (&cache_lock);
-    return (0);
+    return (-1);
   }
 
-  names = calloc (size_arrays, sizeof (*names));
-  times = calloc (size_arrays, sizeof (*times));
-  if ((names == NULL) || (times == NULL))
-  {
-    ERROR ("uc_get_names: calloc failed.");
-    sfree (names);
-    sfree (times);
-    pthread_mutex_unlock (&cache_lock);
-    return (ENOMEM);
-  }
+  if (iter->started)
+    c_btree_iterator_seek (bi, &iter->last_name);
 
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
+  for (i = 0; i < UC_ITERATOR_CHUNK_SIZE; i++)
   {
+    /* Names are at most this long, see uc_name_strdup. */
+    if (sizeof (iter->pool) - pool_used < sizeof (iter->last))
+      break;
+
+    if (c_btree_iterator_next (bi, (void *) &key, (void *) &ce) != 0)
+    {
+      iter->done = 1;
+      break;
+    }
+    last = key;
+
     /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
+    if (ce->state == STATE_MISSING)
+      continue;
+
+    if (uc_name_format (iter->pool + pool_used,
+          sizeof (iter->pool) - pool_used, key) != 0)
       continue;
 
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert (number < size_arrays);
+    iter->offsets[iter->num] = pool_used;
+    iter->times[iter->num] = ce->last_time;
+    pool_used += strlen (iter->pool + pool_used) + 1;
+    iter->num++;
+  }
 
-    if (ret_times != NULL)
-      times[number] = value->last_time;
+  /* Remember where to continue. The entry may be gone by then, so keep a
+   * copy of its name. */
+  if ((last != NULL)
+      && (uc_name_format (iter->last, sizeof (iter->last), last) != 0))
+    status = -1;
+
+  c_btree_iterator_destroy (bi);
+  pthread_mutex_unlock (&cache_lock);
+
+  if (status != 0)
+  {
+    ERROR ("uc_iterator_fill: uc_name_format failed.");
+    return (-1);
+  }
+
+  if (last != NULL)
+  {
+    uc_name_parse (&iter->last_name, iter->last_parts, iter->last);
+    iter->started = 1;
+  }
+
+  return (0);
+} /* }}} int uc_iterator_fill */
+
+uc_iterator_t *uc_get_iterator (void) /* {{{ */
+{
+  uc_iterator_t *iter;
+
+  iter = calloc (1, sizeof (*iter));
+  if (iter == NULL)
+  {
+    ERROR ("uc_get_iterator: calloc failed.");
+    return (NULL);
+  }
+
+  return (iter);
+} /* }}} uc_iterator_t *uc_get_iterator */
+
+int uc_iterator_next (uc_iterator_t *iter, const char **ret_name) /* {{{ */
+{
+  if ((iter == NULL) || (ret_name == NULL))
+    return (-1);
 
-    names[number] = strdup (key);
+  while (iter->pos >= iter->num)
+  {
+    if (iter->done)
+      return (1);
+    if (uc_iterator_fill (iter) != 0)
+      return (-1);
+  }
+
+  *ret_name = iter->pool + iter->offsets[iter->pos];
+  iter->pos++;
+
+  return (0);
+} /* }}} int uc_iterator_next */
+
+int uc_iterator_get_time (uc_iterator_t *iter, cdtime_t *ret_time) /* {{{ */
+{
+  if ((iter == NULL) || (ret_time == NULL) || (iter->pos == 0))
+    return (-1);
+
+  *ret_time = iter->times[iter->pos - 1];
+  return (0);
+} /* }}} int uc_iterator_get_time */
+
+void uc_iterator_destroy (uc_iterator_t *iter) /* {{{ */
+{
+  sfree (iter);
+} /* }}} void uc_iterator_destroy */
+
+int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+{
+  uc_iterator_t *iter;
+  const char *name;
+
+  char **names = NULL;
+  cdtime_t *times = NULL;
+  size_t number = 0;
+  size_t size_arrays = 0;
+
+  int status = 0;
+
+  if ((ret_names == NULL) || (ret_number == NULL))
+    return (-1);
+
+  iter = uc_get_iterator ();
+  if (iter == NULL)
+    return (ENOMEM);
+
+  /* The names are returned in order, so there's no need to sort them. */
+  while ((status = uc_iterator_next (iter, &name)) == 0)
+  {
+    if (number >= size_arrays)
+    {
+      size_t new_size = (size_arrays == 0) ? 64 : 2 * size_arrays;
+      char **tmp_names;
+      cdtime_t *tmp_times;
+
+      tmp_names = realloc (names, new_size * sizeof (*names));
+      if (tmp_names != NULL)
+        names = tmp_names;
+      tmp_times = realloc (times, new_size * sizeof (*times));
+      if (tmp_times != NULL)
+        times = tmp_times;
+      if ((tmp_names == NULL) || (tmp_times == NULL))
+      {
+        ERROR ("uc_get_names: realloc failed.");
+        status = -1;
+        break;
+      }
+      size_arrays = new_size;
+    }
+
+    uc_iterator_get_time (iter, &times[number]);
+    names[number] = strdup (name);
     if (names[number] == NULL)
     {
       status = -1;
@@ -623,12 +1274,12 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
     }
 
     number++;
-  } /* while (c_avl_iterator_next) */
+  } /* while (uc_iterator_next) */
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+  uc_iterator_destroy (iter);
 
-  if (status != 0)
+  /* A positive status marks the end of the list. */
+  if (status < 0)
   {
     size_t i;
     
@@ -637,6 +1288,7 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
       sfree (names[i]);
     }
     sfree (names);
+    sfree (times);
 
     return (-1);
   }
@@ -644,6 +1296,8 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
+  else
+    sfree (times);
   *ret_number = number;
 
   return (0);
@@ -663,7 +1317,7 @@ int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
     ret = ce->state;
@@ -688,7 +1342,7 @@ int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
     ret = ce->state;
@@ -709,7 +1363,7 @@ int uc_get_history_by_name (const char *name,
 
   pthread_mutex_lock (&cache_lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
+  status = cache_lookup (name, &ce);
   if (status != 0)
   {
     pthread_mutex_unlock (&cache_lock);
@@ -797,7 +1451,7 @@ int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
     ret = ce->hits;
@@ -822,7 +1476,7 @@ int uc_set_hits (const data_set_t *ds, const value_list_t *vl, int hits)
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
     ret = ce->hits;
@@ -848,7 +1502,7 @@ int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
 
   pthread_mutex_lock (&cache_lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if (cache_lookup (name, &ce) == 0)
   {
     assert (ce != NULL);
     ret = ce->hits;
@@ -879,7 +1533,7 @@ static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
 
   pthread_mutex_lock (&cache_lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
+  status = cache_lookup (name, &ce);
   if (status != 0)
   {
     pthread_mutex_unlock (&cache_lock);
@@ -29,14 +29,67 @@
 #define STATE_ERROR    2
 #define STATE_MISSING 15
 
+/* Rates of a value list, as computed by uc_update_dispatch. `rates' is
+ * provided by the caller and must have room for `rates_num' values. */
+struct uc_rates_s
+{
+  gauge_t *rates;
+  size_t   rates_num;
+
+  /* Private members */
+  const value_list_t *vl;
+  cdtime_t time;
+  _Bool valid;
+  struct uc_rates_s *prev;
+};
+typedef struct uc_rates_s uc_rates_t;
+
 int uc_init (void);
 int uc_check_timeout (void);
 int uc_update (const data_set_t *ds, const value_list_t *vl);
+
+/*
+ * uc_update_dispatch, uc_update_dispatch_done
+ *
+ * Like uc_update, but also stores the rates computed for `vl' in `r'. Until
+ * uc_update_dispatch_done is called, uc_get_rate and uc_get_rate_into return
+ * these rates for `vl' when called from the same thread, without looking the
+ * value list up in the cache. Used by plugin_dispatch_values, so write
+ * callbacks get the rates cheaply.
+ */
+int uc_update_dispatch (const data_set_t *ds, const value_list_t *vl,
+    uc_rates_t *r);
+void uc_update_dispatch_done (uc_rates_t *r);
+
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
+/* Copies the rates of `vl' to `ret_rates', which must have room for exactly
+ * ds->ds_num values. Returns zero on success. */
+int uc_get_rate_into (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates, size_t ret_rates_num);
 
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * Iterator interface
+ *
+ * Returns the names in the cache in ascending order, skipping missing values.
+ * The names are copied from the cache in chunks, and the cache is locked only
+ * while a chunk is copied. Values may therefore be added or removed while
+ * iterating: values present during the whole iteration are returned exactly
+ * once, others may or may not be returned. uc_iterator_next returns zero upon
+ * success, a positive value at the end and a negative value if an error
+ * occurred. The returned name is valid until the next call. uc_iterator_get_time returns the time of the
+ * value returned last, as seen when its chunk was copied.
+ */
+struct uc_iterator_s;
+typedef struct uc_iterator_s uc_iterator_t;
+
+uc_iterator_t *uc_get_iterator (void);
+int uc_iterator_next (uc_iterator_t *iter, const char **ret_name);
+int uc_iterator_get_time (uc_iterator_t *iter, cdtime_t *ret_time);
+void uc_iterator_destroy (uc_iterator_t *iter);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
@@ -26,18 +26,37 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
+/* Rates of one of the identifiers given to GETVAL. `values' is NULL if the
+ * lookup failed. */
+struct getval_result_s
+{
+  char *identifier;
+  const data_set_t *ds;
+  gauge_t *values;
+};
+typedef struct getval_result_s getval_result_t;
+
+#define free_everything_and_return(status) do { \
+    size_t j; \
+    for (j = 0; j < results_num; j++) \
+      sfree (results[j].values); \
+    sfree (results); \
+    return (status); \
+  } while (0)
+
 #define print_to_socket(fh, ...) \
   if (fprintf (fh, __VA_ARGS__) < 0) { \
     char errbuf[1024]; \
     WARNING ("handle_getval: failed to write to socket #%i: %s", \
 	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
-    return -1; \
+    free_everything_and_return (-1); \
   }
 
-int handle_getval (FILE *fh, char *buffer)
+/* Looks up the rates of `res->identifier'. Upon failure, an error message is
+ * written to `errmsg'. */
+static int getval_lookup (getval_result_t *res,
+    char *errmsg, size_t errmsg_size)
 {
-  char *command;
-  char *identifier;
   char *identifier_copy;
 
   char *hostname;
@@ -51,55 +70,19 @@ int handle_getval (FILE *fh, char *buffer)
   const data_set_t *ds;
 
   int   status;
-  size_t i;
-
-  if ((fh == NULL) || (buffer == NULL))
-    return (-1);
-
-  DEBUG ("utils_cmd_getval: handle_getval (fh = %p, buffer = %s);",
-      (void *) fh, buffer);
-
-  command = NULL;
-  status = parse_string (&buffer, &command);
-  if (status != 0)
-  {
-    print_to_socket (fh, "-1 Cannot parse command.\n");
-    return (-1);
-  }
-  assert (command != NULL);
-
-  if (strcasecmp ("GETVAL", command) != 0)
-  {
-    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
-    return (-1);
-  }
-
-  identifier = NULL;
-  status = parse_string (&buffer, &identifier);
-  if (status != 0)
-  {
-    print_to_socket (fh, "-1 Cannot parse identifier.\n");
-    return (-1);
-  }
-  assert (identifier != NULL);
-
-  if (*buffer != 0)
-  {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    return (-1);
-  }
 
   /* parse_identifier() modifies its first argument,
    * returning pointers into it */
-  identifier_copy = sstrdup (identifier);
+  identifier_copy = sstrdup (res->identifier);
 
   status = parse_identifier (identifier_copy, &hostname,
       &plugin, &plugin_instance,
       &type, &type_instance);
   if (status != 0)
   {
-    DEBUG ("handle_getval: Cannot parse identifier `%s'.", identifier);
-    print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n", identifier);
+    DEBUG ("handle_getval: Cannot parse identifier `%s'.", res->identifier);
+    ssnprintf (errmsg, errmsg_size, "Cannot parse identifier `%s'.",
+        res->identifier);
     sfree (identifier_copy);
     return (-1);
   }
@@ -108,17 +91,17 @@ int handle_getval (FILE *fh, char *buffer)
   if (ds == NULL)
   {
     DEBUG ("handle_getval: plugin_get_ds (%s) == NULL;", type);
-    print_to_socket (fh, "-1 Type `%s' is unknown.\n", type);
+    ssnprintf (errmsg, errmsg_size, "Type `%s' is unknown.", type);
     sfree (identifier_copy);
     return (-1);
   }
 
   values = NULL;
   values_num = 0;
-  status = uc_get_rate_by_name (identifier, &values, &values_num);
+  status = uc_get_rate_by_name (res->identifier, &values, &values_num);
   if (status != 0)
   {
-    print_to_socket (fh, "-1 No such value\n");
+    sstrncpy (errmsg, "No such value", errmsg_size);
     sfree (identifier_copy);
     return (-1);
   }
@@ -128,31 +111,157 @@ int handle_getval (FILE *fh, char *buffer)
     ERROR ("ds[%s]->ds_num = %i, "
 	"but uc_get_rate_by_name returned %u values.",
 	ds->type, ds->ds_num, (unsigned int) values_num);
-    print_to_socket (fh, "-1 Error reading value from cache.\n");
+    sstrncpy (errmsg, "Error reading value from cache.", errmsg_size);
     sfree (values);
     sfree (identifier_copy);
     return (-1);
   }
 
-  print_to_socket (fh, "%u Value%s found\n", (unsigned int) values_num,
-      (values_num == 1) ? "" : "s");
-  for (i = 0; i < values_num; i++)
+  res->ds = ds;
+  res->values = values;
+
+  sfree (identifier_copy);
+  return (0);
+} /* int getval_lookup */
+
+int handle_getval (FILE *fh, char *buffer)
+{
+  char *command;
+  getval_result_t *results = NULL;
+  size_t results_num = 0;
+  size_t values_num = 0;
+  size_t missing_num = 0;
+  char errmsg[1024];
+
+  int   status;
+  size_t i;
+  size_t j;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  DEBUG ("utils_cmd_getval: handle_getval (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
   {
-    print_to_socket (fh, "%s=", ds->ds[i].name);
-    if (isnan (values[i]))
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    free_everything_and_return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("GETVAL", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    free_everything_and_return (-1);
+  }
+
+  /* GETVAL accepts any number of identifiers. The number is limited by the
+   * length of the command line, so looking them all up first is cheap. */
+  do
+  {
+    getval_result_t *tmp;
+    char *identifier = NULL;
+
+    status = parse_string (&buffer, &identifier);
+    if (status != 0)
     {
-      print_to_socket (fh, "NaN\n");
+      print_to_socket (fh, "-1 Cannot parse identifier.\n");
+      free_everything_and_return (-1);
     }
-    else
+    assert (identifier != NULL);
+
+    tmp = realloc (results, (results_num + 1) * sizeof (*results));
+    if (tmp == NULL)
     {
-      print_to_socket (fh, "%12e\n", values[i]);
+      print_to_socket (fh, "-1 Out of memory.\n");
+      free_everything_and_return (-1);
     }
+    results = tmp;
+    memset (results + results_num, 0, sizeof (*results));
+    results[results_num].identifier = identifier;
+    results_num++;
+  } while (*buffer != 0);
+
+  /* With a single identifier, lookup errors are reported to the client and
+   * the values are printed without the identifier. */
+  if (results_num == 1)
+  {
+    if (getval_lookup (results, errmsg, sizeof (errmsg)) != 0)
+    {
+      print_to_socket (fh, "-1 %s\n", errmsg);
+      free_everything_and_return (-1);
+    }
+
+    values_num = (size_t) results[0].ds->ds_num;
+    print_to_socket (fh, "%u Value%s found\n", (unsigned int) values_num,
+        (values_num == 1) ? "" : "s");
+    for (i = 0; i < values_num; i++)
+    {
+      print_to_socket (fh, "%s=", results[0].ds->ds[i].name);
+      if (isnan (results[0].values[i]))
+      {
+        print_to_socket (fh, "NaN\n");
+      }
+      else
+      {
+        print_to_socket (fh, "%12e\n", results[0].values[i]);
+      }
+    }
+
+    free_everything_and_return (0);
   }
 
-  sfree (values);
-  sfree (identifier_copy);
+  for (i = 0; i < results_num; i++)
+  {
+    if (getval_lookup (results + i, errmsg, sizeof (errmsg)) != 0)
+    {
+      DEBUG ("handle_getval: %s: %s", results[i].identifier, errmsg);
+      missing_num++;
+      continue;
+    }
+    values_num += (size_t) results[i].ds->ds_num;
+  }
 
-  return (0);
+  if (missing_num > 0)
+  {
+    print_to_socket (fh, "%u Value%s found, %u identifier%s not found\n",
+        (unsigned int) values_num, (values_num == 1) ? "" : "s",
+        (unsigned int) missing_num, (missing_num == 1) ? "" : "s");
+  }
+  else
+  {
+    print_to_socket (fh, "%u Value%s found\n", (unsigned int) values_num,
+        (values_num == 1) ? "" : "s");
+  }
+
+  for (i = 0; i < results_num; i++)
+  {
+    char identifier[2 * 6 * DATA_MAX_NAME_LEN];
+
+    if (results[i].values == NULL)
+      continue;
+
+    sstrncpy (identifier, results[i].identifier, sizeof (identifier));
+    escape_string (identifier, sizeof (identifier));
+
+    for (j = 0; j < (size_t) results[i].ds->ds_num; j++)
+    {
+      print_to_socket (fh, "%s %s=", identifier, results[i].ds->ds[j].name);
+      if (isnan (results[i].values[j]))
+      {
+        print_to_socket (fh, "NaN\n");
+      }
+      else
+      {
+        print_to_socket (fh, "%12e\n", results[i].values[j]);
+      }
+    }
+  }
+
+  free_everything_and_return (0);
 } /* int handle_getval */
 
 /* vim: set sw=2 sts=2 ts=8 : */
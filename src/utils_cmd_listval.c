@@ -27,14 +27,30 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
+#include <regex.h>
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
+
+/* Number of values sent per block if the "chunked" option is given. */
+#define LISTVAL_CHUNK_SIZE 256
+
+/* Lines which have not been sent yet. */
+struct listval_output_s
+{
+  char  *buffer;
+  size_t buffer_len;
+  size_t buffer_size;
+  size_t lines_num;
+};
+typedef struct listval_output_s listval_output_t;
+
 #define free_everything_and_return(status) do { \
-    size_t j; \
-    for (j = 0; j < number; j++) { \
-      sfree(names[j]); \
-      names[j] = NULL; \
-    } \
-    sfree(names); \
-    sfree(times); \
+    if (iter != NULL) \
+      uc_iterator_destroy (iter); \
+    if (have_regex) \
+      regfree (&regex); \
+    sfree (out.buffer); \
     return (status); \
   } while (0)
 
@@ -46,15 +62,69 @@
     free_everything_and_return (-1); \
   }
 
+static int listval_append (listval_output_t *out,
+    cdtime_t time, const char *name)
+{
+  while (42)
+  {
+    size_t available = out->buffer_size - out->buffer_len;
+    size_t new_size;
+    int status = 0;
+    char *tmp;
+
+    if (out->buffer != NULL)
+      status = ssnprintf (out->buffer + out->buffer_len, available,
+          "%.3f %s\n", CDTIME_T_TO_DOUBLE (time), name);
+    if ((out->buffer != NULL) && (status >= 0)
+        && ((size_t) status < available))
+    {
+      out->buffer_len += (size_t) status;
+      out->lines_num++;
+      return (0);
+    }
+
+    new_size = (out->buffer_size == 0) ? 4096 : 2 * out->buffer_size;
+    tmp = realloc (out->buffer, new_size);
+    if (tmp == NULL)
+      return (-1);
+    out->buffer = tmp;
+    out->buffer_size = new_size;
+  }
+} /* int listval_append */
+
+/* Sends the status line and the lines collected so far. */
+static int listval_flush (FILE *fh, listval_output_t *out)
+{
+  if ((fprintf (fh, "%i Value%s found\n", (int) out->lines_num,
+          (out->lines_num == 1) ? "" : "s") < 0)
+      || (fwrite (out->buffer, 1, out->buffer_len, fh) != out->buffer_len))
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  out->buffer_len = 0;
+  out->lines_num = 0;
+  return (0);
+} /* int listval_flush */
+
 int handle_listval (FILE *fh, char *buffer)
 {
   char *command;
-  char **names = NULL;
-  cdtime_t *times = NULL;
+  char *glob = NULL;
+  regex_t regex;
+  _Bool have_regex = 0;
+  _Bool chunked = 0;
+  uc_iterator_t *iter = NULL;
+  listval_output_t out;
+  const char *name;
   size_t number = 0;
-  size_t i;
   int status;
 
+  memset (&out, 0, sizeof (out));
+
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
       (void *) fh, buffer);
 
@@ -73,25 +143,99 @@ int handle_listval (FILE *fh, char *buffer)
     free_everything_and_return (-1);
   }
 
-  if (*buffer != 0)
+  while (*buffer != 0)
   {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    status = parse_option (&buffer, &opt_key, &opt_value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Parsing options failed.\n");
+      free_everything_and_return (-1);
+    }
+
+    if ((strcasecmp ("glob", opt_key) == 0) && (glob == NULL))
+    {
+#if HAVE_FNMATCH_H
+      glob = opt_value;
+#else
+      print_to_socket (fh, "-1 Option `glob' is not supported.\n");
+      free_everything_and_return (-1);
+#endif
+    }
+    else if ((strcasecmp ("regex", opt_key) == 0) && !have_regex)
+    {
+      if (regcomp (&regex, opt_value, REG_EXTENDED | REG_NOSUB) != 0)
+      {
+        print_to_socket (fh, "-1 Compiling the regular expression `%s' "
+            "failed.\n", opt_value);
+        free_everything_and_return (-1);
+      }
+      have_regex = 1;
+    }
+    else if (strcasecmp ("chunked", opt_key) == 0)
+    {
+      chunked = IS_TRUE (opt_value);
+    }
+    else
+    {
+      print_to_socket (fh, "-1 Cannot parse option %s\n", opt_key);
+      free_everything_and_return (-1);
+    }
+  } /* while (*buffer != 0) */
+
+  iter = uc_get_iterator ();
+  if (iter == NULL)
+  {
+    print_to_socket (fh, "-1 uc_get_iterator failed.\n");
     free_everything_and_return (-1);
   }
 
-  status = uc_get_names (&names, &times, &number);
-  if (status != 0)
+  /* The cache is only locked while the iterator copies the next chunk of
+   * names, so filtering and writing don't block other threads. */
+  while ((status = uc_iterator_next (iter, &name)) == 0)
+  {
+    cdtime_t time = 0;
+
+#if HAVE_FNMATCH_H
+    if ((glob != NULL) && (fnmatch (glob, name, /* flags = */ 0) != 0))
+      continue;
+#endif
+    if (have_regex && (regexec (&regex, name, 0, NULL, 0) != 0))
+      continue;
+
+    uc_iterator_get_time (iter, &time);
+    if (listval_append (&out, time, name) != 0)
+    {
+      ERROR ("handle_listval: listval_append failed.");
+      print_to_socket (fh, "-1 Out of memory.\n");
+      free_everything_and_return (-1);
+    }
+    number++;
+
+    if (chunked && (out.lines_num >= LISTVAL_CHUNK_SIZE)
+        && (listval_flush (fh, &out) != 0))
+      free_everything_and_return (-1);
+  }
+
+  /* Don't let a failure look like the end of the list. With the "chunked"
+   * option, this ends the values sent so far with an error status. */
+  if (status < 0)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
+    ERROR ("handle_listval: Reading the value cache failed.");
+    print_to_socket (fh, "-1 Reading the value cache failed.\n");
     free_everything_and_return (-1);
   }
 
-  print_to_socket (fh, "%i Value%s found\n",
-      (int) number, (number == 1) ? "" : "s");
-  for (i = 0; i < number; i++)
-    print_to_socket (fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE (times[i]),
-       	names[i]);
+  /* Without the "chunked" option, all values are sent as one block, because
+   * the status line has to state the number of values. */
+  if ((!chunked || (out.lines_num > 0)) && (listval_flush (fh, &out) != 0))
+    free_everything_and_return (-1);
+
+  if (chunked)
+    print_to_socket (fh, "0 Done: %i value%s found\n",
+        (int) number, (number == 1) ? "" : "s");
 
   free_everything_and_return (0);
 } /* int handle_listval */
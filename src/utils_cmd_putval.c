@@ -25,6 +25,8 @@
 
 #include "utils_parse_option.h"
 
+#include "utils_cmd_putval.h"
+
 #define print_to_socket(fh, ...) \
 	if (fprintf (fh, __VA_ARGS__) < 0) { \
 		char errbuf[1024]; \
@@ -33,22 +35,6 @@
 		return -1; \
 	}
 
-static int dispatch_values (const data_set_t *ds, value_list_t *vl,
-	       	FILE *fh, char *buffer)
-{
-	int status;
-
-	status = parse_values (buffer, vl, ds);
-	if (status != 0)
-	{
-		print_to_socket (fh, "-1 Parsing the values string failed.\n");
-		return (-1);
-	}
-
-	plugin_dispatch_values (vl);
-	return (0);
-} /* int dispatch_values */
-
 static int set_option (value_list_t *vl, const char *key, const char *value)
 {
 	if ((vl == NULL) || (key == NULL) || (value == NULL))
@@ -73,7 +59,12 @@ static int set_option (value_list_t *vl, const char *key, const char *value)
 	return (0);
 } /* int parse_option */
 
-int handle_putval (FILE *fh, char *buffer)
+/* Parses a PUTVAL command and dispatches its values. The data set and the
+ * values buffer are kept in `pb' for the next command. Returns the number of
+ * values dispatched or -1 on failure, in which case an error message is
+ * stored in `errmsg'. */
+static int putval_dispatch (putval_batch_t *pb, char *buffer, /* {{{ */
+		char *errmsg, size_t errmsg_size)
 {
 	char *command;
 	char *identifier;
@@ -85,26 +76,22 @@ int handle_putval (FILE *fh, char *buffer)
 	int   status;
 	int   values_submitted;
 
-	char *identifier_copy;
+	char identifier_copy[6 * DATA_MAX_NAME_LEN];
 
-	const data_set_t *ds;
 	value_list_t vl = VALUE_LIST_INIT;
 
-	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
-			(void *) fh, buffer);
-
 	command = NULL;
 	status = parse_string (&buffer, &command);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse command.\n");
+		ssnprintf (errmsg, errmsg_size, "Cannot parse command.");
 		return (-1);
 	}
 	assert (command != NULL);
 
 	if (strcasecmp ("PUTVAL", command) != 0)
 	{
-		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		ssnprintf (errmsg, errmsg_size, "Unexpected command: `%s'.", command);
 		return (-1);
 	}
 
@@ -112,14 +99,19 @@ int handle_putval (FILE *fh, char *buffer)
 	status = parse_string (&buffer, &identifier);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse identifier.\n");
+		ssnprintf (errmsg, errmsg_size, "Cannot parse identifier.");
 		return (-1);
 	}
 	assert (identifier != NULL);
 
 	/* parse_identifier() modifies its first argument,
 	 * returning pointers into it */
-	identifier_copy = sstrdup (identifier);
+	if (strlen (identifier) >= sizeof (identifier_copy))
+	{
+		ssnprintf (errmsg, errmsg_size, "Identifier too long.");
+		return (-1);
+	}
+	sstrncpy (identifier_copy, identifier, sizeof (identifier_copy));
 
 	status = parse_identifier (identifier_copy, &hostname,
 			&plugin, &plugin_instance,
@@ -128,9 +120,8 @@ int handle_putval (FILE *fh, char *buffer)
 	{
 		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
 				identifier);
-		print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n",
+		ssnprintf (errmsg, errmsg_size, "Cannot parse identifier `%s'.",
 				identifier);
-		sfree (identifier_copy);
 		return (-1);
 	}
 
@@ -141,8 +132,7 @@ int handle_putval (FILE *fh, char *buffer)
 			|| ((type_instance != NULL)
 				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
 	{
-		print_to_socket (fh, "-1 Identifier too long.\n");
-		sfree (identifier_copy);
+		ssnprintf (errmsg, errmsg_size, "Identifier too long.");
 		return (-1);
 	}
 
@@ -154,27 +144,36 @@ int handle_putval (FILE *fh, char *buffer)
 	if (type_instance != NULL)
 		sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
 
-	ds = plugin_get_ds (type);
-	if (ds == NULL) {
-		print_to_socket (fh, "-1 Type `%s' isn't defined.\n", type);
-		sfree (identifier_copy);
-		return (-1);
-	}
-
-	/* Free identifier_copy */
-	hostname = NULL;
-	plugin = NULL; plugin_instance = NULL;
-	type = NULL;   type_instance = NULL;
-	sfree (identifier_copy);
-
-	vl.values_len = ds->ds_num;
-	vl.values = (value_t *) malloc (vl.values_len * sizeof (value_t));
-	if (vl.values == NULL)
+	/* Only look up the data set if the type differs from the previous
+	 * command's. */
+	if ((pb->ds == NULL) || (strcmp (pb->ds->type, type) != 0))
 	{
-		print_to_socket (fh, "-1 malloc failed.\n");
-		return (-1);
+		pb->ds = plugin_get_ds (type);
+		if (pb->ds == NULL)
+		{
+			ssnprintf (errmsg, errmsg_size, "Type `%s' isn't defined.", type);
+			return (-1);
+		}
+
+		if (pb->values_size < (size_t) pb->ds->ds_num)
+		{
+			value_t *tmp;
+
+			tmp = realloc (pb->values, pb->ds->ds_num * sizeof (*pb->values));
+			if (tmp == NULL)
+			{
+				pb->ds = NULL;
+				ssnprintf (errmsg, errmsg_size, "malloc failed.");
+				return (-1);
+			}
+			pb->values = tmp;
+			pb->values_size = (size_t) pb->ds->ds_num;
+		}
 	}
 
+	vl.values = pb->values;
+	vl.values_len = pb->ds->ds_num;
+
 	/* All the remaining fields are part of the optionlist. */
 	values_submitted = 0;
 	while (*buffer != 0)
@@ -187,7 +186,7 @@ int handle_putval (FILE *fh, char *buffer)
 		{
 			/* parse_option failed, buffer has been modified.
 			 * => we need to abort */
-			print_to_socket (fh, "-1 Misformatted option.\n");
+			ssnprintf (errmsg, errmsg_size, "Misformatted option.");
 			return (-1);
 		}
 		else if (status == 0)
@@ -203,30 +202,93 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_string (&buffer, &string);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Misformatted value.\n");
+			ssnprintf (errmsg, errmsg_size, "Misformatted value.");
 			return (-1);
 		}
 		assert (string != NULL);
 
-		status = dispatch_values (ds, &vl, fh, string);
+		status = parse_values (string, &vl, pb->ds);
 		if (status != 0)
 		{
-			/* An error has already been printed. */
+			ssnprintf (errmsg, errmsg_size,
+					"Parsing the values string failed.");
 			return (-1);
 		}
+
+		plugin_dispatch_values (&vl);
 		values_submitted++;
 	} /* while (*buffer != 0) */
 	/* Done parsing the options. */
 
+	return (values_submitted);
+} /* }}} int putval_dispatch */
+
+int handle_putval (FILE *fh, char *buffer)
+{
+	putval_batch_t pb;
+	char errmsg[1024];
+	int values_submitted;
+
+	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	memset (&pb, 0, sizeof (pb));
+
+	values_submitted = putval_dispatch (&pb, buffer, errmsg, sizeof (errmsg));
+	putval_batch_destroy (&pb);
+
+	if (values_submitted < 0)
+	{
+		print_to_socket (fh, "-1 %s\n", errmsg);
+		return (-1);
+	}
+
 	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
 			values_submitted,
 			(values_submitted == 1) ? "value has" : "values have");
 
-	sfree (vl.values); 
-
 	return (0);
 } /* int handle_putval */
 
+int handle_putval_batch (putval_batch_t *pb, char *buffer) /* {{{ */
+{
+	char errmsg[sizeof (pb->error)];
+	int values_submitted;
+
+	pb->commands_num++;
+
+	values_submitted = putval_dispatch (pb, buffer, errmsg, sizeof (errmsg));
+	if (values_submitted < 0)
+	{
+		if (pb->errors_num == 0)
+			ssnprintf (pb->error, sizeof (pb->error), "command #%i: %s",
+					pb->commands_num, errmsg);
+		pb->errors_num++;
+		return (-1);
+	}
+
+	pb->values_num += values_submitted;
+	return (0);
+} /* }}} int handle_putval_batch */
+
+void putval_batch_reset (putval_batch_t *pb) /* {{{ */
+{
+	pb->commands_num = 0;
+	pb->values_num = 0;
+	pb->errors_num = 0;
+	pb->error[0] = 0;
+} /* }}} void putval_batch_reset */
+
+void putval_batch_destroy (putval_batch_t *pb) /* {{{ */
+{
+	if (pb == NULL)
+		return;
+
+	sfree (pb->values);
+	pb->values_size = 0;
+	pb->ds = NULL;
+} /* }}} void putval_batch_destroy */
+
 int create_putval (char *ret, size_t ret_len, /* {{{ */
 	const data_set_t *ds, const value_list_t *vl)
 {
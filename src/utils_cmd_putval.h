@@ -26,8 +26,36 @@
 
 #include "plugin.h"
 
+/* State of a batch of PUTVAL commands. The data set and the values buffer
+ * are kept between commands, so data sets are only looked up when the type
+ * changes and no memory is allocated per command. Initialize with zeros. */
+struct putval_batch_s
+{
+	const data_set_t *ds;
+	value_t *values;
+	size_t values_size;
+
+	int commands_num;
+	int values_num;
+	int errors_num;
+	/* error message of the first failed command */
+	char error[256];
+};
+typedef struct putval_batch_s putval_batch_t;
+
 int handle_putval (FILE *fh, char *buffer);
 
+/* Handles a PUTVAL command like `handle_putval', but doesn't print a
+ * response. Instead, the commands, dispatched values and failures are counted
+ * in `pb'. Returns zero upon success and non-zero otherwise. */
+int handle_putval_batch (putval_batch_t *pb, char *buffer);
+
+/* Resets the counters of `pb', keeping the cached data. */
+void putval_batch_reset (putval_batch_t *pb);
+
+/* Frees the memory held by `pb', but not `pb' itself. */
+void putval_batch_destroy (putval_batch_t *pb);
+
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
 
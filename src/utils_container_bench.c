@@ -0,0 +1,334 @@
+/**
+ * collectd - src/utils_container_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Compares the AVL tree (`utils_avltree.h'), the B-tree (`utils_btree.h')
+ *   and the hash table (`utils_htable.h') using keys that look like the
+ *   identifiers used by the value cache. Before timing anything, all three
+ *   containers are run through the same random sequence of operations and
+ *   their results are compared.
+ *
+ *   Usage: utils_container_bench [<number of keys>]
+ **/
+
+#include "collectd.h"
+#include "utils_avltree.h"
+#include "utils_btree.h"
+#include "utils_htable.h"
+
+#include <time.h>
+
+struct bench_container_s
+{
+	const char *name;
+	_Bool ordered;
+	void *(*create) (void);
+	void (*destroy) (void *);
+	int (*insert) (void *, void *, void *);
+	int (*get) (void *, const void *, void **);
+	int (*remove) (void *, const void *, void **, void **);
+	int (*size) (void *);
+	/* Iterates over all entries and returns the number of entries seen, or
+	 * -1 if the keys were not returned in order but should have been. */
+	int (*iterate) (void *, _Bool);
+};
+typedef struct bench_container_s bench_container_t;
+
+static double bench_now (void) /* {{{ */
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1e9));
+} /* }}} double bench_now */
+
+/*
+ * Adapters
+ */
+static void *avl_create (void) /* {{{ */
+{
+	return (c_avl_create ((void *) strcmp));
+} /* }}} void *avl_create */
+
+static int avl_iterate (void *t, _Bool ordered) /* {{{ */
+{
+	c_avl_iterator_t *iter = c_avl_get_iterator (t);
+	const char *prev = NULL;
+	void *key;
+	void *value;
+	int num = 0;
+
+	while (c_avl_iterator_next (iter, &key, &value) == 0)
+	{
+		if (ordered && (prev != NULL) && (strcmp (prev, key) >= 0))
+			num = -1;
+		if (num >= 0)
+			num++;
+		prev = key;
+	}
+	c_avl_iterator_destroy (iter);
+
+	return (num);
+} /* }}} int avl_iterate */
+
+static void *btree_create (void) /* {{{ */
+{
+	return (c_btree_create ((void *) strcmp));
+} /* }}} void *btree_create */
+
+static int btree_iterate (void *t, _Bool ordered) /* {{{ */
+{
+	c_btree_iterator_t *iter = c_btree_get_iterator (t);
+	const char *prev = NULL;
+	void *key;
+	void *value;
+	int num = 0;
+
+	while (c_btree_iterator_next (iter, &key, &value) == 0)
+	{
+		if (ordered && (prev != NULL) && (strcmp (prev, key) >= 0))
+			num = -1;
+		if (num >= 0)
+			num++;
+		prev = key;
+	}
+	c_btree_iterator_destroy (iter);
+
+	return (num);
+} /* }}} int btree_iterate */
+
+static void *htable_create (void) /* {{{ */
+{
+	return (c_htable_create (c_htable_hash_string, (void *) strcmp));
+} /* }}} void *htable_create */
+
+static int htable_iterate (void *t, _Bool ordered) /* {{{ */
+{
+	c_htable_iterator_t *iter = c_htable_get_iterator (t);
+	void *key;
+	void *value;
+	int num = 0;
+
+	(void) ordered;
+
+	while (c_htable_iterator_next (iter, &key, &value) == 0)
+		num++;
+	c_htable_iterator_destroy (iter);
+
+	return (num);
+} /* }}} int htable_iterate */
+
+static bench_container_t containers[] =
+{
+	{ "c_avl", 1, avl_create, (void *) c_avl_destroy,
+		(void *) c_avl_insert, (void *) c_avl_get, (void *) c_avl_remove,
+		(void *) c_avl_size, avl_iterate },
+	{ "c_btree", 1, btree_create, (void *) c_btree_destroy,
+		(void *) c_btree_insert, (void *) c_btree_get, (void *) c_btree_remove,
+		(void *) c_btree_size, btree_iterate },
+	{ "c_htable", 0, htable_create, (void *) c_htable_destroy,
+		(void *) c_htable_insert, (void *) c_htable_get,
+		(void *) c_htable_remove, (void *) c_htable_size, htable_iterate }
+};
+static size_t containers_num = sizeof (containers) / sizeof (containers[0]);
+
+/*
+ * Tests
+ */
+static void bench_shuffle (char **keys, size_t keys_num) /* {{{ */
+{
+	size_t i;
+
+	for (i = keys_num - 1; i > 0; i--)
+	{
+		size_t j = ((size_t) random ()) % (i + 1);
+		char *tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+} /* }}} void bench_shuffle */
+
+/* Runs the same random operations on all containers and compares the
+ * results. */
+static int bench_check (char **keys, size_t keys_num) /* {{{ */
+{
+	void *t[containers_num];
+	long ops = 20 * ((long) keys_num);
+	int expected_size;
+	int errors = 0;
+	size_t i;
+	long op;
+
+	for (i = 0; i < containers_num; i++)
+		t[i] = containers[i].create ();
+
+	for (op = 0; op < ops; op++)
+	{
+		char *key = keys[((size_t) random ()) % keys_num];
+		int what = (int) (random () % 3);
+		int expected = 0;
+
+		for (i = 0; i < containers_num; i++)
+		{
+			void *value = NULL;
+			int status;
+
+			if (what == 0)
+				status = containers[i].insert (t[i], key, key);
+			else if (what == 1)
+				status = containers[i].remove (t[i], key, NULL, &value);
+			else
+				status = containers[i].get (t[i], key, &value);
+
+			status = (status == 0) ? 0 : 1;
+			if ((status == 0) && (what != 0) && (value != key))
+				status = 2;
+
+			if (i == 0)
+				expected = status;
+			else if (status != expected)
+			{
+				if (errors < 10)
+					fprintf (stderr, "%s: operation %i on \"%s\" returned %i, "
+							"expected %i.\n", containers[i].name, what, key,
+							status, expected);
+				errors++;
+			}
+		}
+	}
+
+	expected_size = containers[0].size (t[0]);
+	for (i = 0; i < containers_num; i++)
+	{
+		int num = containers[i].iterate (t[i], containers[i].ordered);
+		if ((num != expected_size) || (containers[i].size (t[i]) != num))
+		{
+			fprintf (stderr, "%s: iterated over %i entries, size is %i, "
+					"expected %i.\n", containers[i].name, num,
+					containers[i].size (t[i]), expected_size);
+			errors++;
+		}
+		containers[i].destroy (t[i]);
+	}
+
+	printf ("check: %ld random operations, %i errors\n", ops, errors);
+	return ((errors == 0) ? 0 : -1);
+} /* }}} int bench_check */
+
+static void bench_run (bench_container_t *c, /* {{{ */
+		char **keys, char **misses, size_t keys_num)
+{
+	double t[6];
+	void *tree;
+	void *value;
+	size_t found = 0;
+	size_t i;
+
+	tree = c->create ();
+
+	t[0] = bench_now ();
+	for (i = 0; i < keys_num; i++)
+		c->insert (tree, keys[i], keys[i]);
+	t[1] = bench_now ();
+	for (i = 0; i < keys_num; i++)
+		if (c->get (tree, keys[(i * 7919) % keys_num], &value) == 0)
+			found++;
+	t[2] = bench_now ();
+	for (i = 0; i < keys_num; i++)
+		if (c->get (tree, misses[i], &value) == 0)
+			found++;
+	t[3] = bench_now ();
+	c->iterate (tree, /* ordered = */ 0);
+	t[4] = bench_now ();
+	for (i = 0; i < keys_num; i++)
+		c->remove (tree, keys[i], NULL, NULL);
+	t[5] = bench_now ();
+
+	c->destroy (tree);
+
+	printf ("  %-10s %8.1f %8.1f %8.1f %8.1f %8.1f%s\n", c->name,
+			1e9 * (t[1] - t[0]) / keys_num, 1e9 * (t[2] - t[1]) / keys_num,
+			1e9 * (t[3] - t[2]) / keys_num, 1e9 * (t[4] - t[3]) / keys_num,
+			1e9 * (t[5] - t[4]) / keys_num,
+			(found == keys_num) ? "" : "  (lookup errors!)");
+} /* }}} void bench_run */
+
+static char *bench_key (size_t n, _Bool miss) /* {{{ */
+{
+	char buffer[256];
+	_Bool cpu = (n / 8) % 2;
+
+	/* Many keys share long prefixes, like identifiers in the cache do. */
+	snprintf (buffer, sizeof (buffer),
+			"host%04zu.example.com/%s-%zu/%s-%zu%s",
+			n / 64, cpu ? "cpu" : "interface", (n / 16) % 4,
+			cpu ? "cpu" : "if_octets", n % 8, miss ? "-missing" : "");
+
+	return (strdup (buffer));
+} /* }}} char *bench_key */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	char **keys;
+	char **misses;
+	size_t keys_num = 100000;
+	int status;
+	size_t i;
+
+	if (argc >= 2)
+		keys_num = (size_t) atol (argv[1]);
+	if (keys_num < 1)
+		keys_num = 1;
+
+	keys = calloc (keys_num, sizeof (*keys));
+	misses = calloc (keys_num, sizeof (*misses));
+	if ((keys == NULL) || (misses == NULL))
+		return (EXIT_FAILURE);
+
+	for (i = 0; i < keys_num; i++)
+	{
+		keys[i] = bench_key (i, /* miss = */ 0);
+		misses[i] = bench_key (i, /* miss = */ 1);
+		if ((keys[i] == NULL) || (misses[i] == NULL))
+			return (EXIT_FAILURE);
+	}
+
+	srandom (42);
+	status = bench_check (keys, keys_num);
+
+	bench_shuffle (keys, keys_num);
+	printf ("%zu keys, ns/operation:\n", keys_num);
+	printf ("  %-10s %8s %8s %8s %8s %8s\n", "",
+			"insert", "get", "get-miss", "iterate", "remove");
+	for (i = 0; i < containers_num; i++)
+		bench_run (containers + i, keys, misses, keys_num);
+
+	for (i = 0; i < keys_num; i++)
+	{
+		free (keys[i]);
+		free (misses[i]);
+	}
+	free (keys);
+	free (misses);
+
+	return ((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
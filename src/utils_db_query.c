@@ -62,6 +62,12 @@ struct udb_result_preparation_area_s /* {{{ */
   char  **instances_buffer;
   char  **values_buffer;
 
+  /* Reused for each row: `vl' holds the identifier and, if instances are
+   * used, the instance prefix, which is `type_instance_len' bytes long. */
+  value_t      *values;
+  value_list_t  vl;
+  size_t        type_instance_len;
+
   struct udb_result_preparation_area_s *next;
 }; /* }}} */
 typedef struct udb_result_preparation_area_s udb_result_preparation_area_t;
@@ -75,6 +81,12 @@ struct udb_query_preparation_area_s /* {{{ */
 
   cdtime_t interval;
 
+  /* The column names the result areas have been prepared for, separated by
+   * null bytes. If a query returns the same columns again, the preparation
+   * of the previous run is reused. */
+  char  *column_names;
+  size_t column_names_size;
+
   udb_result_preparation_area_t *result_prep_areas;
 }; /* }}} */
 
@@ -186,26 +198,21 @@ static int udb_result_submit (udb_result_t *r, /* {{{ */
     udb_result_preparation_area_t *r_area,
     udb_query_t const *q, udb_query_preparation_area_t *q_area)
 {
-  value_list_t vl = VALUE_LIST_INIT;
+  value_list_t vl;
+  size_t len;
   size_t i;
 
   assert (r != NULL);
   assert (r_area->ds != NULL);
   assert (((size_t) r_area->ds->ds_num) == r->values_num);
-
-  vl.values = (value_t *) calloc (r_area->ds->ds_num, sizeof (value_t));
-  if (vl.values == NULL)
-  {
-    ERROR ("db query utils: malloc failed.");
-    return (-1);
-  }
-  vl.values_len = r_area->ds->ds_num;
+  assert (r_area->values != NULL);
 
   for (i = 0; i < r->values_num; i++)
   {
     char *value_str = r_area->values_buffer[i];
 
-    if (0 != parse_value (value_str, &vl.values[i], r_area->ds->ds[i].type))
+    if (0 != parse_value (value_str, &r_area->values[i],
+          r_area->ds->ds[i].type))
     {
       ERROR ("db query utils: udb_result_submit: Parsing `%s' as %s failed.",
           value_str, DS_TYPE_TO_STRING (r_area->ds->ds[i].type));
@@ -214,48 +221,28 @@ static int udb_result_submit (udb_result_t *r, /* {{{ */
     }
   }
 
-  if (q_area->interval > 0)
-    vl.interval = q_area->interval;
-
-  sstrncpy (vl.host, q_area->host, sizeof (vl.host));
-  sstrncpy (vl.plugin, q_area->plugin, sizeof (vl.plugin));
-  sstrncpy (vl.plugin_instance, q_area->db_name, sizeof (vl.plugin_instance));
-  sstrncpy (vl.type, r->type, sizeof (vl.type));
+  /* The dispatch may modify the value list (e.g. targets may rewrite the
+   * identifier), so start with a copy of the prepared one. */
+  memcpy (&vl, &r_area->vl, sizeof (vl));
+  vl.values = r_area->values;
 
-  /* Set vl.type_instance {{{ */
-  if (r->instances_num <= 0)
-  {
-    if (r->instance_prefix == NULL)
-      vl.type_instance[0] = 0;
-    else
-      sstrncpy (vl.type_instance, r->instance_prefix,
-          sizeof (vl.type_instance));
-  }
-  else /* if ((r->instances_num > 0) */
+  /* Append the instances to the prepared prefix of vl.type_instance {{{ */
+  len = r_area->type_instance_len;
+  for (i = 0; i < r->instances_num; i++)
   {
-    if (r->instance_prefix == NULL)
-    {
-      strjoin (vl.type_instance, sizeof (vl.type_instance),
-          r_area->instances_buffer, r->instances_num, "-");
-    }
-    else
-    {
-      char tmp[DATA_MAX_NAME_LEN];
+    const char *str = r_area->instances_buffer[i];
 
-      strjoin (tmp, sizeof (tmp), r_area->instances_buffer,
-          r->instances_num, "-");
-      tmp[sizeof (tmp) - 1] = 0;
+    if ((i > 0) && (len < sizeof (vl.type_instance) - 1))
+      vl.type_instance[len++] = '-';
 
-      snprintf (vl.type_instance, sizeof (vl.type_instance), "%s-%s",
-          r->instance_prefix, tmp);
-    }
+    while ((*str != 0) && (len < sizeof (vl.type_instance) - 1))
+      vl.type_instance[len++] = *(str++);
   }
-  vl.type_instance[sizeof (vl.type_instance) - 1] = 0;
+  vl.type_instance[len] = 0;
   /* }}} */
 
   plugin_dispatch_values (&vl);
 
-  sfree (vl.values);
   return (0);
 } /* }}} void udb_result_submit */
 
@@ -270,6 +257,7 @@ static void udb_result_finish_result (udb_result_t const *r, /* {{{ */
   sfree (prep_area->values_pos);
   sfree (prep_area->instances_buffer);
   sfree (prep_area->values_buffer);
+  sfree (prep_area->values);
 } /* }}} void udb_result_finish_result */
 
 static int udb_result_handle_result (udb_result_t *r, /* {{{ */
@@ -292,8 +280,10 @@ static int udb_result_handle_result (udb_result_t *r, /* {{{ */
 
 static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
     udb_result_preparation_area_t *prep_area,
+    udb_query_preparation_area_t const *q_area,
     char **column_names, size_t column_num)
 {
+  value_list_t vl = VALUE_LIST_INIT;
   size_t i;
 
   if ((r == NULL) || (prep_area == NULL))
@@ -305,6 +295,7 @@ static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
   sfree (prep_area->values_pos); \
   sfree (prep_area->instances_buffer); \
   sfree (prep_area->values_buffer); \
+  sfree (prep_area->values); \
   return (status)
 
   /* Make sure previous preparations are cleaned up. */
@@ -369,6 +360,37 @@ static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
     ERROR ("db query utils: udb_result_prepare_result: malloc failed.");
     BAIL_OUT (-ENOMEM);
   }
+
+  prep_area->values
+    = (value_t *) calloc (r->values_num, sizeof (value_t));
+  if (prep_area->values == NULL)
+  {
+    ERROR ("db query utils: udb_result_prepare_result: malloc failed.");
+    BAIL_OUT (-ENOMEM);
+  }
+  /* }}} */
+
+  /* Prepare the value list {{{ */
+  vl.values_len = (int) r->values_num;
+  if (q_area->interval > 0)
+    vl.interval = q_area->interval;
+
+  sstrncpy (vl.host, q_area->host, sizeof (vl.host));
+  sstrncpy (vl.plugin, q_area->plugin, sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, q_area->db_name, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, r->type, sizeof (vl.type));
+
+  if (r->instance_prefix == NULL)
+    vl.type_instance[0] = 0;
+  else if (r->instances_num <= 0)
+    sstrncpy (vl.type_instance, r->instance_prefix,
+        sizeof (vl.type_instance));
+  else
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%s-",
+        r->instance_prefix);
+
+  memcpy (&prep_area->vl, &vl, sizeof (prep_area->vl));
+  prep_area->type_instance_len = strlen (vl.type_instance);
   /* }}} */
 
   /* Determine the position of the instance columns {{{ */
@@ -429,6 +451,7 @@ static void udb_result_free (udb_result_t *r) /* {{{ */
     return;
 
   sfree (r->type);
+  sfree (r->instance_prefix);
 
   for (i = 0; i < r->instances_num; i++)
     sfree (r->instances[i]);
@@ -825,15 +848,13 @@ int udb_query_check_version (udb_query_t *q, unsigned int version) /* {{{ */
   return (1);
 } /* }}} int udb_query_check_version */
 
-void udb_query_finish_result (udb_query_t const *q, /* {{{ */
+/* Frees everything allocated by `udb_query_prepare_result'. */
+static void udb_query_reset_result (udb_query_t const *q, /* {{{ */
     udb_query_preparation_area_t *prep_area)
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
 
-  if ((q == NULL) || (prep_area == NULL))
-    return;
-
   prep_area->column_num = 0;
   sfree (prep_area->host);
   sfree (prep_area->plugin);
@@ -841,6 +862,9 @@ void udb_query_finish_result (udb_query_t const *q, /* {{{ */
 
   prep_area->interval = 0;
 
+  sfree (prep_area->column_names);
+  prep_area->column_names_size = 0;
+
   for (r = q->results, r_area = prep_area->result_prep_areas;
       r != NULL; r = r->next, r_area = r_area->next)
   {
@@ -849,6 +873,83 @@ void udb_query_finish_result (udb_query_t const *q, /* {{{ */
       break;
     udb_result_finish_result (r, r_area);
   }
+} /* }}} void udb_query_reset_result */
+
+/* Returns true if the preparation area has been prepared for exactly these
+ * parameters, so that the preparation can be reused. */
+static _Bool udb_query_is_prepared (udb_query_preparation_area_t *prep_area, /* {{{ */
+    const char *host, const char *plugin, const char *db_name,
+    char **column_names, size_t column_num, cdtime_t interval)
+{
+  const char *ptr;
+  size_t i;
+
+  if ((prep_area->column_names == NULL)
+      || (prep_area->host == NULL) || (strcmp (host, prep_area->host) != 0)
+      || (prep_area->plugin == NULL) || (strcmp (plugin, prep_area->plugin) != 0)
+      || (prep_area->db_name == NULL)
+      || (strcmp (db_name, prep_area->db_name) != 0)
+      || (interval != prep_area->interval))
+    return (0);
+
+  ptr = prep_area->column_names;
+  for (i = 0; i < column_num; i++)
+  {
+    size_t len;
+
+    if (ptr >= prep_area->column_names + prep_area->column_names_size)
+      return (0);
+
+    len = strlen (ptr);
+    if (strcmp (column_names[i], ptr) != 0)
+      return (0);
+    ptr += len + 1;
+  }
+
+  return (ptr == prep_area->column_names + prep_area->column_names_size);
+} /* }}} _Bool udb_query_is_prepared */
+
+/* Remembers the column names, see `udb_query_is_prepared'. */
+static int udb_query_save_column_names ( /* {{{ */
+    udb_query_preparation_area_t *prep_area,
+    char **column_names, size_t column_num)
+{
+  size_t size = 0;
+  char *ptr;
+  size_t i;
+
+  for (i = 0; i < column_num; i++)
+    size += strlen (column_names[i]) + 1;
+
+  sfree (prep_area->column_names);
+  prep_area->column_names_size = 0;
+
+  prep_area->column_names = malloc (size + 1);
+  if (prep_area->column_names == NULL)
+    return (-ENOMEM);
+
+  ptr = prep_area->column_names;
+  for (i = 0; i < column_num; i++)
+  {
+    size_t len = strlen (column_names[i]) + 1;
+    memcpy (ptr, column_names[i], len);
+    ptr += len;
+  }
+  prep_area->column_names_size = size;
+
+  return (0);
+} /* }}} int udb_query_save_column_names */
+
+/* Ends the handling of a result. The buffers and column positions are kept
+ * and reused by the next `udb_query_prepare_result' if the query returns
+ * the same columns again. */
+void udb_query_finish_result (udb_query_t const *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area)
+{
+  if ((q == NULL) || (prep_area == NULL))
+    return;
+
+  prep_area->column_num = 0;
 } /* }}} void udb_query_finish_result */
 
 int udb_query_handle_result (udb_query_t const *q, /* {{{ */
@@ -916,7 +1017,14 @@ int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
   if ((q == NULL) || (prep_area == NULL))
     return (-EINVAL);
 
-  udb_query_finish_result (q, prep_area);
+  if (udb_query_is_prepared (prep_area, host, plugin, db_name,
+        column_names, column_num, interval))
+  {
+    prep_area->column_num = column_num;
+    return (0);
+  }
+
+  udb_query_reset_result (q, prep_area);
 
   prep_area->column_num = column_num;
   prep_area->host = strdup (host);
@@ -929,7 +1037,7 @@ int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
       || (prep_area->db_name == NULL))
   {
     ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
-    udb_query_finish_result (q, prep_area);
+    udb_query_reset_result (q, prep_area);
     return (-ENOMEM);
   }
 
@@ -954,18 +1062,27 @@ int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
     {
       ERROR ("db query utils: Query `%s': Invalid number of result "
           "preparation areas.", q->name);
-      udb_query_finish_result (q, prep_area);
+      udb_query_reset_result (q, prep_area);
       return (-EINVAL);
     }
 
-    status = udb_result_prepare_result (r, r_area, column_names, column_num);
+    status = udb_result_prepare_result (r, r_area, prep_area,
+        column_names, column_num);
     if (status != 0)
     {
-      udb_query_finish_result (q, prep_area);
+      udb_query_reset_result (q, prep_area);
       return (status);
     }
   }
 
+  /* Only if all results could be prepared, the preparation is reused. */
+  if (udb_query_save_column_names (prep_area, column_names, column_num) != 0)
+  {
+    ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
+    udb_query_reset_result (q, prep_area);
+    return (-ENOMEM);
+  }
+
   return (0);
 } /* }}} int udb_query_prepare_result */
 
@@ -990,12 +1107,7 @@ udb_query_allocate_preparation_area (udb_query_t *q) /* {{{ */
     r_area = (udb_result_preparation_area_t *)malloc (sizeof (*r_area));
     if (r_area == NULL)
     {
-      for (r_area = q_area->result_prep_areas;
-          r_area != NULL; r_area = r_area->next)
-      {
-        free (r_area);
-      }
-      free (q_area);
+      udb_query_delete_preparation_area (q_area);
       return NULL;
     }
 
@@ -1027,12 +1139,14 @@ udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{
     sfree (area->values_pos);
     sfree (area->instances_buffer);
     sfree (area->values_buffer);
+    sfree (area->values);
     free (area);
   }
 
   sfree (q_area->host);
   sfree (q_area->plugin);
   sfree (q_area->db_name);
+  sfree (q_area->column_names);
 
   free (q_area);
 } /* }}} void udb_query_delete_preparation_area */
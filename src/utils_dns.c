@@ -161,10 +161,6 @@ typedef int (printer)(const char *, ...);
 /*
  * Global variables
  */
-int qtype_counts[T_MAX];
-int opcode_counts[OP_MAX];
-int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 static pcap_t *pcap_obj = NULL;
 #endif
@@ -290,14 +286,16 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *))
 }
 
 #define RFC1035_MAXLABELSZ 63
+/* "loop_detect" is the number of compression pointers followed so far. It is
+ * passed as an argument, rather than kept in a static variable, so that
+ * several capture threads can parse packets at the same time. */
 static int
-rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
-)
+rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns,
+	int loop_detect)
 {
     off_t no = 0;
     unsigned char c;
     size_t len;
-    static int loop_detect = 0;
     if (loop_detect > 2)
 	return 4;		/* compression loop */
     if (ns <= 0)
@@ -323,9 +321,8 @@ rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
 		return 2;	/* bad compression ptr */
 	    if (ptr < DNS_MSG_HDR_SZ)
 		return 2;	/* bad compression ptr */
-	    loop_detect++;
-	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no);
-	    loop_detect--;
+	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no,
+		    loop_detect + 1);
 	    return rc;
 	} else if (c > RFC1035_MAXLABELSZ) {
 	    /*
@@ -400,7 +397,8 @@ handle_dns(const char *buf, int len)
 
     offset = DNS_MSG_HDR_SZ;
     memset(qh.qname, '\0', MAX_QNAME_SZ);
-    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ);
+    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ,
+	    /* loop_detect = */ 0);
     if (status != 0)
     {
 	INFO ("utils_dns: handle_dns: rfc1035NameUnpack failed "
@@ -423,11 +421,6 @@ handle_dns(const char *buf, int len)
 
     qh.length = (uint16_t) len;
 
-    /* gather stats */
-    qtype_counts[qh.qtype]++;
-    qclass_counts[qh.qclass]++;
-    opcode_counts[qh.opcode]++;
-
     if (Callback != NULL)
 	    Callback (&qh);
 
@@ -673,6 +666,27 @@ handle_linux_sll (const u_char *pkt, int len)
 }
 #endif /* DLT_LINUX_SLL */
 
+/* public function */
+int handle_ip_packet (uint16_t ethertype, const u_char *pkt, int len)
+{
+    char buf[PCAP_SNAPLEN];
+
+    if (len < 0)
+	return (0);
+    /* Truncate like a capture with a snaplen of PCAP_SNAPLEN would. */
+    if (len > PCAP_SNAPLEN)
+	len = PCAP_SNAPLEN;
+
+    if ((ETHERTYPE_IP != ethertype)
+	    && (ETHERTYPE_IPV6 != ethertype))
+	return 0;
+    memcpy(buf, pkt, len);
+    if (ETHERTYPE_IPV6 == ethertype)
+	return (handle_ipv6 ((void *) buf, len));
+    else
+	return handle_ip((struct ip *) buf, len);
+}
+
 /* public function */
 void handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr, const u_char *pkt)
 {
@@ -72,10 +72,6 @@ struct rfc1035_header_s {
 };
 typedef struct rfc1035_header_s rfc1035_header_t;
 
-extern int qtype_counts[T_MAX];
-extern int opcode_counts[OP_MAX];
-extern int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 void dnstop_set_pcap_obj (pcap_t *po);
 #endif
@@ -84,6 +80,11 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *));
 void ignore_list_add_name (const char *name);
 #if HAVE_PCAP_H
 void handle_pcap (u_char * udata, const struct pcap_pkthdr *hdr, const u_char * pkt);
+
+/* Handles a packet starting with the IPv4 or IPv6 header, as received from a
+ * SOCK_DGRAM packet socket. "ethertype" is the protocol in host byte order.
+ * Returns non-zero if the packet was a DNS message. */
+int handle_ip_packet (uint16_t ethertype, const u_char *pkt, int len);
 #endif
 
 const char *qtype_str(int t);
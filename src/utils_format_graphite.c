@@ -27,6 +27,7 @@
 
 #include "utils_cache.h"
 #include "utils_format_json.h"
+#include "utils_format_number.h"
 #include "utils_parse_option.h"
 
 /* Utils functions to format data sets in graphite format.
@@ -36,46 +37,24 @@ static int gr_format_values (char *ret, size_t ret_len,
         int ds_num, const data_set_t *ds, const value_list_t *vl,
         gauge_t const *rates)
 {
-    size_t offset = 0;
     int status;
 
     assert (0 == strcmp (ds->type, vl->type));
 
-    memset (ret, 0, ret_len);
-
-#define BUFFER_ADD(...) do { \
-    status = ssnprintf (ret + offset, ret_len - offset, \
-            __VA_ARGS__); \
-    if (status < 1) \
-    { \
-        return (-1); \
-    } \
-    else if (((size_t) status) >= (ret_len - offset)) \
-    { \
-        return (-1); \
-    } \
-    else \
-    offset += ((size_t) status); \
-} while (0)
-
-    if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD ("%f", vl->values[ds_num].gauge);
-    else if (rates != NULL)
-        BUFFER_ADD ("%f", rates[ds_num]);
-    else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD ("%llu", vl->values[ds_num].counter);
-    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD ("%"PRIi64, vl->values[ds_num].derive);
-    else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD ("%"PRIu64, vl->values[ds_num].absolute);
+    if ((ds->ds[ds_num].type != DS_TYPE_GAUGE) && (rates != NULL))
+        status = format_number_double (ret, ret_len, rates[ds_num]);
     else
+        status = format_number_value (ret, ret_len,
+                ds->ds[ds_num].type, vl->values[ds_num]);
+
+    if (status < 0)
     {
         ERROR ("gr_format_values plugin: Unknown data source type: %i",
                 ds->ds[ds_num].type);
         return (-1);
     }
-
-#undef BUFFER_ADD
+    else if ((status == 0) || (((size_t) status) >= ret_len))
+        return (-1);
 
     return (0);
 }
@@ -175,9 +154,11 @@ int format_graphite (char *buffer, size_t buffer_size,
     int i;
     int buffer_pos = 0;
 
+    gauge_t rates_buffer[ds->ds_num];
     gauge_t *rates = NULL;
-    if (store_rates)
-      rates = uc_get_rate (ds, vl);
+    if (store_rates && (uc_get_rate_into (ds, vl, rates_buffer,
+                    STATIC_ARRAY_SIZE (rates_buffer)) == 0))
+      rates = rates_buffer;
 
     for (i = 0; i < ds->ds_num; i++)
     {
@@ -195,7 +176,6 @@ int format_graphite (char *buffer, size_t buffer_size,
         if (status != 0)
         {
             ERROR ("format_graphite: error with gr_format_name");
-            sfree (rates);
             return (status);
         }
 
@@ -206,7 +186,6 @@ int format_graphite (char *buffer, size_t buffer_size,
         if (status != 0)
         {
             ERROR ("format_graphite: error with gr_format_values");
-            sfree (rates);
             return (status);
         }
 
@@ -219,7 +198,6 @@ int format_graphite (char *buffer, size_t buffer_size,
         if (message_len >= sizeof (message)) {
             ERROR ("format_graphite: message buffer too small: "
                     "Need %zu bytes.", message_len + 1);
-            sfree (rates);
             return (-ENOMEM);
         }
 
@@ -227,13 +205,11 @@ int format_graphite (char *buffer, size_t buffer_size,
         if ((buffer_pos + message_len) >= buffer_size)
         {
             ERROR ("format_graphite: target buffer too small");
-            sfree (rates);
             return (-ENOMEM);
         }
         memcpy((void *) (buffer + buffer_pos), message, message_len);
         buffer_pos += message_len;
     }
-    sfree (rates);
     return (status);
 } /* int format_graphite */
 
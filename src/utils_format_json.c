@@ -25,6 +25,7 @@
 
 #include "utils_cache.h"
 #include "utils_format_json.h"
+#include "utils_format_number.h"
 
 static int escape_string (char *buffer, size_t buffer_size, /* {{{ */
     const char *string)
@@ -77,24 +78,31 @@ static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
 {
   size_t offset = 0;
   int i;
-  gauge_t *rates = NULL;
+  gauge_t rates[ds->ds_num];
+  _Bool have_rates = 0;
 
-  memset (buffer, 0, buffer_size);
+  buffer[0] = 0;
 
 #define BUFFER_ADD(...) do { \
   int status; \
   status = ssnprintf (buffer + offset, buffer_size - offset, \
       __VA_ARGS__); \
   if (status < 1) \
-  { \
-    sfree(rates); \
     return (-1); \
-  } \
   else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
     return (-ENOMEM); \
-  } \
+  else \
+    offset += ((size_t) status); \
+} while (0)
+
+  /* Like BUFFER_ADD, but uses one of the format_number_* functions. */
+#define BUFFER_ADD_NUMBER(func, ...) do { \
+  int status; \
+  status = func (buffer + offset, buffer_size - offset, __VA_ARGS__); \
+  if (status < 1) \
+    return (-1); \
+  else if (((size_t) status) >= (buffer_size - offset)) \
+    return (-ENOMEM); \
   else \
     offset += ((size_t) status); \
 } while (0)
@@ -108,46 +116,44 @@ static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
     if (ds->ds[i].type == DS_TYPE_GAUGE)
     {
       if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD ("%g", vl->values[i].gauge);
+        BUFFER_ADD_NUMBER (format_number_double, vl->values[i].gauge);
       else
         BUFFER_ADD ("null");
     }
     else if (store_rates)
     {
-      if (rates == NULL)
-        rates = uc_get_rate (ds, vl);
-      if (rates == NULL)
+      if (!have_rates)
       {
-        WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return (-1);
+        if (uc_get_rate_into (ds, vl, rates, STATIC_ARRAY_SIZE (rates)) != 0)
+        {
+          WARNING ("utils_format_json: uc_get_rate_into failed.");
+          return (-1);
+        }
+        have_rates = 1;
       }
 
       if(isfinite (rates[i]))
-        BUFFER_ADD ("%g", rates[i]);
+        BUFFER_ADD_NUMBER (format_number_double, rates[i]);
       else
         BUFFER_ADD ("null");
     }
-    else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
+    else if ((ds->ds[i].type == DS_TYPE_COUNTER)
+        || (ds->ds[i].type == DS_TYPE_DERIVE)
+        || (ds->ds[i].type == DS_TYPE_ABSOLUTE))
+      BUFFER_ADD_NUMBER (format_number_value, ds->ds[i].type, vl->values[i]);
     else
     {
       ERROR ("format_json: Unknown data source type: %i",
           ds->ds[i].type);
-      sfree (rates);
       return (-1);
     }
   } /* for ds->ds_num */
   BUFFER_ADD ("]");
 
+#undef BUFFER_ADD_NUMBER
 #undef BUFFER_ADD
 
   DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
   return (0);
 } /* }}} int values_to_json */
 
@@ -157,7 +163,7 @@ static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
   size_t offset = 0;
   int i;
 
-  memset (buffer, 0, buffer_size);
+  buffer[0] = 0;
 
 #define BUFFER_ADD(...) do { \
   int status; \
@@ -194,7 +200,7 @@ static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
   size_t offset = 0;
   int i;
 
-  memset (buffer, 0, buffer_size);
+  buffer[0] = 0;
 
 #define BUFFER_ADD(...) do { \
   int status; \
@@ -234,7 +240,7 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
   int status;
   int i;
 
-  memset (buffer, 0, buffer_size);
+  buffer[0] = 0;
 
 #define BUFFER_ADD(...) do { \
   status = ssnprintf (buffer + offset, buffer_size - offset, \
@@ -280,8 +286,15 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
     else if (type == MD_TYPE_DOUBLE)
     {
       double value = 0.0;
+      char number[FORMAT_NUMBER_MAX_LEN];
       if (meta_data_get_double (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%f", key, value);
+      {
+        if (isfinite (value))
+          format_number_double (number, sizeof (number), value);
+        else
+          sstrncpy (number, "null", sizeof (number));
+        BUFFER_ADD (",\"%s\":%s", key, number);
+      }
     }
     else if (type == MD_TYPE_BOOLEAN)
     {
@@ -312,7 +325,7 @@ static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
   size_t offset = 0;
   int status;
 
-  memset (buffer, 0, buffer_size);
+  buffer[0] = 0;
 
 #define BUFFER_ADD(...) do { \
   status = ssnprintf (buffer + offset, buffer_size - offset, \
@@ -363,7 +376,7 @@ static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
   if (vl->meta != NULL)
   {
     char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
+    meta_buffer[0] = 0;
     status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
     if (status != 0)
       return (status);
@@ -419,7 +432,7 @@ int format_json_initialize (char *buffer, /* {{{ */
   if (buffer_free < 3)
     return (-ENOMEM);
 
-  memset (buffer, 0, buffer_free);
+  buffer[0] = 0;
   *ret_buffer_fill = buffer_fill;
   *ret_buffer_free = buffer_free;
 
@@ -0,0 +1,537 @@
+/**
+ * collectd - src/utils_format_number.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * The floating point conversion implements the Grisu2 algorithm described in
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers" by
+ * Florian Loitsch, PLDI 2010.
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_format_number.h"
+
+#include <math.h>
+
+/* Copies the `len' characters in `tmp' to `buffer', if it's large enough. */
+static int format_number_copy (char *buffer, size_t buffer_size, /* {{{ */
+		const char *tmp, size_t len)
+{
+	if (len < buffer_size)
+	{
+		memcpy (buffer, tmp, len);
+		buffer[len] = 0;
+	}
+	else if (buffer_size > 0)
+	{
+		buffer[0] = 0;
+	}
+
+	return ((int) len);
+} /* }}} int format_number_copy */
+
+/* Writes the digits of `value' right-aligned into the 20 bytes before `end'
+ * and returns a pointer to the first digit. */
+static char *format_digits (char *end, uint64_t value) /* {{{ */
+{
+	char *ptr = end;
+
+	do
+	{
+		ptr--;
+		*ptr = (char) ('0' + (value % 10));
+		value /= 10;
+	} while (value != 0);
+
+	return (ptr);
+} /* }}} char *format_digits */
+
+int format_number_uint64 (char *buffer, size_t buffer_size, /* {{{ */
+		uint64_t value)
+{
+	char tmp[FORMAT_NUMBER_MAX_LEN];
+	char *end = tmp + sizeof (tmp);
+	char *ptr;
+
+	ptr = format_digits (end, value);
+	return (format_number_copy (buffer, buffer_size,
+				ptr, (size_t) (end - ptr)));
+} /* }}} int format_number_uint64 */
+
+int format_number_int64 (char *buffer, size_t buffer_size, /* {{{ */
+		int64_t value)
+{
+	char tmp[FORMAT_NUMBER_MAX_LEN];
+	char *end = tmp + sizeof (tmp);
+	char *ptr;
+
+	if (value < 0)
+	{
+		/* Negate in unsigned arithmetic, so INT64_MIN works. */
+		ptr = format_digits (end, ((uint64_t) 0) - ((uint64_t) value));
+		ptr--;
+		*ptr = '-';
+	}
+	else
+	{
+		ptr = format_digits (end, (uint64_t) value);
+	}
+
+	return (format_number_copy (buffer, buffer_size,
+				ptr, (size_t) (end - ptr)));
+} /* }}} int format_number_int64 */
+
+/*
+ * Grisu2
+ */
+/* A floating point number f * 2^e with a 64 bit significand. */
+struct diy_fp_s
+{
+	uint64_t f;
+	int e;
+};
+typedef struct diy_fp_s diy_fp_t;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT     (-DP_EXPONENT_BIAS)
+#define DP_HIDDEN_BIT       (((uint64_t) 1) << DP_SIGNIFICAND_SIZE)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+#define DP_EXPONENT_MASK    ((uint64_t) 0x7FF0000000000000ULL)
+
+/* Normalized 64 bit approximations of 10^k for k = -348, -340, ..., 340. */
+static const diy_fp_t cached_powers[] =
+{
+	{ 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 },
+	{ 0x8b16fb203055ac76ULL, -1166 }, { 0xcf42894a5dce35eaULL, -1140 },
+	{ 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+	{ 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 },
+	{ 0xbe5691ef416bd60cULL, -1007 }, { 0x8dd01fad907ffc3cULL,  -980 },
+	{ 0xd3515c2831559a83ULL,  -954 }, { 0x9d71ac8fada6c9b5ULL,  -927 },
+	{ 0xea9c227723ee8bcbULL,  -901 }, { 0xaecc49914078536dULL,  -874 },
+	{ 0x823c12795db6ce57ULL,  -847 }, { 0xc21094364dfb5637ULL,  -821 },
+	{ 0x9096ea6f3848984fULL,  -794 }, { 0xd77485cb25823ac7ULL,  -768 },
+	{ 0xa086cfcd97bf97f4ULL,  -741 }, { 0xef340a98172aace5ULL,  -715 },
+	{ 0xb23867fb2a35b28eULL,  -688 }, { 0x84c8d4dfd2c63f3bULL,  -661 },
+	{ 0xc5dd44271ad3cdbaULL,  -635 }, { 0x936b9fcebb25c996ULL,  -608 },
+	{ 0xdbac6c247d62a584ULL,  -582 }, { 0xa3ab66580d5fdaf6ULL,  -555 },
+	{ 0xf3e2f893dec3f126ULL,  -529 }, { 0xb5b5ada8aaff80b8ULL,  -502 },
+	{ 0x87625f056c7c4a8bULL,  -475 }, { 0xc9bcff6034c13053ULL,  -449 },
+	{ 0x964e858c91ba2655ULL,  -422 }, { 0xdff9772470297ebdULL,  -396 },
+	{ 0xa6dfbd9fb8e5b88fULL,  -369 }, { 0xf8a95fcf88747d94ULL,  -343 },
+	{ 0xb94470938fa89bcfULL,  -316 }, { 0x8a08f0f8bf0f156bULL,  -289 },
+	{ 0xcdb02555653131b6ULL,  -263 }, { 0x993fe2c6d07b7facULL,  -236 },
+	{ 0xe45c10c42a2b3b06ULL,  -210 }, { 0xaa242499697392d3ULL,  -183 },
+	{ 0xfd87b5f28300ca0eULL,  -157 }, { 0xbce5086492111aebULL,  -130 },
+	{ 0x8cbccc096f5088ccULL,  -103 }, { 0xd1b71758e219652cULL,   -77 },
+	{ 0x9c40000000000000ULL,   -50 }, { 0xe8d4a51000000000ULL,   -24 },
+	{ 0xad78ebc5ac620000ULL,     3 }, { 0x813f3978f8940984ULL,    30 },
+	{ 0xc097ce7bc90715b3ULL,    56 }, { 0x8f7e32ce7bea5c70ULL,    83 },
+	{ 0xd5d238a4abe98068ULL,   109 }, { 0x9f4f2726179a2245ULL,   136 },
+	{ 0xed63a231d4c4fb27ULL,   162 }, { 0xb0de65388cc8ada8ULL,   189 },
+	{ 0x83c7088e1aab65dbULL,   216 }, { 0xc45d1df942711d9aULL,   242 },
+	{ 0x924d692ca61be758ULL,   269 }, { 0xda01ee641a708deaULL,   295 },
+	{ 0xa26da3999aef774aULL,   322 }, { 0xf209787bb47d6b85ULL,   348 },
+	{ 0xb454e4a179dd1877ULL,   375 }, { 0x865b86925b9bc5c2ULL,   402 },
+	{ 0xc83553c5c8965d3dULL,   428 }, { 0x952ab45cfa97a0b3ULL,   455 },
+	{ 0xde469fbd99a05fe3ULL,   481 }, { 0xa59bc234db398c25ULL,   508 },
+	{ 0xf6c69a72a3989f5cULL,   534 }, { 0xb7dcbf5354e9beceULL,   561 },
+	{ 0x88fcf317f22241e2ULL,   588 }, { 0xcc20ce9bd35c78a5ULL,   614 },
+	{ 0x98165af37b2153dfULL,   641 }, { 0xe2a0b5dc971f303aULL,   667 },
+	{ 0xa8d9d1535ce3b396ULL,   694 }, { 0xfb9b7cd9a4a7443cULL,   720 },
+	{ 0xbb764c4ca7a44410ULL,   747 }, { 0x8bab8eefb6409c1aULL,   774 },
+	{ 0xd01fef10a657842cULL,   800 }, { 0x9b10a4e5e9913129ULL,   827 },
+	{ 0xe7109bfba19c0c9dULL,   853 }, { 0xac2820d9623bf429ULL,   880 },
+	{ 0x80444b5e7aa7cf85ULL,   907 }, { 0xbf21e44003acdd2dULL,   933 },
+	{ 0x8e679c2f5e44ff8fULL,   960 }, { 0xd433179d9c8cb841ULL,   986 },
+	{ 0x9e19db92b4e31ba9ULL,  1013 }, { 0xeb96bf6ebadf77d9ULL,  1039 },
+	{ 0xaf87023b9bf0ee6bULL,  1066 }
+};
+
+static const uint32_t pow10_32[] =
+{
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000
+};
+
+static diy_fp_t diy_fp_from_double (double d) /* {{{ */
+{
+	diy_fp_t ret;
+	uint64_t bits;
+	int biased_e;
+
+	memcpy (&bits, &d, sizeof (bits));
+	biased_e = (int) ((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+
+	ret.f = bits & DP_SIGNIFICAND_MASK;
+	if (biased_e != 0)
+	{
+		ret.f += DP_HIDDEN_BIT;
+		ret.e = biased_e - DP_EXPONENT_BIAS;
+	}
+	else
+	{
+		ret.e = DP_MIN_EXPONENT + 1;
+	}
+
+	return (ret);
+} /* }}} diy_fp_t diy_fp_from_double */
+
+static diy_fp_t diy_fp_normalize (diy_fp_t x) /* {{{ */
+{
+	while ((x.f & (((uint64_t) 1) << 63)) == 0)
+	{
+		x.f <<= 1;
+		x.e--;
+	}
+	return (x);
+} /* }}} diy_fp_t diy_fp_normalize */
+
+/* Returns x * y, rounded. The result is not normalized. */
+static diy_fp_t diy_fp_multiply (diy_fp_t x, diy_fp_t y) /* {{{ */
+{
+	const uint64_t mask32 = 0xFFFFFFFFULL;
+	uint64_t a = x.f >> 32;
+	uint64_t b = x.f & mask32;
+	uint64_t c = y.f >> 32;
+	uint64_t d = y.f & mask32;
+	uint64_t ac = a * c;
+	uint64_t bc = b * c;
+	uint64_t ad = a * d;
+	uint64_t bd = b * d;
+	uint64_t tmp;
+	diy_fp_t ret;
+
+	tmp = (bd >> 32) + (ad & mask32) + (bc & mask32);
+	tmp += ((uint64_t) 1) << 31; /* round */
+
+	ret.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+	ret.e = x.e + y.e + 64;
+	return (ret);
+} /* }}} diy_fp_t diy_fp_multiply */
+
+/* Computes the boundaries m- and m+ of `v', i.e. the points half way to the
+ * neighboring doubles. Both have the exponent of the normalized m+. */
+static void diy_fp_boundaries (diy_fp_t v, /* {{{ */
+		diy_fp_t *ret_minus, diy_fp_t *ret_plus)
+{
+	diy_fp_t plus;
+	diy_fp_t minus;
+
+	plus.f = (v.f << 1) + 1;
+	plus.e = v.e - 1;
+	plus = diy_fp_normalize (plus);
+
+	/* If v is a power of two, the lower neighbor is closer. */
+	if (v.f == DP_HIDDEN_BIT)
+	{
+		minus.f = (v.f << 2) - 1;
+		minus.e = v.e - 2;
+	}
+	else
+	{
+		minus.f = (v.f << 1) - 1;
+		minus.e = v.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	*ret_minus = minus;
+	*ret_plus = plus;
+} /* }}} void diy_fp_boundaries */
+
+/* Returns a cached power of ten c = 10^-k, such that the product of c and a
+ * number with binary exponent `e' has an exponent in [-60, -32]. */
+static diy_fp_t cached_power (int e, int *ret_k) /* {{{ */
+{
+	double dk;
+	int k;
+	int index;
+
+	/* 1 / log2(10) = 0.30102999566398114 */
+	dk = (-61 - e) * 0.30102999566398114 + 347;
+	k = (int) dk;
+	if ((dk - k) > 0.0)
+		k++;
+
+	index = (k >> 3) + 1;
+	*ret_k = -(-348 + index * 8);
+
+	return (cached_powers[index]);
+} /* }}} diy_fp_t cached_power */
+
+static int count_digits32 (uint32_t n) /* {{{ */
+{
+	int i;
+
+	for (i = 1; i < 10; i++)
+		if (n < pow10_32[i])
+			return (i);
+	return (10);
+} /* }}} int count_digits32 */
+
+/* Moves the last digit towards `w' as long as the result stays within the
+ * boundaries. */
+static void grisu_round (char *buffer, int len, /* {{{ */
+		uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while ((rest < wp_w)
+			&& ((delta - rest) >= ten_kappa)
+			&& (((rest + ten_kappa) < wp_w)
+				|| ((wp_w - rest) > (rest + ten_kappa - wp_w))))
+	{
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+} /* }}} void grisu_round */
+
+/* Generates the shortest digits in the interval [mp - delta, mp]. */
+static int grisu_digits (diy_fp_t w, diy_fp_t mp, /* {{{ */
+		uint64_t delta, char *buffer, int *k)
+{
+	diy_fp_t one;
+	uint64_t wp_w;
+	uint32_t p1;
+	uint64_t p2;
+	int kappa;
+	int len = 0;
+
+	one.f = ((uint64_t) 1) << -mp.e;
+	one.e = mp.e;
+	wp_w = mp.f - w.f;
+	p1 = (uint32_t) (mp.f >> -one.e);
+	p2 = mp.f & (one.f - 1);
+	kappa = count_digits32 (p1);
+
+	/* Integer part */
+	while (kappa > 0)
+	{
+		uint32_t d = p1 / pow10_32[kappa - 1];
+		uint64_t tmp;
+
+		p1 %= pow10_32[kappa - 1];
+		if ((d != 0) || (len != 0))
+			buffer[len++] = (char) ('0' + d);
+		kappa--;
+
+		tmp = (((uint64_t) p1) << -one.e) + p2;
+		if (tmp <= delta)
+		{
+			*k += kappa;
+			grisu_round (buffer, len, delta, tmp,
+					((uint64_t) pow10_32[kappa]) << -one.e, wp_w);
+			return (len);
+		}
+	}
+
+	/* Fractional part */
+	while (42)
+	{
+		char d;
+
+		p2 *= 10;
+		delta *= 10;
+		d = (char) (p2 >> -one.e);
+		if ((d != 0) || (len != 0))
+			buffer[len++] = (char) ('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+
+		if (p2 < delta)
+		{
+			int index = -kappa;
+
+			*k += kappa;
+			grisu_round (buffer, len, delta, p2, one.f,
+					wp_w * ((index < 10) ? pow10_32[index] : 0));
+			return (len);
+		}
+	}
+} /* }}} int grisu_digits */
+
+/* Writes the shortest digit string of the positive, finite and non-zero
+ * `value' to `buffer'. value = digits * 10^k. Returns the number of digits. */
+static int grisu2 (double value, char *buffer, int *k) /* {{{ */
+{
+	diy_fp_t v = diy_fp_from_double (value);
+	diy_fp_t w_m;
+	diy_fp_t w_p;
+	diy_fp_t c_mk;
+	diy_fp_t w;
+	diy_fp_t wp;
+	diy_fp_t wm;
+
+	diy_fp_boundaries (v, &w_m, &w_p);
+	c_mk = cached_power (w_p.e, k);
+
+	w = diy_fp_multiply (diy_fp_normalize (v), c_mk);
+	wp = diy_fp_multiply (w_p, c_mk);
+	wm = diy_fp_multiply (w_m, c_mk);
+
+	/* Stay within the boundaries despite the imprecision of the
+	 * multiplication. */
+	wm.f++;
+	wp.f--;
+
+	return (grisu_digits (w, wp, wp.f - wm.f, buffer, k));
+} /* }}} int grisu2 */
+
+static int write_exponent (char *buffer, int e) /* {{{ */
+{
+	int len = 0;
+
+	buffer[len++] = 'e';
+	if (e < 0)
+	{
+		buffer[len++] = '-';
+		e = -e;
+	}
+	else
+	{
+		buffer[len++] = '+';
+	}
+
+	/* At least two digits, like printf(3). */
+	if (e >= 100)
+	{
+		buffer[len++] = (char) ('0' + (e / 100));
+		e %= 100;
+	}
+	buffer[len++] = (char) ('0' + (e / 10));
+	buffer[len++] = (char) ('0' + (e % 10));
+
+	return (len);
+} /* }}} int write_exponent */
+
+/* Turns the `len' digits in `buffer', representing digits * 10^k, into
+ * decimal or exponential notation. `buffer' must have room for
+ * FORMAT_NUMBER_MAX_LEN characters. Returns the new length. */
+static int prettify (char *buffer, int len, int k) /* {{{ */
+{
+	/* 10^(kk-1) <= value < 10^kk */
+	int kk = len + k;
+	int i;
+
+	if ((k >= 0) && (kk <= 21))
+	{
+		/* 1234e7 -> 12340000000 */
+		for (i = len; i < kk; i++)
+			buffer[i] = '0';
+		return (kk);
+	}
+	else if ((kk > 0) && (kk <= 21))
+	{
+		/* 1234e-2 -> 12.34 */
+		memmove (buffer + kk + 1, buffer + kk, (size_t) (len - kk));
+		buffer[kk] = '.';
+		return (len + 1);
+	}
+	else if ((kk > -6) && (kk <= 0))
+	{
+		/* 1234e-6 -> 0.001234 */
+		int offset = 2 - kk;
+
+		memmove (buffer + offset, buffer, (size_t) len);
+		buffer[0] = '0';
+		buffer[1] = '.';
+		for (i = 2; i < offset; i++)
+			buffer[i] = '0';
+		return (len + offset);
+	}
+	else if (len == 1)
+	{
+		/* 1e30 -> 1e+30 */
+		return (1 + write_exponent (buffer + 1, kk - 1));
+	}
+
+	/* 1234e30 -> 1.234e+33 */
+	memmove (buffer + 2, buffer + 1, (size_t) (len - 1));
+	buffer[1] = '.';
+	return (len + 1 + write_exponent (buffer + len + 1, kk - 1));
+} /* }}} int prettify */
+
+int format_number_double (char *buffer, size_t buffer_size, /* {{{ */
+		double value)
+{
+	char tmp[FORMAT_NUMBER_MAX_LEN];
+	char *ptr = tmp;
+	int len;
+	int k = 0;
+
+	if (isnan (value))
+		return (format_number_copy (buffer, buffer_size, "nan", 3));
+
+	if (signbit (value))
+	{
+		*ptr = '-';
+		ptr++;
+		value = -value;
+	}
+
+	if (isinf (value))
+	{
+		memcpy (ptr, "inf", 3);
+		return (format_number_copy (buffer, buffer_size,
+					tmp, (size_t) (ptr - tmp) + 3));
+	}
+
+	if (value == 0.0)
+	{
+		*ptr = '0';
+		return (format_number_copy (buffer, buffer_size,
+					tmp, (size_t) (ptr - tmp) + 1));
+	}
+
+	/* Integers are very common, e.g. for gauges counting things. Every
+	 * integer below 2^53 is exactly representable and printed as such. */
+	if ((value < 9007199254740992.0) && (value == floor (value)))
+	{
+		char *end = tmp + sizeof (tmp);
+		char *digits = format_digits (end, (uint64_t) value);
+
+		len = (int) (end - digits);
+		memmove (ptr, digits, (size_t) len);
+		return (format_number_copy (buffer, buffer_size,
+					tmp, (size_t) (ptr - tmp) + len));
+	}
+
+	len = grisu2 (value, ptr, &k);
+	len = prettify (ptr, len, k);
+
+	return (format_number_copy (buffer, buffer_size,
+				tmp, (size_t) (ptr - tmp) + len));
+} /* }}} int format_number_double */
+
+int format_number_value (char *buffer, size_t buffer_size, /* {{{ */
+		int ds_type, value_t value)
+{
+	if (ds_type == DS_TYPE_GAUGE)
+		return (format_number_double (buffer, buffer_size, value.gauge));
+	else if (ds_type == DS_TYPE_COUNTER)
+		return (format_number_uint64 (buffer, buffer_size,
+					(uint64_t) value.counter));
+	else if (ds_type == DS_TYPE_DERIVE)
+		return (format_number_int64 (buffer, buffer_size, value.derive));
+	else if (ds_type == DS_TYPE_ABSOLUTE)
+		return (format_number_uint64 (buffer, buffer_size, value.absolute));
+
+	return (-1);
+} /* }}} int format_number_value */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
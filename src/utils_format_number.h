@@ -0,0 +1,64 @@
+/**
+ * collectd - src/utils_format_number.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Converts numbers to strings without going through the printf(3) machinery.
+ *   Used by the plugins writing values in text form, e.g. CSV, JSON or
+ *   Graphite.
+ *
+ *   Floating point numbers are printed with the shortest representation that
+ *   converts back to the same number ("round trip"), using the Grisu2
+ *   algorithm by Florian Loitsch. Numbers in [1e-6, 1e21) are printed in
+ *   decimal notation, others in exponential notation, e.g. "1.5e+30". Not a
+ *   number and infinity are printed as "nan", "inf" and "-inf".
+ **/
+
+#ifndef UTILS_FORMAT_NUMBER_H
+#define UTILS_FORMAT_NUMBER_H 1
+
+#include "plugin.h"
+
+/* Enough for any number printed by the functions below, including the
+ * terminating null byte. */
+#define FORMAT_NUMBER_MAX_LEN 32
+
+/*
+ * format_number_uint64, format_number_int64, format_number_double
+ *
+ * Write `value' to `buffer' and null-terminate it. Like snprintf(3), the
+ * functions return the number of characters written, excluding the null byte.
+ * If the buffer is too small, the number of characters that would have been
+ * written is returned and the content of `buffer' is undefined, so callers can
+ * use the same check they use for snprintf(3).
+ */
+int format_number_uint64 (char *buffer, size_t buffer_size, uint64_t value);
+int format_number_int64 (char *buffer, size_t buffer_size, int64_t value);
+int format_number_double (char *buffer, size_t buffer_size, double value);
+
+/*
+ * format_number_value
+ *
+ * Formats a value of the given data source type, see DS_TYPE_*. Returns the
+ * same as the functions above, or -1 if the type is unknown.
+ */
+int format_number_value (char *buffer, size_t buffer_size,
+		int ds_type, value_t value);
+
+#endif /* UTILS_FORMAT_NUMBER_H */
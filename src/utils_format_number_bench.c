@@ -0,0 +1,248 @@
+/**
+ * collectd - src/utils_format_number_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Compares the cost of formatting numbers with snprintf(3), the way the
+ *   write plugins used to do it, and with the functions in
+ *   `utils_format_number.h'. Also checks that every double printed converts
+ *   back to the same value.
+ *
+ *   Usage: utils_format_number_bench [<iterations>]
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_format_number.h"
+
+#include <math.h>
+#include <time.h>
+
+#define BENCH_VALUES_NUM 4096
+
+static double bench_now (void) /* {{{ */
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1e9));
+} /* }}} double bench_now */
+
+/* Returns a random double with all bits random, i.e. covering the entire
+ * range of exponents. NaN and infinity are excluded. */
+static double bench_random_bits (void) /* {{{ */
+{
+	uint64_t bits;
+	double d;
+
+	do
+	{
+		bits = (((uint64_t) random ()) << 42)
+			^ (((uint64_t) random ()) << 21)
+			^ ((uint64_t) random ());
+		bits ^= ((uint64_t) random ()) << 63;
+		memcpy (&d, &bits, sizeof (d));
+	} while (!isfinite (d));
+
+	return (d);
+} /* }}} double bench_random_bits */
+
+/* Returns a value as typically reported by read plugins: a percentage, a
+ * load average, a byte count, ... */
+static double bench_random_typical (void) /* {{{ */
+{
+	switch (random () % 4)
+	{
+		case 0: return ((double) (random () % 100000));
+		case 1: return (100.0 * ((double) random ()) / RAND_MAX);
+		case 2: return (((double) (random () % 1000)) / 100.0);
+		default: return (((double) random ()) * 1024.0 / 3.0);
+	}
+} /* }}} double bench_random_typical */
+
+/* Verifies that all values convert back to themselves and counts the values
+ * for which printf(3) finds a shorter representation. */
+static int bench_check (const double *values, size_t values_num) /* {{{ */
+{
+	size_t errors = 0;
+	size_t longer = 0;
+	size_t i;
+
+	for (i = 0; i < values_num; i++)
+	{
+		char buffer[FORMAT_NUMBER_MAX_LEN];
+		char shortest[FORMAT_NUMBER_MAX_LEN];
+		int len;
+		int precision;
+
+		len = format_number_double (buffer, sizeof (buffer), values[i]);
+		if ((len < 1) || (len >= (int) sizeof (buffer))
+				|| (strtod (buffer, NULL) != values[i]))
+		{
+			fprintf (stderr, "Round trip failed: %.17g -> \"%s\"\n",
+					values[i], buffer);
+			errors++;
+			continue;
+		}
+
+		for (precision = 1; precision <= 17; precision++)
+		{
+			snprintf (shortest, sizeof (shortest), "%.*g",
+					precision, values[i]);
+			if (strtod (shortest, NULL) == values[i])
+				break;
+		}
+		if (precision < 17)
+		{
+			/* Compare the number of significant digits. */
+			char *ptr;
+			int digits = 0;
+			int zeros = 0;
+
+			for (ptr = buffer; (*ptr != 0) && (*ptr != 'e'); ptr++)
+			{
+				if ((*ptr == '0') && (digits == 0))
+					continue;
+				if (!isdigit ((int) *ptr))
+					continue;
+				if (*ptr == '0')
+					zeros++;
+				else
+				{
+					digits += zeros + 1;
+					zeros = 0;
+				}
+			}
+
+			if (digits > precision)
+				longer++;
+		}
+	}
+
+	printf ("check: %zu values, %zu round trip errors, "
+			"%zu not shortest\n", values_num, errors, longer);
+	return ((errors == 0) ? 0 : -1);
+} /* }}} int bench_check */
+
+static void bench_printf (const char *name, const char *format, /* {{{ */
+		const double *values, long iterations)
+{
+	char buffer[64];
+	size_t total = 0;
+	double t0, t1;
+	long i;
+
+	t0 = bench_now ();
+	for (i = 0; i < iterations; i++)
+		total += (size_t) snprintf (buffer, sizeof (buffer), format,
+				values[i % BENCH_VALUES_NUM]);
+	t1 = bench_now ();
+
+	printf ("  %-24s %8.1f ns/value (%4.1f chars)\n", name,
+			1e9 * (t1 - t0) / ((double) iterations),
+			((double) total) / ((double) iterations));
+} /* }}} void bench_printf */
+
+static void bench_double (const char *name, /* {{{ */
+		const double *values, long iterations)
+{
+	char buffer[64];
+	size_t total = 0;
+	double t0, t1;
+	long i;
+
+	t0 = bench_now ();
+	for (i = 0; i < iterations; i++)
+		total += (size_t) format_number_double (buffer, sizeof (buffer),
+				values[i % BENCH_VALUES_NUM]);
+	t1 = bench_now ();
+
+	printf ("  %-24s %8.1f ns/value (%4.1f chars)\n", name,
+			1e9 * (t1 - t0) / ((double) iterations),
+			((double) total) / ((double) iterations));
+} /* }}} void bench_double */
+
+static void bench_integers (const uint64_t *values, long iterations) /* {{{ */
+{
+	char buffer[64];
+	size_t total = 0;
+	double t0, t1, t2;
+	long i;
+
+	t0 = bench_now ();
+	for (i = 0; i < iterations; i++)
+		total += (size_t) snprintf (buffer, sizeof (buffer), "%"PRIu64,
+				values[i % BENCH_VALUES_NUM]);
+	t1 = bench_now ();
+	for (i = 0; i < iterations; i++)
+		total += (size_t) format_number_uint64 (buffer, sizeof (buffer),
+				values[i % BENCH_VALUES_NUM]);
+	t2 = bench_now ();
+
+	printf ("integers:\n");
+	printf ("  %-24s %8.1f ns/value\n", "snprintf (%\"PRIu64\")",
+			1e9 * (t1 - t0) / ((double) iterations));
+	printf ("  %-24s %8.1f ns/value\n", "format_number_uint64",
+			1e9 * (t2 - t1) / ((double) iterations));
+} /* }}} void bench_integers */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	static double typical[BENCH_VALUES_NUM];
+	static double random_bits[BENCH_VALUES_NUM];
+	static uint64_t integers[BENCH_VALUES_NUM];
+	long iterations = 1000000;
+	int status = 0;
+	size_t i;
+
+	if (argc >= 2)
+		iterations = atol (argv[1]);
+	if (iterations < 1)
+		iterations = 1;
+
+	srandom (42);
+	for (i = 0; i < BENCH_VALUES_NUM; i++)
+	{
+		typical[i] = bench_random_typical ();
+		random_bits[i] = bench_random_bits ();
+		integers[i] = (((uint64_t) random ()) << (random () % 32));
+	}
+
+	if (bench_check (typical, BENCH_VALUES_NUM) != 0)
+		status = -1;
+	if (bench_check (random_bits, BENCH_VALUES_NUM) != 0)
+		status = -1;
+
+	printf ("typical values:\n");
+	bench_printf ("snprintf (%g)", "%g", typical, iterations);
+	bench_printf ("snprintf (%f)", "%f", typical, iterations);
+	bench_printf ("snprintf (%.17g)", "%.17g", typical, iterations);
+	bench_double ("format_number_double", typical, iterations);
+
+	printf ("random bit patterns:\n");
+	bench_printf ("snprintf (%g)", "%g", random_bits, iterations);
+	bench_printf ("snprintf (%.17g)", "%.17g", random_bits, iterations);
+	bench_double ("format_number_double", random_bits, iterations);
+
+	bench_integers (integers, iterations);
+
+	return ((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
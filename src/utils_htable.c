@@ -0,0 +1,353 @@
+/**
+ * collectd - src/utils_htable.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils_htable.h"
+
+#define HTABLE_SIZE_MIN 16
+
+/* Grow when more than 3/4 of the slots are used, shrink when less than 1/8
+ * are used. */
+#define HTABLE_TOO_FULL(t) (4 * ((t)->size + 1) > 3 * (t)->slots_num)
+#define HTABLE_TOO_EMPTY(t) (((t)->slots_num > HTABLE_SIZE_MIN) \
+		&& (8 * (t)->size < (t)->slots_num))
+
+/*
+ * private data types
+ */
+struct c_htable_slot_s
+{
+	void *key; /* NULL if the slot is empty */
+	void *value;
+	unsigned int hash;
+};
+typedef struct c_htable_slot_s c_htable_slot_t;
+
+struct c_htable_s
+{
+	c_htable_slot_t *slots;
+	size_t slots_num; /* always a power of two */
+	size_t size;
+	size_t pick_pos;
+
+	unsigned int (*hash) (const void *);
+	int (*compare) (const void *, const void *);
+};
+
+struct c_htable_iterator_s
+{
+	c_htable_t *table;
+	size_t pos;
+};
+
+/*
+ * private functions
+ */
+/* Returns the slot holding `key' or the empty slot where it would have to be
+ * inserted. */
+static size_t htable_find (c_htable_t *t, const void *key, /* {{{ */
+		unsigned int hash)
+{
+	size_t mask = t->slots_num - 1;
+	size_t i = hash & mask;
+
+	while (t->slots[i].key != NULL)
+	{
+		if ((t->slots[i].hash == hash)
+				&& (t->compare (key, t->slots[i].key) == 0))
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return (i);
+} /* }}} size_t htable_find */
+
+static int htable_resize (c_htable_t *t, size_t slots_num) /* {{{ */
+{
+	c_htable_slot_t *old_slots = t->slots;
+	size_t old_slots_num = t->slots_num;
+	c_htable_slot_t *new_slots;
+	size_t mask = slots_num - 1;
+	size_t i;
+
+	new_slots = calloc (slots_num, sizeof (*new_slots));
+	if (new_slots == NULL)
+		return (-1);
+
+	for (i = 0; i < old_slots_num; i++)
+	{
+		size_t j;
+
+		if (old_slots[i].key == NULL)
+			continue;
+
+		j = old_slots[i].hash & mask;
+		while (new_slots[j].key != NULL)
+			j = (j + 1) & mask;
+		new_slots[j] = old_slots[i];
+	}
+
+	t->slots = new_slots;
+	t->slots_num = slots_num;
+	t->pick_pos = 0;
+	free (old_slots);
+
+	return (0);
+} /* }}} int htable_resize */
+
+/* Removes the entry in slot `i' and moves following entries of the same
+ * cluster back, so that lookups don't need tombstones. */
+static void htable_remove_slot (c_htable_t *t, size_t i) /* {{{ */
+{
+	size_t mask = t->slots_num - 1;
+	size_t j = i;
+
+	while (42)
+	{
+		size_t home;
+
+		j = (j + 1) & mask;
+		if (t->slots[j].key == NULL)
+			break;
+
+		/* The entry in `j' may be moved to `i' only if its home slot is not in
+		 * the (cyclic) range (i, j]. */
+		home = t->slots[j].hash & mask;
+		if (((j > i) && ((home <= i) || (home > j)))
+				|| ((j < i) && ((home <= i) && (home > j))))
+		{
+			t->slots[i] = t->slots[j];
+			i = j;
+		}
+	}
+
+	t->slots[i].key = NULL;
+	t->slots[i].value = NULL;
+	t->size--;
+} /* }}} void htable_remove_slot */
+
+/*
+ * public functions
+ */
+c_htable_t *c_htable_create (unsigned int (*hash) (const void *), /* {{{ */
+		int (*compare) (const void *, const void *))
+{
+	c_htable_t *t;
+
+	if ((hash == NULL) || (compare == NULL))
+		return (NULL);
+
+	t = calloc (1, sizeof (*t));
+	if (t == NULL)
+		return (NULL);
+
+	t->slots = calloc (HTABLE_SIZE_MIN, sizeof (*t->slots));
+	if (t->slots == NULL)
+	{
+		free (t);
+		return (NULL);
+	}
+	t->slots_num = HTABLE_SIZE_MIN;
+	t->size = 0;
+	t->hash = hash;
+	t->compare = compare;
+
+	return (t);
+} /* }}} c_htable_t *c_htable_create */
+
+void c_htable_destroy (c_htable_t *t) /* {{{ */
+{
+	if (t == NULL)
+		return;
+
+	free (t->slots);
+	free (t);
+} /* }}} void c_htable_destroy */
+
+int c_htable_insert (c_htable_t *t, void *key, void *value) /* {{{ */
+{
+	unsigned int hash;
+	size_t i;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	hash = t->hash (key);
+	i = htable_find (t, key, hash);
+	if (t->slots[i].key != NULL)
+		return (1);
+
+	if (HTABLE_TOO_FULL (t))
+	{
+		if (htable_resize (t, 2 * t->slots_num) != 0)
+			return (-1);
+		i = htable_find (t, key, hash);
+	}
+
+	t->slots[i].key = key;
+	t->slots[i].value = value;
+	t->slots[i].hash = hash;
+	t->size++;
+
+	return (0);
+} /* }}} int c_htable_insert */
+
+int c_htable_remove (c_htable_t *t, const void *key, /* {{{ */
+		void **rkey, void **rvalue)
+{
+	size_t i;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	i = htable_find (t, key, t->hash (key));
+	if (t->slots[i].key == NULL)
+		return (-1);
+
+	if (rkey != NULL)
+		*rkey = t->slots[i].key;
+	if (rvalue != NULL)
+		*rvalue = t->slots[i].value;
+
+	htable_remove_slot (t, i);
+
+	/* Failing to shrink the table is not an error. */
+	if (HTABLE_TOO_EMPTY (t))
+		htable_resize (t, t->slots_num / 2);
+
+	return (0);
+} /* }}} int c_htable_remove */
+
+int c_htable_get (c_htable_t *t, const void *key, void **value) /* {{{ */
+{
+	size_t i;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	i = htable_find (t, key, t->hash (key));
+	if (t->slots[i].key == NULL)
+		return (-1);
+
+	if (value != NULL)
+		*value = t->slots[i].value;
+
+	return (0);
+} /* }}} int c_htable_get */
+
+int c_htable_pick (c_htable_t *t, void **key, void **value) /* {{{ */
+{
+	size_t mask;
+	size_t i;
+
+	if ((t == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	if (t->size == 0)
+		return (-1);
+
+	/* Continue where the last call stopped, so that emptying the table is
+	 * linear. The table is not shrunk here for the same reason. */
+	mask = t->slots_num - 1;
+	i = t->pick_pos & mask;
+	while (t->slots[i].key == NULL)
+		i = (i + 1) & mask;
+	t->pick_pos = i;
+
+	*key = t->slots[i].key;
+	*value = t->slots[i].value;
+	htable_remove_slot (t, i);
+
+	return (0);
+} /* }}} int c_htable_pick */
+
+c_htable_iterator_t *c_htable_get_iterator (c_htable_t *t) /* {{{ */
+{
+	c_htable_iterator_t *iter;
+
+	if (t == NULL)
+		return (NULL);
+
+	iter = calloc (1, sizeof (*iter));
+	if (iter == NULL)
+		return (NULL);
+	iter->table = t;
+	iter->pos = 0;
+
+	return (iter);
+} /* }}} c_htable_iterator_t *c_htable_get_iterator */
+
+int c_htable_iterator_next (c_htable_iterator_t *iter, /* {{{ */
+		void **key, void **value)
+{
+	c_htable_t *t;
+
+	if ((iter == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	t = iter->table;
+	while ((iter->pos < t->slots_num) && (t->slots[iter->pos].key == NULL))
+		iter->pos++;
+
+	if (iter->pos >= t->slots_num)
+		return (-1);
+
+	*key = t->slots[iter->pos].key;
+	*value = t->slots[iter->pos].value;
+	iter->pos++;
+
+	return (0);
+} /* }}} int c_htable_iterator_next */
+
+void c_htable_iterator_destroy (c_htable_iterator_t *iter) /* {{{ */
+{
+	free (iter);
+} /* }}} void c_htable_iterator_destroy */
+
+int c_htable_size (c_htable_t *t) /* {{{ */
+{
+	if (t == NULL)
+		return (0);
+	return ((int) t->size);
+} /* }}} int c_htable_size */
+
+/* FNV-1a */
+unsigned int c_htable_hash_string (const void *key) /* {{{ */
+{
+	const unsigned char *str = key;
+	unsigned int hash = 2166136261U;
+
+	while (*str != 0)
+	{
+		hash ^= *str;
+		hash *= 16777619U;
+		str++;
+	}
+
+	return (hash);
+} /* }}} unsigned int c_htable_hash_string */
+
+/* vim: set sw=8 sts=8 noet fdm=marker : */
@@ -0,0 +1,151 @@
+/**
+ * collectd - src/utils_htable.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Hash table with open addressing (linear probing). Key and value pointers
+ *   and the hash of the key are stored in one flat array, so a lookup usually
+ *   touches one cache line of the table plus the key it compares with.
+ *
+ *   The interface mirrors `utils_avltree.h'. Unlike the AVL tree, the table
+ *   is not ordered: iterators return the entries in no particular order.
+ **/
+
+#ifndef UTILS_HTABLE_H
+#define UTILS_HTABLE_H 1
+
+struct c_htable_s;
+typedef struct c_htable_s c_htable_t;
+
+struct c_htable_iterator_s;
+typedef struct c_htable_iterator_s c_htable_iterator_t;
+
+/*
+ * NAME
+ *   c_htable_create
+ *
+ * DESCRIPTION
+ *   Allocates a new hash table.
+ *
+ * PARAMETERS
+ *   `hash'     Function returning the hash of a key. Keys which compare equal
+ *              must have the same hash. If your keys are char-pointers, you
+ *              can use `c_htable_hash_string' here.
+ *   `compare'  Function used to compare two keys. It has to return zero if the
+ *              keys are equal and non-zero otherwise, so `strcmp' from the
+ *              libc can be used for char-pointers.
+ *
+ * RETURN VALUE
+ *   A c_htable_t-pointer upon success or NULL upon failure.
+ */
+c_htable_t *c_htable_create (unsigned int (*hash) (const void *),
+		int (*compare) (const void *, const void *));
+
+/*
+ * NAME
+ *   c_htable_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a hash table. Stored value- and key-pointer are lost, but of
+ *   course not freed.
+ */
+void c_htable_destroy (c_htable_t *t);
+
+/*
+ * NAME
+ *   c_htable_insert
+ *
+ * DESCRIPTION
+ *   Stores the key-value-pair in the hash table pointed to by `t'. The key
+ *   pointer is not copied and must not be NULL; see `c_avl_insert'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise. It's less than zero if an error
+ *   occurred or greater than zero if the key is already stored in the table.
+ */
+int c_htable_insert (c_htable_t *t, void *key, void *value);
+
+/*
+ * NAME
+ *   c_htable_remove
+ *
+ * DESCRIPTION
+ *   Removes a key-value-pair from the table t. The stored key and value may be
+ *   returned in `rkey' and `rvalue', both of which may be NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the table.
+ */
+int c_htable_remove (c_htable_t *t, const void *key,
+		void **rkey, void **rvalue);
+
+/*
+ * NAME
+ *   c_htable_get
+ *
+ * DESCRIPTION
+ *   Retrieve the `value' belonging to `key'. `value' may be NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the table.
+ */
+int c_htable_get (c_htable_t *t, const void *key, void **value);
+
+/*
+ * NAME
+ *   c_htable_pick
+ *
+ * DESCRIPTION
+ *   Remove an arbitrary element from the table and return its `key' and
+ *   `value'. Intended for removing all elements, one at a time.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the table is empty or key or value is
+ *   NULL.
+ */
+int c_htable_pick (c_htable_t *t, void **key, void **value);
+
+/*
+ * Iterators return all entries in an unspecified order. The table must not be
+ * modified while an iterator is in use.
+ */
+c_htable_iterator_t *c_htable_get_iterator (c_htable_t *t);
+int c_htable_iterator_next (c_htable_iterator_t *iter,
+		void **key, void **value);
+void c_htable_iterator_destroy (c_htable_iterator_t *iter);
+
+/*
+ * NAME
+ *   c_htable_size
+ *
+ * RETURN VALUE
+ *   Number of entries in the table, 0 if the table is empty or NULL.
+ */
+int c_htable_size (c_htable_t *t);
+
+/*
+ * NAME
+ *   c_htable_hash_string
+ *
+ * DESCRIPTION
+ *   Hash function for null-terminated strings, to be used with `strcmp'.
+ */
+unsigned int c_htable_hash_string (const void *key);
+
+#endif /* UTILS_HTABLE_H */
@@ -55,8 +55,18 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_htable.h"
 #include "utils_ignorelist.h"
 
+#include <pthread.h>
+
+/* Initial number of names whose regex match result is cached. When the
+ * cache is full, names which have not been looked up since the previous
+ * eviction are dropped, so names that come and go (e.g. virtual network
+ * interfaces) can't let it grow without bounds. If all names are still in
+ * use, the limit is doubled instead. */
+#define IGNORELIST_CACHE_SIZE 4096
+
 /*
  * private prototypes
  */
@@ -64,8 +74,8 @@ struct ignorelist_item_s
 {
 #if HAVE_REGEX_H
 	regex_t *rmatch;	/* regular expression entry identification */
+	char *pattern;		/* the regular expression itself */
 #endif
-	char *smatch;		/* string entry identification */
 	struct ignorelist_item_s *next;
 };
 typedef struct ignorelist_item_s ignorelist_item_t;
@@ -73,13 +83,48 @@ typedef struct ignorelist_item_s ignorelist_item_t;
 struct ignorelist_s
 {
 	int ignore;		/* ignore entries */
-	ignorelist_item_t *head;	/* pointer to the first entry */
+	int entries_num;	/* number of string and regex entries */
+
+	/* String entries, looked up by name. */
+	c_htable_t *strings;
+
+	/* Regex entries. */
+	ignorelist_item_t *head;	/* pointer to the first regex entry */
+#if HAVE_REGEX_H
+	/* All regex entries combined into one alternation, so every name is
+	 * matched with a single `regexec' call. Built lazily by
+	 * `ignorelist_match'; if it cannot be compiled, the entries are
+	 * matched one by one. */
+	regex_t *combined;
+	_Bool combined_failed;
+
+	/* Names already matched against the regex entries. The value is an
+	 * `ignorelist_cache_entry_t'. */
+	c_htable_t *cache;
+	int cache_size;
+	unsigned int cache_generation;
+	pthread_mutex_t lock;
+#endif
 };
 
+#if HAVE_REGEX_H
+struct ignorelist_cache_entry_s
+{
+	int status;			/* result of the regex match */
+	unsigned int generation;	/* `cache_generation' of the last lookup */
+};
+typedef struct ignorelist_cache_entry_s ignorelist_cache_entry_t;
+#endif
+
 /* *** *** *** ********************************************* *** *** *** */
 /* *** *** *** *** *** ***   private functions   *** *** *** *** *** *** */
 /* *** *** *** ********************************************* *** *** *** */
 
+static int ignorelist_compare_string (const void *a, const void *b)
+{
+	return (strcmp ((const char *) a, (const char *) b));
+} /* int ignorelist_compare_string */
+
 static inline void ignorelist_append (ignorelist_t *il, ignorelist_item_t *item)
 {
 	assert ((il != NULL) && (item != NULL));
@@ -89,6 +134,127 @@ static inline void ignorelist_append (ignorelist_t *il, ignorelist_item_t *item)
 }
 
 #if HAVE_REGEX_H
+static void ignorelist_cache_clear (ignorelist_t *il)
+{
+	void *key;
+	void *value;
+
+	if (il->cache == NULL)
+		return;
+
+	while (c_htable_pick (il->cache, &key, &value) == 0)
+	{
+		sfree (key);
+		sfree (value);
+	}
+} /* void ignorelist_cache_clear */
+
+/* Make room in the full cache by removing all names which have not been
+ * looked up since the previous call. The caller must hold `il->lock'. */
+static void ignorelist_cache_evict (ignorelist_t *il)
+{
+	c_htable_iterator_t *iter;
+	char **expired;
+	int expired_num;
+	char *key;
+	ignorelist_cache_entry_t *ce;
+	int i;
+
+	expired = malloc (c_htable_size (il->cache) * sizeof (*expired));
+	if (expired == NULL)
+	{
+		ignorelist_cache_clear (il);
+		return;
+	}
+	expired_num = 0;
+
+	iter = c_htable_get_iterator (il->cache);
+	while (c_htable_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+	{
+		if (ce->generation != il->cache_generation)
+			expired[expired_num++] = key;
+	}
+	c_htable_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+	{
+		c_htable_remove (il->cache, expired[i], (void *) &key, (void *) &ce);
+		sfree (key);
+		sfree (ce);
+	}
+	sfree (expired);
+
+	/* All cached names are in use: Let the cache grow with them. */
+	if (expired_num == 0)
+		il->cache_size *= 2;
+
+	il->cache_generation++;
+} /* void ignorelist_cache_evict */
+
+/* Drop the combined regex and the cached results, e.g. because an entry
+ * has been added. The caller must hold `il->lock'. */
+static void ignorelist_invalidate (ignorelist_t *il)
+{
+	if (il->combined != NULL)
+	{
+		regfree (il->combined);
+		sfree (il->combined);
+	}
+	il->combined_failed = 0;
+
+	ignorelist_cache_clear (il);
+} /* void ignorelist_invalidate */
+
+/* Builds "(re1)|(re2)|..." from all regex entries and compiles it. The caller
+ * must hold `il->lock'. */
+static int ignorelist_combine (ignorelist_t *il)
+{
+	ignorelist_item_t *item;
+	regex_t *combined;
+	char *pattern;
+	size_t pattern_size;
+	size_t pattern_len;
+	int status;
+
+	pattern_size = 1;
+	for (item = il->head; item != NULL; item = item->next)
+		pattern_size += strlen (item->pattern) + 3;
+
+	pattern = malloc (pattern_size);
+	combined = malloc (sizeof (*combined));
+	if ((pattern == NULL) || (combined == NULL))
+	{
+		sfree (pattern);
+		sfree (combined);
+		return (-1);
+	}
+	memset (combined, 0, sizeof (*combined));
+
+	pattern_len = 0;
+	for (item = il->head; item != NULL; item = item->next)
+	{
+		status = ssnprintf (pattern + pattern_len,
+				pattern_size - pattern_len, "%s(%s)",
+				(pattern_len == 0) ? "" : "|", item->pattern);
+		pattern_len += (size_t) status;
+	}
+
+	status = regcomp (combined, pattern, REG_EXTENDED | REG_NOSUB);
+	if (status != 0)
+	{
+		DEBUG ("ignorelist: Compiling the combined regex \"%s\" "
+				"failed. Matching entries one by one.",
+				pattern);
+		sfree (pattern);
+		sfree (combined);
+		return (-1);
+	}
+
+	sfree (pattern);
+	il->combined = combined;
+	return (0);
+} /* int ignorelist_combine */
+
 static int ignorelist_append_regex(ignorelist_t *il, const char *entry)
 {
 	int rcompile;
@@ -144,9 +310,13 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *entry)
 	}
 	memset (new, '\0', sizeof(ignorelist_item_t));
 	new->rmatch = regtemp;
+	new->pattern = sstrdup (entry);
 
 	/* append new entry */
+	pthread_mutex_lock (&il->lock);
 	ignorelist_append (il, new);
+	ignorelist_invalidate (il);
+	pthread_mutex_unlock (&il->lock);
 
 	return (0);
 } /* int ignorelist_append_regex(ignorelist_t *il, const char *entry) */
@@ -154,19 +324,30 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *entry)
 
 static int ignorelist_append_string(ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *new;
+	char *key;
 
-	/* create new entry */
-	if ((new = malloc(sizeof(ignorelist_item_t))) == NULL )
+	if (il->strings == NULL)
+	{
+		il->strings = c_htable_create (c_htable_hash_string,
+				ignorelist_compare_string);
+		if (il->strings == NULL)
+		{
+			ERROR ("cannot allocate new entry");
+			return (1);
+		}
+	}
+
+	/* duplicate entries are stored only once */
+	if (c_htable_get (il->strings, entry, NULL) == 0)
+		return (0);
+
+	key = sstrdup (entry);
+	if (c_htable_insert (il->strings, key, NULL) != 0)
 	{
 		ERROR ("cannot allocate new entry");
+		sfree (key);
 		return (1);
 	}
-	memset (new, '\0', sizeof(ignorelist_item_t));
-	new->smatch = sstrdup(entry);
-
-	/* append new entry */
-	ignorelist_append (il, new);
 
 	return (0);
 } /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
@@ -176,33 +357,99 @@ static int ignorelist_append_string(ignorelist_t *il, const char *entry)
  * check list for entry regex match
  * return 1 if found
  */
-static int ignorelist_match_regex (ignorelist_item_t *item, const char *entry)
+static int ignorelist_match_regex (ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->rmatch != NULL)
+	ignorelist_item_t *item;
+	char *key;
+	ignorelist_cache_entry_t *ce = NULL;
+	int status;
+
+	assert ((il != NULL) && (il->head != NULL)
 			&& (entry != NULL) && (strlen (entry) > 0));
 
-	/* match regex */
-	if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
-		return (1);
+	pthread_mutex_lock (&il->lock);
 
-	return (0);
-} /* int ignorelist_match_regex (ignorelist_item_t *item, const char *entry) */
+	if ((il->cache != NULL)
+			&& (c_htable_get (il->cache, entry, (void *) &ce) == 0))
+	{
+		ce->generation = il->cache_generation;
+		status = ce->status;
+		pthread_mutex_unlock (&il->lock);
+		return (status);
+	}
+
+	if ((il->combined == NULL) && !il->combined_failed)
+	{
+		if (ignorelist_combine (il) != 0)
+			il->combined_failed = 1;
+	}
+
+	status = 0;
+	if (il->combined != NULL)
+	{
+		/* match regex */
+		if (regexec (il->combined, entry, 0, NULL, 0) == 0)
+			status = 1;
+	}
+	else
+	{
+		for (item = il->head; item != NULL; item = item->next)
+		{
+			if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
+			{
+				status = 1;
+				break;
+			}
+		}
+	}
+
+	if (il->cache == NULL)
+	{
+		il->cache = c_htable_create (c_htable_hash_string,
+				ignorelist_compare_string);
+		il->cache_size = IGNORELIST_CACHE_SIZE;
+	}
+	if (il->cache != NULL)
+	{
+		if (c_htable_size (il->cache) >= il->cache_size)
+			ignorelist_cache_evict (il);
+
+		key = strdup (entry);
+		ce = malloc (sizeof (*ce));
+		if ((key != NULL) && (ce != NULL))
+		{
+			ce->status = status;
+			ce->generation = il->cache_generation;
+		}
+		if ((key == NULL) || (ce == NULL)
+				|| (c_htable_insert (il->cache, key, ce) != 0))
+		{
+			sfree (key);
+			sfree (ce);
+		}
+	}
+
+	pthread_mutex_unlock (&il->lock);
+	return (status);
+} /* int ignorelist_match_regex (ignorelist_t *il, const char *entry) */
 #endif
 
 /*
  * check list for entry string match
  * return 1 if found
  */
-static int ignorelist_match_string (ignorelist_item_t *item, const char *entry)
+static int ignorelist_match_string (ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->smatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	assert ((il != NULL) && (entry != NULL) && (strlen (entry) > 0));
 
-	if (strcmp (entry, item->smatch) == 0)
+	if (il->strings == NULL)
+		return (0);
+
+	if (c_htable_get (il->strings, entry, NULL) == 0)
 		return (1);
 
 	return (0);
-} /* int ignorelist_match_string (ignorelist_item_t *item, const char *entry) */
+} /* int ignorelist_match_string (ignorelist_t *il, const char *entry) */
 
 
 /* *** *** *** ******************************************** *** *** *** */
@@ -227,6 +474,10 @@ ignorelist_t *ignorelist_create (int invert)
 	 */
 	il->ignore = invert ? 0 : 1;
 
+#if HAVE_REGEX_H
+	pthread_mutex_init (&il->lock, /* attr = */ NULL);
+#endif
+
 	return (il);
 } /* ignorelist_t *ignorelist_create (int ignore) */
 
@@ -248,17 +499,31 @@ void ignorelist_free (ignorelist_t *il)
 		if (this->rmatch != NULL)
 		{
 			regfree (this->rmatch);
-			this->rmatch = NULL;
+			sfree (this->rmatch);
 		}
+		sfree (this->pattern);
 #endif
-		if (this->smatch != NULL)
-		{
-			sfree (this->smatch);
-			this->smatch = NULL;
-		}
 		sfree (this);
 	}
 
+	if (il->strings != NULL)
+	{
+		void *key;
+		void *value;
+
+		while (c_htable_pick (il->strings, &key, &value) == 0)
+			sfree (key);
+		c_htable_destroy (il->strings);
+		il->strings = NULL;
+	}
+
+#if HAVE_REGEX_H
+	ignorelist_invalidate (il);
+	if (il->cache != NULL)
+		c_htable_destroy (il->cache);
+	pthread_mutex_destroy (&il->lock);
+#endif
+
 	sfree (il);
 	il = NULL;
 } /* void ignorelist_destroy (ignorelist_t *il) */
@@ -324,6 +589,9 @@ int ignorelist_add (ignorelist_t *il, const char *entry)
 		ret = ignorelist_append_string(il, entry);
 	}
 
+	if (ret == 0)
+		il->entries_num++;
+
 	return (ret);
 } /* int ignorelist_add (ignorelist_t *il, const char *entry) */
 
@@ -333,32 +601,20 @@ int ignorelist_add (ignorelist_t *il, const char *entry)
  */
 int ignorelist_match (ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *traverse;
-
 	/* if no entries, collect all */
-	if ((il == NULL) || (il->head == NULL))
+	if ((il == NULL) || (il->entries_num == 0))
 		return (0);
 
-	if ((entry == NULL) || (strlen (entry) == 0))
+	if ((entry == NULL) || (entry[0] == 0))
 		return (0);
 
-	/* traverse list and check entries */
-	for (traverse = il->head; traverse != NULL; traverse = traverse->next)
-	{
+	if (ignorelist_match_string (il, entry))
+		return (il->ignore);
+
 #if HAVE_REGEX_H
-		if (traverse->rmatch != NULL)
-		{
-			if (ignorelist_match_regex (traverse, entry))
-				return (il->ignore);
-		}
-		else
+	if ((il->head != NULL) && ignorelist_match_regex (il, entry))
+		return (il->ignore);
 #endif
-		{
-			if (ignorelist_match_string (traverse, entry))
-				return (il->ignore);
-		}
-	} /* for traverse */
 
 	return (1 - il->ignore);
 } /* int ignorelist_match (ignorelist_t *il, const char *entry) */
-
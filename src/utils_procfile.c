@@ -0,0 +1,228 @@
+/**
+ * collectd - src/utils_procfile.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_procfile.h"
+
+#include <fcntl.h>
+
+#define CU_PROCFILE_INITIAL_SIZE 4096
+
+struct cu_procfile_s
+{
+	char *file;
+	int fd;
+
+	char *buffer;
+	size_t buffer_size;
+	size_t buffer_fill;
+
+	/* Offset of the next line to be returned by `cu_procfile_readline'. */
+	size_t position;
+};
+
+static int cu_procfile_open (cu_procfile_t *obj) /* {{{ */
+{
+	int flags = O_RDONLY;
+
+#ifdef O_CLOEXEC
+	/* Don't leak the descriptor to processes started by other plugins. */
+	flags |= O_CLOEXEC;
+#endif
+
+	obj->fd = open (obj->file, flags);
+	if (obj->fd < 0)
+		return (-1);
+
+#ifndef O_CLOEXEC
+	fcntl (obj->fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	return (0);
+} /* }}} int cu_procfile_open */
+
+static void cu_procfile_close (cu_procfile_t *obj) /* {{{ */
+{
+	if (obj->fd >= 0)
+		close (obj->fd);
+	obj->fd = -1;
+} /* }}} void cu_procfile_close */
+
+/* Reads the file from offset zero until EOF. */
+static int cu_procfile_read_all (cu_procfile_t *obj) /* {{{ */
+{
+	obj->buffer_fill = 0;
+	obj->position = 0;
+
+	while (42)
+	{
+		ssize_t status;
+
+		/* Leave room for the terminating null byte. */
+		if ((obj->buffer_size - obj->buffer_fill) < 2)
+		{
+			size_t new_size = 2 * obj->buffer_size;
+			char *tmp;
+
+			tmp = realloc (obj->buffer, new_size);
+			if (tmp == NULL)
+			{
+				errno = ENOMEM;
+				return (-1);
+			}
+			obj->buffer = tmp;
+			obj->buffer_size = new_size;
+		}
+
+		status = pread (obj->fd, obj->buffer + obj->buffer_fill,
+				obj->buffer_size - obj->buffer_fill - 1,
+				(off_t) obj->buffer_fill);
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		else if (status == 0)
+			break;
+
+		obj->buffer_fill += (size_t) status;
+	}
+
+	obj->buffer[obj->buffer_fill] = 0;
+	return (0);
+} /* }}} int cu_procfile_read_all */
+
+cu_procfile_t *cu_procfile_create (const char *file) /* {{{ */
+{
+	cu_procfile_t *obj;
+
+	if (file == NULL)
+		return (NULL);
+
+	obj = malloc (sizeof (*obj));
+	if (obj == NULL)
+		return (NULL);
+	memset (obj, 0, sizeof (*obj));
+	obj->fd = -1;
+
+	obj->file = strdup (file);
+	obj->buffer = malloc (CU_PROCFILE_INITIAL_SIZE);
+	if ((obj->file == NULL) || (obj->buffer == NULL))
+	{
+		sfree (obj->file);
+		sfree (obj->buffer);
+		sfree (obj);
+		return (NULL);
+	}
+	obj->buffer_size = CU_PROCFILE_INITIAL_SIZE;
+	obj->buffer[0] = 0;
+
+	return (obj);
+} /* }}} cu_procfile_t *cu_procfile_create */
+
+void cu_procfile_destroy (cu_procfile_t *obj) /* {{{ */
+{
+	if (obj == NULL)
+		return;
+
+	cu_procfile_close (obj);
+	sfree (obj->file);
+	sfree (obj->buffer);
+	sfree (obj);
+} /* }}} void cu_procfile_destroy */
+
+int cu_procfile_read (cu_procfile_t *obj) /* {{{ */
+{
+	int status;
+
+	if (obj == NULL)
+	{
+		errno = EINVAL;
+		return (-1);
+	}
+
+	status = -1;
+	if (obj->fd >= 0)
+	{
+		status = cu_procfile_read_all (obj);
+		/* Re-open the file once, e.g. if it has been replaced. */
+		if (status != 0)
+			cu_procfile_close (obj);
+	}
+
+	if (status != 0)
+	{
+		status = cu_procfile_open (obj);
+		if (status == 0)
+			status = cu_procfile_read_all (obj);
+	}
+
+	if (status != 0)
+	{
+		int saved_errno = errno;
+
+		cu_procfile_close (obj);
+		obj->buffer_fill = 0;
+		obj->position = 0;
+		obj->buffer[0] = 0;
+
+		errno = saved_errno;
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int cu_procfile_read */
+
+char *cu_procfile_readline (cu_procfile_t *obj) /* {{{ */
+{
+	char *line;
+	char *newline;
+
+	if ((obj == NULL) || (obj->position >= obj->buffer_fill))
+		return (NULL);
+
+	line = obj->buffer + obj->position;
+	newline = memchr (line, '\n', obj->buffer_fill - obj->position);
+	if (newline == NULL)
+	{
+		/* Last line without a trailing newline. The buffer is null
+		 * terminated by `cu_procfile_read_all'. */
+		obj->position = obj->buffer_fill;
+	}
+	else
+	{
+		*newline = 0;
+		obj->position = (size_t) (newline - obj->buffer) + 1;
+	}
+
+	return (line);
+} /* }}} char *cu_procfile_readline */
+
+const char *cu_procfile_name (const cu_procfile_t *obj) /* {{{ */
+{
+	if (obj == NULL)
+		return (NULL);
+	return (obj->file);
+} /* }}} const char *cu_procfile_name */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
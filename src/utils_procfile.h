@@ -0,0 +1,87 @@
+/**
+ * collectd - src/utils_procfile.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Reads files below /proc and /sys which are re-read every interval. The
+ *   file descriptor is kept open between reads and the file is re-read from
+ *   the beginning using pread(2). Lines are returned as pointers into an
+ *   internal buffer, so no copying and no stdio is involved.
+ **/
+
+#ifndef UTILS_PROCFILE_H
+#define UTILS_PROCFILE_H 1
+
+struct cu_procfile_s;
+typedef struct cu_procfile_s cu_procfile_t;
+
+/*
+ * NAME
+ *   cu_procfile_create
+ *
+ * DESCRIPTION
+ *   Allocates a new procfile object. The file is opened lazily by the first
+ *   call to `cu_procfile_read', so the file doesn't need to exist yet.
+ *
+ * PARAMETERS
+ *   `file'       The name of the file to be read, e.g. "/proc/stat".
+ */
+cu_procfile_t *cu_procfile_create (const char *file);
+
+/*
+ * cu_procfile_destroy
+ *
+ * Closes the file and frees all memory associated with the procfile object.
+ */
+void cu_procfile_destroy (cu_procfile_t *obj);
+
+/*
+ * cu_procfile_read
+ *
+ * Reads the entire file into the internal buffer, growing it as necessary,
+ * and resets the line iterator. Pointers returned by `cu_procfile_readline'
+ * become invalid.
+ *
+ * If reading fails, the file is re-opened once, e.g. because a per-process
+ * file went away or the file has been replaced.
+ *
+ * Returns 0 when successful and non-zero otherwise. In the latter case
+ * `errno' is set and nothing has been logged, so the caller can decide whether
+ * a missing file is an error.
+ */
+int cu_procfile_read (cu_procfile_t *obj);
+
+/*
+ * cu_procfile_readline
+ *
+ * Returns the next line of the buffer filled by `cu_procfile_read', with the
+ * trailing newline removed, or NULL when all lines have been returned. The
+ * returned string may be modified, e.g. by `strsplit', and remains valid until
+ * the next call of `cu_procfile_read' or `cu_procfile_destroy'.
+ */
+char *cu_procfile_readline (cu_procfile_t *obj);
+
+/*
+ * cu_procfile_name
+ *
+ * Returns the file name passed to `cu_procfile_create'.
+ */
+const char *cu_procfile_name (const cu_procfile_t *obj);
+
+#endif /* UTILS_PROCFILE_H */
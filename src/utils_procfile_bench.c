@@ -0,0 +1,151 @@
+/**
+ * collectd - src/utils_procfile_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Author:
+ *   agent <agent at local>
+ *
+ * DESCRIPTION
+ *   Compares the cost of reading a file below /proc with stdio, the way
+ *   plugins used to do it, and with `cu_procfile_t'.
+ *
+ *   Usage: utils_procfile_bench [<file> [<iterations>]]
+ **/
+
+#include "collectd.h"
+#include "utils_procfile.h"
+
+#include <time.h>
+
+/* Splits `buffer' in place, like `strsplit' does, and returns the number of
+ * fields. */
+static int bench_split (char *buffer) /* {{{ */
+{
+	char *saveptr = NULL;
+	int fields_num = 0;
+
+	while (strtok_r (buffer, " \t\r\n", &saveptr) != NULL)
+	{
+		buffer = NULL;
+		fields_num++;
+	}
+
+	return (fields_num);
+} /* }}} int bench_split */
+
+static double bench_now (void) /* {{{ */
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1e9));
+} /* }}} double bench_now */
+
+static int bench_stdio (const char *file, long iterations, /* {{{ */
+		long *ret_fields)
+{
+	long fields = 0;
+	long i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		FILE *fh;
+		char buffer[1024];
+
+		fh = fopen (file, "r");
+		if (fh == NULL)
+		{
+			perror ("fopen");
+			return (-1);
+		}
+
+		while (fgets (buffer, sizeof (buffer), fh) != NULL)
+			fields += bench_split (buffer);
+
+		fclose (fh);
+	}
+
+	*ret_fields = fields;
+	return (0);
+} /* }}} int bench_stdio */
+
+static int bench_procfile (const char *file, long iterations, /* {{{ */
+		long *ret_fields)
+{
+	cu_procfile_t *pf;
+	long fields = 0;
+	long i;
+
+	pf = cu_procfile_create (file);
+	if (pf == NULL)
+		return (-1);
+
+	for (i = 0; i < iterations; i++)
+	{
+		char *line;
+
+		if (cu_procfile_read (pf) != 0)
+		{
+			perror ("cu_procfile_read");
+			cu_procfile_destroy (pf);
+			return (-1);
+		}
+
+		while ((line = cu_procfile_readline (pf)) != NULL)
+			fields += bench_split (line);
+	}
+
+	cu_procfile_destroy (pf);
+
+	*ret_fields = fields;
+	return (0);
+} /* }}} int bench_procfile */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	const char *file = "/proc/stat";
+	long iterations = 10000;
+	long fields_stdio = 0;
+	long fields_procfile = 0;
+	double t0, t1, t2;
+
+	if (argc >= 2)
+		file = argv[1];
+	if (argc >= 3)
+		iterations = atol (argv[2]);
+	if (iterations < 1)
+		iterations = 1;
+
+	t0 = bench_now ();
+	if (bench_stdio (file, iterations, &fields_stdio) != 0)
+		return (EXIT_FAILURE);
+	t1 = bench_now ();
+	if (bench_procfile (file, iterations, &fields_procfile) != 0)
+		return (EXIT_FAILURE);
+	t2 = bench_now ();
+
+	printf ("%s: %li iterations\n", file, iterations);
+	printf ("  stdio:    %10.3f us/read (%li fields)\n",
+			1e6 * (t1 - t0) / ((double) iterations),
+			fields_stdio / iterations);
+	printf ("  procfile: %10.3f us/read (%li fields)\n",
+			1e6 * (t2 - t1) / ((double) iterations),
+			fields_procfile / iterations);
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -21,11 +21,57 @@
 
 #include "collectd.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
 #include <pthread.h>
 #include <rrd.h>
 
+/*
+ * Private types
+ */
+struct cu_rrd_value_s
+{
+  char *string;
+  cdtime_t time;
+};
+typedef struct cu_rrd_value_s cu_rrd_value_t;
+
+/* A file waiting to be created or being created, and the values received for
+ * it in the meantime. */
+struct cu_rrd_job_s
+{
+  char *filename;
+  data_set_t ds;
+  value_list_t vl;
+
+  cu_rrd_value_t *values;
+  size_t values_num;
+
+  struct cu_rrd_job_s *next;
+};
+typedef struct cu_rrd_job_s cu_rrd_job_t;
+
+struct cu_rrd_creator_s
+{
+  const rrdcreate_config_t *cfg;
+  cu_rrd_value_callback_t callback;
+  void *user_data;
+
+  /* Maps file names to jobs, including the ones currently being processed.
+   * Only jobs that have not been started are in the queue. */
+  c_avl_tree_t *jobs;
+  cu_rrd_job_t *queue_head;
+  cu_rrd_job_t *queue_tail;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  _Bool shutdown;
+
+  pthread_t *threads;
+  size_t threads_num;
+};
+
 /*
  * Private variables
  */
@@ -436,4 +482,302 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   return (status);
 } /* }}} int cu_rrd_create_file */
 
+static void cu_rrd_job_free (cu_rrd_job_t *job) /* {{{ */
+{
+  size_t i;
+
+  if (job == NULL)
+    return;
+
+  for (i = 0; i < job->values_num; i++)
+    sfree (job->values[i].string);
+  sfree (job->values);
+
+  sfree (job->ds.ds);
+  sfree (job->filename);
+  sfree (job);
+} /* }}} void cu_rrd_job_free */
+
+static int cu_rrd_job_add_value (cu_rrd_job_t *job, /* {{{ */
+    const char *value, cdtime_t value_time)
+{
+  cu_rrd_value_t *tmp;
+
+  tmp = realloc (job->values, (job->values_num + 1) * sizeof (*job->values));
+  if (tmp == NULL)
+    return (ENOMEM);
+  job->values = tmp;
+
+  job->values[job->values_num].string = strdup (value);
+  if (job->values[job->values_num].string == NULL)
+    return (ENOMEM);
+  job->values[job->values_num].time = value_time;
+  job->values_num++;
+
+  return (0);
+} /* }}} int cu_rrd_job_add_value */
+
+static cu_rrd_job_t *cu_rrd_job_create (const char *filename, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  cu_rrd_job_t *job;
+
+  job = malloc (sizeof (*job));
+  if (job == NULL)
+    return (NULL);
+  memset (job, 0, sizeof (*job));
+
+  job->filename = strdup (filename);
+
+  /* Keep a private copy of the data set and the value list. Only the
+   * meta data needed to create the file is copied, not the values. */
+  memcpy (&job->ds, ds, sizeof (job->ds));
+  job->ds.ds = malloc (ds->ds_num * sizeof (*job->ds.ds));
+  if ((job->filename == NULL) || (job->ds.ds == NULL))
+  {
+    cu_rrd_job_free (job);
+    return (NULL);
+  }
+  memcpy (job->ds.ds, ds->ds, ds->ds_num * sizeof (*job->ds.ds));
+
+  memcpy (&job->vl, vl, sizeof (job->vl));
+  job->vl.values = NULL;
+  job->vl.values_len = 0;
+  job->vl.meta = NULL;
+
+  job->next = NULL;
+
+  return (job);
+} /* }}} cu_rrd_job_t *cu_rrd_job_create */
+
+static void *cu_rrd_creator_thread (void *arg) /* {{{ */
+{
+  cu_rrd_creator_t *c = arg;
+
+  pthread_mutex_lock (&c->lock);
+  while (42)
+  {
+    cu_rrd_job_t *job;
+    void *key = NULL;
+    size_t i;
+    int status;
+
+    while ((c->queue_head == NULL) && !c->shutdown)
+      pthread_cond_wait (&c->cond, &c->lock);
+
+    /* Pending jobs are finished before shutting down. */
+    if (c->queue_head == NULL)
+      break;
+
+    job = c->queue_head;
+    c->queue_head = job->next;
+    if (c->queue_head == NULL)
+      c->queue_tail = NULL;
+    job->next = NULL;
+
+    pthread_mutex_unlock (&c->lock);
+
+    status = cu_rrd_create_file (job->filename, &job->ds, &job->vl, c->cfg);
+
+    pthread_mutex_lock (&c->lock);
+
+    if (status != 0)
+    {
+      ERROR ("cu_rrd_creator_thread: Creating \"%s\" failed. "
+          "Dropping %zu buffered value%s.", job->filename, job->values_num,
+          (job->values_num == 1) ? "" : "s");
+    }
+
+    /* Drain the buffered values without holding the lock, since the callback
+     * may block, e.g. on network I/O. The job stays in the tree meanwhile, so
+     * new values for this file are appended to it instead of overtaking the
+     * ones being replayed. Once no values are left, the job is removed and
+     * values are passed to the callers directly again. */
+    while ((status == 0) && (job->values_num > 0))
+    {
+      cu_rrd_value_t *values = job->values;
+      size_t values_num = job->values_num;
+
+      job->values = NULL;
+      job->values_num = 0;
+      pthread_mutex_unlock (&c->lock);
+
+      for (i = 0; i < values_num; i++)
+      {
+        (*c->callback) (job->filename, values[i].string,
+            values[i].time, c->user_data);
+        sfree (values[i].string);
+      }
+      sfree (values);
+
+      pthread_mutex_lock (&c->lock);
+    }
+
+    c_avl_remove (c->jobs, job->filename, &key, /* value = */ NULL);
+    cu_rrd_job_free (job);
+  } /* while (42) */
+  pthread_mutex_unlock (&c->lock);
+
+  return ((void *) 0);
+} /* }}} void *cu_rrd_creator_thread */
+
+cu_rrd_creator_t *cu_rrd_creator_create (const rrdcreate_config_t *cfg, /* {{{ */
+    cu_rrd_value_callback_t callback, void *user_data)
+{
+  cu_rrd_creator_t *c;
+  size_t threads_num;
+
+  if ((cfg == NULL) || (callback == NULL))
+    return (NULL);
+
+  threads_num = (cfg->create_threads > 0) ? ((size_t) cfg->create_threads) : 1;
+
+  c = malloc (sizeof (*c));
+  if (c == NULL)
+    return (NULL);
+  memset (c, 0, sizeof (*c));
+
+  c->cfg = cfg;
+  c->callback = callback;
+  c->user_data = user_data;
+  c->queue_head = NULL;
+  c->queue_tail = NULL;
+  c->shutdown = 0;
+  pthread_mutex_init (&c->lock, /* attr = */ NULL);
+  pthread_cond_init (&c->cond, /* attr = */ NULL);
+
+  c->jobs = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  c->threads = calloc (threads_num, sizeof (*c->threads));
+  if ((c->jobs == NULL) || (c->threads == NULL))
+  {
+    cu_rrd_creator_destroy (c);
+    return (NULL);
+  }
+
+  for (c->threads_num = 0; c->threads_num < threads_num; c->threads_num++)
+  {
+    int status;
+
+    status = plugin_thread_create (c->threads + c->threads_num,
+        /* attr = */ NULL, cu_rrd_creator_thread, c);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("cu_rrd_creator_create: pthread_create failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+  }
+
+  if (c->threads_num == 0)
+  {
+    cu_rrd_creator_destroy (c);
+    return (NULL);
+  }
+
+  return (c);
+} /* }}} cu_rrd_creator_t *cu_rrd_creator_create */
+
+void cu_rrd_creator_destroy (cu_rrd_creator_t *c) /* {{{ */
+{
+  size_t i;
+
+  if (c == NULL)
+    return;
+
+  pthread_mutex_lock (&c->lock);
+  if (c->queue_head != NULL)
+    INFO ("cu_rrd_creator_destroy: Waiting for pending RRD files "
+        "to be created.");
+  c->shutdown = 1;
+  pthread_cond_broadcast (&c->cond);
+  pthread_mutex_unlock (&c->lock);
+
+  for (i = 0; i < c->threads_num; i++)
+    pthread_join (c->threads[i], /* retval = */ NULL);
+  sfree (c->threads);
+
+  /* All jobs have been processed by now, unless no thread could be started.
+   * Queued jobs are also in the tree, so free them from there. */
+  c->queue_head = c->queue_tail = NULL;
+  if (c->jobs != NULL)
+  {
+    void *key;
+    void *value;
+
+    while (c_avl_pick (c->jobs, &key, &value) == 0)
+      cu_rrd_job_free (value);
+    c_avl_destroy (c->jobs);
+  }
+
+  pthread_mutex_destroy (&c->lock);
+  pthread_cond_destroy (&c->cond);
+  sfree (c);
+} /* }}} void cu_rrd_creator_destroy */
+
+int cu_rrd_creator_submit (cu_rrd_creator_t *c, /* {{{ */
+    const char *filename, const data_set_t *ds, const value_list_t *vl,
+    const char *value)
+{
+  cu_rrd_job_t *job = NULL;
+  int status;
+
+  if ((c == NULL) || (filename == NULL) || (vl == NULL) || (value == NULL))
+    return (EINVAL);
+
+  pthread_mutex_lock (&c->lock);
+
+  status = c_avl_get (c->jobs, filename, (void *) &job);
+  if (status != 0)
+  {
+    /* Not pending and the caller doesn't want it created. */
+    if (ds == NULL)
+    {
+      pthread_mutex_unlock (&c->lock);
+      return (ENOENT);
+    }
+
+    if (c->shutdown)
+    {
+      pthread_mutex_unlock (&c->lock);
+      return (-1);
+    }
+
+    job = cu_rrd_job_create (filename, ds, vl);
+    if (job == NULL)
+    {
+      pthread_mutex_unlock (&c->lock);
+      ERROR ("cu_rrd_creator_submit: cu_rrd_job_create failed.");
+      return (ENOMEM);
+    }
+
+    status = c_avl_insert (c->jobs, job->filename, job);
+    if (status != 0)
+    {
+      pthread_mutex_unlock (&c->lock);
+      ERROR ("cu_rrd_creator_submit: c_avl_insert failed.");
+      cu_rrd_job_free (job);
+      return (ENOMEM);
+    }
+
+    if (c->queue_tail == NULL)
+      c->queue_head = job;
+    else
+      c->queue_tail->next = job;
+    c->queue_tail = job;
+
+    pthread_cond_signal (&c->cond);
+  }
+
+  status = cu_rrd_job_add_value (job, value, vl->time);
+
+  pthread_mutex_unlock (&c->lock);
+
+  if (status != 0)
+    ERROR ("cu_rrd_creator_submit: Buffering a value for \"%s\" failed.",
+        filename);
+
+  return (status);
+} /* }}} int cu_rrd_creator_submit */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -38,6 +38,10 @@ struct rrdcreate_config_s
 
   char **consolidation_functions;
   size_t consolidation_functions_num;
+
+  /* Create new files in background threads, see cu_rrd_creator_create. */
+  _Bool async;
+  int create_threads;
 };
 typedef struct rrdcreate_config_s rrdcreate_config_t;
 
@@ -45,6 +49,40 @@ int cu_rrd_create_file (const char *filename,
     const data_set_t *ds, const value_list_t *vl,
     const rrdcreate_config_t *cfg);
 
+/*
+ * Asynchronous creation of RRD files
+ *
+ * A "creator" creates files in `cfg->create_threads' background threads, so
+ * the write callbacks don't block while new files are set up. Values received
+ * for a file while it is being created are buffered and passed to `callback'
+ * in order once the file exists. If creating the file fails, the buffered
+ * values are dropped.
+ */
+struct cu_rrd_creator_s;
+typedef struct cu_rrd_creator_s cu_rrd_creator_t;
+
+typedef void (*cu_rrd_value_callback_t) (const char *filename,
+    const char *value, cdtime_t value_time, void *user_data);
+
+cu_rrd_creator_t *cu_rrd_creator_create (const rrdcreate_config_t *cfg,
+    cu_rrd_value_callback_t callback, void *user_data);
+
+/* Waits for all pending files to be created. */
+void cu_rrd_creator_destroy (cu_rrd_creator_t *c);
+
+/*
+ * cu_rrd_creator_submit
+ *
+ * Buffers `value' (formatted as for rrd_update) for `filename' if the file is
+ * waiting to be created. Otherwise, if `ds' is not NULL, queues the creation
+ * of the file. Returns ENOENT if `ds' is NULL and the file is not pending, so
+ * callers can check for a pending creation before stat()ing the file. Returns
+ * zero if the value has been taken over.
+ */
+int cu_rrd_creator_submit (cu_rrd_creator_t *c,
+    const char *filename, const data_set_t *ds, const value_list_t *vl,
+    const char *value);
+
 #endif /* UTILS_RRDCREATE_H */
 
 /* vim: set sw=2 sts=2 et : */
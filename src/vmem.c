@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #if KERNEL_LINUX
 static const char *config_keys[] =
@@ -31,6 +32,8 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int verbose_output = 0;
+
+static cu_procfile_t *proc_vmstat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -105,19 +108,24 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+
+  if (proc_vmstat == NULL)
+  {
+    proc_vmstat = cu_procfile_create ("/proc/vmstat");
+    if (proc_vmstat == NULL)
+      return (-1);
+  }
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  if (cu_procfile_read (proc_vmstat) != 0)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
+    ERROR ("vmem plugin: Reading /proc/vmstat failed: %s",
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while ((buffer = cu_procfile_readline (proc_vmstat)) != NULL)
   {
     char *fields[4];
     int fields_num;
@@ -254,10 +262,7 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose (fh);
-  fh = NULL;
+  } /* while (cu_procfile_readline) */
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
@@ -272,11 +277,22 @@ static int vmem_read (void)
   return (0);
 } /* int vmem_read */
 
+static int vmem_shutdown (void)
+{
+#if KERNEL_LINUX
+  cu_procfile_destroy (proc_vmstat);
+  proc_vmstat = NULL;
+#endif /* KERNEL_LINUX */
+
+  return (0);
+} /* int vmem_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("vmem", vmem_config,
       config_keys, config_keys_num);
   plugin_register_read ("vmem", vmem_read);
+  plugin_register_shutdown ("vmem", vmem_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 ts=8 : */
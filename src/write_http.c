@@ -36,6 +36,13 @@
 
 #include <curl/curl.h>
 
+#if HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+#define WH_DEFAULT_BUFFER_SIZE 4096
+#define WH_MIN_BUFFER_SIZE     1024
+
 /*
  * Private variables
  */
@@ -50,27 +57,53 @@ struct wh_callback_s
         int   verify_host;
         char *cacert;
         int   store_rates;
+        int   compress;
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON    1
         int format;
 
         CURL *curl;
+        struct curl_slist *headers;
         char curl_errbuf[CURL_ERROR_SIZE];
 
-        char   send_buffer[4096];
+        /* The buffer values are added to. */
+        char  *send_buffer;
+        size_t send_buffer_size;
         size_t send_buffer_free;
         size_t send_buffer_fill;
         cdtime_t send_buffer_init_time;
 
+        /* A full buffer waiting for or being sent by the sender thread. While
+         * the thread is idle, `pending_buffer' is NULL and the second buffer
+         * is kept in `spare_buffer'. */
+        char  *pending_buffer;
+        size_t pending_buffer_fill;
+        char  *spare_buffer;
+
+#if HAVE_LIBZ
+        z_stream gzip_stream;
+        _Bool    gzip_initialized;
+        char    *gzip_buffer;
+        size_t   gzip_buffer_size;
+#endif
+
         pthread_mutex_t send_lock;
+        /* Signaled when a buffer is pending or the thread should exit. */
+        pthread_cond_t  send_cond;
+        /* Signaled when the sender thread is done with a buffer. */
+        pthread_cond_t  done_cond;
+
+        _Bool     send_thread_running;
+        _Bool     send_thread_stop;
+        pthread_t send_thread;
 };
 typedef struct wh_callback_s wh_callback_t;
 
 static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
 {
-        memset (cb->send_buffer, 0, sizeof (cb->send_buffer));
-        cb->send_buffer_free = sizeof (cb->send_buffer);
+        cb->send_buffer[0] = 0;
+        cb->send_buffer_free = cb->send_buffer_size;
         cb->send_buffer_fill = 0;
         cb->send_buffer_init_time = cdtime ();
 
@@ -82,11 +115,68 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
         }
 } /* }}} wh_reset_buffer */
 
-static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+#if HAVE_LIBZ
+/* Compresses `buffer' into `cb->gzip_buffer'. Returns the size of the
+ * compressed data or zero on failure. */
+static size_t wh_compress_buffer (wh_callback_t *cb, /* {{{ */
+                const char *buffer, size_t buffer_len)
+{
+        z_stream *zs = &cb->gzip_stream;
+        size_t size;
+        int status;
+
+        size = (size_t) deflateBound (zs, (uLong) buffer_len);
+        if (cb->gzip_buffer_size < size)
+        {
+                char *tmp = realloc (cb->gzip_buffer, size);
+                if (tmp == NULL)
+                {
+                        ERROR ("write_http plugin: realloc failed.");
+                        return (0);
+                }
+                cb->gzip_buffer = tmp;
+                cb->gzip_buffer_size = size;
+        }
+
+        zs->next_in = (Bytef *) buffer;
+        zs->avail_in = (uInt) buffer_len;
+        zs->next_out = (Bytef *) cb->gzip_buffer;
+        zs->avail_out = (uInt) cb->gzip_buffer_size;
+
+        status = deflate (zs, Z_FINISH);
+        size = cb->gzip_buffer_size - zs->avail_out;
+        deflateReset (zs);
+
+        if (status != Z_STREAM_END)
+        {
+                ERROR ("write_http plugin: deflate failed with status %i.",
+                                status);
+                return (0);
+        }
+
+        return (size);
+} /* }}} size_t wh_compress_buffer */
+#endif
+
+/* Sends a buffer. Only called by the sender thread, which is the only user of
+ * `cb->curl' once it has been started. */
+static int wh_send_buffer (wh_callback_t *cb, /* {{{ */
+                const char *buffer, size_t buffer_len)
 {
         int status = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+#if HAVE_LIBZ
+        if (cb->compress)
+        {
+                buffer_len = wh_compress_buffer (cb, buffer, buffer_len);
+                if (buffer_len == 0)
+                        return (-1);
+                buffer = cb->gzip_buffer;
+        }
+#endif
+
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, buffer);
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE, (long) buffer_len);
         status = curl_easy_perform (cb->curl);
         if (status != 0)
         {
@@ -97,31 +187,123 @@ static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
         return (status);
 } /* }}} wh_send_buffer */
 
+static void *wh_send_thread (void *arg) /* {{{ */
+{
+        wh_callback_t *cb = arg;
+
+        pthread_mutex_lock (&cb->send_lock);
+        while (42)
+        {
+                char *buffer;
+                size_t buffer_fill;
+
+                while (!cb->send_thread_stop && (cb->pending_buffer == NULL))
+                        pthread_cond_wait (&cb->send_cond, &cb->send_lock);
+
+                /* Send the last pending buffer before exiting. */
+                if (cb->pending_buffer == NULL)
+                        break;
+
+                buffer = cb->pending_buffer;
+                buffer_fill = cb->pending_buffer_fill;
+                pthread_mutex_unlock (&cb->send_lock);
+
+                wh_send_buffer (cb, buffer, buffer_fill);
+
+                pthread_mutex_lock (&cb->send_lock);
+                cb->pending_buffer = NULL;
+                cb->pending_buffer_fill = 0;
+                cb->spare_buffer = buffer;
+                pthread_cond_broadcast (&cb->done_cond);
+        }
+        pthread_mutex_unlock (&cb->send_lock);
+
+        return (NULL);
+} /* }}} void *wh_send_thread */
+
+/* Frees everything allocated by `wh_callback_init'. The sender thread must
+ * not be running. */
+static void wh_callback_cleanup (wh_callback_t *cb) /* {{{ */
+{
+        if (cb->curl != NULL)
+                curl_easy_cleanup (cb->curl);
+        cb->curl = NULL;
+        if (cb->headers != NULL)
+                curl_slist_free_all (cb->headers);
+        cb->headers = NULL;
+
+#if HAVE_LIBZ
+        if (cb->gzip_initialized)
+                deflateEnd (&cb->gzip_stream);
+        cb->gzip_initialized = 0;
+        sfree (cb->gzip_buffer);
+        cb->gzip_buffer_size = 0;
+#endif
+
+        sfree (cb->send_buffer);
+        sfree (cb->spare_buffer);
+        sfree (cb->credentials);
+} /* }}} void wh_callback_cleanup */
+
 static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 {
-        struct curl_slist *headers;
+        int status;
 
         if (cb->curl != NULL)
                 return (0);
 
+        cb->send_buffer = malloc (cb->send_buffer_size);
+        cb->spare_buffer = malloc (cb->send_buffer_size);
+        if ((cb->send_buffer == NULL) || (cb->spare_buffer == NULL))
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                wh_callback_cleanup (cb);
+                return (-1);
+        }
+
+#if HAVE_LIBZ
+        if (cb->compress)
+        {
+                /* windowBits + 16: Write a gzip header and trailer. */
+                status = deflateInit2 (&cb->gzip_stream, Z_DEFAULT_COMPRESSION,
+                                Z_DEFLATED, 15 + 16, /* memLevel = */ 8,
+                                Z_DEFAULT_STRATEGY);
+                if (status != Z_OK)
+                {
+                        ERROR ("write_http plugin: deflateInit2 failed with "
+                                        "status %i.", status);
+                        wh_callback_cleanup (cb);
+                        return (-1);
+                }
+                cb->gzip_initialized = 1;
+        }
+#endif
+
         cb->curl = curl_easy_init ();
         if (cb->curl == NULL)
         {
                 ERROR ("curl plugin: curl_easy_init failed.");
+                wh_callback_cleanup (cb);
                 return (-1);
         }
 
         curl_easy_setopt (cb->curl, CURLOPT_NOSIGNAL, 1);
         curl_easy_setopt (cb->curl, CURLOPT_USERAGENT, PACKAGE_NAME"/"PACKAGE_VERSION);
+#if LIBCURL_VERSION_NUM >= 0x071900
+        /* The handle is re-used for all requests, so the connection is kept
+         * open between requests. Keep idle connections from timing out. */
+        curl_easy_setopt (cb->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
 
-        headers = NULL;
-        headers = curl_slist_append (headers, "Accept:  */*");
+        cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
         if (cb->format == WH_FORMAT_JSON)
-                headers = curl_slist_append (headers, "Content-Type: application/json");
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
         else
-                headers = curl_slist_append (headers, "Content-Type: text/plain");
-        headers = curl_slist_append (headers, "Expect:");
-        curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, headers);
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
+        if (cb->compress)
+                cb->headers = curl_slist_append (cb->headers, "Content-Encoding: gzip");
+        cb->headers = curl_slist_append (cb->headers, "Expect:");
+        curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, cb->headers);
 
         curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
         curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
@@ -138,6 +320,7 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
                 if (cb->credentials == NULL)
                 {
                         ERROR ("curl plugin: malloc failed.");
+                        wh_callback_cleanup (cb);
                         return (-1);
                 }
 
@@ -155,9 +338,43 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 
         wh_reset_buffer (cb);
 
+        status = plugin_thread_create (&cb->send_thread, /* attr = */ NULL,
+                        wh_send_thread, cb);
+        if (status != 0)
+        {
+                char errbuf[1024];
+                ERROR ("write_http plugin: pthread_create failed: %s",
+                                sstrerror (errno, errbuf, sizeof (errbuf)));
+                wh_callback_cleanup (cb);
+                return (-1);
+        }
+        cb->send_thread_running = 1;
+
         return (0);
 } /* }}} int wh_callback_init */
 
+/* Hands the send buffer to the sender thread and continues with the spare
+ * buffer. Waits for the sender thread if it's still busy with the previous
+ * buffer, i.e. only if data is produced faster than it can be sent. */
+static int wh_queue_buffer_nolock (wh_callback_t *cb) /* {{{ */
+{
+        char *tmp;
+
+        assert (cb->pending_buffer == NULL);
+        assert (cb->spare_buffer != NULL);
+
+        tmp = cb->spare_buffer;
+        cb->spare_buffer = NULL;
+        cb->pending_buffer = cb->send_buffer;
+        cb->pending_buffer_fill = cb->send_buffer_fill;
+        cb->send_buffer = tmp;
+
+        pthread_cond_signal (&cb->send_cond);
+
+        wh_reset_buffer (cb);
+        return (0);
+} /* }}} int wh_queue_buffer_nolock */
+
 static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
         int status;
@@ -167,6 +384,11 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         CDTIME_T_TO_DOUBLE (timeout),
                         cb->send_buffer_fill);
 
+        /* Wait for the sender thread to finish the previous buffer. This
+         * releases the lock, so check the buffer only afterwards. */
+        while (cb->pending_buffer != NULL)
+                pthread_cond_wait (&cb->done_cond, &cb->send_lock);
+
         /* timeout == 0  => flush unconditionally */
         if (timeout > 0)
         {
@@ -185,8 +407,7 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         return (0);
                 }
 
-                status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
+                status = wh_queue_buffer_nolock (cb);
         }
         else if (cb->format == WH_FORMAT_JSON)
         {
@@ -207,8 +428,7 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         return (status);
                 }
 
-                status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
+                status = wh_queue_buffer_nolock (cb);
         }
         else
         {
@@ -261,15 +481,28 @@ static void wh_callback_free (void *data) /* {{{ */
 
         cb = data;
 
-        wh_flush_nolock (/* timeout = */ 0, cb);
+        if (cb->send_thread_running)
+        {
+                pthread_mutex_lock (&cb->send_lock);
+                wh_flush_nolock (/* timeout = */ 0, cb);
+                cb->send_thread_stop = 1;
+                pthread_cond_signal (&cb->send_cond);
+                pthread_mutex_unlock (&cb->send_lock);
 
-        curl_easy_cleanup (cb->curl);
+                pthread_join (cb->send_thread, /* retval = */ NULL);
+                cb->send_thread_running = 0;
+        }
+
+        wh_callback_cleanup (cb);
         sfree (cb->location);
         sfree (cb->user);
         sfree (cb->pass);
-        sfree (cb->credentials);
         sfree (cb->cacert);
 
+        pthread_mutex_destroy (&cb->send_lock);
+        pthread_cond_destroy (&cb->send_cond);
+        pthread_cond_destroy (&cb->done_cond);
+
         sfree (cb);
 } /* }}} void wh_callback_free */
 
@@ -350,8 +583,8 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 
         DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%) \"%s\"",
                         cb->location,
-                        cb->send_buffer_fill, sizeof (cb->send_buffer),
-                        100.0 * ((double) cb->send_buffer_fill) / ((double) sizeof (cb->send_buffer)),
+                        cb->send_buffer_fill, cb->send_buffer_size,
+                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size),
                         command);
 
         /* Check if we have enough space for this command. */
@@ -405,8 +638,8 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
 
         DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%)",
                         cb->location,
-                        cb->send_buffer_fill, sizeof (cb->send_buffer),
-                        100.0 * ((double) cb->send_buffer_fill) / ((double) sizeof (cb->send_buffer)));
+                        cb->send_buffer_fill, cb->send_buffer_size,
+                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size));
 
         /* Check if we have enough space for this command. */
         pthread_mutex_unlock (&cb->send_lock);
@@ -502,6 +735,31 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
         return (0);
 } /* }}} int config_set_string */
 
+static int config_set_buffer_size (wh_callback_t *cb, /* {{{ */
+                oconfig_item_t *ci)
+{
+        double size;
+
+        if ((ci->values_num != 1)
+                        || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+        {
+                WARNING ("write_http plugin: The `%s' config option "
+                                "needs exactly one numeric argument.", ci->key);
+                return (-1);
+        }
+
+        size = ci->values[0].value.number;
+        if (size < WH_MIN_BUFFER_SIZE)
+        {
+                WARNING ("write_http plugin: The `%s' option must be at "
+                                "least %i.", ci->key, WH_MIN_BUFFER_SIZE);
+                size = WH_MIN_BUFFER_SIZE;
+        }
+
+        cb->send_buffer_size = (size_t) size;
+        return (0);
+} /* }}} int config_set_buffer_size */
+
 static int wh_config_url (oconfig_item_t *ci) /* {{{ */
 {
         wh_callback_t *cb;
@@ -524,8 +782,11 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
         cb->cacert = NULL;
         cb->format = WH_FORMAT_COMMAND;
         cb->curl = NULL;
+        cb->send_buffer_size = WH_DEFAULT_BUFFER_SIZE;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+        pthread_cond_init (&cb->send_cond, /* attr = */ NULL);
+        pthread_cond_init (&cb->done_cond, /* attr = */ NULL);
 
         config_set_string (&cb->location, ci);
         if (cb->location == NULL)
@@ -549,6 +810,10 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                         config_set_format (cb, child);
                 else if (strcasecmp ("StoreRates", child->key) == 0)
                         config_set_boolean (&cb->store_rates, child);
+                else if (strcasecmp ("Compress", child->key) == 0)
+                        config_set_boolean (&cb->compress, child);
+                else if (strcasecmp ("BufferSize", child->key) == 0)
+                        config_set_buffer_size (cb, child);
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -556,6 +821,16 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                 }
         }
 
+#if !HAVE_LIBZ
+        if (cb->compress)
+        {
+                WARNING ("write_http plugin: The plugin has been built without "
+                                "zlib support. Requests to \"%s\" will not be "
+                                "compressed.", cb->location);
+                cb->compress = 0;
+        }
+#endif
+
         DEBUG ("write_http: Registering write callback with URL %s",
                         cb->location);
 
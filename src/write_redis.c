@@ -28,6 +28,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
+#include "utils_format_number.h"
 
 #include <pthread.h>
 #include <credis.h>
@@ -66,12 +67,13 @@ static int wr_write (const data_set_t *ds, /* {{{ */
     return (status);
   ssnprintf (key, sizeof (key), "collectd/%s", ident);
 
-  memset (value, 0, sizeof (value));
+  value[0] = 0;
   value_size = sizeof (value);
   value_ptr = &value[0];
 
-#define APPEND(...) do {                                             \
-  status = snprintf (value_ptr, value_size, __VA_ARGS__);            \
+  /* The format_number_* functions return the same as snprintf(3). */
+#define APPEND(func, ...) do {                                       \
+  status = func (value_ptr, value_size, __VA_ARGS__);                \
   if (((size_t) status) > value_size)                                \
   {                                                                  \
     value_ptr += value_size;                                         \
@@ -84,19 +86,14 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   }                                                                  \
 } while (0)
 
-  APPEND ("%lu", (unsigned long) vl->time);
+  APPEND (format_number_uint64, (uint64_t) vl->time);
   for (i = 0; i < ds->ds_num; i++)
   {
-    if (ds->ds[i].type == DS_TYPE_COUNTER)
-      APPEND ("%llu", vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_GAUGE)
-      APPEND ("%g", vl->values[i].gauge);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      APPEND ("%"PRIi64, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      APPEND ("%"PRIu64, vl->values[i].absolute);
-    else
-      assert (23 == 42);
+    assert ((ds->ds[i].type == DS_TYPE_COUNTER)
+        || (ds->ds[i].type == DS_TYPE_GAUGE)
+        || (ds->ds[i].type == DS_TYPE_DERIVE)
+        || (ds->ds[i].type == DS_TYPE_ABSOLUTE));
+    APPEND (format_number_value, ds->ds[i].type, vl->values[i]);
   }
 
 #undef APPEND